@@ -3850,6 +3850,69 @@ void InitDecoderFlags(void)
     pv.decoder_flags.drop_ipopt_decode      = 1;
 }
 
+#define TUPLE_ROT(x,k) (((x) << (k)) | ((x) >> (32 - (k))))
+
+/**
+ * Hash the address/port/protocol tuple of a packet.
+ *
+ * The hash is the same for both directions of a conversation, so the
+ * session and flow tables can use it as is.  It is computed on first
+ * use and kept in the packet, later callers get it for free.  The seed
+ * is picked at random the first time through so the bucket a tuple
+ * lands in can't be predicted from the wire.
+ *
+ * @param p packet with a decoded IP header
+ *
+ * @return the tuple hash, 0 if there is no IP header
+ */
+u_int32_t GetPacketTupleHash(Packet *p)
+{
+    static u_int32_t seed = 0;
+    u_int32_t a, b, c;
+
+    if(p->packet_flags & PKT_TUPLE_HASHED)
+        return p->tuple_hash;
+
+    if(p->iph == NULL)
+        return 0;
+
+    if(seed == 0)
+        seed = ((u_int32_t) rand() << 16) ^ (u_int32_t) rand() ^ 0x9e3779b9;
+
+    /* order the endpoints so both directions hash alike */
+    if(p->iph->ip_src.s_addr < p->iph->ip_dst.s_addr ||
+       (p->iph->ip_src.s_addr == p->iph->ip_dst.s_addr && p->sp <= p->dp))
+    {
+        a = p->iph->ip_src.s_addr;
+        b = p->iph->ip_dst.s_addr;
+        c = ((u_int32_t) p->sp << 16) | p->dp;
+    }
+    else
+    {
+        a = p->iph->ip_dst.s_addr;
+        b = p->iph->ip_src.s_addr;
+        c = ((u_int32_t) p->dp << 16) | p->sp;
+    }
+
+    a += seed;
+    b += seed ^ p->iph->ip_proto;
+    c += seed;
+
+    /* Bob Jenkins' lookup3 final mix */
+    c ^= b; c -= TUPLE_ROT(b, 14);
+    a ^= c; a -= TUPLE_ROT(c, 11);
+    b ^= a; b -= TUPLE_ROT(a, 25);
+    c ^= b; c -= TUPLE_ROT(b, 16);
+    a ^= c; a -= TUPLE_ROT(c, 4);
+    b ^= a; b -= TUPLE_ROT(a, 14);
+    c ^= b; c -= TUPLE_ROT(b, 24);
+
+    p->tuple_hash = c;
+    p->packet_flags |= PKT_TUPLE_HASHED;
+
+    return c;
+}
+
 #if defined(WORDS_MUSTALIGN) && !defined(__GNUC__)
 u_int32_t
 EXTRACT_32BITS (u_char *p)
@@ -562,6 +562,7 @@ struct enc_header {
                                          */
 #define PKT_STREAM_TWH       0x00001000
 #define PKT_IGNORE_PORT      0x00002000  /* this packet should be ignored, based on port */
+#define PKT_TUPLE_HASHED     0x00004000  /* tuple_hash is valid */
 #define PKT_INLINE_DROP      0x20000000
 #define PKT_OBFUSCATED       0x40000000  /* this packet has been obfuscated */
 #define PKT_LOGGED           0x80000000  /* this packet has been logged */
@@ -1156,6 +1157,7 @@ typedef struct _Packet
 
     u_int8_t csum_flags;        /* checksum flags */
     u_int32_t packet_flags;     /* special flags for the packet */
+    u_int32_t tuple_hash;       /* see GetPacketTupleHash() */
     u_int32_t bytes_to_inspect; /* Number of bytes to check against rules */
 
     BITOP *preprocessor_bits;  /* flags for preprocessors to check */
@@ -1227,6 +1229,7 @@ void DecodeTCPOptions(u_int8_t *, u_int32_t, Packet *);
 void DecodeIPOptions(u_int8_t *, u_int32_t, Packet *);
 void DecodePPPoEPkt(Packet *, struct pcap_pkthdr *, u_int8_t *);
 void DecodeEncPkt(Packet *, struct pcap_pkthdr *, u_int8_t *);
+u_int32_t GetPacketTupleHash(Packet *);
 #ifdef GIDS
 #ifndef IPFW
 void DecodeIptablesPkt(Packet *, struct pcap_pkthdr *, u_int8_t *);
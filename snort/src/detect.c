@@ -934,57 +934,18 @@ int CheckBidirectional(Packet *p, struct _RuleTreeNode *rtn_idx,
  ***************************************************************************/
 int CheckSrcIP(Packet * p, struct _RuleTreeNode * rtn_idx, RuleFpList * fp_list)
 {
-    IpAddrSet *idx; /* ip address indexer */
-
     DEBUG_WRAP(DebugMessage(DEBUG_DETECT,"CheckSrcIPEqual: "););
 
-    /* check for global exception flag */
-    if(!(rtn_idx->flags & EXCEPT_SRC_IP))
-    {
-        /* do the check */
-        for(idx=rtn_idx->sip; idx != NULL; idx=idx->next)
-        {
-            if( ((idx->ip_addr == (p->iph->ip_src.s_addr & idx->netmask)) 
-                        ^ (idx->addr_flags & EXCEPT_IP)) )
-            {
-#ifdef DEBUG
-                if(idx->addr_flags & EXCEPT_IP) {
-                    DebugMessage(DEBUG_DETECT, "  SIP exception match\n");
-                } 
-                else
-                {
-                    DebugMessage(DEBUG_DETECT, "  SIP match\n");
-                }
-
-                DebugMessage(DEBUG_DETECT, "Rule: 0x%X     Packet: 0x%X\n", 
-                        idx->ip_addr, (p->iph->ip_src.s_addr & idx->netmask));
-#endif /* DEBUG */
-
-                /* the packet matches this test, proceed to the next test */
-                return fp_list->next->RuleHeadFunc(p, rtn_idx, fp_list->next);
-            }
-        }
-    }
-    else
+    /* 
+     * the address list and any global exception flag were compiled into
+     * sip_table when the rule was parsed
+     */
+    if(IpAddrSetTableMatch(rtn_idx->sip_table, p->iph->ip_src.s_addr,
+                           IPSET_SLOT_SRC))
     {
-        /* global exception flag is up, we can't match on *any* 
-         * of the source addresses 
-         */
-        DEBUG_WRAP(DebugMessage(DEBUG_DETECT,"  global exception flag, \n"););
-
-        /* do the check */
-        for(idx=rtn_idx->sip; idx != NULL; idx=idx->next)
-        {
-            if( ((idx->ip_addr == (p->iph->ip_src.s_addr & idx->netmask)) 
-                        ^ (idx->addr_flags & EXCEPT_IP)) )
-            {
-                DEBUG_WRAP(DebugMessage(DEBUG_DETECT,"address matched, failing on SIP\n"););
-                /* got address match on globally negated rule, fail */
-                return 0;
-            }
-        }
-        DEBUG_WRAP(DebugMessage(DEBUG_DETECT,"no matches on SIP, passed\n"););
+        DEBUG_WRAP(DebugMessage(DEBUG_DETECT, "  SIP match\n"););
 
+        /* the packet matches this test, proceed to the next test */
         return fp_list->next->RuleHeadFunc(p, rtn_idx, fp_list->next);
     }
     
@@ -1050,58 +1011,15 @@ int CheckSrcIPNotEq(Packet *p, struct _RuleTreeNode *rtn_idx,
  ***************************************************************************/
 int CheckDstIP(Packet *p, struct _RuleTreeNode *rtn_idx, RuleFpList *fp_list)
 {
-    IpAddrSet *idx;  /* ip address indexer */
-
     DEBUG_WRAP(DebugMessage(DEBUG_DETECT, "CheckDstIPEqual: ");)
 
-    /* check for global exception flag */
-    if(!(rtn_idx->flags & EXCEPT_DST_IP))
+    /* as above, the global exception flag is folded into dip_table */
+    if(IpAddrSetTableMatch(rtn_idx->dip_table, p->iph->ip_dst.s_addr,
+                           IPSET_SLOT_DST))
     {
-        /* do the check */
-        for(idx=rtn_idx->dip; idx != NULL; idx=idx->next)
-        {
-            if( ((idx->ip_addr == (p->iph->ip_dst.s_addr & idx->netmask)) 
-                        ^ (idx->addr_flags & EXCEPT_IP)) )
-            {
-#ifdef DEBUG
-                if(idx->addr_flags & EXCEPT_IP)
-                {
-                    DebugMessage(DEBUG_DETECT, "  DIP exception match\n");
-                }
-                else
-                {
-                    DebugMessage(DEBUG_DETECT, "  DIP match\n");
-                }
-                
-                DebugMessage(DEBUG_DETECT, "Rule: 0x%X     Packet: 0x%X\n", 
-                        idx->ip_addr, (p->iph->ip_src.s_addr & idx->netmask));
-#endif /* DEBUG */
-                /* the packet matches this test, proceed to the next test */
-                return fp_list->next->RuleHeadFunc(p, rtn_idx, fp_list->next);
-            }
-        }
-    }
-    else
-    {
-        /* global exception flag is up, we can't match on *any* 
-         * of the source addresses 
-         */
-        DEBUG_WRAP(DebugMessage(DEBUG_DETECT, "  global exception flag, \n"););
-
-        /* do the check */
-        for(idx=rtn_idx->dip; idx != NULL; idx=idx->next)
-        {
-            if( ((idx->ip_addr == (p->iph->ip_dst.s_addr & idx->netmask)) 
-                        ^ (idx->addr_flags & EXCEPT_IP)) )
-            {
-                DEBUG_WRAP(DebugMessage(DEBUG_DETECT,
-                                        "address matched, failing on DIP\n"););
-                /* got address match on globally negated rule, fail */
-                return 0;
-            }
-        }
-        DEBUG_WRAP(DebugMessage(DEBUG_DETECT, "no matches on DIP, passed\n"););
+        DEBUG_WRAP(DebugMessage(DEBUG_DETECT, "  DIP match\n"););
 
+        /* the packet matches this test, proceed to the next test */
         return fp_list->next->RuleHeadFunc(p, rtn_idx, fp_list->next);
     }
 
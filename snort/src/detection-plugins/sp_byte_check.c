@@ -202,6 +202,7 @@ void ByteTestInit(char *data, OptTreeNode *otn, int protocol)
      * individually
      */
     fpl->context = (void *) idx;
+    OptFpListSetLocal(fpl);
 }
 
 
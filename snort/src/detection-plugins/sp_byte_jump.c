@@ -165,6 +165,7 @@ void ByteJumpInit(char *data, OptTreeNode *otn, int protocol)
      * individually
      */
     fpl->context = (void *) idx;
+    OptFpListSetLocal(fpl);
 }
 
 
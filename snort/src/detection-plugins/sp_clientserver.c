@@ -265,22 +265,22 @@ void ParseFlowArgs(char *data, OptTreeNode *otn)
 
     if(csd->from_client) 
     {
-        AddOptFuncToList(CheckFromClient, otn);
+        OptFpListSetKey(AddOptFuncToList(CheckFromClient, otn), NULL, 0);
     } 
 
     if(csd->from_server) 
     {
-        AddOptFuncToList(CheckFromServer, otn);
+        OptFpListSetKey(AddOptFuncToList(CheckFromServer, otn), NULL, 0);
     }
 
     if(csd->ignore_reassembled) 
     {
-        AddOptFuncToList(CheckForNonReassembled, otn);
+        OptFpListSetKey(AddOptFuncToList(CheckForNonReassembled, otn), NULL, 0);
     }
 
     if(csd->only_reassembled) 
     {
-        AddOptFuncToList(CheckForReassembled, otn);
+        OptFpListSetKey(AddOptFuncToList(CheckForReassembled, otn), NULL, 0);
     }
 
     
@@ -178,22 +178,26 @@ void ParseDsize(char *data, OptTreeNode *otn)
         printf("min dsize: %d\n", ds_ptr->dsize);
         printf("max dsize: %d\n", ds_ptr->dsize2);
 #endif
-        AddOptFuncToList(CheckDsizeRange, otn);
+        OptFpListSetKey(AddOptFuncToList(CheckDsizeRange, otn), ds_ptr,
+                        sizeof(DsizeCheckData));
         return;
     }
     else if(*data == '>')
     {
         data++;
-        AddOptFuncToList(CheckDsizeGT, otn);
+        OptFpListSetKey(AddOptFuncToList(CheckDsizeGT, otn), ds_ptr,
+                        sizeof(DsizeCheckData));
     }
     else if(*data == '<')
     {
         data++;
-        AddOptFuncToList(CheckDsizeLT, otn);
+        OptFpListSetKey(AddOptFuncToList(CheckDsizeLT, otn), ds_ptr,
+                        sizeof(DsizeCheckData));
     }
     else
     {
-        AddOptFuncToList(CheckDsizeEq, otn);
+        OptFpListSetKey(AddOptFuncToList(CheckDsizeEq, otn), ds_ptr,
+                        sizeof(DsizeCheckData));
     }
 
     while(isspace((int)*data)) data++;
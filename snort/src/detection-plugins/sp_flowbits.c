@@ -140,6 +140,11 @@ static void FlowBitsInit(char *data, OptTreeNode *otn, int protocol)
      */
     
     fpl->context = (void *) flowbits;
+
+    /* tests only read the bits, they may be run early */
+    if(flowbits->type == FLOWBITS_ISSET || flowbits->type == FLOWBITS_ISNOTSET)
+        OptFpListSetMovable(fpl);
+
     return;
 }
 
@@ -115,7 +115,8 @@ void IcmpCodeCheckInit(char *data, OptTreeNode *otn, int protocol)
     /* finally, attach the option's detection function to the rule's 
        detect function pointer list */
     
-    AddOptFuncToList(IcmpCodeCheck, otn);
+    OptFpListSetKey(AddOptFuncToList(IcmpCodeCheck, otn),
+                    otn->ds_list[PLUGIN_ICMP_CODE], sizeof(IcmpCodeCheckData));
 }
 
 
@@ -100,7 +100,8 @@ void IcmpTypeCheckInit(char *data, OptTreeNode *otn, int protocol)
 
     /* finally, attach the option's detection function to the rule's 
        detect function pointer list */
-    AddOptFuncToList(IcmpTypeCheck, otn);
+    OptFpListSetKey(AddOptFuncToList(IcmpTypeCheck, otn),
+                    otn->ds_list[PLUGIN_ICMP_TYPE], sizeof(IcmpTypeCheckData));
 }
 
 
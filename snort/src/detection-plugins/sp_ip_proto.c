@@ -109,6 +109,7 @@ void IpProtoInit(char *data, OptTreeNode *otn, int protocol)
     ofl = AddOptFuncToList(IpProtoDetectorFunction, otn);
 
     ofl->context = ipd;
+    OptFpListSetKey(ofl, ipd, sizeof(IpProtoData));
 
     /*
     **  Set the ds_list for the first ip_proto check for a rule.  This
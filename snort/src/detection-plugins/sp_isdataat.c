@@ -134,6 +134,7 @@ void IsDataAtInit(char *data, OptTreeNode *otn, int protocol)
      * individually
      */
     fpl->context = (void *) idx;
+    OptFpListSetLocal(fpl);
 }
 
 
@@ -73,6 +73,10 @@ u_int8_t *doe_ptr;
 
 int detect_depth;       /* depth to the first char of the match */
 
+PatternMatchData *fp_match_pmd;
+u_int8_t *fp_match_data;
+u_int8_t *fp_match_ptr;
+
 extern HttpUri UriBufs[URI_COUNT]; /* the set of buffers that we are using to match against
                       set in decode.c */
 extern u_int8_t DecodeBuffer[DECODE_BLEN];
@@ -103,6 +107,7 @@ void PayloadReplaceInit(char *data, OptTreeNode * otn, int protocol)
 {
     PatternMatchData *idx;
     PatternMatchData *test_idx;
+    OptFpList *fpl;
 
     if(!InlineMode())
         return;
@@ -128,6 +133,16 @@ void PayloadReplaceInit(char *data, OptTreeNode * otn, int protocol)
                    file_name, file_line);
     }
 
+    /* 
+     * the content this replace belongs to now writes to the packet, keep
+     * everything that follows it from being run in front of it
+     */
+    for(fpl = otn->opt_func; fpl && fpl->next; fpl = fpl->next)
+        ;
+
+    if(fpl)
+        fpl->local = 0;
+
 #ifdef DEBUG
     printf("PayLoadReplaceInit Added to rule!\n");
 #endif
@@ -852,6 +867,7 @@ void PayloadSearchInit(char *data, OptTreeNode * otn, int protocol)
     fpl = AddOptFuncToList(CheckANDPatternMatch, otn);
 
     fpl->context = pmd;
+    OptFpListSetLocal(fpl);
 
     DEBUG_WRAP(DebugMessage(DEBUG_PATTERN_MATCH, 
                 "OTN function PatternMatch Added to rule!\n"););
@@ -882,6 +898,7 @@ void PayloadSearchUri(char *data, OptTreeNode * otn, int protocol)
     fpl = AddOptFuncToList(CheckUriPatternMatch, otn);
 
     fpl->context = pmd;
+    OptFpListSetLocal(fpl);
 
     DEBUG_WRAP(DebugMessage(DEBUG_PATTERN_MATCH, 
                 "OTN function PatternMatch Added to rule!\n"););
@@ -1679,6 +1696,61 @@ static int CheckORPatternMatch(Packet * p, struct _OptTreeNode * otn_idx,
     return 0;
 }
 
+/*
+ * The fast pattern matcher already found this content, and where, on
+ * its way into the rule.  That location is the one a search from the
+ * start of the buffer would turn up as long as nothing moves or limits
+ * the search window, so use it and skip the search.
+ *
+ * Some of the matchers are loose with the index they report, the
+ * pattern is checked at the location before it is trusted.
+ *
+ * return 1 and set up doe_ptr if the match can be reused, 0 otherwise
+ */
+static INLINE int ReuseFastPatternMatch(char *dp, int dsize, 
+                                        PatternMatchData *idx)
+{
+    char *match = (char *) fp_match_ptr;
+    u_int i;
+
+    if(idx != fp_match_pmd || (char *) fp_match_data != dp)
+        return 0;
+
+    if(idx->use_doe || idx->offset || idx->depth || idx->distance ||
+       idx->within || idx->exception_flag)
+        return 0;
+
+    if(match < dp || match + idx->pattern_size > dp + dsize)
+        return 0;
+
+    if(idx->search == uniSearch)
+    {
+        if(memcmp(match, idx->pattern_buf, idx->pattern_size))
+            return 0;
+    }
+    else if(idx->search == uniSearchCI)
+    {
+        for(i = 0; i < idx->pattern_size; i++)
+        {
+            if(toupper((unsigned char) match[i]) != 
+               toupper((unsigned char) idx->pattern_buf[i]))
+                return 0;
+        }
+    }
+    else
+    {
+        return 0;
+    }
+
+    doe_ptr = (u_int8_t *) match + idx->pattern_size;
+    detect_depth = match - dp;
+
+    DEBUG_WRAP(DebugMessage(DEBUG_PATTERN_MATCH, 
+                "Reusing fast pattern match at %d\n", detect_depth););
+
+    return 1;
+}
+
 static int CheckANDPatternMatch(Packet *p, struct _OptTreeNode *otn_idx, 
                 OptFpList *fp_list)
 {
@@ -1712,6 +1784,13 @@ static int CheckANDPatternMatch(Packet *p, struct _OptTreeNode *otn_idx,
     /* this now takes care of all the special cases where we'd run
      * over the buffer */
     orig_doe = doe_ptr;
+
+    if(fp_match_pmd && ReuseFastPatternMatch(dp, dsize, idx))
+    {
+        found = 1;
+    }
+    else
+    {
 #ifndef NO_FOUND_ERROR
     found = idx->search(dp, dsize, idx);
     if ( found == -1 )
@@ -1730,6 +1809,7 @@ static int CheckANDPatternMatch(Packet *p, struct _OptTreeNode *otn_idx,
     /* Original code.  Does not account for searching outside the buffer. */
     found = (idx->search(dp, dsize, idx) ^ idx->exception_flag);
 #endif
+    }
 
     if (InlineMode() && found && idx->replace_buf)
     {
@@ -52,6 +52,15 @@ typedef struct _PatternMatchData
     struct _PatternMatchData *next; /* ptr to next match struct */
 } PatternMatchData;
 
+/*
+**  Where the fast pattern matcher found the content that triggered the
+**  rule under evaluation, set by fpdetect.c for the length of the
+**  evaluation.  fp_match_pmd is NULL the rest of the time.
+*/
+extern PatternMatchData *fp_match_pmd;
+extern u_int8_t *fp_match_data;     /* buffer the matcher searched */
+extern u_int8_t *fp_match_ptr;      /* start of the match in it */
+
 void SetupPatternMatch(void);
 int SetUseDoePtr(OptTreeNode *otn);
 
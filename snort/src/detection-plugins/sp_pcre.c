@@ -32,6 +32,10 @@
 #include "plugin_enum.h"
 #include "util.h"
 #include "mstring.h"
+#include "sp_pattern_match.h"
+#include "sp_pcre.h"
+#include "detect.h"
+#include "sfregex.h"
 #include <sys/types.h>
 
 #ifdef WIN32
@@ -47,8 +51,39 @@ typedef struct _PcreData
     pcre *re;           /* compiled regex */
     pcre_extra *pe;     /* studied regex foo */
     int options;        /* sp_pcre specfic options (relative & inverse) */
+
+    int id;             /* order of appearance, for regex groups */
+    char *expr;         /* the regex and its flags, for regex groups */
+    int compile_flags;
+
+    struct _PcreData *next_expr;    /* holding an expr, see PcreExprFree */
 } PcreData;
 
+/*
+ * The simple regexes of a port group, see PcreGroupFinish.  Results are
+ * kept per buffer for the packet being inspected.
+ */
+typedef struct _PcreGroup
+{
+    PcreData **pcres;   /* sorted by id */
+    int *member;        /* set member of each, -1 if pcre has to do it */
+    int npcres;
+    int maxpcres;
+
+    SFREGEX_SET *set;
+
+    unsigned char *matched[2];  /* raw and decoded buffer */
+    u_int32_t seq[2];
+    const u_int8_t *data[2];
+    int dsize[2];
+
+} PcreGroup;
+
+static int pcre_count = 0;
+static PcreGroup *pcre_group = NULL;
+static PcreData *pcre_exprs = NULL;
+static u_int32_t pcre_packet_seq = 1;
+
 
 #define SNORT_PCRE_RELATIVE 1  /* relative to the end of the last match */
 #define SNORT_PCRE_INVERT   2  /* invert detect */
@@ -63,11 +98,20 @@ typedef struct _PcreData
  */
 #define SNORT_PCRE_OVECTOR_SIZE 3
 
+/*
+ * shortest literal worth handing to the fast pattern matcher, anything
+ * shorter hits on most packets anyway
+ */
+#define SNORT_PCRE_LITERAL_MIN  3
+#define SNORT_PCRE_LITERAL_MAX  256
+
 extern u_int8_t DecodeBuffer[DECODE_BLEN];
 extern u_int8_t *doe_ptr;
 
 void SnortPcreInit(char *, OptTreeNode *, int);
 void SnortPcreParse(char *, PcreData *, OptTreeNode *);
+static int SnortPcreLiteral(const char *, int, char *);
+static void SnortPcreAddLiteral(const char *, int, PcreData *, OptTreeNode *);
 void SnortPcreDump(PcreData *);
 int SnortPcre(Packet *, struct _OptTreeNode *, OptFpList *);
 
@@ -92,6 +136,8 @@ void SnortPcreInit(char *data, OptTreeNode *otn, int protocol)
                    file_name, file_line);
     }
 
+    pcre_data->id = pcre_count++;
+
     SnortPcreParse(data, pcre_data, otn);
 
     fpl = AddOptFuncToList(SnortPcre, otn);
@@ -101,6 +147,7 @@ void SnortPcreInit(char *data, OptTreeNode *otn, int protocol)
      * individually
      */
     fpl->context = (void *) pcre_data;
+    OptFpListSetLocal(fpl);
 
     return;
 }
@@ -230,6 +277,17 @@ void SnortPcreParse(char *data, PcreData *pcre_data, OptTreeNode *otn)
                    file_line, error);
     }
 
+    SnortPcreAddLiteral(re, compile_flags, pcre_data, otn);
+
+    pcre_data->expr = strdup(re);
+    pcre_data->compile_flags = compile_flags;
+
+    if(pcre_data->expr != NULL)
+    {
+        pcre_data->next_expr = pcre_exprs;
+        pcre_exprs = pcre_data;
+    }
+
     free(free_me);
 
     return;
@@ -242,6 +300,551 @@ void SnortPcreParse(char *data, PcreData *pcre_data, OptTreeNode *otn)
 
 }
 
+/*
+ * Skip a character class, re points at the opening '['.  Returns a
+ * pointer to the closing ']' or NULL if there isn't one.
+ */
+static const char *SkipPcreClass(const char *re)
+{
+    re++;
+
+    if(*re == '^')
+        re++;
+
+    /* a leading ']' is a member of the class */
+    if(*re == ']')
+        re++;
+
+    for(; *re; re++)
+    {
+        if(*re == '\\')
+        {
+            if(!*++re)
+                return NULL;
+        }
+        else if(*re == '[' && re[1] == ':')
+        {
+            /* [:alpha:] */
+            const char *end = strstr(re + 2, ":]");
+
+            if(end)
+                re = end + 1;
+        }
+        else if(*re == ']')
+        {
+            return re;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Skip a group, re points at the opening '('.  Returns a pointer to the
+ * closing ')' or NULL if there isn't one.
+ */
+static const char *SkipPcreGroup(const char *re)
+{
+    int depth = 0;
+
+    for(; *re; re++)
+    {
+        switch(*re)
+        {
+        case '\\':
+            if(!*++re)
+                return NULL;
+            break;
+
+        case '[':
+            if(!(re = SkipPcreClass(re)))
+                return NULL;
+            break;
+
+        case '(':
+            depth++;
+            break;
+
+        case ')':
+            if(--depth == 0)
+                return re;
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Find the longest run of plain characters that every match of the
+ * regex has to contain, so the rule can sit behind the fast pattern
+ * matcher.  This does not try to understand the regex, anything that
+ * isn't obviously a literal ends the run:
+ *
+ *   - groups, classes, '.', anchors and escapes like \d are skipped,
+ *     as is the whole of a longer escape (\x{..}, \cA, octal and back
+ *     references, \k, \g, \p); \Q..\E is taken as plain text
+ *   - a quantified character is dropped from the run
+ *   - alternation at the top level, inline options like (?i) and
+ *     the x flag give up on the whole regex
+ *
+ * Returns the length of the literal copied into lit, which must hold
+ * SNORT_PCRE_LITERAL_MAX bytes, or 0 if there is none.
+ */
+static int SnortPcreLiteral(const char *re, int flags, char *lit)
+{
+    char run[SNORT_PCRE_LITERAL_MAX];
+    int  run_len = 0, best_len = 0;
+    int  c;
+
+    if(flags & PCRE_EXTENDED)
+        return 0;
+
+#define PCRE_END_RUN() \
+    do { \
+        if(run_len > best_len) { \
+            memcpy(lit, run, run_len); \
+            best_len = run_len; \
+        } \
+        run_len = 0; \
+    } while(0)
+
+    while(*re)
+    {
+        c = -1;
+
+        switch(*re)
+        {
+        case '|':
+            return 0;
+
+        case ')':
+            return 0;
+
+        case '(':
+            /* (?i) and friends change how the rest is matched */
+            if(re[1] == '?' && (isalpha((int)re[2]) || re[2] == '-'))
+            {
+                const char *p = re + 2;
+
+                while(isalpha((int)*p) || *p == '-')
+                    p++;
+
+                if(*p == ')' || *p == ':')
+                    return 0;
+            }
+
+            PCRE_END_RUN();
+
+            if(!(re = SkipPcreGroup(re)))
+                return 0;
+
+            re++;
+            continue;
+
+        case '[':
+            PCRE_END_RUN();
+
+            if(!(re = SkipPcreClass(re)))
+                return 0;
+
+            re++;
+            continue;
+
+        case '*':
+        case '?':
+        case '{':
+        case '+':
+            /* the character before isn't there a fixed number of times */
+            if(run_len > 0 && *re != '+')
+                run_len--;
+
+            PCRE_END_RUN();
+
+            if(*re == '{' && strchr(re, '}'))
+                re = strchr(re, '}');
+
+            re++;
+            continue;
+
+        case '.':
+        case '^':
+        case '$':
+            PCRE_END_RUN();
+            re++;
+            continue;
+
+        case '\\':
+            re++;
+
+            switch(*re)
+            {
+            case 'n': c = '\n';   break;
+            case 'r': c = '\r';   break;
+            case 't': c = '\t';   break;
+            case 'f': c = '\f';   break;
+            case 'a': c = '\a';   break;
+            case 'e': c = 0x1b;   break;
+
+            case 'x':
+                /* \x{..} and \x with fewer than two digits end the run */
+                if(re[1] == '{')
+                {
+                    if(!(re = strchr(re, '}')))
+                        return 0;
+                }
+                else if(isxdigit((int)re[1]) && isxdigit((int)re[2]))
+                {
+                    char hex[3];
+
+                    hex[0] = re[1];
+                    hex[1] = re[2];
+                    hex[2] = '\0';
+                    c = (int)strtol(hex, NULL, 16);
+                    re += 2;
+                }
+                else if(isxdigit((int)re[1]))
+                {
+                    re++;
+                }
+                break;
+
+            case 'c':
+                /* control character, \cA */
+                if(!re[1])
+                    return 0;
+                re++;
+                break;
+
+            case 'Q':
+                /* everything up to \E is literal */
+                re++;
+
+                while(*re && !(re[0] == '\\' && re[1] == 'E'))
+                {
+                    if(run_len < SNORT_PCRE_LITERAL_MAX)
+                        run[run_len++] = *re;
+                    else
+                        PCRE_END_RUN();
+                    re++;
+                }
+
+                if(*re)
+                    re++;
+                if(*re)
+                    re++;
+                continue;
+
+            case 'k':
+            case 'g':
+            case 'p':
+            case 'P':
+                /* named and relative references, properties */
+                if(re[1] == '{' || re[1] == '<' || re[1] == '\'')
+                {
+                    char close = re[1] == '{' ? '}' : re[1] == '<' ? '>' : '\'';
+
+                    if(!(re = strchr(re + 2, close)))
+                        return 0;
+                }
+                else if(*re == 'g' && (re[1] == '-' || re[1] == '+'))
+                {
+                    re++;
+                    while(isdigit((int)re[1]))
+                        re++;
+                }
+                else if(*re == 'g')
+                {
+                    while(isdigit((int)re[1]))
+                        re++;
+                }
+                else if(re[1])
+                {
+                    /* \pL */
+                    re++;
+                }
+                break;
+
+            case '\0':
+                return 0;
+
+            default:
+                /* back references and octal escapes take all their digits */
+                if(isdigit((int)*re))
+                {
+                    while(isdigit((int)re[1]))
+                        re++;
+                }
+                /* \d, \b and so on */
+                else if(!isalnum((int)*re))
+                {
+                    c = (unsigned char)*re;
+                }
+                break;
+            }
+
+            re++;
+            break;
+
+        default:
+            c = (unsigned char)*re++;
+            break;
+        }
+
+        if(c < 0)
+        {
+            PCRE_END_RUN();
+            continue;
+        }
+
+        if(run_len < SNORT_PCRE_LITERAL_MAX)
+            run[run_len++] = (char)c;
+        else
+            PCRE_END_RUN();
+    }
+
+    PCRE_END_RUN();
+
+#undef PCRE_END_RUN
+
+    return best_len;
+}
+
+/*
+ * Hang the regex's literal off the rule for the fast pattern matcher.
+ * The literals of all of a rule's pcre options are kept in
+ * ds_list[PLUGIN_PCRE]; fpcreate.c uses one of them for rules with no
+ * content of their own.  A negated or URI regex can't be prefiltered
+ * on the packet payload.
+ */
+static void SnortPcreAddLiteral(const char *re, int flags, 
+                                PcreData *pcre_data, OptTreeNode *otn)
+{
+    PatternMatchData *pmd, *idx;
+    char lit[SNORT_PCRE_LITERAL_MAX];
+    int  len;
+
+    if(pcre_data->options & (SNORT_PCRE_INVERT | SNORT_PCRE_URI))
+        return;
+
+    len = SnortPcreLiteral(re, flags, lit);
+
+    if(len < SNORT_PCRE_LITERAL_MIN)
+        return;
+
+    pmd = (PatternMatchData *) SnortAlloc(sizeof(PatternMatchData));
+    pmd->pattern_buf = (char *) SnortAlloc(len);
+    memcpy(pmd->pattern_buf, lit, len);
+    pmd->pattern_size = len;
+    pmd->nocase = (flags & PCRE_CASELESS) ? 1 : 0;
+    pmd->rawbytes = (pcre_data->options & SNORT_PCRE_RAWBYTES) ? 1 : 0;
+
+    DEBUG_WRAP(DebugMessage(DEBUG_PATTERN_MATCH, 
+                "pcre: %d byte literal for the fast pattern matcher\n", 
+                len););
+
+    idx = (PatternMatchData *) otn->ds_list[PLUGIN_PCRE];
+
+    if(idx == NULL)
+    {
+        otn->ds_list[PLUGIN_PCRE] = pmd;
+        return;
+    }
+
+    while(idx->next != NULL)
+        idx = idx->next;
+
+    idx->next = pmd;
+}
+
+void *PcreGroupNew(void)
+{
+    return SnortAlloc(sizeof(PcreGroup));
+}
+
+/*
+ * Collect the pcre options of a rule, each regex only once per group
+ */
+void PcreGroupAddOtn(void *group, OptTreeNode *otn)
+{
+    PcreGroup *pg = (PcreGroup *) group;
+    OptFpList *fpl;
+    int i;
+
+    for(fpl = otn->opt_func; fpl; fpl = fpl->next)
+    {
+        if(fpl->OptTestFunc != SnortPcre)
+            continue;
+
+        for(i = 0; i < pg->npcres; i++)
+        {
+            if(pg->pcres[i] == fpl->context)
+                break;
+        }
+
+        if(i < pg->npcres)
+            continue;
+
+        if(pg->npcres == pg->maxpcres)
+        {
+            pg->maxpcres = pg->maxpcres ? pg->maxpcres * 2 : 16;
+            pg->pcres = (PcreData **) realloc(pg->pcres, 
+                                    pg->maxpcres * sizeof(PcreData *));
+
+            if(pg->pcres == NULL)
+                FatalError("Unable to allocate pcre group\n");
+        }
+
+        pg->pcres[pg->npcres++] = (PcreData *) fpl->context;
+    }
+}
+
+static int PcreIdCmp(const void *a, const void *b)
+{
+    return (*(PcreData * const *)a)->id - (*(PcreData * const *)b)->id;
+}
+
+/*
+ * Compile the group's regexes into a regex set.  Relative and URI
+ * regexes don't search the packet from the start, and multiline and
+ * extended syntax are left to pcre, as is anything sfregex refuses.
+ * Returns NULL, freeing the group, if nothing could go in the set.
+ */
+void *PcreGroupFinish(void *group)
+{
+    PcreGroup *pg = (PcreGroup *) group;
+    PcreData *pd;
+    int i, flags, n = 0;
+
+    if(pg == NULL)
+        return NULL;
+
+    qsort(pg->pcres, pg->npcres, sizeof(PcreData *), PcreIdCmp);
+
+    pg->member = (int *) SnortAlloc((pg->npcres + 1) * sizeof(int));
+    pg->set = sfregex_new(0);
+
+    if(pg->set == NULL)
+        FatalError("Unable to allocate pcre group\n");
+
+    for(i = 0; i < pg->npcres; i++)
+    {
+        pd = pg->pcres[i];
+        pg->member[i] = -1;
+
+        if(pd->expr == NULL ||
+           pd->options & (SNORT_PCRE_RELATIVE | SNORT_PCRE_URI) ||
+           pd->compile_flags & (PCRE_MULTILINE | PCRE_EXTENDED))
+            continue;
+
+        flags = 0;
+
+        if(pd->compile_flags & PCRE_CASELESS)
+            flags |= SFREGEX_NOCASE;
+        if(pd->compile_flags & PCRE_DOTALL)
+            flags |= SFREGEX_DOTALL;
+        if(pd->compile_flags & PCRE_ANCHORED)
+            flags |= SFREGEX_ANCHORED;
+        if(pd->compile_flags & PCRE_DOLLAR_ENDONLY)
+            flags |= SFREGEX_ENDONLY;
+
+        if((pg->member[i] = sfregex_add(pg->set, pd->expr, flags)) >= 0)
+            n++;
+    }
+
+    if(n == 0 || sfregex_compile(pg->set))
+    {
+        sfregex_free(pg->set);
+        free(pg->member);
+        free(pg->pcres);
+        free(pg);
+        return NULL;
+    }
+
+    pg->matched[0] = (unsigned char *) SnortAlloc(n);
+    pg->matched[1] = (unsigned char *) SnortAlloc(n);
+
+    return pg;
+}
+
+/*
+ * The regex groups copy what they need, so once they are all built the
+ * exprs kept for them can go.  A group built after this leaves every
+ * regex to pcre.
+ */
+void PcreExprFree(void)
+{
+    PcreData *pd;
+
+    while((pd = pcre_exprs) != NULL)
+    {
+        pcre_exprs = pd->next_expr;
+
+        free(pd->expr);
+        pd->expr = NULL;
+        pd->next_expr = NULL;
+    }
+}
+
+/*
+ * Set the group whose rules are being evaluated, NULL for none
+ */
+void PcreGroupSelect(void *group)
+{
+    pcre_group = (PcreGroup *) group;
+}
+
+void PcreGroupNewPacket(void)
+{
+    if(++pcre_packet_seq == 0)
+        pcre_packet_seq = 1;
+}
+
+/*
+ * Does the regex match the buffer, according to the current group's
+ * DFA.  The whole group is run over a buffer the first time one of its
+ * regexes asks about it.  Returns -1 if the group can't tell.
+ */
+static int PcreGroupMatch(PcreData *pd, const u_int8_t *data, int dsize)
+{
+    PcreGroup *pg = pcre_group;
+    int lo, hi, mid, slot;
+
+    lo = 0;
+    hi = pg->npcres - 1;
+
+    while(lo <= hi)
+    {
+        mid = (lo + hi) / 2;
+
+        if(pg->pcres[mid]->id == pd->id)
+            break;
+
+        if(pg->pcres[mid]->id < pd->id)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+
+    if(lo > hi || pg->member[mid] < 0)
+        return -1;
+
+    slot = (data == DecodeBuffer) ? 1 : 0;
+
+    if(pg->seq[slot] != pcre_packet_seq || pg->data[slot] != data ||
+       pg->dsize[slot] != dsize)
+    {
+        if(sfregex_search(pg->set, data, dsize, pg->matched[slot]) < 0)
+            return -1;
+
+        pg->seq[slot]   = pcre_packet_seq;
+        pg->data[slot]  = data;
+        pg->dsize[slot] = dsize;
+    }
+
+    return pg->matched[slot][pg->member[mid]];
+}
+
 /** 
  * Perform a search of the PCRE data.
  * 
@@ -410,7 +1013,39 @@ int SnortPcre(Packet *p, struct _OptTreeNode *otn, OptFpList *fp_list)
                );
 
 
-    matched = pcre_search(pcre_data, base_ptr, length, 0, &found_offset);
+    /*
+     * The group DFA answers whether there is a match without pcre.
+     * pcre is still needed for where the match ends, unless nothing
+     * after this option cares.
+     */
+    if(pcre_group && base_ptr == start_ptr && length > 0 &&
+       (matched = PcreGroupMatch(pcre_data, (u_int8_t *) base_ptr, 
+                                 length)) >= 0)
+    {
+        if(pcre_data->options & SNORT_PCRE_INVERT)
+        {
+            /* no match end, doe_ptr is left where it was */
+            matched = !matched;
+            found_offset = -1;
+        }
+        else if(!matched)
+        {
+            return 0;
+        }
+        else if(fp_list->next->OptTestFunc == OptListEnd)
+        {
+            return 1;
+        }
+        else
+        {
+            matched = pcre_search(pcre_data, base_ptr, length, 0, 
+                                  &found_offset);
+        }
+    }
+    else
+    {
+        matched = pcre_search(pcre_data, base_ptr, length, 0, &found_offset);
+    }
 
     /* set the doe_ptr if we have a valid offset */
     if(found_offset > 0)
@@ -427,9 +1062,11 @@ int SnortPcre(Packet *p, struct _OptTreeNode *otn, OptFpList *fp_list)
         {
             /* if the OTN checks are successful, return 1, else
                return the next iteration */
-            /* set the doe_ptr for stateful pattern matching later */
+            /* set the doe_ptr for stateful pattern matching later,
+               an inverted match has no end to set it to */
 
-            doe_ptr = (u_int8_t *) base_ptr + found_offset;
+            if(found_offset >= 0)
+                doe_ptr = (u_int8_t *) base_ptr + found_offset;
 
             return 1;
         }
@@ -467,3 +1104,50 @@ int SnortPcre(Packet *p, struct _OptTreeNode *otn, OptFpList *fp_list)
     return 0;
 }
 
+#ifdef SP_PCRE_MAIN
+/*
+ * Check the literals pulled out of regexes with escapes that run over
+ * more than one character.  Links with the rest of snort for the
+ * plugin's other references.
+ */
+int main(int argc, char **argv)
+{
+    static const char *tests[][2] = {
+        { "\\x9GET /",           "GET /" },
+        { "\\x09GET /",          "\tGET /" },
+        { "\\x{41}BCD",          "BCD" },
+        { "\\012abc",            "abc" },
+        { "\\0abc",              "abc" },
+        { "(a)\\1xyz",           "xyz" },
+        { "\\cAUSER",            "USER" },
+        { "\\Q\\x41\\E",         "\\x41" },
+        { "\\Qa.b\\Ec?",         "a.b" },
+        { "(?<n>a)\\k<n>login",  "login" },
+        { "\\g{1}login",         "login" },
+        { "\\g-1login",          "login" },
+        { "\\p{Lu}admin",        "admin" },
+        { "\\PLadmin",           "admin" },
+        { "\\x41\\x42C",         "ABC" },
+        { NULL, NULL }
+    };
+    char lit[SNORT_PCRE_LITERAL_MAX + 1];
+    int  i, n, bad = 0;
+
+    for(i = 0; tests[i][0]; i++)
+    {
+        n = SnortPcreLiteral(tests[i][0], 0, lit);
+        lit[n] = '\0';
+
+        if(strcmp(lit, tests[i][1]))
+        {
+            printf("%s: got \"%s\", want \"%s\"\n", tests[i][0], lit,
+                   tests[i][1]);
+            bad++;
+        }
+    }
+
+    printf("%s\n", bad ? "FAILED" : "passed");
+
+    return bad != 0;
+}
+#endif
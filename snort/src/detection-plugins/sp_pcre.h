@@ -27,6 +27,19 @@
 #ifndef __SNORT_PCRE_H__
 #define __SNORT_PCRE_H__
 
+#include "rules.h"
+
 void SetupPcre(void);
 
+/*
+ * Regex groups: the simple pcre options of a port group's rules,
+ * matched together by one DFA pass per packet (sfutil/sfregex.c).
+ */
+void *PcreGroupNew(void);
+void  PcreGroupAddOtn(void *group, OptTreeNode *otn);
+void *PcreGroupFinish(void *group);
+void  PcreGroupSelect(void *group);
+void  PcreGroupNewPacket(void);
+void  PcreExprFree(void);
+
 #endif /* __SNORT_PCRE_H__ */
@@ -86,7 +86,9 @@ void TCPFlagCheckInit(char *data, OptTreeNode *otn, int protocol)
 			    CheckTcpFlags););
 
     /* link the plugin function in to the current OTN */
-    AddOptFuncToList(CheckTcpFlags, otn);
+    OptFpListSetKey(AddOptFuncToList(CheckTcpFlags, otn),
+                    otn->ds_list[PLUGIN_TCP_FLAG_CHECK],
+                    sizeof(TCPFlagCheckData));
 
     DEBUG_WRAP(DebugMessage(DEBUG_PLUGIN, "OTN function CheckTcpFlags added to rule!\n"););
 }
@@ -158,13 +158,16 @@ void ParseTtl(char *data, OptTreeNode *otn)
     }
     switch (ttlrel) {
         case '>':
-            AddOptFuncToList(CheckTtlGT, otn);
+            OptFpListSetKey(AddOptFuncToList(CheckTtlGT, otn), ds_ptr,
+                            sizeof(TtlCheckData));
             break;
         case '<':     
-            AddOptFuncToList(CheckTtlLT, otn);
+            OptFpListSetKey(AddOptFuncToList(CheckTtlLT, otn), ds_ptr,
+                            sizeof(TtlCheckData));
             break;
         case '=':
-            AddOptFuncToList(CheckTtlEq, otn);
+            OptFpListSetKey(AddOptFuncToList(CheckTtlEq, otn), ds_ptr,
+                            sizeof(TtlCheckData));
             break;
         case '-':
             while(isspace((int)*data)) data++;
@@ -182,7 +185,8 @@ void ParseTtl(char *data, OptTreeNode *otn)
                 ds_ptr->h_ttl = ds_ptr->ttl;
                 ds_ptr->ttl   = atoi(data);
             }
-            AddOptFuncToList(CheckTtlRG, otn);
+            OptFpListSetKey(AddOptFuncToList(CheckTtlRG, otn), ds_ptr,
+                            sizeof(TtlCheckData));
             break;
         default:
             /* wtf? */
@@ -32,15 +32,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <math.h>
 
 #include "rules.h"
 #include "parser.h"
 #include "fpcreate.h"
 #include "fpdetect.h"
+#include "detect.h"
 #include "sp_pattern_match.h"
 #include "sp_icmp_code_check.h"
 #include "sp_icmp_type_check.h"
 #include "sp_ip_proto.h"
+#include "sp_pcre.h"
 #include "plugin_enum.h"
 #include "util.h"
 #include "rules.h"
@@ -81,6 +85,21 @@ static PORT_RULE_MAP *prmIcmpRTNX= NULL;
 
 static FPDETECT fpDetect;
 
+/*
+**  Roots of the option prefix trie, and its size for the stats
+*/
+static OptTrieNode *OptTrieRoots = NULL;
+static int OptTrieNodes = 0;
+static int OptTrieShared = 0;
+
+/*
+**  Option test stats, one per test function that shows up in the trie
+*/
+#define MAX_OPT_TEST_STATS 64
+
+static OptTestStats OptStats[MAX_OPT_TEST_STATS];
+static int          OptStatsCount = 0;
+
 /*
 **  The following functions are wrappers to the pcrm routines,
 **  that utilize the variables that we have intialized by
@@ -117,6 +136,8 @@ int prmFindRuleGroupUdp(int dport, int sport, PORT_GROUP ** src,
 **  These Otnhas* functions check the otns for different contents.  This
 **  helps us decide later what group (uri, content) the otn will go to.
 */
+static int OtnHasUriContent( OptTreeNode * otn );
+
 static int OtnHasContent( OptTreeNode * otn ) 
 {
     if( !otn ) return 0;
@@ -126,6 +147,15 @@ static int OtnHasContent( OptTreeNode * otn )
         return 1; 
     }
 
+    /*
+    **  A pcre literal stands in for content, see sp_pcre.c.  URI rules
+    **  stay with their uricontent.
+    */
+    if( otn->ds_list[PLUGIN_PCRE] && !OtnHasUriContent( otn ) )
+    {
+        return 1;
+    }
+
 #ifdef DYNAMIC_PLUGIN
     if (otn->ds_list[PLUGIN_DYNAMIC])
     {
@@ -311,6 +341,45 @@ int fpSetDebugMode()
     return 0;
 }
 
+/*
+**  Match each port group's pcre options together with one DFA.
+*/
+int fpSetPcreDfa()
+{
+    fpDetect.pcre_dfa = 1;
+    return 0;
+}
+
+/*
+**  Print the fast pattern picked for each rule.
+*/
+int fpSetDebugPrintFastPattern()
+{
+    fpDetect.debug_print_fast_pattern = 1;
+    return 0;
+}
+
+/*
+**  Sample traffic to score fast pattern candidates with.
+*/
+int fpSetFastPatternCorpus(char *file)
+{
+    if(!file || !*file)
+    {
+        return 1;
+    }
+
+    if(fpDetect.fast_pattern_corpus)
+    {
+        free(fpDetect.fast_pattern_corpus);
+    }
+
+    fpDetect.fast_pattern_corpus = strdup(file);
+    MEMASSERT(fpDetect.fast_pattern_corpus,"fast pattern corpus");
+
+    return 0;
+}
+
 /*
 **  Revert the detection engine back to not inspecting packets
 **  that are going to be rebuilt.
@@ -337,6 +406,22 @@ int fpSetMaxQueueEvents(int iNum)
     return 0;
 }
 
+/*
+**  Sets the number of packets to gather option test stats over before
+**  the option lists are re-ranked.
+*/
+int fpSetAdaptiveOrder(int iNum)
+{
+    if(iNum <= 0)
+    {
+        return 1;
+    }
+
+    fpDetect.adaptive_order = iNum;
+
+    return 0;
+}
+
 /*
 **  Build a Pattern group for the Uri-Content rules in this group
 **
@@ -389,6 +474,12 @@ void BuildMultiPatGroupsUri( PORT_GROUP * pg )
         return;
     }
 
+    if( !pg->pgHits )
+    {
+        pg->pgHits = (int *)calloc(pg->pgCount, sizeof(int));
+        MEMASSERT(pg->pgHits,"pg->pgHits");
+    }
+
     /*
     *  Add in all of the URI contents, since these are effectively OR rules.
     *  
@@ -410,6 +501,7 @@ void BuildMultiPatGroupsUri( PORT_GROUP * pg )
                MEMASSERT(pmx,"pmx-uricontent");
                pmx->RuleNode    = rnWalk;
                pmx->PatternMatchData= pmd;
+               pmx->bit         = 0;
 
                /*
                **  Add the max content length to this otnx
@@ -450,6 +542,7 @@ void BuildMultiPatGroupsUri( PORT_GROUP * pg )
             
                 pmx->RuleNode        = rnWalk;
                 pmx->PatternMatchData= pmd;
+                pmx->bit             = 0;
             
                 pmd->pattern_buf = fplist[i]->content;
                 pmd->pattern_size= fplist[i]->length;
@@ -512,49 +605,436 @@ static int IsPureNotRule( PatternMatchData * pmd )
     return ( rcnt == ncnt ) ;  
 }
 
+/*
+**  Fast pattern selection model.  Byte and byte pair counts from a
+**  small built in sample of common protocol text and binary headers,
+**  plus the corpus file given with 'config detection:
+**  fast-pattern-corpus', over a rough prior for bytes the samples never
+**  show.  Everything is case folded.  The model only exists while the
+**  detection engine is being built.
+*/
+#define FP_PAIR_WEIGHT   4.0     /* how far a pair count is trusted */
+#define FP_PRIOR_WEIGHT  256.0   /* byte counts the prior is worth */
+#define FP_CORPUS_MAX    (16*1024*1024)
+#define FP_SHORT_PATTERN 4       /* shorter ones lose to longer ones */
+
+typedef struct _FP_MODEL {
+
+    double      byte_prob[256];
+    u_int32_t   byte_count[256];
+    u_int32_t * pair_count;      /* [prev << 8 | cur] */
+
+} FP_MODEL;
+
+static FP_MODEL * FpModel = NULL;
+
+static const char * FpSample[] = {
+    "GET / HTTP/1.1\r\nHost: www.example.com\r\n"
+    "User-Agent: Mozilla/4.0 (compatible; MSIE 6.0; Windows NT 5.1)\r\n"
+    "Accept: text/html,application/xhtml+xml,*/*\r\n"
+    "Accept-Language: en-us,en;q=0.5\r\nAccept-Encoding: gzip, deflate\r\n"
+    "Connection: keep-alive\r\nCookie: session=0123456789abcdef\r\n\r\n",
+    "POST /index.php HTTP/1.1\r\nHost: example.org\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\n"
+    "Content-Length: 27\r\nReferer: http://example.org/\r\n\r\n",
+    "HTTP/1.1 200 OK\r\nDate: Mon, 23 May 2005 22:38:34 GMT\r\n"
+    "Server: Apache/1.3.3.7 (Unix)\r\nLast-Modified: Wed, 08 Jan 2003\r\n"
+    "Content-Type: text/html; charset=UTF-8\r\nContent-Length: 131\r\n"
+    "Cache-Control: no-cache\r\nSet-Cookie: id=a3fWa; path=/\r\n\r\n"
+    "<html><head><title>Index</title></head><body></body></html>",
+    "HTTP/1.0 404 Not Found\r\nContent-Type: text/html\r\n\r\n",
+    "220 mail.example.com ESMTP\r\nHELO client.example.com\r\n"
+    "MAIL FROM:<user@example.com>\r\nRCPT TO:<admin@example.com>\r\n"
+    "DATA\r\nSubject: hello\r\n.\r\nQUIT\r\n250 OK\r\n",
+    "USER anonymous\r\nPASS guest\r\n331 Password required\r\n"
+    "230 User logged in\r\nPWD\r\nCWD /pub\r\nPORT 10,0,0,1,4,1\r\n"
+    "RETR file.txt\r\n226 Transfer complete\r\n",
+    NULL
+};
+
+/*
+**  Binary traffic: SMB and DCE/RPC headers, which are mostly zero
+**  padding, and the runs of 0x00, 0xff and 0x90 found in file data and
+**  exploit payloads alike.  Without them those runs look rare.
+*/
+static const unsigned char FpSmbNegotiate[] = {
+    0x00, 0x00, 0x00, 0x85, 0xff, 0x53, 0x4d, 0x42, 0x72, 0x00, 0x00, 0x00,
+    0x00, 0x18, 0x53, 0xc8, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0xff, 0xfe, 0x00, 0x00, 0x00, 0x00, 0x00, 0x62,
+    0x00, 0x02, 0x50, 0x43, 0x20, 0x4e, 0x45, 0x54, 0x57, 0x4f, 0x52, 0x4b,
+    0x20, 0x50, 0x52, 0x4f, 0x47, 0x52, 0x41, 0x4d, 0x20, 0x31, 0x2e, 0x30,
+    0x00, 0x02, 0x4e, 0x54, 0x20, 0x4c, 0x4d, 0x20, 0x30, 0x2e, 0x31, 0x32,
+    0x00
+};
+
+static const unsigned char FpDceBind[] = {
+    0x05, 0x00, 0x0b, 0x03, 0x10, 0x00, 0x00, 0x00, 0x48, 0x00, 0x00, 0x00,
+    0x01, 0x00, 0x00, 0x00, 0xb8, 0x10, 0xb8, 0x10, 0x00, 0x00, 0x00, 0x00,
+    0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0xc8, 0x4f, 0x32, 0x4b,
+    0x70, 0x16, 0xd3, 0x01, 0x12, 0x78, 0x5a, 0x47, 0xbf, 0x6e, 0xe1, 0x88,
+    0x03, 0x00, 0x00, 0x00, 0x04, 0x5d, 0x88, 0x8a, 0xeb, 0x1c, 0xc9, 0x11,
+    0x9f, 0xe8, 0x08, 0x00, 0x2b, 0x10, 0x48, 0x60, 0x02, 0x00, 0x00, 0x00
+};
+
+static const struct {
+    const unsigned char * buf;
+    int                   len;
+} FpBinSample[] = {
+    { FpSmbNegotiate, sizeof(FpSmbNegotiate) },
+    { FpDceBind,      sizeof(FpDceBind) },
+    { NULL, 0 }
+};
+
+static const struct {
+    unsigned char c;
+    int           len;
+} FpRunSample[] = {
+    { 0x00, 256 },
+    { 0xff, 64 },
+    { 0x90, 64 },
+    { 0, 0 }
+};
+
+/*
+**  Rough share of each byte in traffic the samples don't cover: text,
+**  zero padding and the odd binary byte.
+*/
+static double FpPrior( int c )
+{
+    if( c == 0x00 )                 return 40.0;
+    if( c == ' ' )                  return 30.0;
+    if( c >= 'a' && c <= 'z' )      return 12.0;
+    if( c >= '0' && c <= '9' )      return 6.0;
+    if( c == '\r' || c == '\n' )    return 6.0;
+    if( c == 0xff )                 return 6.0;
+    if( c > 0x20 && c < 0x7f )      return 2.0;
+
+    return 1.0;
+}
+
+static void FpModelAdd( FP_MODEL * m, const unsigned char * buf, int len )
+{
+    int prev = -1, i, c;
+
+    for( i = 0; i < len; i++ )
+    {
+        c = tolower(buf[i]);
+
+        m->byte_count[c]++;
+
+        if( prev >= 0 )
+            m->pair_count[(prev << 8) | c]++;
+
+        prev = c;
+    }
+}
+
+static void FpModelBuild( void )
+{
+    double total = 0.0, prior = 0.0, w[256];
+    int    i;
+
+    FpModel = (FP_MODEL *) calloc(1, sizeof(FP_MODEL));
+    MEMASSERT(FpModel,"fast pattern model");
+
+    FpModel->pair_count = (u_int32_t *) calloc(65536, sizeof(u_int32_t));
+    MEMASSERT(FpModel->pair_count,"fast pattern model pairs");
+
+    for( i = 0; FpSample[i]; i++ )
+    {
+        FpModelAdd( FpModel, (const unsigned char *)FpSample[i],
+                    strlen(FpSample[i]) );
+    }
+
+    for( i = 0; FpBinSample[i].buf; i++ )
+    {
+        FpModelAdd( FpModel, FpBinSample[i].buf, FpBinSample[i].len );
+    }
+
+    for( i = 0; FpRunSample[i].len; i++ )
+    {
+        unsigned char run[256];
+
+        memset( run, FpRunSample[i].c, FpRunSample[i].len );
+        FpModelAdd( FpModel, run, FpRunSample[i].len );
+    }
+
+    if( fpDetect.fast_pattern_corpus )
+    {
+        FILE          * fp;
+        unsigned char   buf[4096];
+        size_t          n, nread = 0;
+
+        fp = fopen( fpDetect.fast_pattern_corpus, "rb" );
+        if( !fp )
+        {
+            FatalError("Unable to open fast pattern corpus %s\n",
+                       fpDetect.fast_pattern_corpus);
+        }
+
+        while( nread < FP_CORPUS_MAX && 
+               (n = fread(buf, 1, sizeof(buf), fp)) > 0 )
+        {
+            FpModelAdd( FpModel, buf, n );
+            nread += n;
+        }
+
+        fclose( fp );
+
+        LogMessage("Fast pattern corpus: %lu bytes from %s\n",
+                   (unsigned long)nread, fpDetect.fast_pattern_corpus);
+    }
+
+    for( i = 0; i < 256; i++ )
+    {
+        w[i] = FpPrior( tolower(i) );
+        prior += w[i];
+        total += FpModel->byte_count[i];
+    }
+
+    for( i = 0; i < 256; i++ )
+    {
+        FpModel->byte_prob[i] = 
+            (FpModel->byte_count[i] + FP_PRIOR_WEIGHT * w[i] / prior) /
+            (total + FP_PRIOR_WEIGHT);
+    }
+}
+
+static void FpModelFree( void )
+{
+    if( !FpModel )
+        return;
+
+    free( FpModel->pair_count );
+    free( FpModel );
+    FpModel = NULL;
+}
+
+/*
+**  How surprising a pattern is, in bits: -log2 of its probability under
+**  the pair model.  Long patterns and rare bytes score high, strings
+**  the model has seen a lot of ("HTTP/1.1", "Content-Type:") score low.
+*/
+static double FpPatternBits( PatternMatchData * pmd )
+{
+    const unsigned char * p = (const unsigned char *)pmd->pattern_buf;
+    double bits, prob;
+    int    i, c, prev;
+
+    prev = tolower(p[0]);
+    bits = -log(FpModel->byte_prob[prev]);
+
+    for( i = 1; i < (int)pmd->pattern_size; i++ )
+    {
+        c = tolower(p[i]);
+
+        prob = (FpModel->pair_count[(prev << 8) | c] +
+                FP_PAIR_WEIGHT * FpModel->byte_prob[c]) /
+               (FpModel->byte_count[prev] + FP_PAIR_WEIGHT);
+
+        bits -= log(prob);
+        prev = c;
+    }
+
+    return bits / log(2.0);
+}
+
 /*
 **
 **  NAME
-**    FindLongestPattern
+**    FindFastPattern
 **
 **  DESCRIPTION
-**    This functions selects the longest pattern out of a set of
-**    patterns per snort rule.  By picking the longest pattern, we
-**    help the pattern matcher speed and the selection criteria during
-**    detection.
+**    This functions selects the pattern of a snort rule that goes into
+**    the pattern matcher.  It used to be the longest one, but a long
+**    pattern made of common text (User-Agent:, HTTP/1.1) hits on most
+**    packets and sends the rule through verification every time.
+**    Each candidate is scored in bits by the byte pair model above and
+**    the rarest one wins, the longer one on a tie.  A pattern shorter
+**    than FP_SHORT_PATTERN never wins on score over a longer one, the
+**    model can't tell a rare short pattern from one it hasn't seen.
+**    The score is returned as well for reporting.
 **
 **  FORMAL INPUTS
-**    PatternMatchData * - contents to select largest
+**    PatternMatchData * - contents to select from
+**    double *           - where to put the score, may be NULL
 **
 **  FORMAL OUTPUTS 
-**    PatternMatchData * - ptr to largest pattern
+**    PatternMatchData * - ptr to selected pattern
 **
 */
-static PatternMatchData * FindLongestPattern( PatternMatchData * pmd )
+static PatternMatchData * FindFastPattern( PatternMatchData * pmd,
+                                           double * score )
 {
-    PatternMatchData *pmdmax;
-   
-    /* Find the 1st pattern that is not a NOT pattern */   
-    while( pmd && pmd->exception_flag ) pmd=pmd->next;
-        
-    if( !pmd ) return NULL;  /* All Patterns are NOT patterns */
-      
-    pmdmax = pmd;
+    PatternMatchData *pmdmax = NULL;
+    double bits, maxbits = 0.0;
+    int    better;
+
+    if( !FpModel )
+        FpModelBuild();
+
+    for( ; pmd; pmd = pmd->next )
+    {
+        if( pmd->exception_flag || !pmd->pattern_buf || !pmd->pattern_size )
+            continue;
+
+        bits = FpPatternBits( pmd );
+
+        if( !pmdmax )
+            better = 1;
+        else if( pmd->pattern_size != pmdmax->pattern_size &&
+                 (pmd->pattern_size < FP_SHORT_PATTERN ||
+                  pmdmax->pattern_size < FP_SHORT_PATTERN) )
+            better = pmd->pattern_size > pmdmax->pattern_size;
+        else
+            better = bits > maxbits || (bits == maxbits &&
+                     pmd->pattern_size > pmdmax->pattern_size);
+
+        if( better )
+        {
+            pmdmax  = pmd;
+            maxbits = bits;
+        }
+    }
+
+    if( score )
+        *score = maxbits;
+
+    return pmdmax;
+}
+
+/*
+**  Print the fast pattern picked for every content rule
+*/
+static void PrintFastPatterns( void )
+{
+    RuleListNode     * rule;
+    RuleTreeNode     * rtn;
+    RuleTreeNode     * lists[4];
+    OptTreeNode      * otn;
+    PatternMatchData * pmd;
+    double             bits;
+    unsigned           i;
+    int                l;
+
+    extern RuleListNode *RuleLists;
 
-    while( pmd )
+    for( rule = RuleLists; rule; rule = rule->next )
     {
-        if(pmd->pattern_buf) 
+        if( !rule->RuleList )
+            continue;
+
+        lists[0] = rule->RuleList->TcpList;
+        lists[1] = rule->RuleList->UdpList;
+        lists[2] = rule->RuleList->IcmpList;
+        lists[3] = rule->RuleList->IpList;
+
+        for( l = 0; l < 4; l++ )
         {
-            if( (pmd->pattern_size > pmdmax->pattern_size) && 
-                    !pmd->exception_flag)
+            for( rtn = lists[l]; rtn; rtn = rtn->right )
             {
-                pmdmax = pmd;
+                for( otn = rtn->down; otn; otn = otn->next )
+                {
+                    pmd = otn->ds_list[PLUGIN_PATTERN_MATCH];
+                    if( !pmd || IsPureNotRule( pmd ) )
+                        continue;
+
+                    pmd = FindFastPattern( pmd, &bits );
+                    if( !pmd )
+                        continue;
+
+                    printf("SID %u: fast pattern \"", otn->sigInfo.id);
+
+                    for( i = 0; i < pmd->pattern_size; i++ )
+                    {
+                        unsigned char c = pmd->pattern_buf[i];
+
+                        if( isprint(c) && c != '"' && c != '|' )
+                            putchar(c);
+                        else
+                            printf("|%02X|", c);
+                    }
+
+                    printf("\" len=%u %.1f bits%s\n", pmd->pattern_size, bits,
+                           pmd->nocase ? " nocase" : "");
+                }
             }
         }
-        pmd = pmd->next;
     }
+}
 
-    return pmdmax;
+/*
+**
+**  NAME
+**    AddPrefilterContents
+**
+**  DESCRIPTION
+**    Adds the fast pattern of a rule to the pattern matcher, along with
+**    the rule's other plain contents: not negated, not relative, and
+**    not a duplicate of one already added.  Each one gets a bit in
+**    otnx->required, and otnx_match only evaluates the rule once every
+**    bit has been seen in the packet.  A rule whose second content is
+**    missing is then never evaluated at all.  Only the first 32
+**    literals get a bit, the rest are left to the option evaluation.
+**
+**  FORMAL INPUTS
+**    void *             - the group's pattern matcher
+**    RULE_NODE *        - the rule
+**    PatternMatchData * - the rule's contents
+**    PatternMatchData * - the fast pattern picked for the rule
+**
+*/
+static void AddPrefilterContents( void * mpse_obj, RULE_NODE * rnWalk,
+                                  PatternMatchData * pmd,
+                                  PatternMatchData * pmdmax )
+{
+    OTNX             *otnx = (OTNX *)(rnWalk->rnRuleData);
+    PatternMatchData *added[32];
+    PatternMatchData *p;
+    PMX              *pmx;
+    int               nadded = 0;
+    int               i;
+
+    /* the fast pattern goes first, so it always gets a bit */
+    added[nadded++] = pmdmax;
+
+    for( p = pmd; p && nadded < 32; p = p->next )
+    {
+        if( p == pmdmax || !p->pattern_buf || p->exception_flag || 
+            p->use_doe )
+            continue;
+
+        for( i = 0; i < nadded; i++ )
+        {
+            if( added[i]->pattern_size == p->pattern_size &&
+                added[i]->nocase == p->nocase &&
+                !memcmp(added[i]->pattern_buf, p->pattern_buf,
+                        p->pattern_size) )
+                break;
+        }
+
+        if( i == nadded )
+            added[nadded++] = p;
+    }
+
+    for( i = 0; i < nadded; i++ )
+    {
+        pmx = (PMX*)malloc(sizeof(PMX) );
+        MEMASSERT(pmx,"pmx-content");
+        pmx->RuleNode        = rnWalk;
+        pmx->PatternMatchData= added[i];
+        pmx->bit             = 1u << i;
+
+        otnx->required |= pmx->bit;
+
+        mpseAddPattern( mpse_obj, added[i]->pattern_buf, 
+          added[i]->pattern_size,
+          added[i]->nocase,  /* NoCase: 1-NoCase, 0-Case */
+          added[i]->offset, 
+          added[i]->depth,
+          pmx,  
+          rnWalk->iRuleNodeID );
+    }
 }
 
 /*
@@ -600,6 +1080,12 @@ void BuildMultiPatGroup( PORT_GROUP * pg )
     {
         return;
     }
+
+    if( !pg->pgHits )
+    {
+        pg->pgHits = (int *)calloc(pg->pgCount, sizeof(int));
+        MEMASSERT(pg->pgHits,"pg->pgHits");
+    }
       
     /*
     *  For each content rule, add one of the AND contents,
@@ -612,6 +1098,10 @@ void BuildMultiPatGroup( PORT_GROUP * pg )
         otn = otnx->otn;
         rtn = otnx->rtn;
 
+        otnx->required = 0;
+        otnx->seen     = 0;
+        otnx->seen_seq = 0;
+
         /* Add the longest AND patterns, 'content:' patterns*/
         pmd = otn->ds_list[PLUGIN_PATTERN_MATCH];
 
@@ -640,6 +1130,7 @@ void BuildMultiPatGroup( PORT_GROUP * pg )
                     MEMASSERT(pmx,"pmx-!content");
                     pmx->RuleNode   = rnWalk;
                     pmx->PatternMatchData= pmd;
+                    pmx->bit        = 0;
 
                     mpseAddPattern( mpse_obj, pmd->pattern_buf, 
                       pmd->pattern_size, 
@@ -659,25 +1150,46 @@ void BuildMultiPatGroup( PORT_GROUP * pg )
         else
         {
             /* Add the longest content for normal or mixed contents */
-           pmdmax = FindLongestPattern( pmd );  
+           pmdmax = FindFastPattern( pmd, NULL );  
            if( pmdmax )
            {
-               pmx = (PMX*)malloc(sizeof(PMX) );
-               MEMASSERT(pmx,"pmx-content");
-               pmx->RuleNode    = rnWalk;
-               pmx->PatternMatchData= pmdmax;
-
                otnx->content_length = pmdmax->pattern_size;
 
-               mpseAddPattern( mpse_obj, pmdmax->pattern_buf, pmdmax->pattern_size,
-                 pmdmax->nocase,  /* NoCase: 1-NoCase, 0-Case */
-                 pmdmax->offset, 
-                 pmdmax->depth,
-                 pmx,  
-               rnWalk->iRuleNodeID );
+               /*
+               **  Every other literal the rule requires goes in as well,
+               **  see AddPrefilterContents.
+               */
+               AddPrefilterContents( mpse_obj, rnWalk, pmd, pmdmax );
            }
         }
 
+        /*
+        **  No content at all, the rule gets in on the literal its
+        **  regex requires.
+        */
+        if( !pmd && !otn->ds_list[PLUGIN_PATTERN_MATCH_OR] )
+        {
+            pmdmax = FindFastPattern( otn->ds_list[PLUGIN_PCRE], NULL );
+            if( pmdmax )
+            {
+                otnx->content_length = pmdmax->pattern_size;
+
+                pmx = (PMX*)malloc(sizeof(PMX) );
+                MEMASSERT(pmx,"pmx-pcre");
+                pmx->RuleNode    = rnWalk;
+                pmx->PatternMatchData= pmdmax;
+                pmx->bit         = 0;
+
+                mpseAddPattern( mpse_obj, pmdmax->pattern_buf, 
+                  pmdmax->pattern_size,
+                  pmdmax->nocase,  /* NoCase: 1-NoCase, 0-Case */
+                  0, 
+                  0,
+                  pmx,  
+                  rnWalk->iRuleNodeID );
+            }
+        }
+
         /* Add all of the OR contents 'file-list' content */     
         pmd = otn->ds_list[PLUGIN_PATTERN_MATCH_OR];
         while( pmd )
@@ -688,6 +1200,7 @@ void BuildMultiPatGroup( PORT_GROUP * pg )
                 MEMASSERT(pmx,"pmx-uricontent");
                 pmx->RuleNode    = rnWalk;
                 pmx->PatternMatchData= pmd;
+                pmx->bit         = 0;
 
                 mpseAddPattern( mpse_obj, pmd->pattern_buf, pmd->pattern_size,
                 pmd->nocase,  /* NoCase: 1-NoCase, 0-Case */
@@ -723,6 +1236,7 @@ void BuildMultiPatGroup( PORT_GROUP * pg )
                 
                 pmx->RuleNode        = rnWalk;
                 pmx->PatternMatchData= pmd;
+                pmx->bit             = 0;
                 
                 pmd->pattern_buf = fplist[i]->content;
                 pmd->pattern_size= fplist[i]->length;
@@ -752,6 +1266,52 @@ void BuildMultiPatGroup( PORT_GROUP * pg )
     mpsePrepPatterns( mpse_obj );
 }
 
+/*
+**
+**  NAME
+**    BuildPcreGroup::
+**
+**  DESCRIPTION
+**    Puts the pcre options of all of a port group's rules, content,
+**    uri and no-content alike, into one regex group, so a packet runs
+**    one DFA pass for them instead of a pcre_exec per option.
+**
+**  FORMAL INPUTS
+**    PORT_GROUP * - the port group
+**
+**  FORMAL OUTPUTS
+**    None
+**
+*/
+static void BuildPcreGroup( PORT_GROUP * pg )
+{
+    RULE_NODE * lists[3];
+    RULE_NODE * rnWalk;
+    OTNX      * otnx;
+    void      * group;
+    int         i;
+
+    if( !pg || pg->pgPcreGroup )
+        return;
+
+    lists[0] = pg->pgHead;
+    lists[1] = pg->pgUriHead;
+    lists[2] = pg->pgHeadNC;
+
+    group = PcreGroupNew();
+
+    for( i = 0; i < 3; i++ )
+    {
+        for( rnWalk = lists[i]; rnWalk; rnWalk = rnWalk->rnNext )
+        {
+            otnx = (OTNX *)rnWalk->rnRuleData;
+            PcreGroupAddOtn( group, otnx->otn );
+        }
+    }
+
+    pg->pgPcreGroup = PcreGroupFinish( group );
+}
+
 /*
 **
 **  NAME
@@ -782,6 +1342,9 @@ void BuildMultiPatternGroups( PORT_RULE_MAP * prm )
         {
             BuildMultiPatGroup( pg );
             BuildMultiPatGroupsUri( pg );
+
+            if( fpDetect.pcre_dfa )
+                BuildPcreGroup( pg );
         }
 
         pg = prmFindDstRuleGroup( prm, i );
@@ -789,6 +1352,9 @@ void BuildMultiPatternGroups( PORT_RULE_MAP * prm )
         {
             BuildMultiPatGroup( pg );
             BuildMultiPatGroupsUri( pg );
+
+            if( fpDetect.pcre_dfa )
+                BuildPcreGroup( pg );
         }
     }
 
@@ -796,8 +1362,312 @@ void BuildMultiPatternGroups( PORT_RULE_MAP * prm )
      
     BuildMultiPatGroup( pg );
     BuildMultiPatGroupsUri( pg );
+
+    if( fpDetect.pcre_dfa )
+        BuildPcreGroup( pg );
+}
+
+
+static OptTestStats * OptGetTestStats( OptFpList * fpl )
+{
+    int i;
+
+    for( i = 0; i < OptStatsCount; i++ )
+    {
+        if( OptStats[i].OptTestFunc == fpl->OptTestFunc )
+            return &OptStats[i];
+    }
+
+    if( OptStatsCount == MAX_OPT_TEST_STATS )
+        return NULL;
+
+    OptStats[OptStatsCount].OptTestFunc = fpl->OptTestFunc;
+
+    return &OptStats[OptStatsCount++];
+}
+
+/*
+**  Expected cost of running a test before it rejects a packet,
+**  cost/(1 - pass rate).  Lower goes first.  Tests we have no numbers
+**  for rank behind the ones we do, and without tick counts every test
+**  is assumed to cost the same.
+*/
+static double OptTestRank( OptFpList * fpl )
+{
+    OptTestStats * stats = NULL;
+    double cost, fail;
+    int i;
+
+    for( i = 0; i < OptStatsCount; i++ )
+    {
+        if( OptStats[i].OptTestFunc == fpl->OptTestFunc )
+        {
+            stats = &OptStats[i];
+            break;
+        }
+    }
+
+    if( !stats || !stats->checks )
+        return 1e30;
+
+    cost = stats->ticks > 0 ? stats->ticks / stats->checks : 1.0;
+    fail = 1.0 - (double)stats->matches / stats->checks;
+
+    if( fail < 1e-6 )
+        fail = 1e-6;
+
+    return cost / fail;
 }
 
+/*
+**  Reorder one run of movable and local tests: pure tests first, ranked,
+**  then the other movable tests, then the local ones.  Movable and local
+**  tests each keep their own relative order otherwise.
+*/
+static OptFpList ** OptReorderRun( OptFpList ** link, OptFpList * run,
+                                   OptFpList * end )
+{
+    OptFpList * pure = NULL;
+    OptFpList * movable = NULL, ** movable_tail = &movable;
+    OptFpList * local = NULL, ** local_tail = &local;
+    OptFpList * fpl, * next, ** pp;
+
+    for( fpl = run; fpl != end; fpl = next )
+    {
+        next = fpl->next;
+        fpl->next = NULL;
+
+        if( fpl->pure )
+        {
+            /* stable insertion by rank */
+            for( pp = &pure; *pp && OptTestRank(*pp) <= OptTestRank(fpl);
+                 pp = &(*pp)->next )
+                ;
+
+            fpl->next = *pp;
+            *pp = fpl;
+        }
+        else if( fpl->movable )
+        {
+            *movable_tail = fpl;
+            movable_tail = &fpl->next;
+        }
+        else
+        {
+            *local_tail = fpl;
+            local_tail = &fpl->next;
+        }
+    }
+
+    *local_tail = end;
+    *movable_tail = local;
+
+    for( pp = &pure; *pp; pp = &(*pp)->next )
+        ;
+    *pp = movable;
+
+    *link = pure;
+
+    /* hand back the link that points at end */
+    for( pp = link; *pp != end; pp = &(*pp)->next )
+        ;
+
+    return pp;
+}
+
+/*
+**  Hoist the cheap, side effect free tests of an OTN in front of the
+**  cursor tests, without moving anything across a test that has other
+**  side effects (flowbits:set, replace, ...).
+*/
+static void OptReorderOtn( OptTreeNode * otn )
+{
+    OptFpList ** link = &otn->opt_func;
+    OptFpList *  run, * end;
+
+    while( *link )
+    {
+        if( !(*link)->movable && !(*link)->local )
+        {
+            link = &(*link)->next;
+            continue;
+        }
+
+        run = *link;
+
+        for( end = run; end && (end->movable || end->local); end = end->next )
+            ;
+
+        link = OptReorderRun( link, run, end );
+    }
+}
+
+/*
+**  Find the child of parent (or root, if parent is NULL) that runs the
+**  same test with the same key, making one if there isn't one.
+*/
+static OptTrieNode * OptTrieFindChild( OptTrieNode * parent, OptFpList * fpl,
+                                       OptTreeNode * otn )
+{
+    OptTrieNode ** head = parent ? &parent->child : &OptTrieRoots;
+    OptTrieNode *  node;
+
+    for( node = *head; node; node = node->sibling )
+    {
+        if( node->test.OptTestFunc == fpl->OptTestFunc &&
+            node->test.key_size == fpl->key_size &&
+            (!fpl->key_size || !memcmp(node->test.key, fpl->key, fpl->key_size)) )
+        {
+            OptTrieShared++;
+            return node;
+        }
+    }
+
+    node = (OptTrieNode *) calloc(1, sizeof(OptTrieNode));
+    MEMASSERT(node,"OptTrieNode");
+
+    node->test         = *fpl;
+    node->test.next    = (OptFpList *) calloc(1, sizeof(OptFpList));
+    MEMASSERT(node->test.next,"OptTrieNode end");
+    node->test.next->OptTestFunc = OptListEnd;
+
+    node->otn     = otn;
+    node->stats   = OptGetTestStats( fpl );
+    node->parent  = parent;
+    node->sibling = *head;
+    *head         = node;
+
+    OptTrieNodes++;
+
+    return node;
+}
+
+/*
+**  Run the leading pure tests of an OTN down the trie.  The OTN keeps
+**  the deepest node it reached and the rest of its own option list.
+*/
+static void OptTrieAddOtn( OptTreeNode * otn )
+{
+    OptTrieNode * node = NULL;
+    OptFpList   * fpl;
+
+    OptReorderOtn( otn );
+
+    for( fpl = otn->opt_func; fpl && fpl->pure; fpl = fpl->next )
+    {
+        node = OptTrieFindChild( node, fpl, otn );
+    }
+
+    otn->opt_prefix    = node;
+    otn->opt_func_rest = fpl;
+}
+
+static void OptTrieAddList( RuleTreeNode * rtn )
+{
+    OptTreeNode * otn;
+
+    for( ; rtn; rtn = rtn->right )
+    {
+        for( otn = rtn->down; otn; otn = otn->next )
+        {
+            OptTrieAddOtn( otn );
+        }
+    }
+}
+
+/*
+**
+**  NAME
+**    BuildOptionTrie::
+**
+**  DESCRIPTION
+**    Rule option lists very often start with the same tests, 
+**    flow:to_server and friends, dsize, flags and so on.  Those tests
+**    that only look at the packet (see OptFpListSetKey) are folded into
+**    a trie, so a test shared by many rules is run once per packet and
+**    a rule whose prefix failed earlier in the packet is rejected
+**    without running anything.  An OTN shows up in several port groups
+**    so one trie is shared by all of them.
+**
+*/
+static void BuildOptionTrie( void )
+{
+    RuleListNode * rule;
+
+    extern RuleListNode *RuleLists;
+
+    for( rule = RuleLists; rule; rule = rule->next )
+    {
+        if( !rule->RuleList )
+            continue;
+
+        OptTrieAddList( rule->RuleList->TcpList );
+        OptTrieAddList( rule->RuleList->UdpList );
+        OptTrieAddList( rule->RuleList->IcmpList );
+        OptTrieAddList( rule->RuleList->IpList );
+    }
+
+    if(fpDetect.debug)
+    {
+        printf("\n** Option Trie -- %d nodes, %d shared prefix tests\n",
+               OptTrieNodes, OptTrieShared);
+    }
+}
+
+static void OptTrieFree( OptTrieNode * node )
+{
+    OptTrieNode * next;
+
+    for( ; node; node = next )
+    {
+        next = node->sibling;
+
+        OptTrieFree( node->child );
+
+        free( node->test.next );
+        free( node );
+    }
+}
+
+/*
+**
+**  NAME
+**    fpAdaptOptionOrder::
+**
+**  DESCRIPTION
+**    End of the adaptive-order warm-up.  The pure tests of every OTN
+**    are re-ranked by what they cost and how often they passed, and
+**    the option trie is rebuilt from the new lists.  fpdetect calls
+**    this between packets, so nothing is being evaluated while the
+**    lists are relinked.
+**
+*/
+void fpAdaptOptionOrder()
+{
+    int i;
+
+    OptTrieFree( OptTrieRoots );
+
+    OptTrieRoots  = NULL;
+    OptTrieNodes  = 0;
+    OptTrieShared = 0;
+
+    BuildOptionTrie();
+
+    LogMessage("Rule option order adapted, %d option trie nodes\n",
+               OptTrieNodes);
+
+    if(fpDetect.debug)
+    {
+        for( i = 0; i < OptStatsCount; i++ )
+        {
+            printf("   test %p: checks=%lu matches=%lu avg ticks=%.1f\n",
+                   (void *)OptStats[i].OptTestFunc, OptStats[i].checks,
+                   OptStats[i].matches, OptStats[i].checks ?
+                   OptStats[i].ticks / OptStats[i].checks : 0.0);
+        }
+    }
+}
 
 /*
 **
@@ -1257,6 +2127,16 @@ int fpCreateFastPacketDetection()
     BuildMultiPatternGroups(prmIcmpRTNX);
     BuildMultiPatternGroups(prmIpRTNX);
 
+    BuildOptionTrie();
+
+    if(fpDetect.debug_print_fast_pattern)
+    {
+        PrintFastPatterns();
+    }
+
+    FpModelFree();
+    PcreExprFree();
+
     if(fpDetect.debug)
     {
         printf("\n** TCP Rule Group Stats -- ");
@@ -61,12 +61,22 @@ typedef struct _otnx_{
    RuleTreeNode  * rtn; 
    unsigned int    content_length;
 
+   /*
+   **  Content prefilter: one bit per literal content the pattern
+   **  matcher has to see before the rule is worth evaluating, and the
+   **  bits seen so far in the current search.
+   */
+   u_int32_t       required;
+   u_int32_t       seen;
+   u_int32_t       seen_seq;
+
 } OTNX;
 
 typedef struct _pmx_ {
 
    void * RuleNode;
    void * PatternMatchData;
+   u_int32_t bit;     /* this content's bit in otnx->required, or 0 */
 
 } PMX;
 
@@ -80,9 +90,26 @@ typedef struct _FPDETECT {
     int search_method;
     int debug;
     int max_queue_events;
+    int adaptive_order;     /* warm-up packets before re-ranking, 0 is off */
+    int debug_print_fast_pattern;
+    char *fast_pattern_corpus;  /* sample traffic for fast pattern scoring */
+    int pcre_dfa;           /* regex groups for pcre, see sp_pcre.c */
 
 } FPDETECT;
 
+/*
+**  Per option test numbers gathered from the option trie during the
+**  adaptive-order warm-up.
+*/
+typedef struct _OptTestStats {
+
+    int (*OptTestFunc)(Packet *, struct _OptTreeNode *, struct _OptFpList *);
+    unsigned long checks;
+    unsigned long matches;
+    double        ticks;
+
+} OptTestStats;
+
 /*
 **  This function initializes the detection engine configuration
 **  options before setting them.
@@ -107,8 +134,18 @@ int prmFindRuleGroupIcmp(int type, PORT_GROUP **type_group, PORT_GROUP ** gen);
 
 int fpSetDetectSearchMethod( char * method );
 int fpSetDebugMode();
+int fpSetDebugPrintFastPattern();
+int fpSetPcreDfa();
+int fpSetFastPatternCorpus(char *file);
 int fpSetStreamInsert();
 int fpSetMaxQueueEvents(int iNum);
+int fpSetAdaptiveOrder(int iNum);
+
+/*
+**  Called by fpdetect at the end of the adaptive-order warm-up to
+**  re-rank the option tests and rebuild the option trie.
+*/
+void fpAdaptOptionOrder();
 
 /*
 **  Shows the event stats for the created FastPacketDetection
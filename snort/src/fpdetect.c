@@ -52,6 +52,7 @@
 #include "inline.h"
 
 #include "sp_pattern_match.h"
+#include "sp_pcre.h"
 #include "spp_frag3.h"
 #include "stream_api.h"
 
@@ -98,6 +99,7 @@ extern OptTreeNode *otn_tmp;
 extern u_int8_t    DecodeBuffer[DECODE_BLEN];
 extern OptTreeNode *current_otn;
 extern SNORT_EVENT_QUEUE g_event_queue;
+extern int         head_count;  /* parser.c */
 /*              
 **  MATCH_INFO
 **  The events that are matched get held in this structure,
@@ -128,10 +130,37 @@ typedef struct
     Packet * p;
     int check_ports;
 
+    /*
+    **  Whether the content prefilter applies to this search, and the
+    **  search otnx->seen belongs to.
+    */
+    int prefilter;
+    u_int32_t search_seq;
+
+    /*
+    **  Buffer being searched, so rule evaluation can reuse the match
+    **  location.  NULL for URI searches.
+    */
+    u_int8_t *search_data;
+
     MATCH_INFO *matchInfo;
     int iMatchInfoArraySize;
+
+    /*
+    **  Per-packet RTN header results, indexed by head_node_number.
+    **  Only the entries listed in rtn_touched are ever non-zero, so
+    **  clearing them between packets costs one store per RTN tested.
+    */
+    u_int8_t *rtn_result;
+    int      *rtn_touched;
+    int       rtn_ntouched;
+    int       rtn_cache_size;
 } OTNX_MATCH_DATA;
 
+#define RTN_RESULT_UNKNOWN  0
+#define RTN_RESULT_PASS     1
+#define RTN_RESULT_FAIL     2
+
 /*
 **  Static function prototypes
 */
@@ -148,6 +177,7 @@ static INLINE int fpEvalHeaderUdp(Packet *p);
 static INLINE int fpEvalHeaderSW(PORT_GROUP *port_group, Packet *p, 
         int check_ports);
 static int otnx_match (void* id, int index, void * data );               
+static INLINE void fpResetRuleNodeHits(PORT_GROUP *pg);
 static INLINE int fpAddMatch( OTNX_MATCH_DATA *omd, OTNX *otnx, int pLen );
 static INLINE int fpAddSessionAlert(Packet *p, OTNX *otnx);
 static INLINE int fpSessionAlerted(Packet *p, OTNX *otnx);
@@ -158,6 +188,18 @@ extern u_int8_t *doe_ptr;
 
 static OTNX_MATCH_DATA omd;
 
+/*
+**  Bumped for every packet, option trie results from older packets
+**  are ignored.
+*/
+static u_int32_t opt_trie_seq = 0;
+
+/*
+**  Packets left in the adaptive-order warm-up, -1 once it's done or if
+**  it was never configured
+*/
+static int opt_adapt_left = 0;
+
 #ifdef PERF_PROFILING
 PreprocStats rulePerfStats;
 #endif
@@ -172,8 +214,68 @@ int OtnXMatchDataInitialize()
         FatalError("Out of memory initializing detection engine\n");
     }
 
+    /* head_node_number runs from 1 to head_count */
+    omd.rtn_cache_size = head_count + 1;
+    omd.rtn_result = (u_int8_t *)SnortAlloc(omd.rtn_cache_size * sizeof(u_int8_t));
+    omd.rtn_touched = (int *)SnortAlloc(omd.rtn_cache_size * sizeof(int));
+    omd.rtn_ntouched = 0;
+
     return 0;
 }
+
+/*
+**  NAME
+**    fpResetRTNCache::
+**
+**  DESCRIPTION
+**    Forget the header results of the last packet.
+**
+*/
+static INLINE void fpResetRTNCache(void)
+{
+    while(omd.rtn_ntouched > 0)
+    {
+        omd.rtn_result[omd.rtn_touched[--omd.rtn_ntouched]] =
+            RTN_RESULT_UNKNOWN;
+    }
+}
+
+/*
+**  NAME
+**    fpEvalRTNHeader::
+**
+**  DESCRIPTION
+**    Runs the RTN's header function list (proto, addresses, ports,
+**    bidirectional), remembering the result for the rest of the packet.
+**    Many OTNs share one RTN, so content heavy packets would otherwise
+**    repeat the same header checks for every OTN that hits.
+**
+**  FORMAL INPUTS
+**    RuleTreeNode * - RTN to check packet against.
+**    Packet       * - Packet to evaluate
+**
+**  FORMAL OUTPUT
+**    int - 1 if match, 0 if match failed.
+**
+*/
+static INLINE int fpEvalRTNHeader(RuleTreeNode *rtn, Packet *p)
+{
+    int id = rtn->head_node_number;
+    int match;
+
+    if(id >= omd.rtn_cache_size)
+        return rtn->rule_func->RuleHeadFunc(p, rtn, rtn->rule_func);
+
+    if(omd.rtn_result[id] != RTN_RESULT_UNKNOWN)
+        return omd.rtn_result[id] == RTN_RESULT_PASS;
+
+    match = rtn->rule_func->RuleHeadFunc(p, rtn, rtn->rule_func);
+
+    omd.rtn_result[id] = match ? RTN_RESULT_PASS : RTN_RESULT_FAIL;
+    omd.rtn_touched[omd.rtn_ntouched++] = id;
+
+    return match;
+}
     
 /*
 **  NAME
@@ -458,6 +560,60 @@ static INLINE int fpAddMatch(OTNX_MATCH_DATA *omd, OTNX *otnx, int pLen )
     return 0;
 }
 
+/*
+**
+**  NAME
+**    fpEvalOptPrefix::
+**
+**  DESCRIPTION
+**    Evaluates a node of the option prefix trie, and the nodes above it,
+**    at most once per packet.
+**
+**  FORMAL INPUTS
+**    OptTrieNode * - the last shared test of an OTN
+**    Packet *      - Packet to evaluate
+**
+**  FORMAL OUTPUT
+**    int - 0 if no match, 1 if match.
+**
+*/
+static int fpEvalOptPrefix(OptTrieNode *node, Packet *p)
+{
+#ifdef PERF_PROFILING
+    UINT64 ticks_start = 0, ticks_end = 0;
+#endif
+
+    if(node->eval_seq == opt_trie_seq)
+        return node->result;
+
+    if(node->parent && !fpEvalOptPrefix(node->parent, p))
+    {
+        node->result = 0;
+    }
+    else if(opt_adapt_left > 0 && node->stats)
+    {
+        /* warm-up, keep numbers for the re-ranking */
+#ifdef PERF_PROFILING
+        rdtsc(ticks_start);
+#endif
+        node->result = node->test.OptTestFunc(p, node->otn, &node->test) ? 1 : 0;
+#ifdef PERF_PROFILING
+        rdtsc(ticks_end);
+        node->stats->ticks += (double)(ticks_end - ticks_start);
+#endif
+        node->stats->checks++;
+        node->stats->matches += node->result;
+    }
+    else
+    {
+        node->result = node->test.OptTestFunc(p, node->otn, &node->test) ? 1 : 0;
+    }
+
+    node->eval_seq = opt_trie_seq;
+
+    return node->result;
+}
+
 /*
 **
 **  NAME
@@ -476,6 +632,7 @@ static INLINE int fpAddMatch(OTNX_MATCH_DATA *omd, OTNX *otnx, int pLen )
 */
 static INLINE int fpEvalOTN(OptTreeNode *List, Packet *p)
 {
+    OptFpList *opt_func;
     PROFILE_VARS;
 
     if(List == NULL)
@@ -545,7 +702,23 @@ static INLINE int fpEvalOTN(OptTreeNode *List, Packet *p)
 
     OTN_PROFILE_START(List);
 
-    if(!List->opt_func->OptTestFunc(p, List, List->opt_func))
+    /*
+    **  Run the shared leading tests through the option trie, then the
+    **  rest of this rule's own tests.
+    */
+    if(List->opt_func_rest)
+    {
+        opt_func = List->opt_func_rest;
+
+        if(List->opt_prefix && !fpEvalOptPrefix(List->opt_prefix, p))
+            opt_func = NULL;
+    }
+    else
+    {
+        opt_func = List->opt_func;
+    }
+
+    if(!opt_func || !opt_func->OptTestFunc(p, List, opt_func))
     {
 #ifdef PERF_PROFILING
         /* Handle the case where flowbits:noalert returns 0 to here
@@ -629,7 +802,7 @@ static INLINE int fpEvalRTN(RuleTreeNode *rtn, Packet *p, int check_ports)
     DEBUG_WRAP(DebugMessage(DEBUG_DETECT, "[*] Rule Head %d\n", 
                 rtn->head_node_number);)
 
-    if(!rtn->rule_func->RuleHeadFunc(p, rtn, rtn->rule_func))
+    if(!fpEvalRTNHeader(rtn, p))
     {
         DEBUG_WRAP(DebugMessage(DEBUG_DETECT,
                     "   => Header check failed, checking next node\n"););
@@ -717,7 +890,7 @@ static INLINE int fpEvalRTNSW(RuleTreeNode *rtn, OptTreeNode *otn, Packet *p, in
     DEBUG_WRAP(DebugMessage(DEBUG_DETECT, "[*] Rule Head %d\n", 
                 rtn->head_node_number);)
 
-    if(!rtn->rule_func->RuleHeadFunc(p, rtn, rtn->rule_func))
+    if(!fpEvalRTNHeader(rtn, p))
     {
         DEBUG_WRAP(DebugMessage(DEBUG_DETECT,
                     "   => Header check failed, checking next node\n"););
@@ -774,6 +947,24 @@ static int otnx_match( void * id, int index, void * data)
     PatternMatchData *pmd    = (PatternMatchData*)pmx->PatternMatchData;
     PROFILE_VARS;
 
+    /*
+    **  Content prefilter, hold off until the matcher has seen every
+    **  literal the rule requires.
+    */
+    if( pmx->bit && omd->prefilter )
+    {
+        if( otnx->seen_seq != omd->search_seq )
+        {
+            otnx->seen_seq = omd->search_seq;
+            otnx->seen = 0;
+        }
+
+        otnx->seen |= pmx->bit;
+
+        if( otnx->seen != otnx->required )
+            return 0;
+    }
+
     /* set up the current otn pointer for the exception handler */
     current_otn = otnx->otn;
 
@@ -796,8 +987,21 @@ static int otnx_match( void * id, int index, void * data)
         return 0;
     }
 
+    /*
+    **  Let the content plugin start from this match instead of
+    **  searching for the content again.
+    */
+    if( omd->search_data )
+    {
+        fp_match_pmd  = pmd;
+        fp_match_data = omd->search_data;
+        fp_match_ptr  = omd->search_data + index;
+    }
+
     if( fpEvalRTNSW(otnx->rtn, otnx->otn, omd->p, omd->check_ports) )
     {
+        fp_match_pmd = NULL;
+
         /*
         **  We have a qualified event
         */
@@ -812,6 +1016,8 @@ static int otnx_match( void * id, int index, void * data)
     }
     else
     {
+        fp_match_pmd = NULL;
+
         /*
         ** This means that the event is non-qualified.
         */
@@ -829,6 +1035,10 @@ static int otnx_match( void * id, int index, void * data)
         **  There was an error, don't do anything right now.
         */
     }   
+    else if(omd->pg->pgHits)
+    {
+        omd->pg->pgHits[omd->pg->pgHitCount++] = rnNode->iRuleNodeID;
+    }
 
     PREPROC_PROFILE_END(rulePerfStats);
 
@@ -837,6 +1047,40 @@ static int otnx_match( void * id, int index, void * data)
     return 0;
 }
 
+/*
+**
+**  NAME
+**    fpResetRuleNodeHits::
+**
+**  DESCRIPTION
+**    Clears the RULE_NODE hit bits of a port group after a search.
+**    Only the bits otnx_match set are cleared, a search usually
+**    hits a handful of rules out of the thousands a generic group
+**    can hold.
+**
+**  FORMAL INPUTS
+**    PORT_GROUP * - the port group that was searched
+**
+**  FORMAL OUTPUT
+**    None
+**
+*/
+static INLINE void fpResetRuleNodeHits(PORT_GROUP *pg)
+{
+    int i;
+
+    if( !pg->pgHits )
+    {
+        boResetBITOP(&(pg->boRuleNodeID));
+        return;
+    }
+
+    for( i = 0; i < pg->pgHitCount; i++ )
+        boClearByte(&(pg->boRuleNodeID), pg->pgHits[i]);
+
+    pg->pgHitCount = 0;
+}
+
 static int sortOrderByPriority(const void *e1, const void *e2)
 {
     OTNX *o1;
@@ -1271,6 +1515,11 @@ static INLINE int fpEvalHeaderSW(PORT_GROUP *port_group, Packet *p, int check_po
     **  Init the info for rule ordering selection
     */
     //InitMatchInfo( &omd );
+
+    /*
+    **  pcre options of this group's rules go through its regex group
+    */
+    PcreGroupSelect(port_group->pgPcreGroup);
     
     if (do_detect_content)
     {
@@ -1313,6 +1562,8 @@ static INLINE int fpEvalHeaderSW(PORT_GROUP *port_group, Packet *p, int check_po
                         omd.pg = port_group;
                         omd.p  = p;
                         omd.check_ports= check_ports;
+                        omd.prefilter = 0;
+                        omd.search_data = NULL;
     
                         mpseSearch (so, UriBufs[i].uri, UriBufs[i].length, 
                              otnx_match, &omd);
@@ -1327,7 +1578,8 @@ static INLINE int fpEvalHeaderSW(PORT_GROUP *port_group, Packet *p, int check_po
             */
             if(UriBufs[0].decode_flags & HTTPURI_PIPELINE_REQ)
             {
-                boResetBITOP(&(port_group->boRuleNodeID));
+                fpResetRuleNodeHits(port_group);
+                PcreGroupSelect(NULL);
                 return 0;
             }
     
@@ -1350,6 +1602,14 @@ static INLINE int fpEvalHeaderSW(PORT_GROUP *port_group, Packet *p, int check_po
                 omd.pg = port_group;
                 omd.p = p;
                 omd.check_ports= check_ports;
+
+                /*
+                **  Options may check either buffer here, depending on
+                **  rawbytes, so a literal missing from this one says
+                **  nothing.
+                */
+                omd.prefilter = 0;
+                omd.search_data = DecodeBuffer;
     
                 mpseSearch ( so, DecodeBuffer, p->alt_dsize, 
                         otnx_match, &omd );
@@ -1361,7 +1621,7 @@ static INLINE int fpEvalHeaderSW(PORT_GROUP *port_group, Packet *p, int check_po
                  **  will need to validate that same rule in the case
                  **  of rawbytes.
                  */
-                boResetBITOP(&(port_group->boRuleNodeID));
+                fpResetRuleNodeHits(port_group);
             }
             
             /*
@@ -1378,11 +1638,16 @@ static INLINE int fpEvalHeaderSW(PORT_GROUP *port_group, Packet *p, int check_po
                 omd.pg = port_group;
                 omd.p = p;
                 omd.check_ports= check_ports;
+                omd.prefilter = !(p->packet_flags & PKT_ALT_DECODE);
+                omd.search_data = p->data;
+
+                if( ++omd.search_seq == 0 )
+                    omd.search_seq = 1;
     
                 mpseSearch ( so, p->data, p->dsize, otnx_match, &omd );
             }
     
-            boResetBITOP(&(port_group->boRuleNodeID));
+            fpResetRuleNodeHits(port_group);
         }
     }
 
@@ -1450,6 +1715,8 @@ static INLINE int fpEvalHeaderSW(PORT_GROUP *port_group, Packet *p, int check_po
         }
     }
 
+    PcreGroupSelect(NULL);
+
     return 0;
 }
 
@@ -1713,6 +1980,27 @@ int fpEvalPacket(Packet *p)
 {
     int ip_proto = p->iph->ip_proto;
 
+    fpResetRTNCache();
+
+    if(++opt_trie_seq == 0)
+        opt_trie_seq = 1;
+
+    PcreGroupNewPacket();
+
+    if(opt_adapt_left >= 0)
+    {
+        if(opt_adapt_left == 0)
+        {
+            opt_adapt_left = fpDetect->adaptive_order ? 
+                fpDetect->adaptive_order : -1;
+        }
+        else if(--opt_adapt_left == 0)
+        {
+            fpAdaptOptionOrder();
+            opt_adapt_left = -1;
+        }
+    }
+
     switch(ip_proto)
     {
         case IPPROTO_TCP:
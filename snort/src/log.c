@@ -455,7 +455,8 @@ FILE *OpenAlertFile(char *filearg)
     /* Do not buffer in WIN32 */
     setvbuf(file, (char *) NULL, _IONBF, (size_t) 0);
 #else
-    setvbuf(file, (char *) NULL, _IOLBF, (size_t) 0);
+    /* the alert outputs flush through their SF_TEXTBUF */
+    setvbuf(file, (char *) NULL, _IOFBF, (size_t) SFTB_FLUSH_SIZE);
 #endif
 
     return file;
@@ -1667,6 +1668,126 @@ void PrintPriorityData(FILE *fp, int do_newline)
 
 }
 
+
+/*
+ * Function: TextBufTimestamp(SF_TEXTBUF *, Packet *)
+ *
+ * Purpose: Appends the ts_print() timestamp of a packet to a text buffer
+ *
+ * Arguments: tb => text buffer to append to
+ *            p => packet, NULL for the current time
+ *
+ * Returns: void function
+ */
+void TextBufTimestamp(SF_TEXTBUF *tb, Packet *p)
+{
+    sftb_puttime(tb, p == NULL ? NULL : (struct timeval *) &p->pkth->ts,
+                 pv.use_utc ? 0 : thiszone, pv.include_year);
+}
+
+
+/*
+ * Function: TextBufPriorityData(SF_TEXTBUF *, int)
+ *
+ * Purpose: PrintPriorityData() for a text buffer
+ *
+ * Arguments: tb => text buffer to append to
+ *            do_newline => tack a \n to the end of the line or not (bool)
+ *
+ * Returns: void function
+ */
+void TextBufPriorityData(SF_TEXTBUF *tb, int do_newline)
+{
+    if(!otn_tmp)
+        return;
+
+    if(otn_tmp->sigInfo.classType)
+    {
+        sftb_write(tb, "[Classification: ", 17);
+        sftb_puts(tb, otn_tmp->sigInfo.classType->name);
+        sftb_write(tb, "] ", 2);
+    }
+
+    sftb_write(tb, "[Priority: ", 11);
+    sftb_putu(tb, otn_tmp->sigInfo.priority);
+    sftb_write(tb, "] ", 2);
+
+    if(do_newline)
+        sftb_putc(tb, '\n');
+}
+
+
+/*
+ * Function: TextBufMessage(SF_TEXTBUF *, SFTB_CACHE *, char *, Event *,
+ *                          const char *, const char *)
+ *
+ * Purpose: Appends "<lead>[gid:sid:rev] <interface> msg<trail>" to a text
+ *          buffer.  None of it changes from one alert of a rule to the
+ *          next, so it is rendered once and then copied out of the cache.
+ *
+ * Arguments: tb => text buffer to append to
+ *            cache => rendered messages, may be NULL
+ *            msg => the alert message
+ *            event => event data, may be NULL
+ *            lead, trail => text around the message
+ *
+ * Returns: void function
+ */
+void TextBufMessage(SF_TEXTBUF *tb, SFTB_CACHE *cache, char *msg,
+                    Event *event, const char *lead, const char *trail)
+{
+    u_int32_t gid = 0, sid = 0, rev = 0;
+    int has_event = 0;
+    char *text;
+    int len, start;
+
+    if(event != NULL)
+    {
+        gid = event->sig_generator;
+        sid = event->sig_id;
+        rev = event->sig_rev;
+        has_event = 1;
+    }
+
+    if(cache != NULL &&
+       (text = sftb_cache_find(cache, msg, gid, sid, rev, has_event, &len)))
+    {
+        sftb_write(tb, text, len);
+        return;
+    }
+
+    start = tb->len;
+
+    sftb_puts(tb, lead);
+
+    if(event != NULL)
+    {
+        sftb_putc(tb, '[');
+        sftb_putu(tb, gid);
+        sftb_putc(tb, ':');
+        sftb_putu(tb, sid);
+        sftb_putc(tb, ':');
+        sftb_putu(tb, rev);
+        sftb_write(tb, "] ", 2);
+    }
+
+    if(pv.alert_interface_flag)
+    {
+        sftb_write(tb, " <", 2);
+        sftb_puts(tb, PRINT_INTERFACE(pv.interface));
+        sftb_write(tb, "> ", 2);
+    }
+
+    sftb_puts(tb, msg);
+    sftb_puts(tb, trail);
+
+    if(cache != NULL)
+    {
+        sftb_cache_add(cache, msg, gid, sid, rev, has_event,
+                       tb->buf + start, tb->len - start);
+    }
+}
+
         
 /*
  * Function: PrintXrefs(FILE *)
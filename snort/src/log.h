@@ -28,6 +28,7 @@
 
 #include "event.h"
 #include "decode.h"
+#include "sftextbuf.h"
 
 #if defined (SUNOS) || defined (SOLARIS) || defined (HPUX) || defined (IRIX) \
 || defined (AIX) || defined (OSF1)
@@ -68,6 +69,10 @@ void PrintUDPHeader(FILE *, Packet *);
 void PrintEAPHeader(FILE *, Packet *);
 void PrintPriorityData(FILE *, int);
 void PrintXrefs(FILE *, int);
+void TextBufTimestamp(SF_TEXTBUF *, Packet *);
+void TextBufPriorityData(SF_TEXTBUF *, int);
+void TextBufMessage(SF_TEXTBUF *, SFTB_CACHE *, char *, Event *,
+                    const char *, const char *);
 void CreateTCPFlagString(Packet *, char *);
 
 
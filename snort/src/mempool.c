@@ -38,6 +38,24 @@
 
 /* $Id: mempool.c,v 1.7 2004/03/23 15:34:45 chris_reid Exp $ */
 #include "mempool.h"
+#include "util.h"
+
+/*
+ * Magazine cache.
+ *
+ * The depot is lock free and needs the 64-bit __sync builtins, configure
+ * checks for them.  Without them it falls back to plain loads and
+ * stores, which is only good for a single thread, so a cache for more
+ * than one thread is refused.
+ */
+#ifdef HAVE_SYNC_BUILTINS
+#define MEMPOOL_ATOMIC
+#endif
+
+#if defined(TEST_MEMPOOL) && defined(ENABLE_PTHREAD) && defined(MEMPOOL_ATOMIC)
+#include <pthread.h>
+#define MEMPOOL_TEST_THREADS
+#endif
 
 /* Function: int mempool_init(MemPool *mempool,
  *                            PoolCount num_objects, size_t obj_size)
@@ -258,8 +276,511 @@ void mempool_free(MemPool *mempool, MemBucket *obj)
     return;
 }
 
+/* depot primitives, atomic only with MEMPOOL_ATOMIC */
+#ifdef MEMPOOL_ATOMIC
+#define MEMPOOL_CAS64(p, o, n)  __sync_bool_compare_and_swap((p), (o), (n))
+#define MEMPOOL_ADD32(p, n)     __sync_add_and_fetch((p), (n))
+#else
+static int mempool_cas64(volatile u_int64_t *p, u_int64_t o, u_int64_t n)
+{
+    if(*p != o)
+        return 0;
+
+    *p = n;
+    return 1;
+}
+
+static u_int32_t mempool_add32(volatile u_int32_t *p, u_int32_t n)
+{
+    return *p += n;
+}
+
+#define MEMPOOL_CAS64(p, o, n)  mempool_cas64((p), (o), (n))
+#define MEMPOOL_ADD32(p, n)     mempool_add32((p), (n))
+#endif
+
+#define MEMPOOL_MAG(mc, i) \
+    ((MemMagazine *)((mc)->magazines + (size_t)(i) * (mc)->mag_stride))
+
+/* round n up to a multiple of align, a power of two */
+#define MEMPOOL_ROUND(n, align)  (((n) + (align) - 1) & ~((size_t)(align) - 1))
+
+static void *mempool_aligned(size_t size, size_t align, void **raw)
+{
+    *raw = calloc(1, size + align);
+
+    if(*raw == NULL)
+        return NULL;
+
+    return (void *) MEMPOOL_ROUND((size_t)*raw, align);
+}
+
+static void mempool_depot_push(MemCache *mc, volatile u_int64_t *head,
+                               MemMagazine *m)
+{
+    u_int64_t old, new;
+    u_int32_t idx = ((char *)m - mc->magazines) / mc->mag_stride + 1;
+
+    do
+    {
+        old = *head;
+        m->next = (u_int32_t)old;
+        new = ((old >> 32) + 1) << 32 | idx;
+    } while(!MEMPOOL_CAS64(head, old, new));
+}
+
+static MemMagazine *mempool_depot_pop(MemCache *mc, volatile u_int64_t *head)
+{
+    u_int64_t old, new;
+    MemMagazine *m;
+
+    do
+    {
+        old = *head;
+
+        if((u_int32_t)old == 0)
+            return NULL;
+
+        /* may be stale if someone else pops first, the tag catches that */
+        m = MEMPOOL_MAG(mc, (u_int32_t)old - 1);
+        new = ((old >> 32) + 1) << 32 | m->next;
+    } while(!MEMPOOL_CAS64(head, old, new));
+
+    return m;
+}
+
+static void mempool_depot_put_full(MemCache *mc, MemMagazine *m)
+{
+    u_int32_t n;
+
+    mempool_depot_push(mc, &mc->full, m);
+    n = MEMPOOL_ADD32(&mc->nfull, 1);
+
+    /* racy, but it is only a statistic */
+    if(n > mc->full_hiwater)
+        mc->full_hiwater = n;
+}
+
+static MemMagazine *mempool_depot_get_full(MemCache *mc)
+{
+    MemMagazine *m;
+    u_int32_t n;
+
+    if((m = mempool_depot_pop(mc, &mc->full)) == NULL)
+        return NULL;
+
+    n = MEMPOOL_ADD32(&mc->nfull, (u_int32_t)-1);
+
+    if(n < mc->full_lowater)
+        mc->full_lowater = n;
+
+    return m;
+}
+
+/* Function: int mempool_cache_init(MemCache *mc, PoolCount num_objects,
+ *                                  size_t obj_size, unsigned mag_size,
+ *                                  size_t align, unsigned max_threads)
+ * 
+ * Purpose: allocate num_objects objects and load them into magazines in
+ *          the depot, with enough empty magazines that a free never
+ *          finds the depot out of them
+ * Args: mc          - pointer to a MemCache struct
+ *       num_objects - number of items in this pool
+ *       obj_size    - size of the items
+ *       mag_size    - objects per magazine, 0 for MEMPOOL_MAG_SIZE
+ *       align       - object alignment, a power of two, e.g.
+ *                     MEMPOOL_CACHELINE so no two objects share a line;
+ *                     0 for pointer alignment
+ *       max_threads - most MemCacheThreads that will be made, only 1
+ *                     without MEMPOOL_ATOMIC
+ * 
+ * Returns: 0 on success, 1 on failure
+ */ 
+int mempool_cache_init(MemCache *mc, PoolCount num_objects, size_t obj_size,
+                       unsigned mag_size, size_t align, unsigned max_threads)
+{
+    MemMagazine *m;
+    PoolCount i;
+    u_int32_t nfull;
+
+    if(mc == NULL || num_objects < 1 || obj_size < 1 || max_threads < 1)
+        return 1;
+
+#ifndef MEMPOOL_ATOMIC
+    if(max_threads > 1)
+    {
+        ErrorMessage("mempool: no atomic operations, a magazine cache "
+                     "is limited to one thread\n");
+        return 1;
+    }
+#endif
+
+    if(align == 0)
+        align = sizeof(void *);
+
+    if(align & (align - 1))
+        return 1;
+
+    bzero(mc, sizeof(MemCache));
+
+    mc->obj_size = obj_size;
+    mc->stride = MEMPOOL_ROUND(obj_size, align);
+    mc->total = num_objects;
+    mc->mag_size = mag_size ? mag_size : MEMPOOL_MAG_SIZE;
+    mc->max_threads = max_threads;
+
+    /*
+     * Every thread holds two magazines and may hand back one partly
+     * full one when it is released, the rest hold the objects.
+     */
+    nfull = (num_objects + mc->mag_size - 1) / mc->mag_size;
+    mc->nmags = nfull + 3 * max_threads + 1;
+    mc->mag_stride = MEMPOOL_ROUND(sizeof(MemMagazine) +
+                                   (mc->mag_size - 1) * sizeof(void *),
+                                   sizeof(void *));
+    mc->thread_stride = MEMPOOL_ROUND(sizeof(MemCacheThread),
+                                      MEMPOOL_CACHELINE);
+
+    mc->objects = mempool_aligned(mc->stride * num_objects, align,
+                                  &mc->objmem);
+    mc->magazines = mempool_aligned(mc->mag_stride * mc->nmags,
+                                    MEMPOOL_CACHELINE, &mc->magmem);
+    mc->threads = mempool_aligned(mc->thread_stride * max_threads,
+                                  MEMPOOL_CACHELINE, &mc->threadmem);
+
+    if(mc->objects == NULL || mc->magazines == NULL || mc->threads == NULL)
+    {
+        ErrorMessage("mempool: unable to allocate cache\n");
+        mempool_cache_destroy(mc);
+        return 1;
+    }
+
+    for(i = 0; i < num_objects; i++)
+    {
+        m = MEMPOOL_MAG(mc, i / mc->mag_size);
+        m->objs[m->count++] = mc->objects + (size_t)i * mc->stride;
+    }
+
+    for(i = 0; i < nfull; i++)
+        mempool_depot_put_full(mc, MEMPOOL_MAG(mc, i));
+
+    for(i = nfull; i < mc->nmags; i++)
+        mempool_depot_push(mc, &mc->empty, MEMPOOL_MAG(mc, i));
+
+    mc->full_lowater = mc->nfull;
+
+    return 0;
+}
+
+/* Function: int mempool_cache_destroy(MemCache *mc) 
+ * 
+ * Purpose: free the cache, every object and thread handle goes with it
+ * Args: mc - pointer to a MemCache struct
+ * 
+ * Returns: 0 on success, 1 on failure
+ */ 
+int mempool_cache_destroy(MemCache *mc)
+{
+    if(mc == NULL)
+        return 1;
+
+    free(mc->objmem);
+    free(mc->magmem);
+    free(mc->threadmem);
+
+    bzero(mc, sizeof(MemCache));
+
+    return 0;
+}
+
+/* Function: MemCacheThread *mempool_cache_thread(MemCache *mc)
+ * 
+ * Purpose: make the handle one thread allocates and frees through.
+ *          Only that thread may use it.
+ * Args: mc - pointer to a MemCache struct
+ * 
+ * Returns: the handle, NULL once max_threads handles were made
+ */ 
+MemCacheThread *mempool_cache_thread(MemCache *mc)
+{
+    MemCacheThread *t;
+    u_int32_t n;
+
+    n = MEMPOOL_ADD32(&mc->nthreads, 1);
+
+    if(n > mc->max_threads)
+        return NULL;
+
+    t = (MemCacheThread *)((char *)mc->threads + (n - 1) * mc->thread_stride);
+
+    t->cache = mc;
+    t->loaded = mempool_depot_pop(mc, &mc->empty);
+    t->previous = mempool_depot_pop(mc, &mc->empty);
+
+    return t;
+}
+
+/* Function: void mempool_cache_thread_release(MemCacheThread *t)
+ * 
+ * Purpose: hand a thread's magazines back to the depot when it is done,
+ *          the handle is not reused
+ * Args: t - the thread's handle
+ */ 
+void mempool_cache_thread_release(MemCacheThread *t)
+{
+    MemCache *mc = t->cache;
+
+    if(t->loaded->count)
+        mempool_depot_put_full(mc, t->loaded);
+    else
+        mempool_depot_push(mc, &mc->empty, t->loaded);
+
+    if(t->previous->count)
+        mempool_depot_put_full(mc, t->previous);
+    else
+        mempool_depot_push(mc, &mc->empty, t->previous);
+
+    t->loaded = t->previous = NULL;
+}
+
+/* Function: void *mempool_cache_alloc(MemCacheThread *t)
+ * 
+ * Purpose: allocate an object from the thread's magazines, trading its
+ *          empty magazine for a full one from the depot when both are out
+ * Args: t - the calling thread's handle
+ * 
+ * Returns: a pointer to the object, NULL if the pool is used up
+ */ 
+void *mempool_cache_alloc(MemCacheThread *t)
+{
+    MemMagazine *m;
+
+    if(t->loaded->count == 0)
+    {
+        if(t->previous->count)
+        {
+            m = t->loaded;
+            t->loaded = t->previous;
+            t->previous = m;
+        }
+        else
+        {
+            if((m = mempool_depot_get_full(t->cache)) == NULL)
+            {
+                t->misses++;
+                return NULL;
+            }
+
+            mempool_depot_push(t->cache, &t->cache->empty, t->previous);
+            t->previous = t->loaded;
+            t->loaded = m;
+            t->depot_gets++;
+        }
+    }
+
+    t->allocs++;
+
+    if(++t->outstanding > t->hiwater)
+        t->hiwater = t->outstanding;
+
+    return t->loaded->objs[--t->loaded->count];
+}
+
+/* Function: void mempool_cache_free(MemCacheThread *t, void *obj)
+ * 
+ * Purpose: return an object to the thread's magazines, trading a full
+ *          magazine for an empty one from the depot when both are full.
+ *          The object may have come from any thread.
+ * Args: t   - the calling thread's handle
+ *       obj - object from mempool_cache_alloc()
+ */ 
+void mempool_cache_free(MemCacheThread *t, void *obj)
+{
+    MemMagazine *m;
+
+    if(t->loaded->count == t->cache->mag_size)
+    {
+        if(t->previous->count == 0)
+        {
+            m = t->loaded;
+            t->loaded = t->previous;
+            t->previous = m;
+        }
+        else
+        {
+            /* can't run dry, see the magazine count in mempool_cache_init */
+            m = mempool_depot_pop(t->cache, &t->cache->empty);
+
+            mempool_depot_put_full(t->cache, t->previous);
+            t->previous = t->loaded;
+            t->loaded = m;
+            t->depot_puts++;
+        }
+    }
+
+    t->frees++;
+    t->outstanding--;
+
+    t->loaded->objs[t->loaded->count++] = obj;
+}
+
+/* Function: void mempool_cache_stats(MemCache *mc, const char *name)
+ * 
+ * Purpose: dump depot and per thread counters
+ * Args: mc   - pointer to a MemCache struct
+ *       name - label for the output
+ */ 
+void mempool_cache_stats(MemCache *mc, const char *name)
+{
+    MemCacheThread *t;
+    u_int32_t i, n;
+
+    n = mc->nthreads < mc->max_threads ? mc->nthreads : mc->max_threads;
+
+    LogMessage("%s: %u objects of %u bytes, %u magazines of %u, "
+            "depot full %u (low %u high %u)\n", name ? name : "mempool",
+            mc->total, (unsigned)mc->stride, mc->nmags, mc->mag_size,
+            mc->nfull, mc->full_lowater, mc->full_hiwater);
+
+    for(i = 0; i < n; i++)
+    {
+        t = (MemCacheThread *)((char *)mc->threads + i * mc->thread_stride);
+
+        LogMessage("   thread %u: allocs=%lu frees=%lu misses=%lu "
+                "depot gets=%lu puts=%lu outstanding=%ld hiwater=%ld\n",
+                i, t->allocs, t->frees, t->misses, t->depot_gets,
+                t->depot_puts, t->outstanding, t->hiwater);
+    }
+}
+
 #ifdef TEST_MEMPOOL
 
+#include <stdarg.h>
+
+/* the test links without util.c */
+void LogMessage(const char *format, ...)
+{
+    va_list ap;
+
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+}
+
+void ErrorMessage(const char *format, ...)
+{
+    va_list ap;
+
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+}
+
+#define CACHE_OBJS    4096
+#ifdef MEMPOOL_ATOMIC
+#define CACHE_THREADS 4
+#else
+#define CACHE_THREADS 1
+#endif
+#define CACHE_ROUNDS  200000
+
+/*
+ * Each thread keeps a window of objects stamped with its id, frees a
+ * random one and allocates a new one.  The windows cover half the pool so
+ * magazines go through the depot and on to other threads.
+ */
+static MemCache cache;
+
+static void *cache_worker(void *arg)
+{
+    MemCacheThread *t = mempool_cache_thread(&cache);
+    long id = (long) arg;
+    void *win[CACHE_OBJS / CACHE_THREADS / 2];
+    unsigned r = (unsigned) id + 1;
+    int i, k, bad = 0;
+    int n = sizeof(win) / sizeof(win[0]);
+
+    for(i = 0; i < n; i++)
+    {
+        win[i] = mempool_cache_alloc(t);
+        *(long *) win[i] = id;
+    }
+
+    for(i = 0; i < CACHE_ROUNDS; i++)
+    {
+        r = r * 1103515245 + 12345;
+        k = (r >> 8) % n;
+
+        if(*(long *) win[k] != id)
+            bad++;
+
+        mempool_cache_free(t, win[k]);
+
+        if((win[k] = mempool_cache_alloc(t)) == NULL)
+        {
+            bad++;
+            break;
+        }
+
+        *(long *) win[k] = id;
+    }
+
+    for(i = 0; i < n; i++)
+        mempool_cache_free(t, win[i]);
+
+    mempool_cache_thread_release(t);
+
+    return (void *)(long) bad;
+}
+
+static int test_cache(void)
+{
+    MemMagazine *m;
+    u_int32_t i;
+    long bad = 0, objs = 0;
+
+    if(mempool_cache_init(&cache, CACHE_OBJS, 40, 0, MEMPOOL_CACHELINE,
+                          CACHE_THREADS))
+    {
+        printf("error in mempool_cache_init\n");
+        return 1;
+    }
+
+#ifdef MEMPOOL_TEST_THREADS
+    {
+        pthread_t tids[CACHE_THREADS];
+        void *ret;
+
+        for(i = 0; i < CACHE_THREADS; i++)
+            pthread_create(&tids[i], NULL, cache_worker, (void *)(long) i);
+
+        for(i = 0; i < CACHE_THREADS; i++)
+        {
+            pthread_join(tids[i], &ret);
+            bad += (long) ret;
+        }
+    }
+#else
+    for(i = 0; i < CACHE_THREADS; i++)
+        bad += (long) cache_worker((void *)(long) i);
+#endif
+
+    mempool_cache_stats(&cache, "test");
+
+    /* everything should be back in the depot */
+    for(i = 0; i < cache.nmags; i++)
+    {
+        m = MEMPOOL_MAG(&cache, i);
+        objs += m->count;
+    }
+
+    printf("cache: %ld of %u objects back, %ld bad\n", objs, CACHE_OBJS, bad);
+
+    mempool_cache_destroy(&cache);
+
+    return bad || objs != CACHE_OBJS;
+}
+
 #define SIZE 36
 int main(void)
 {
@@ -326,7 +847,7 @@ int main(void)
     printf("free: %u, used: %u\n", test.free, test.used);
 
     
-    return 0;
+    return test_cache();
 }
 #endif /* TEST_MEMPOOL */
 
@@ -21,6 +21,7 @@
 #ifndef _MEMPOOL_H
 #define _MEMPOOL_H
 
+#include <sys/types.h>
 #include "sf_sdlist.h"
 
 typedef unsigned int PoolCount;
@@ -56,6 +57,81 @@ int mempool_destroy(MemPool *mempool);
 MemBucket *mempool_alloc(MemPool *mempool);
 void mempool_free(MemPool *mempool, MemBucket *obj);
 
+/*
+ * Magazine cache variant.  Each thread allocates and frees through its
+ * own MemCacheThread, which holds two magazines of object pointers and
+ * only goes to the shared depot to swap a whole magazine, so the common
+ * case touches no shared memory.  The depot keeps full and empty
+ * magazines on two lock free stacks.  Objects are handed out as plain
+ * pointers and are not cleared.
+ */
+#define MEMPOOL_CACHELINE    64    /* align option for objects one thread owns */
+#define MEMPOOL_MAG_SIZE     32    /* default objects per magazine */
+
+typedef struct _MemMagazine
+{
+    u_int32_t next;                /* depot stack link, index + 1 */
+    u_int32_t count;               /* objects in objs[] */
+    void *objs[1];                 /* mag_size of them */
+} MemMagazine;
+
+typedef struct _MemCacheThread
+{
+    struct _MemCache *cache;
+    MemMagazine *loaded;           /* alloc and free work on this one */
+    MemMagazine *previous;         /* always full or empty */
+
+    unsigned long allocs;
+    unsigned long frees;
+    unsigned long depot_gets;      /* full magazines taken from the depot */
+    unsigned long depot_puts;      /* full magazines given back */
+    unsigned long misses;          /* allocs that found the pool empty */
+    long outstanding;              /* allocs - frees, may go negative */
+    long hiwater;
+} MemCacheThread;
+
+typedef struct _MemCache
+{
+    void *objmem;                  /* raw blocks, for free() */
+    void *magmem;
+    void *threadmem;
+
+    char *objects;
+    size_t obj_size;
+    size_t stride;                 /* obj_size rounded up to the alignment */
+    PoolCount total;
+
+    char *magazines;
+    size_t mag_stride;
+    unsigned mag_size;
+    u_int32_t nmags;
+
+    MemCacheThread *threads;
+    size_t thread_stride;          /* keeps each thread on its own lines */
+    u_int32_t max_threads;
+
+    /* depot stack heads are (tag << 32 | index + 1), the tag stops ABA */
+    char pad0[MEMPOOL_CACHELINE];
+    volatile u_int64_t full;
+    char pad1[MEMPOOL_CACHELINE];
+    volatile u_int64_t empty;
+    char pad2[MEMPOOL_CACHELINE];
+
+    volatile u_int32_t nthreads;
+    volatile u_int32_t nfull;      /* non empty magazines in the depot */
+    u_int32_t full_hiwater;
+    u_int32_t full_lowater;
+} MemCache;
+
+int mempool_cache_init(MemCache *mc, PoolCount num_objects, size_t obj_size,
+                       unsigned mag_size, size_t align, unsigned max_threads);
+int mempool_cache_destroy(MemCache *mc);
+MemCacheThread *mempool_cache_thread(MemCache *mc);
+void mempool_cache_thread_release(MemCacheThread *t);
+void *mempool_cache_alloc(MemCacheThread *t);
+void mempool_cache_free(MemCacheThread *t, void *obj);
+void mempool_cache_stats(MemCache *mc, const char *name);
+
 #endif /* _MEMPOOL_H */
 
 
@@ -0,0 +1,227 @@
+/*
+** Copyright (C) 1998-2006 Martin Roesch <roesch@sourcefire.com>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/* shm_alert_reader.c
+ *
+ * Reference reader for the alert_shm ring.  It only needs this file and
+ * spo_alert_shm.h, not the rest of snort, so tools can copy both.
+ *
+ * Built with SHM_ALERT_READER_MAIN it is a small command line reader
+ * that prints alerts as they show up:
+ *
+ *   cc -DSHM_ALERT_READER_MAIN -o shm_alert_reader shm_alert_reader.c
+ *   ./shm_alert_reader [ring file]
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "spo_alert_shm.h"
+
+#define SHM_ALERT_SLOT(r, n) \
+    ((ShmAlertRecord *)((r)->slots + \
+        ((n) & ((r)->hdr->nslots - 1)) * (r)->hdr->record_size))
+
+/*
+ * Map a ring file and position the reader at the newest record, so only
+ * alerts raised from now on are returned.
+ *
+ * Returns 0 on success, -1 if the file is missing or not a ring.
+ */
+int ShmAlertOpen(ShmAlertReader *r, const char *path)
+{
+    struct stat st;
+
+    memset(r, 0, sizeof(ShmAlertReader));
+
+    if( (r->fd = open(path, O_RDONLY)) < 0 )
+        return -1;
+
+    if( fstat(r->fd, &st) || st.st_size < (off_t)sizeof(ShmAlertHeader) )
+    {
+        close(r->fd);
+        return -1;
+    }
+
+    r->len  = st.st_size;
+    r->base = mmap(NULL, r->len, PROT_READ, MAP_SHARED, r->fd, 0);
+
+    if( r->base == MAP_FAILED )
+    {
+        close(r->fd);
+        return -1;
+    }
+
+    r->hdr = (ShmAlertHeader *)r->base;
+
+    if( r->hdr->magic != SHM_ALERT_MAGIC ||
+        r->hdr->version != SHM_ALERT_VERSION ||
+        r->hdr->record_size < sizeof(ShmAlertRecord) ||
+        r->hdr->header_size + (size_t)r->hdr->nslots * r->hdr->record_size
+            > r->len )
+    {
+        ShmAlertClose(r);
+        return -1;
+    }
+
+    SHM_ALERT_BARRIER();
+
+    r->slots = (u_int8_t *)r->base + r->hdr->header_size;
+    r->next  = r->hdr->head;
+
+    return 0;
+}
+
+/*
+ * Copy out the next record.
+ *
+ * Returns 1 with a record, 0 when there is nothing new yet.  Records the
+ * writer overwrote before we got to them are skipped and counted in
+ * r->lost.
+ */
+int ShmAlertNext(ShmAlertReader *r, ShmAlertRecord *rec)
+{
+    ShmAlertRecord *slot;
+    u_int32_t head, seq;
+
+    for( ;; )
+    {
+        head = r->hdr->head;
+        SHM_ALERT_BARRIER();
+
+        if( r->next == head )
+            return 0;
+
+        /* more than a ring behind, jump to the oldest record still there */
+        if( head - r->next > r->hdr->nslots )
+        {
+            u_int32_t oldest = head - r->hdr->nslots;
+
+            r->lost += oldest - r->next;
+            r->next  = oldest ? oldest : 1;
+        }
+
+        slot = SHM_ALERT_SLOT(r, r->next);
+
+        seq = slot->seq;
+        SHM_ALERT_BARRIER();
+
+        if( seq == r->next )
+        {
+            memcpy(rec, (void *)slot, sizeof(ShmAlertRecord));
+            SHM_ALERT_BARRIER();
+
+            if( slot->seq == seq )
+            {
+                if( ++r->next == 0 )
+                    r->next = 1;
+
+                return 1;
+            }
+        }
+
+        /* the writer got to this slot first */
+        r->lost++;
+
+        if( ++r->next == 0 )
+            r->next = 1;
+    }
+}
+
+void ShmAlertClose(ShmAlertReader *r)
+{
+    if( r->base && r->base != MAP_FAILED )
+        munmap(r->base, r->len);
+
+    if( r->fd >= 0 )
+        close(r->fd);
+
+    r->base = NULL;
+    r->hdr  = NULL;
+    r->fd   = -1;
+}
+
+#ifdef SHM_ALERT_READER_MAIN
+static void print_ip(u_int32_t ip)
+{
+    printf("%u.%u.%u.%u", ip >> 24, (ip >> 16) & 0xff, (ip >> 8) & 0xff,
+           ip & 0xff);
+}
+
+int main( int argc, char ** argv )
+{
+    ShmAlertReader r;
+    ShmAlertRecord rec;
+    unsigned long  lost = 0;
+    const char   * path = argc > 1 ? argv[1] : SHM_ALERT_FILE;
+
+    if( ShmAlertOpen(&r, path) )
+    {
+        fprintf(stderr, "%s: not an alert_shm ring\n", path);
+        return 1;
+    }
+
+    printf("%s: %u slots, writer pid %u\n", path, r.hdr->nslots, r.hdr->pid);
+
+    for( ;; )
+    {
+        if( !ShmAlertNext(&r, &rec) )
+        {
+            if( r.hdr->flags & SHM_ALERT_CLOSED )
+                break;
+
+            usleep(1000);
+            continue;
+        }
+
+        if( r.lost != lost )
+        {
+            printf("*** %lu records lost\n", r.lost - lost);
+            lost = r.lost;
+        }
+
+        printf("%u.%06u [**] [%u:%u:%u] %s [**] [Priority: %u] ",
+               rec.ts_sec, rec.ts_usec, rec.sig_generator, rec.sig_id,
+               rec.sig_rev, rec.msg, rec.priority);
+
+        if( rec.flags & SHM_ALERT_NOPACKET )
+        {
+            printf("\n");
+            continue;
+        }
+
+        printf("{%u} ", rec.protocol);
+        print_ip(rec.sip);
+        printf(":%u -> ", rec.sp);
+        print_ip(rec.dip);
+        printf(":%u (%u bytes)\n", rec.dp, rec.pktlen);
+    }
+
+    printf("%s: closed, %lu records lost\n", path, r.lost);
+
+    ShmAlertClose(&r);
+
+    return 0;
+}
+#endif
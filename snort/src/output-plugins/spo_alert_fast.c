@@ -69,6 +69,8 @@
 typedef struct _SpoAlertFastData
 {
     FILE *file;
+    SF_TEXTBUF *tb;
+    SFTB_CACHE *cache;
     u_int8_t packet_flag;
 } SpoAlertFastData;
 
@@ -76,7 +78,9 @@ void AlertFastInit(u_char *);
 SpoAlertFastData *ParseAlertFastArgs(char *);
 void AlertFastCleanExitFunc(int, void *);
 void AlertFastRestartFunc(int, void *);
+void AlertFastIdle(int, void *);
 void AlertFast(Packet *, char *, void *, Event *);
+static void AlertFastOpen(SpoAlertFastData *);
 
 
 
@@ -129,85 +133,59 @@ void AlertFastInit(u_char *args)
     AddFuncToOutputList(AlertFast, NT_OUTPUT_ALERT, data);
     AddFuncToCleanExitList(AlertFastCleanExitFunc, data);
     AddFuncToRestartList(AlertFastRestartFunc, data);
+
+    if(data->tb->flush_secs)
+        AddFuncToIdleList(AlertFastIdle, data);
 }
 
 void AlertFast(Packet *p, char *msg, void *arg, Event *event)
 {
-    char timestamp[TIMEBUF_SIZE];
     SpoAlertFastData *data = (SpoAlertFastData *)arg;
-
-    bzero((char *) timestamp, TIMEBUF_SIZE);
-    ts_print(p == NULL ? NULL : (struct timeval *) & p->pkth->ts, timestamp);
+    SF_TEXTBUF *tb = data->tb;
 
     /* dump the timestamp */
-    fwrite(timestamp, strlen(timestamp), 1, data->file);
-
+    TextBufTimestamp(tb, p);
 
     if(msg != NULL)
     {
-        fwrite(" [**] ", 6, 1, data->file);
-
-        if(event != NULL)
-        {
-            fprintf(data->file, "[%lu:%lu:%lu] ",
-                    (unsigned long) event->sig_generator,
-                    (unsigned long) event->sig_id,
-                    (unsigned long) event->sig_rev);
-        }
-
-        if(pv.alert_interface_flag)
-        {
-            fprintf(data->file, " <%s> ", PRINT_INTERFACE(pv.interface));
-            fwrite(msg, strlen(msg), 1, data->file);
-        }
-        else
-        {
-            fwrite(msg, strlen(msg), 1, data->file);
-        }
-
-        fwrite(" [**] ", 6, 1, data->file);
+        TextBufMessage(tb, data->cache, msg, event, " [**] ", " [**] ");
     }
 
     /* print the packet header to the alert file */
     if(p && p->iph)
     {
-        PrintPriorityData(data->file, 0);
-
-        fprintf(data->file, "{%s} ", protocol_names[p->iph->ip_proto]);
+        TextBufPriorityData(tb, 0);
 
+        sftb_putc(tb, '{');
+        sftb_puts(tb, protocol_names[p->iph->ip_proto]);
+        sftb_write(tb, "} ", 2);
 
+        /* port information only for unfragmented tcp and udp */
+        sftb_putip(tb, p->iph->ip_src.s_addr);
 
-        if(p->frag_flag)
+        if(!p->frag_flag && (p->iph->ip_proto == IPPROTO_TCP ||
+                             p->iph->ip_proto == IPPROTO_UDP))
         {
-            /* just print the straight IP header */
-            fputs(inet_ntoa(p->iph->ip_src), data->file);
-            fwrite(" -> ", 4, 1, data->file);
-            fputs(inet_ntoa(p->iph->ip_dst), data->file);
+            sftb_putc(tb, ':');
+            sftb_putu(tb, p->sp);
         }
-        else
+
+        sftb_write(tb, " -> ", 4);
+        sftb_putip(tb, p->iph->ip_dst.s_addr);
+
+        if(!p->frag_flag && (p->iph->ip_proto == IPPROTO_TCP ||
+                             p->iph->ip_proto == IPPROTO_UDP))
         {
-            switch(p->iph->ip_proto)
-            {
-                case IPPROTO_UDP:
-                case IPPROTO_TCP:
-                    /* print the header complete with port information */
-                    fputs(inet_ntoa(p->iph->ip_src), data->file);
-                    fprintf(data->file, ":%d -> ", p->sp);
-                    fputs(inet_ntoa(p->iph->ip_dst), data->file);
-                    fprintf(data->file, ":%d", p->dp);
-                    break;
-                case IPPROTO_ICMP:
-                default:
-                    /* just print the straight IP header */
-                    fputs(inet_ntoa(p->iph->ip_src), data->file);
-                    fwrite(" -> ", 4, 1, data->file);
-                    fputs(inet_ntoa(p->iph->ip_dst), data->file);
-            }
+            sftb_putc(tb, ':');
+            sftb_putu(tb, p->dp);
         }
     }               /* end of if (p) */
     if(p && data->packet_flag)
     {
-        fputc('\n', data->file);
+        sftb_putc(tb, '\n');
+
+        /* the packet dump goes straight to the file */
+        sftb_drain(tb);
 
         if(p->iph)
             PrintIPPkt(data->file, p->iph->ip_proto, p);
@@ -215,12 +193,33 @@ void AlertFast(Packet *p, char *msg, void *arg, Event *event)
             PrintArpHeader(data->file, p);
     }
 
-    fputc('\n', data->file);
+    sftb_putc(tb, '\n');
 
-    fflush(data->file);
+    sftb_end(tb);
     return;
 }
 
+/*
+ * Function: AlertFastOpen(SpoAlertFastData *)
+ *
+ * Purpose: Sets up the text buffer for the alert file.  Alerts on stdout
+ *          are written as they come, a file is written when 64K of alerts
+ *          are waiting or the oldest one is a second old.
+ *
+ * Arguments: data => plugin data with the file opened
+ *
+ * Returns: void function
+ *
+ */
+static void AlertFastOpen(SpoAlertFastData *data)
+{
+    data->tb = sftb_new(data->file, 0, data->file == stdout ? 0 : -1);
+    data->cache = sftb_cache_new(0);
+
+    if(data->tb == NULL)
+        FatalError("alert_fast: unable to allocate the output buffer\n");
+}
+
 /*
  * Function: ParseAlertFastArgs(char *)
  *
@@ -246,6 +245,7 @@ SpoAlertFastData *ParseAlertFastArgs(char *args)
     if(args == NULL)
     {
         data->file = OpenAlertFile(NULL);
+        AlertFastOpen(data);
         return data;
     }
 
@@ -274,14 +274,36 @@ SpoAlertFastData *ParseAlertFastArgs(char *args)
     /* free toks */
     mSplitFree(&toks, num_toks);
 
+    AlertFastOpen(data);
+
     return data;
 }
 
+/*
+ * Function: AlertFastIdle(int, void *)
+ *
+ * Purpose: Write out buffered alerts that have waited flush_secs, so the
+ *          last ones before a quiet spell still reach the file
+ *
+ * Arguments: when => IDLE_BATCH_END or IDLE_PACKET
+ *            arg => data ptr to reference this plugin's data
+ *
+ * Returns: void function
+ */
+void AlertFastIdle(int when, void *arg)
+{
+    SpoAlertFastData *data = (SpoAlertFastData *)arg;
+
+    sftb_age(data->tb);
+}
+
 void AlertFastCleanExitFunc(int signal, void *arg)
 {
     SpoAlertFastData *data = (SpoAlertFastData *)arg;
     /* close alert file */
     DEBUG_WRAP(DebugMessage(DEBUG_LOG,"AlertFastCleanExitFunc\n"););
+    sftb_free(data->tb);
+    sftb_cache_free(data->cache);
     fclose(data->file);
     /*free memory from SpoAlertFastData */
     free(data);
@@ -292,6 +314,8 @@ void AlertFastRestartFunc(int signal, void *arg)
     SpoAlertFastData *data = (SpoAlertFastData *)arg;
     /* close alert file */
     DEBUG_WRAP(DebugMessage(DEBUG_LOG,"AlertFastRestartFunc\n"););
+    sftb_free(data->tb);
+    sftb_cache_free(data->cache);
     fclose(data->file);
     /*free memory from SpoAlertFastData */
     free(data);
@@ -60,6 +60,8 @@
 typedef struct _SpoAlertFullData
 {
     FILE *file;
+    SF_TEXTBUF *tb;
+    SFTB_CACHE *cache;
 } SpoAlertFullData;
 
 void AlertFullInit(u_char *);
@@ -67,6 +69,8 @@ SpoAlertFullData *ParseAlertFullArgs(char *);
 void AlertFull(Packet *, char *, void *, Event *);
 void AlertFullCleanExit(int, void *);
 void AlertFullRestart(int, void *);
+void AlertFullIdle(int, void *);
+static void AlertFullOpen(SpoAlertFullData *);
 
 
 /*
@@ -117,56 +121,40 @@ void AlertFullInit(u_char *args)
     AddFuncToOutputList(AlertFull, NT_OUTPUT_ALERT, data);
     AddFuncToCleanExitList(AlertFullCleanExit, data);
     AddFuncToRestartList(AlertFullRestart, data);
+
+    if(data->tb->flush_secs)
+        AddFuncToIdleList(AlertFullIdle, data);
 }
 
 void AlertFull(Packet *p, char *msg, void *arg, Event *event)
 {
-    char timestamp[TIMEBUF_SIZE];
     SpoAlertFullData *data = (SpoAlertFullData *)arg;
+    SF_TEXTBUF *tb = data->tb;
 
     if(msg != NULL)
     {
-        fwrite("[**] ", 5, 1, data->file);
-
-        if(event != NULL)
-        {
-                fprintf(data->file, "[%lu:%lu:%lu] ",
-                        (unsigned long) event->sig_generator,
-                        (unsigned long) event->sig_id,
-                        (unsigned long) event->sig_rev);
-        }
-
-        if(pv.alert_interface_flag)
-        {
-            fprintf(data->file, " <%s> ", PRINT_INTERFACE(pv.interface));
-            fwrite(msg, strlen(msg), 1, data->file);
-            fwrite(" [**]\n", 6, 1, data->file);
-        }
-        else
-        {
-            fwrite(msg, strlen(msg), 1, data->file);
-            fwrite(" [**]\n", 6, 1, data->file);
-        }
+        TextBufMessage(tb, data->cache, msg, event, "[**] ", " [**]\n");
     }
     else
     {
-        fwrite("[**] Snort Alert! [**]\n", 23, 1, data->file);
+        sftb_write(tb, "[**] Snort Alert! [**]\n", 23);
     }
 
     if(p && p->iph)
     {
-        PrintPriorityData(data->file, 1);
+        TextBufPriorityData(tb, 1);
     }
 
     DEBUG_WRAP(DebugMessage(DEBUG_LOG, "Logging Alert data!\n"););
 
-    bzero((char *) timestamp, TIMEBUF_SIZE);
-    ts_print(p == NULL ? NULL : (struct timeval *) & p->pkth->ts, timestamp);
-
     /* dump the timestamp */
-    fwrite(timestamp, strlen(timestamp), 1, data->file);
+    TextBufTimestamp(tb, p);
+
     if(p && p->iph)
     {
+        /* the header printers write straight to the file */
+        sftb_drain(tb);
+
         /* print the packet header to the alert file */
 
         if(pv.show2hdr_flag)
@@ -200,18 +188,34 @@ void AlertFull(Packet *p, char *msg, void *arg, Event *event)
             PrintXrefs(data->file, 1);
         }
 
-        fputc('\n', data->file);
+        sftb_putc(tb, '\n');
     } /* End of if(p) */
     else
     {
-        fputs("\n\n", data->file);
+        sftb_write(tb, "\n\n", 2);
     }
 
-    fflush(data->file);
+    sftb_end(tb);
     return;
- 
+}
 
+/*
+ * Function: AlertFullOpen(SpoAlertFullData *)
+ *
+ * Purpose: Sets up the text buffer for the alert file, see AlertFastOpen()
+ *
+ * Arguments: data => plugin data with the file opened
+ *
+ * Returns: void function
+ *
+ */
+static void AlertFullOpen(SpoAlertFullData *data)
+{
+    data->tb = sftb_new(data->file, 0, data->file == stdout ? 0 : -1);
+    data->cache = sftb_cache_new(0);
 
+    if(data->tb == NULL)
+        FatalError("alert_full: unable to allocate the output buffer\n");
 }
 
 
@@ -239,6 +243,7 @@ SpoAlertFullData *ParseAlertFullArgs(char *args)
     if(args == NULL)
     {
         data->file = OpenAlertFile(NULL);
+        AlertFullOpen(data);
         return data;
     }
     DEBUG_WRAP(DebugMessage(DEBUG_LOG,"ParseAlertFullArgs: %s\n", args););
@@ -253,14 +258,35 @@ SpoAlertFullData *ParseAlertFullArgs(char *args)
         free(filename);
     }
     mSplitFree(&toks, num_toks);
+    AlertFullOpen(data);
     return data;
 }
 
+/*
+ * Function: AlertFullIdle(int, void *)
+ *
+ * Purpose: Write out buffered alerts that have waited flush_secs, so the
+ *          last ones before a quiet spell still reach the file
+ *
+ * Arguments: when => IDLE_BATCH_END or IDLE_PACKET
+ *            arg => data ptr to reference this plugin's data
+ *
+ * Returns: void function
+ */
+void AlertFullIdle(int when, void *arg)
+{
+    SpoAlertFullData *data = (SpoAlertFullData *)arg;
+
+    sftb_age(data->tb);
+}
+
 void AlertFullCleanExit(int signal, void *arg)
 {
     SpoAlertFullData *data = (SpoAlertFullData *)arg;
     /* close alert file */
     DEBUG_WRAP(DebugMessage(DEBUG_LOG,"AlertFullCleanExit\n"););
+    sftb_free(data->tb);
+    sftb_cache_free(data->cache);
     fclose(data->file);
     /* free memory from SpoAlertFullData */
     free(data);
@@ -271,6 +297,8 @@ void AlertFullRestart(int signal, void *arg)
     SpoAlertFullData *data = (SpoAlertFullData *)arg;
     /* close alert file */
     DEBUG_WRAP(DebugMessage(DEBUG_LOG,"AlertFullRestart\n"););
+    sftb_free(data->tb);
+    sftb_cache_free(data->cache);
     fclose(data->file);
     /* free memory from SpoAlertFullData */
     free(data);
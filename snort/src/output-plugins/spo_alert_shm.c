@@ -0,0 +1,445 @@
+/*
+** Copyright (C) 1998-2006 Martin Roesch <roesch@sourcefire.com>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/* spo_alert_shm
+ *
+ * Purpose:  output plugin that publishes alerts into a shared memory ring
+ *
+ * Arguments:  file <path>    ring file (default /dev/shm/snort_alert)
+ *             slots <n>      records in the ring, rounded up to a power
+ *                            of two (default 4096)
+ *
+ * Effect:
+ *
+ * Every alert is copied into the next slot of a memory mapped ring file
+ * that local tools map and read directly, see spo_alert_shm.h for the
+ * layout.  Snort never waits on a reader and makes no system calls per
+ * alert; a reader that falls more than a ring behind loses records and
+ * can tell from the sequence numbers.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <ctype.h>
+#ifdef HAVE_STRINGS_H
+#include <strings.h>
+#endif
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "event.h"
+#include "decode.h"
+#include "plugbase.h"
+#include "spo_plugbase.h"
+#include "parser.h"
+#include "debug.h"
+#include "mstring.h"
+#include "util.h"
+
+#include "snort.h"
+#include "spo_alert_shm.h"
+
+/*
+ * Win32 has no mmap of a named file the way we use it here.
+ */
+#ifndef WIN32
+
+#define SHM_ALERT_SLOTS_MAX   (1 << 20)
+
+typedef struct _SpoAlertShmData
+{
+    char           * filename;
+    u_int32_t        nslots;
+    u_int32_t        record_size;
+    size_t           len;
+    void           * base;
+    ShmAlertHeader * hdr;
+    u_int8_t       * slots;
+
+} SpoAlertShmData;
+
+static void AlertShmInit(u_char *);
+static SpoAlertShmData *ParseAlertShmArgs(char *);
+static void OpenAlertShm(SpoAlertShmData *);
+static void AlertShm(Packet *, char *, void *, Event *);
+static void AlertShmCleanExit(int, void *);
+static void AlertShmRestart(int, void *);
+static void CloseAlertShm(SpoAlertShmData *);
+
+/*
+ * Function: AlertShmSetup()
+ *
+ * Purpose: Registers the output plugin keyword and initialization
+ *          function into the output plugin list.  This is the function that
+ *          gets called from InitOutputPlugins() in plugbase.c.
+ *
+ * Arguments: None.
+ *
+ * Returns: void function
+ *
+ */
+void AlertShmSetup(void)
+{
+    RegisterOutputPlugin("alert_shm", NT_OUTPUT_ALERT, AlertShmInit);
+    DEBUG_WRAP(DebugMessage(DEBUG_INIT, "Output plugin: AlertShm is setup...\n"););
+}
+
+/*
+ * Function: AlertShmInit(u_char *)
+ *
+ * Purpose: Calls the argument parsing function, maps the ring and links
+ *          the alert function into the function list.
+ *
+ * Arguments: args => ptr to argument string
+ *
+ * Returns: void function
+ *
+ */
+static void AlertShmInit(u_char *args)
+{
+    SpoAlertShmData *data;
+
+    DEBUG_WRAP(DebugMessage(DEBUG_INIT,"Output: AlertShm Initialized\n"););
+
+    pv.alert_plugin_active = 1;
+
+    data = ParseAlertShmArgs((char *)args);
+
+    OpenAlertShm(data);
+
+    AddFuncToOutputList(AlertShm, NT_OUTPUT_ALERT, data);
+    AddFuncToCleanExitList(AlertShmCleanExit, data);
+    AddFuncToRestartList(AlertShmRestart, data);
+}
+
+/*
+ * Function: ParseAlertShmArgs(char *)
+ *
+ * Purpose: Process the plugin arguments from the rules file
+ *
+ * Arguments: args => argument list
+ *
+ * Returns: the plugin's reference data struct
+ */
+static SpoAlertShmData *ParseAlertShmArgs(char *args)
+{
+    SpoAlertShmData *data;
+    int slots = SHM_ALERT_SLOTS;
+
+    DEBUG_WRAP(DebugMessage(DEBUG_LOG,"ParseAlertShmArgs: %s\n", args););
+
+    data = (SpoAlertShmData *)SnortAlloc(sizeof(SpoAlertShmData));
+
+    if(args != NULL)
+    {
+        char **toks;
+        int num_toks;
+        int i;
+
+        toks = mSplit(args, ",", 31, &num_toks, '\\');
+
+        for(i = 0; i < num_toks; i++)
+        {
+            char **stoks;
+            int num_stoks;
+            char *index = toks[i];
+
+            while(isspace((int)*index))
+                ++index;
+
+            stoks = mSplit(index, " ", 2, &num_stoks, 0);
+
+            if(num_stoks > 1 && !strcasecmp("file", stoks[0]) &&
+               data->filename == NULL)
+            {
+                data->filename = strdup(stoks[1]);
+            }
+            else if(num_stoks > 1 && !strcasecmp("slots", stoks[0]))
+            {
+                slots = atoi(stoks[1]);
+            }
+            else
+            {
+                FatalError("%s(%i) => Invalid alert_shm argument: %s\n",
+                           file_name, file_line, index);
+            }
+
+            mSplitFree(&stoks, num_stoks);
+        }
+
+        mSplitFree(&toks, num_toks);
+    }
+
+    if(data->filename == NULL)
+        data->filename = strdup(SHM_ALERT_FILE);
+
+    if(data->filename == NULL)
+        FatalError("Unable to allocate alert_shm file name\n");
+
+    if(slots < 2 || slots > SHM_ALERT_SLOTS_MAX)
+    {
+        FatalError("%s(%i) => alert_shm slots must be between 2 and %d\n",
+                   file_name, file_line, SHM_ALERT_SLOTS_MAX);
+    }
+
+    for(data->nslots = 2; data->nslots < (u_int32_t)slots; data->nslots <<= 1)
+        ;
+
+    /* keep each slot on its own cache lines */
+    data->record_size = (sizeof(ShmAlertRecord) + 63) & ~63;
+
+    return data;
+}
+
+/*
+ * Function: OpenAlertShm(SpoAlertShmData *)
+ *
+ * Purpose: Create and map a fresh ring file.  An old file is unlinked
+ *          rather than truncated so readers still mapping it don't fault.
+ *
+ * Arguments: data => the plugin's reference data struct
+ *
+ * Returns: void function
+ */
+static void OpenAlertShm(SpoAlertShmData *data)
+{
+    ShmAlertHeader *hdr;
+    int fd;
+
+    data->len = sizeof(ShmAlertHeader) +
+                (size_t)data->nslots * data->record_size;
+
+    unlink(data->filename);
+
+    if((fd = open(data->filename, O_RDWR | O_CREAT | O_EXCL, 0640)) < 0)
+    {
+        FatalError("alert_shm: unable to create %s: %s\n",
+                   data->filename, strerror(errno));
+    }
+
+    if(ftruncate(fd, data->len) < 0)
+    {
+        FatalError("alert_shm: unable to size %s: %s\n",
+                   data->filename, strerror(errno));
+    }
+
+    data->base = mmap(NULL, data->len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd, 0);
+
+    if(data->base == MAP_FAILED)
+    {
+        FatalError("alert_shm: unable to map %s: %s\n",
+                   data->filename, strerror(errno));
+    }
+
+    /* the mapping stays valid after the descriptor is gone */
+    close(fd);
+
+    hdr = data->hdr = (ShmAlertHeader *)data->base;
+    data->slots = (u_int8_t *)data->base + sizeof(ShmAlertHeader);
+
+    hdr->version = SHM_ALERT_VERSION;
+    hdr->header_size = sizeof(ShmAlertHeader);
+    hdr->record_size = data->record_size;
+    hdr->nslots = data->nslots;
+    hdr->pid = (u_int32_t)getpid();
+    hdr->flags = 0;
+    hdr->head = 1;
+
+    /* readers check the magic last */
+    SHM_ALERT_BARRIER();
+    hdr->magic = SHM_ALERT_MAGIC;
+
+    LogMessage("alert_shm: %u slots of %u bytes in %s\n",
+               data->nslots, data->record_size, data->filename);
+}
+
+/*
+ * Function: AlertShm(Packet *, char *, void *, Event *)
+ *
+ * Purpose: Copy the alert into the next slot and publish it
+ *
+ * Arguments: p => pointer to the packet data struct
+ *            msg => the message to print in the alert
+ *            arg => the plugin's reference data struct
+ *            event => the event
+ *
+ * Returns: void function
+ */
+static void AlertShm(Packet *p, char *msg, void *arg, Event *event)
+{
+    SpoAlertShmData *data = (SpoAlertShmData *)arg;
+    ShmAlertHeader *hdr = data->hdr;
+    ShmAlertRecord *rec;
+    u_int32_t seq = hdr->head;
+
+    DEBUG_WRAP(DebugMessage(DEBUG_LOG, "Logging Alert data!\n"););
+
+    rec = (ShmAlertRecord *)
+          (data->slots + (seq & (data->nslots - 1)) * data->record_size);
+
+    /* take the slot away from readers before touching it */
+    rec->seq = 0;
+    SHM_ALERT_BARRIER();
+
+    /* only the fixed part, pkt[] and payload[] go by caplen and dsize */
+    memset((char *)rec + sizeof(rec->seq), 0,
+           offsetof(ShmAlertRecord, pkt) - sizeof(rec->seq));
+
+    if(event)
+    {
+        rec->sig_generator = event->sig_generator;
+        rec->sig_id = event->sig_id;
+        rec->sig_rev = event->sig_rev;
+        rec->classification = event->classification;
+        rec->priority = event->priority;
+        rec->event_id = event->event_id;
+        rec->event_reference = event->event_reference;
+        rec->ref_sec = event->ref_time.tv_sec;
+        rec->ref_usec = event->ref_time.tv_usec;
+    }
+
+    if(msg)
+        strlcpy(rec->msg, msg, SHM_ALERT_MSGLEN);
+
+    if(p && p->pkt && p->pkth)
+    {
+        rec->ts_sec = p->pkth->ts.tv_sec;
+        rec->ts_usec = p->pkth->ts.tv_usec;
+        rec->packet_flags = p->packet_flags;
+        rec->pktlen = p->pkth->len;
+        rec->caplen = p->pkth->caplen > SHM_ALERT_SNAPLEN ?
+                      SHM_ALERT_SNAPLEN : p->pkth->caplen;
+
+        memcpy(rec->pkt, p->pkt, rec->caplen);
+
+        if(p->eh)
+            rec->dlthdr = (u_int8_t *)p->eh - p->pkt;
+
+        if(p->iph)
+        {
+            rec->nethdr = (u_int8_t *)p->iph - p->pkt;
+            rec->sip = ntohl(p->iph->ip_src.s_addr);
+            rec->dip = ntohl(p->iph->ip_dst.s_addr);
+            rec->protocol = p->iph->ip_proto;
+
+            switch(p->iph->ip_proto)
+            {
+                case IPPROTO_TCP:
+                    if(p->tcph)
+                        rec->transhdr = (u_int8_t *)p->tcph - p->pkt;
+                    rec->sp = p->sp;
+                    rec->dp = p->dp;
+                    break;
+
+                case IPPROTO_UDP:
+                    if(p->udph)
+                        rec->transhdr = (u_int8_t *)p->udph - p->pkt;
+                    rec->sp = p->sp;
+                    rec->dp = p->dp;
+                    break;
+
+                case IPPROTO_ICMP:
+                    if(p->icmph)
+                    {
+                        rec->transhdr = (u_int8_t *)p->icmph - p->pkt;
+                        rec->sp = p->icmph->type;
+                        rec->dp = p->icmph->code;
+                    }
+                    break;
+
+                default:
+                    rec->flags |= SHM_ALERT_NOTRANS;
+                    break;
+            }
+        }
+
+        /* reassembled and decoded payloads live outside the packet */
+        if(p->data && p->data >= p->pkt &&
+           p->data < p->pkt + p->pkth->caplen)
+            rec->data = p->data - p->pkt;
+        else
+            rec->flags |= SHM_ALERT_NODATA;
+
+        if(p->data && p->dsize)
+        {
+            rec->dsize = p->dsize > SHM_ALERT_SNAPLEN ?
+                         SHM_ALERT_SNAPLEN : p->dsize;
+
+            memcpy(rec->payload, p->data, rec->dsize);
+        }
+    }
+    else
+    {
+        rec->flags |= SHM_ALERT_NOPACKET;
+    }
+
+    SHM_ALERT_BARRIER();
+    rec->seq = seq;
+
+    if(++seq == 0)
+        seq = 1;
+
+    SHM_ALERT_BARRIER();
+    hdr->head = seq;
+}
+
+/*
+ * Function: CloseAlertShm(SpoAlertShmData *)
+ *
+ * Purpose: Tell readers the ring is done and unmap it.  The file is
+ *          left in place so readers can drain what is left.
+ *
+ * Arguments: data => the plugin's reference data struct
+ *
+ * Returns: void function
+ */
+static void CloseAlertShm(SpoAlertShmData *data)
+{
+    if(data->base != NULL)
+    {
+        data->hdr->flags |= SHM_ALERT_CLOSED;
+        munmap(data->base, data->len);
+    }
+
+    free(data->filename);
+    free(data);
+}
+
+static void AlertShmCleanExit(int signal, void *arg)
+{
+    DEBUG_WRAP(DebugMessage(DEBUG_LOG,"AlertShmCleanExit\n"););
+    CloseAlertShm((SpoAlertShmData *)arg);
+}
+
+static void AlertShmRestart(int signal, void *arg)
+{
+    DEBUG_WRAP(DebugMessage(DEBUG_LOG,"AlertShmRestart\n"););
+    CloseAlertShm((SpoAlertShmData *)arg);
+}
+
+#endif /* !WIN32 */
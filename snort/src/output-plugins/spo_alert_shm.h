@@ -0,0 +1,141 @@
+/*
+** Copyright (C) 1998-2006 Martin Roesch <roesch@sourcefire.com>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/* spo_alert_shm.h
+ *
+ * Layout of the shared memory alert ring written by alert_shm.
+ *
+ * The ring file starts with a ShmAlertHeader followed by nslots fixed
+ * size ShmAlertRecord slots.  Snort is the only writer; any number of
+ * local readers may map the file read only.  Record n lives in slot
+ * (n & (nslots - 1)).  While a slot is rewritten its seq is 0, once the
+ * record is complete seq holds n and only then does head move past it.
+ * A reader copies the slot and checks seq again afterwards, if it
+ * changed the writer lapped the reader and the record is lost.
+ * Sequence numbers skip 0 when they wrap.
+ *
+ * Everything is in host byte order, addresses and ports included.
+ *
+ * This header does not depend on the rest of snort so that readers can
+ * use it as is, see shm_alert_reader.c for the reference reader.
+ */
+
+#ifndef __SPO_ALERT_SHM_H__
+#define __SPO_ALERT_SHM_H__
+
+#include <sys/types.h>
+
+#define SHM_ALERT_MAGIC     0x53484d41  /* "SHMA" */
+#define SHM_ALERT_VERSION   2
+
+#define SHM_ALERT_FILE      "/dev/shm/snort_alert"
+#define SHM_ALERT_SLOTS     4096
+
+#define SHM_ALERT_MSGLEN    256
+#define SHM_ALERT_SNAPLEN   1600
+
+/* header flags */
+#define SHM_ALERT_CLOSED    0x1         /* snort has shut the ring down */
+
+/* record flags */
+#define SHM_ALERT_NOPACKET  0x1         /* no packet came with the event */
+#define SHM_ALERT_NOTRANS   0x2         /* no transport header offset */
+#define SHM_ALERT_NODATA    0x4         /* payload isn't in pkt[], data unset */
+
+#if defined(__GNUC__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1))
+#define SHM_ALERT_BARRIER()   __sync_synchronize()
+#elif defined(__GNUC__)
+#define SHM_ALERT_BARRIER()   __asm__ __volatile__("" ::: "memory")
+#else
+#define SHM_ALERT_BARRIER()
+#endif
+
+typedef struct _ShmAlertHeader
+{
+    u_int32_t magic;
+    u_int32_t version;
+    u_int32_t header_size;      /* offset of the first slot */
+    u_int32_t record_size;      /* size of one slot */
+    u_int32_t nslots;           /* power of two */
+    u_int32_t pid;              /* of the writing snort */
+    volatile u_int32_t flags;
+    volatile u_int32_t head;    /* sequence the next record will get */
+    u_int8_t  pad[32];
+
+} ShmAlertHeader;
+
+typedef struct _ShmAlertRecord
+{
+    volatile u_int32_t seq;     /* 0 while the slot is being written */
+
+    u_int32_t sig_generator;
+    u_int32_t sig_id;
+    u_int32_t sig_rev;
+    u_int32_t classification;
+    u_int32_t priority;
+    u_int32_t event_id;
+    u_int32_t event_reference;
+    u_int32_t ref_sec;
+    u_int32_t ref_usec;
+
+    u_int32_t ts_sec;           /* packet timestamp */
+    u_int32_t ts_usec;
+    u_int32_t sip;
+    u_int32_t dip;
+    u_int16_t sp;               /* icmp type for icmp */
+    u_int16_t dp;               /* icmp code for icmp */
+    u_int8_t  protocol;
+    u_int8_t  flags;
+    u_int16_t pad;
+
+    u_int32_t packet_flags;
+    u_int32_t pktlen;           /* length on the wire */
+    u_int32_t caplen;           /* bytes in pkt[] */
+    u_int32_t dlthdr;           /* header offsets into pkt[] */
+    u_int32_t nethdr;
+    u_int32_t transhdr;
+    u_int32_t data;
+    u_int32_t dsize;            /* bytes in payload[] */
+
+    char      msg[SHM_ALERT_MSGLEN];
+    u_int8_t  pkt[SHM_ALERT_SNAPLEN];
+    u_int8_t  payload[SHM_ALERT_SNAPLEN];   /* copied from p->data */
+
+} ShmAlertRecord;
+
+/* reference reader, see shm_alert_reader.c */
+typedef struct _ShmAlertReader
+{
+    int              fd;
+    void           * base;
+    size_t           len;
+    ShmAlertHeader * hdr;
+    u_int8_t       * slots;
+    u_int32_t        next;      /* sequence to read next */
+    unsigned long    lost;      /* records overwritten before we got them */
+
+} ShmAlertReader;
+
+int  ShmAlertOpen(ShmAlertReader *, const char *);
+int  ShmAlertNext(ShmAlertReader *, ShmAlertRecord *);
+void ShmAlertClose(ShmAlertReader *);
+
+void AlertShmSetup(void);
+
+#endif  /* __SPO_ALERT_SHM_H__ */
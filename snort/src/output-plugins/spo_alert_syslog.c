@@ -51,8 +51,13 @@
 
 #ifndef WIN32
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <netdb.h>
+#include <paths.h>
+#include <unistd.h>
+#include <errno.h>
 #endif /* !WIN32 */
 
 #include "decode.h"
@@ -64,14 +69,36 @@
 #include "parser.h"
 #include "mstring.h"
 #include "util.h"
+#include "sfmsgbatch.h"
 
 #include "snort.h"
 
+#define SYSLOG_BUF  1024
+#define SYSLOG_HDR  64      /* "<pri>Mmm dd hh:mm:ss snort[pid]: " */
+
+#ifndef _PATH_LOG
+#define _PATH_LOG   "/dev/log"
+#endif
+
 typedef struct _SyslogData
 {
     int facility;
     int priority;
     int options;
+
+    /*
+     * With "batch" or a host, messages are framed here the way syslog(3)
+     * frames them and sent on our own socket in batches.
+     */
+    int batch;              /* messages per batch, 0 to use syslog(3) */
+    char *host;             /* remote server, NULL for the local socket */
+    int port;
+    int sd;
+    SF_MSGBATCH *mb;
+
+    time_t hdr_time;        /* second the cached header was made for */
+    char hdr[SYSLOG_HDR];
+    int hdr_len;
 } SyslogData;
 
 void AlertSyslogInit(u_char *);
@@ -79,6 +106,10 @@ SyslogData *ParseSyslogArgs(char *);
 void AlertSyslog(Packet *, char *, void *, Event *);
 void AlertSyslogCleanExit(int, void *);
 void AlertSyslogRestart(int, void *);
+void AlertSyslogIdle(int, void *);
+static void SyslogOpenBatch(SyslogData *);
+static void SyslogCloseBatch(SyslogData *);
+static void SyslogSend(SyslogData *, char *);
 
 
 
@@ -129,12 +160,18 @@ void AlertSyslogInit(u_char *args)
 
     openlog("snort", data->options, data->facility);
 
+    if (data->batch)
+        SyslogOpenBatch(data);
+
     DEBUG_WRAP(DebugMessage(DEBUG_INIT,"Linking syslog alert function to call list...\n"););
 
     /* Set the preprocessor function into the function list */
     AddFuncToOutputList(AlertSyslog, NT_OUTPUT_ALERT, data);
     AddFuncToCleanExitList(AlertSyslogCleanExit, data);
     AddFuncToRestartList(AlertSyslogRestart, data);
+
+    if (data->mb != NULL)
+        AddFuncToIdleList(AlertSyslogIdle, data);
 }
 
 
@@ -156,12 +193,14 @@ SyslogData *ParseSyslogArgs(char *args)
 {
 #ifdef WIN32
     char *DEFAULT_SYSLOG_HOST = "127.0.0.1";
+#endif
     int   DEFAULT_SYSLOG_PORT = 514;
     char **config_toks;
     char **host_toks;
     char  *host_string = args;
     int num_config_toks, num_host_toks;
-#endif
+    char *host = NULL;
+    int port = 0;
     char **facility_toks;
     char  *facility_string = args;
     int num_facility_toks = 0;
@@ -190,26 +229,31 @@ SyslogData *ParseSyslogArgs(char *args)
     }
 
     /*
-     * NON-WIN32:  Config should be in the format:
-     *   output alert_syslog: LOG_AUTH LOG_ALERT
-     * 
-     * WIN32:  Config can be in any of these formats:
+     * Config can be in any of these formats:
      *   output alert_syslog: LOG_AUTH LOG_ALERT
      *   output alert_syslog: host=hostname, LOG_AUTH LOG_ALERT
      *   output alert_syslog: host=hostname:port, LOG_AUTH LOG_ALERT
+     *
+     * NON-WIN32:  "batch" or "batch=N" among the facilities/priorities
+     * sends up to N alerts (default 64) with one system call, to the host
+     * over UDP if there is one or else to the local syslog.  Without
+     * "batch" a host is ignored and alerts go to the local syslog.
+     *
+     * WIN32:  without a host alerts go to 127.0.0.1.
      */
 
-#ifdef WIN32
     /* split the host/port part from the facilities/priorities part */
     config_toks = mSplit(args, ",", 2, &num_config_toks, '\\');
     switch( num_config_toks )
     {
         case 1:  /* config consists of only facility/priority info */
+#ifdef WIN32
             LogMessage("alert_syslog output processor is defaulting to syslog "
                     "server on %s port %d!\n",
                     DEFAULT_SYSLOG_HOST, DEFAULT_SYSLOG_PORT);
             strncpy(pv.syslog_server, DEFAULT_SYSLOG_HOST, STD_BUF-1);
             pv.syslog_server_port = DEFAULT_SYSLOG_PORT;
+#endif
             facility_string = config_toks[0];
             break;
 
@@ -236,16 +280,16 @@ SyslogData *ParseSyslogArgs(char *args)
             switch(num_host_toks)
             {
                 case 2:  /* ie,  host=localhost (defaults to port 514) */
-                    strncpy(pv.syslog_server, host_toks[1], STD_BUF-1);
-                    pv.syslog_server_port = DEFAULT_SYSLOG_PORT;  /* default */
+                    host = strdup(host_toks[1]);
+                    port = DEFAULT_SYSLOG_PORT;  /* default */
                     break;
 
                 case 3:  /* ie.  host=localhost:514 */
-                    strncpy(pv.syslog_server, host_toks[1], STD_BUF-1);
-                    pv.syslog_server_port = atoi(host_toks[2]);
-                    if( pv.syslog_server_port == 0 )
+                    host = strdup(host_toks[1]);
+                    port = atoi(host_toks[2]);
+                    if( port == 0 )
                     {
-                        pv.syslog_server_port = DEFAULT_SYSLOG_PORT; /*default*/
+                        port = DEFAULT_SYSLOG_PORT; /*default*/
                         LogMessage("WARNING %s(%d) => alert_syslog port "
                                 "appears to be non-numeric ('%s').  Defaulting " 
                                 "to port %d!\n", file_name, file_line, 
@@ -267,11 +311,23 @@ SyslogData *ParseSyslogArgs(char *args)
                     file_name, file_line, args);
     }
 
+    if(host != NULL)
+    {
+#ifdef WIN32
+        strncpy(pv.syslog_server, host, STD_BUF-1);
+        pv.syslog_server_port = port;
+        free(host);
+#else
+        data->host = host;
+        data->port = port;
+#endif
+    }
+
+#ifdef WIN32
     DEBUG_WRAP(DebugMessage(DEBUG_INIT, "Logging alerts to syslog "
                 "server %s on port %d\n", pv.syslog_server, 
                 pv.syslog_server_port););
-    mSplitFree(&config_toks, num_facility_toks);
-#endif /* WIN32 */
+#endif
 
 
 
@@ -293,6 +349,18 @@ SyslogData *ParseSyslogArgs(char *args)
             tmp = facility_toks[i];
         }
 
+        if(!strncasecmp("batch", tmp, 5) && (tmp[5] == '\0' || tmp[5] == '='))
+        {
+            data->batch = tmp[5] == '=' ? atoi(tmp + 6) : SFMB_MAX_MSGS;
+
+            if(data->batch <= 0)
+            {
+                FatalError("%s(%d) => Invalid alert_syslog batch size: %s\n",
+                        file_name, file_line, tmp);
+            }
+        }
+        else
+
         /* possible openlog options */
 
 #ifdef LOG_CONS 
@@ -482,6 +550,22 @@ SyslogData *ParseSyslogArgs(char *args)
         }
     }
     mSplitFree(&facility_toks, num_facility_toks);
+    mSplitFree(&config_toks, num_config_toks);
+
+#ifdef WIN32
+    /* the win32 syslog() already sends to the server itself */
+    data->batch = 0;
+#else
+    /* syslog(3) cannot reach a remote server, only the batched sender can */
+    if(data->host != NULL && data->batch == 0)
+    {
+        LogMessage("WARNING %s (%d) => alert_syslog host %s is only used "
+                "with \"batch\", alerting to the local syslog\n",
+                file_name, file_line, data->host);
+        free(data->host);
+        data->host = NULL;
+    }
+#endif
 
     return data;
 }
@@ -508,7 +592,6 @@ void AlertSyslog(Packet *p, char *msg, void *arg, Event *event)
     char pri_data[STD_BUF];
     char ip_data[STD_BUF];
     char event_data[STD_BUF];
-#define SYSLOG_BUF  1024
     char event_string[SYSLOG_BUF];
     SyslogData *data = (SyslogData *)arg;
 
@@ -595,12 +678,12 @@ void AlertSyslog(Packet *p, char *msg, void *arg, Event *event)
 
         strlcat(event_string, ip_data, SYSLOG_BUF);
 
-        syslog(data->priority, "%s", event_string);
+        SyslogSend(data, event_string);
 
     }
     else  
     {
-        syslog(data->priority, "%s", msg == NULL ? "ALERT!" : msg);
+        SyslogSend(data, msg == NULL ? "ALERT!" : msg);
     }
 
     return;
@@ -608,10 +691,203 @@ void AlertSyslog(Packet *p, char *msg, void *arg, Event *event)
 }
 
 
+/*
+ * Function: SyslogOpenBatch(SyslogData *)
+ *
+ * Purpose: Open the socket batched alerts are sent on, the local syslog
+ *          socket or a UDP socket to the configured host.  If the local
+ *          socket cannot be reached alerts fall back to syslog(3).
+ *
+ * Arguments: data => pointer to the plugin's reference data struct
+ *
+ * Returns: void function
+ */
+static void SyslogOpenBatch(SyslogData *data)
+{
+#ifndef WIN32
+    struct sockaddr_un local;
+    struct sockaddr_in remote;
+    struct hostent *host_info;
+
+    if(data->host != NULL)
+    {
+        bzero((char *)&remote, sizeof(remote));
+        remote.sin_family = AF_INET;
+        remote.sin_port = htons((u_short)data->port);
+
+        if(!inet_aton(data->host, &remote.sin_addr))
+        {
+            if((host_info = gethostbyname(data->host)) == NULL)
+            {
+                FatalError("alert_syslog: unable to resolve %s\n", data->host);
+            }
+
+            bcopy(host_info->h_addr, (char *)&remote.sin_addr,
+                  sizeof(remote.sin_addr));
+        }
+
+        if((data->sd = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ||
+           connect(data->sd, (struct sockaddr *)&remote, sizeof(remote)) < 0)
+        {
+            FatalError("alert_syslog: unable to reach %s:%d: %s\n",
+                       data->host, data->port, strerror(errno));
+        }
+    }
+    else
+    {
+        bzero((char *)&local, sizeof(local));
+        local.sun_family = AF_UNIX;
+        strlcpy(local.sun_path, _PATH_LOG, sizeof(local.sun_path));
+
+        if((data->sd = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0)
+        {
+            FatalError("alert_syslog: socket() call failed: %s\n",
+                       strerror(errno));
+        }
+
+        if(connect(data->sd, (struct sockaddr *)&local, sizeof(local)) < 0)
+        {
+            ErrorMessage("alert_syslog: unable to connect to %s, not "
+                         "batching alerts: %s\n", _PATH_LOG, strerror(errno));
+            close(data->sd);
+            data->sd = -1;
+            data->batch = 0;
+            return;
+        }
+    }
+
+    data->mb = sfmb_new(data->sd, NULL, 0, SYSLOG_HDR + SYSLOG_BUF,
+                        data->batch, -1);
+
+    if(data->mb == NULL)
+    {
+        FatalError("alert_syslog: unable to allocate %d alert batch\n",
+                   data->batch);
+    }
+#endif
+}
+
+static void SyslogCloseBatch(SyslogData *data)
+{
+#ifndef WIN32
+    if(data->mb != NULL)
+    {
+        sfmb_flush(data->mb);
+
+        LogMessage("alert_syslog: %lu alerts sent in %lu calls, "
+                   "%lu dropped\n", data->mb->sent, data->mb->calls,
+                   data->mb->drops);
+
+        sfmb_free(data->mb);
+        data->mb = NULL;
+        close(data->sd);
+    }
+
+    if(data->host != NULL)
+    {
+        free(data->host);
+        data->host = NULL;
+    }
+#endif
+}
+
+/*
+ * Function: SyslogSend(SyslogData *, char *)
+ *
+ * Purpose: Log one alert message.  Batched messages get the same
+ *          "<pri>timestamp snort[pid]: " framing syslog(3) would have
+ *          given them and each one is sent as its own datagram.
+ *
+ * Arguments: data => pointer to the plugin's reference data struct
+ *            msg => the message text
+ *
+ * Returns: void function
+ */
+static void SyslogSend(SyslogData *data, char *msg)
+{
+#ifndef WIN32
+    char *slot;
+    time_t now;
+    int len;
+
+    if(data->mb == NULL)
+    {
+        syslog(data->priority, "%s", msg);
+        return;
+    }
+
+    /* the header only changes once a second, or when we daemonize */
+    now = time(NULL);
+
+    if(now != data->hdr_time)
+    {
+        char stamp[32];
+
+        strftime(stamp, sizeof(stamp), "%b %e %H:%M:%S", localtime(&now));
+
+        if(data->options & LOG_PID)
+            data->hdr_len = snprintf(data->hdr, SYSLOG_HDR, "<%d>%s snort[%d]: ",
+                    data->facility | data->priority, stamp, (int)getpid());
+        else
+            data->hdr_len = snprintf(data->hdr, SYSLOG_HDR, "<%d>%s snort: ",
+                    data->facility | data->priority, stamp);
+
+        if(data->hdr_len < 0 || data->hdr_len >= SYSLOG_HDR)
+            data->hdr_len = SYSLOG_HDR - 1;
+
+        data->hdr_time = now;
+    }
+
+    slot = (char *)sfmb_slot(data->mb);
+
+    memcpy(slot, data->hdr, data->hdr_len);
+    len = strlen(msg);
+
+    if(len > SYSLOG_BUF - 1)
+        len = SYSLOG_BUF - 1;
+
+    memcpy(slot + data->hdr_len, msg, len);
+
+#ifdef LOG_PERROR
+    if(data->options & LOG_PERROR)
+        fprintf(stderr, "snort: %.*s\n", len, msg);
+#endif
+
+    sfmb_commit(data->mb, data->hdr_len + len);
+#else
+    syslog(data->priority, "%s", msg);
+#endif
+}
+
+/*
+ * Function: AlertSyslogIdle(int, void *)
+ *
+ * Purpose: Send the alerts queued during the last packet batch, or
+ *          after a packet the ones that have waited long enough
+ *
+ * Arguments: when => IDLE_BATCH_END or IDLE_PACKET
+ *            arg => data ptr to reference this plugin's data
+ *
+ * Returns: void function
+ */
+void AlertSyslogIdle(int when, void *arg)
+{
+    SyslogData *data = (SyslogData *)arg;
+
+    if(data->mb == NULL)
+        return;
+
+    if(when == IDLE_PACKET)
+        sfmb_age(data->mb);
+    else if(data->mb->count)
+        sfmb_flush(data->mb);
+}
+
 void AlertSyslogCleanExit(int signal, void *arg)
 {
     SyslogData *data = (SyslogData *)arg;
     DEBUG_WRAP(DebugMessage(DEBUG_LOG, "AlertSyslogCleanExit\n"););
+    SyslogCloseBatch(data);
     /* free memory from SyslogData */
     free(data);
 }
@@ -620,6 +896,7 @@ void AlertSyslogRestart(int signal, void *arg)
 {
     SyslogData *data = (SyslogData *)arg;
     DEBUG_WRAP(DebugMessage(DEBUG_LOG, "AlertSyslogRestartFunc\n"););
+    SyslogCloseBatch(data);
     /* free memory from SyslogData */
     free(data);
 }
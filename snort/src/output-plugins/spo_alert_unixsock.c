@@ -50,6 +50,8 @@
 #include "parser.h"
 #include "debug.h"
 #include "util.h"
+#include "mstring.h"
+#include "sfmsgbatch.h"
 
 #include "snort.h"
 #include "spo_alert_unixsock.h"
@@ -76,6 +78,7 @@ typedef struct _SpoAlertUnixSockData
 
 
 static int alertsd;
+static SF_MSGBATCH *alertbatch;    /* NULL unless "batch" was given */
 #ifndef WIN32
 struct sockaddr_un alertaddr;
 #else
@@ -87,6 +90,7 @@ void AlertUnixSock(Packet *, char *, void *, Event *);
 void ParseAlertUnixSockArgs(char *);
 void AlertUnixSockCleanExit(int, void *);
 void AlertUnixSockRestart(int, void *);
+void AlertUnixSockIdle(int, void *);
 void OpenAlertSock(void);
 void CloseAlertSock(void);
 
@@ -138,6 +142,9 @@ void AlertUnixSockInit(u_char *args)
 
     AddFuncToCleanExitList(AlertUnixSockCleanExit, NULL);
     AddFuncToRestartList(AlertUnixSockRestart, NULL);
+
+    if(alertbatch != NULL)
+        AddFuncToIdleList(AlertUnixSockIdle, NULL);
 }
 
 
@@ -151,13 +158,52 @@ void AlertUnixSockInit(u_char *args)
  *
  * Arguments: args => argument list
  *
+ *            batch [N] - queue up to N alerts (default 64) and send them
+ *                        with one system call at the end of each packet
+ *                        batch, each alert is still its own datagram
+ *
  * Returns: void function
  */
 void ParseAlertUnixSockArgs(char *args)
 {
+    char **toks;
+    int num_toks;
+    int batch = 0;
+
     DEBUG_WRAP(DebugMessage(DEBUG_LOG,"ParseAlertUnixSockArgs: %s\n", args););
+
+    if(args != NULL)
+    {
+        toks = mSplit(args, " \t", 2, &num_toks, 0);
+
+        if(num_toks > 0)
+        {
+            if(strcasecmp("batch", toks[0]) != 0)
+                FatalError("%s(%d) => unknown alert_unixsock argument: %s\n",
+                           file_name, file_line, toks[0]);
+
+            batch = num_toks > 1 ? atoi(toks[1]) : SFMB_MAX_MSGS;
+
+            if(batch <= 0)
+                FatalError("%s(%d) => invalid alert_unixsock batch size: %s\n",
+                           file_name, file_line, toks[1]);
+        }
+
+        mSplitFree(&toks, num_toks);
+    }
+
     /* eventually we may support more than one socket */
     OpenAlertSock();
+
+    if(batch > 0)
+    {
+        alertbatch = sfmb_new(alertsd, (struct sockaddr *)&alertaddr,
+                              sizeof(alertaddr), sizeof(Alertpkt), batch, -1);
+
+        if(alertbatch == NULL)
+            FatalError("alert_unixsock: unable to allocate %d alert batch\n",
+                       batch);
+    }
 }
 
 /****************************************************************************
@@ -172,82 +218,93 @@ void ParseAlertUnixSockArgs(char *args)
  ***************************************************************************/
 void AlertUnixSock(Packet *p, char *msg, void *arg, Event *event)
 {
-    static Alertpkt alertpkt;
+    static Alertpkt single;
+    Alertpkt *alertpkt = &single;
 
     DEBUG_WRAP(DebugMessage(DEBUG_LOG, "Logging Alert data!\n"););
 
-    bzero((char *)&alertpkt,sizeof(alertpkt));
+    /* batched alerts are built right in the slot they are sent from */
+    if(alertbatch != NULL)
+        alertpkt = (Alertpkt *)sfmb_slot(alertbatch);
+
+    bzero((char *)alertpkt,sizeof(Alertpkt));
     if (event)
     {
-        bcopy((const void *)event,(void *)&alertpkt.event,sizeof(Event));
+        bcopy((const void *)event,(void *)&alertpkt->event,sizeof(Event));
     }
 
     if(p && p->pkt)
     {
-        bcopy((const void *)p->pkth,(void *)&alertpkt.pkth,sizeof(struct pcap_pkthdr));
-        bcopy((const void *)p->pkt,alertpkt.pkt,
-              alertpkt.pkth.caplen > SNAPLEN? SNAPLEN : alertpkt.pkth.caplen);
+        bcopy((const void *)p->pkth,(void *)&alertpkt->pkth,sizeof(struct pcap_pkthdr));
+        bcopy((const void *)p->pkt,alertpkt->pkt,
+              alertpkt->pkth.caplen > SNAPLEN? SNAPLEN : alertpkt->pkth.caplen);
     }
     else
-        alertpkt.val|=NOPACKET_STRUCT;
+        alertpkt->val|=NOPACKET_STRUCT;
 
     if (msg)
     {
-        bcopy((const void *)msg,(void *)alertpkt.alertmsg,
+        bcopy((const void *)msg,(void *)alertpkt->alertmsg,
                strlen(msg)>ALERTMSG_LENGTH-1 ? ALERTMSG_LENGTH - 1 : strlen(msg));
     }
 
     /* some data which will help monitoring utility to dissect packet */
-    if(!(alertpkt.val & NOPACKET_STRUCT))
+    if(!(alertpkt->val & NOPACKET_STRUCT))
     {
         if(p)
         {
             if (p->eh) 
             {
-                alertpkt.dlthdr=(char *)p->eh-(char *)p->pkt;
+                alertpkt->dlthdr=(char *)p->eh-(char *)p->pkt;
             }
     
             /* we don't log any headers besides eth yet */
             if (p->iph && p->pkt) 
             {
-                alertpkt.nethdr=(char *)p->iph-(char *)p->pkt;
+                alertpkt->nethdr=(char *)p->iph-(char *)p->pkt;
 	
                 switch(p->iph->ip_proto)
                 {
                     case IPPROTO_TCP:
                        if (p->tcph) 
                        {
-                           alertpkt.transhdr=(char *)p->tcph-(char *)p->pkt;
+                           alertpkt->transhdr=(char *)p->tcph-(char *)p->pkt;
                        }
                        break;
 		    
                     case IPPROTO_UDP:
                         if (p->udph) 
                         {
-                            alertpkt.transhdr=(char *)p->udph-(char *)p->pkt;
+                            alertpkt->transhdr=(char *)p->udph-(char *)p->pkt;
                         }
                         break;
 		    
                     case IPPROTO_ICMP:
                        if (p->icmph) 
                        {
-                           alertpkt.transhdr=(char *)p->icmph-(char *)p->pkt;
+                           alertpkt->transhdr=(char *)p->icmph-(char *)p->pkt;
                        }
                        break;
 		    
                     default:
-                        /* alertpkt.transhdr is null due to initial bzero */
-                        alertpkt.val|=NO_TRANSHDR;
+                        /* alertpkt->transhdr is null due to initial bzero */
+                        alertpkt->val|=NO_TRANSHDR;
                         break;
                 }
             }
 
-            if (p->data && p->pkt) alertpkt.data=p->data - p->pkt;
+            if (p->data && p->pkt) alertpkt->data=p->data - p->pkt;
         }
     }
 
 
-    if(sendto(alertsd,(const void *)&alertpkt,sizeof(Alertpkt),
+    if(alertbatch != NULL)
+    {
+        sfmb_commit(alertbatch, sizeof(Alertpkt));
+        return;
+    }
+
+    if(sendto(alertsd,(const void *)alertpkt,sizeof(Alertpkt),
               0,(struct sockaddr *)&alertaddr,sizeof(alertaddr))==-1)
     {
         /* whatever we do to sign that some alerts could be missed */
@@ -293,6 +350,28 @@ void OpenAlertSock(void)
     }
 }
 
+/*
+ * Function: AlertUnixSockIdle(int, void *)
+ *
+ * Purpose: Send the alerts queued during the last packet batch, or
+ *          after a packet the ones that have waited long enough
+ *
+ * Arguments: when => IDLE_BATCH_END or IDLE_PACKET
+ *            arg => unused
+ *
+ * Returns: void function
+ */
+void AlertUnixSockIdle(int when, void *arg)
+{
+    if(alertbatch == NULL)
+        return;
+
+    if(when == IDLE_PACKET)
+        sfmb_age(alertbatch);
+    else if(alertbatch->count)
+        sfmb_flush(alertbatch);
+}
+
 void AlertUnixSockCleanExit(int signal, void *arg) 
 {
     DEBUG_WRAP(DebugMessage(DEBUG_LOG,"AlertUnixSockCleanExitFunc\n"););
@@ -307,6 +386,18 @@ void AlertUnixSockRestart(int signal, void *arg)
 
 void CloseAlertSock()
 {
+    if(alertbatch != NULL)
+    {
+        sfmb_flush(alertbatch);
+
+        LogMessage("alert_unixsock: %lu alerts sent in %lu calls, "
+                   "%lu dropped\n", alertbatch->sent, alertbatch->calls,
+                   alertbatch->drops);
+
+        sfmb_free(alertbatch);
+        alertbatch = NULL;
+    }
+
     if(alertsd >= 0) {
         close(alertsd);
     }
@@ -70,12 +70,51 @@ typedef struct _AlertCSVConfig
     struct _AlertCSVConfig *next;
 } AlertCSVConfig;
 
+/* output fields, looked up once when the config is parsed */
+typedef enum _AlertCSVField
+{
+    CSV_UNKNOWN = 0,
+    CSV_TIMESTAMP,
+    CSV_SIG_GENERATOR,
+    CSV_SIG_ID,
+    CSV_SIG_REV,
+    CSV_MSG,
+    CSV_PROTO,
+    CSV_ETHSRC,
+    CSV_ETHDST,
+    CSV_ETHTYPE,
+    CSV_UDPLENGTH,
+    CSV_ETHLEN,
+    CSV_TRHEADER,
+    CSV_SRCPORT,
+    CSV_DSTPORT,
+    CSV_SRC,
+    CSV_DST,
+    CSV_ICMPTYPE,
+    CSV_ICMPCODE,
+    CSV_ICMPID,
+    CSV_ICMPSEQ,
+    CSV_TTL,
+    CSV_TOS,
+    CSV_ID,
+    CSV_IPLEN,
+    CSV_DGMLEN,
+    CSV_TCPSEQ,
+    CSV_TCPACK,
+    CSV_TCPLEN,
+    CSV_TCPWINDOW,
+    CSV_TCPFLAGS
+} AlertCSVField;
+
 typedef struct _AlertCSVData
 {
     FILE *file;
     char * csvargs;
     char ** args;
     int numargs;
+    AlertCSVField *fields;
+    SF_TEXTBUF *tb;
+    SFTB_CACHE *cache;      /* escaped messages */
     AlertCSVConfig *config;
 } AlertCSVData;
 
@@ -86,8 +125,9 @@ AlertCSVData *AlertCSVParseArgs(char *);
 void AlertCSV(Packet *, char *, void *, Event *);
 void AlertCSVCleanExit(int, void *);
 void AlertCSVRestart(int, void *);
-void RealAlertCSV(Packet * p, char *msg, FILE * file, char **args, 
-        int numargs, Event *event);
+void AlertCSVIdle(int, void *);
+void RealAlertCSV(Packet * p, char *msg, AlertCSVData *data, Event *event);
+static AlertCSVField CSVFieldType(char *type);
 static char *CSVEscape(char *input);
 
 /*
@@ -139,6 +179,7 @@ void AlertCSVInit(u_char *args)
     AddFuncToOutputList(AlertCSV, NT_OUTPUT_ALERT, data);
     AddFuncToCleanExitList(AlertCSVCleanExit, data);
     AddFuncToRestartList(AlertCSVRestart, data);
+    AddFuncToIdleList(AlertCSVIdle, data);
 }
 
 /*
@@ -191,15 +232,46 @@ AlertCSVData *AlertCSVParseArgs(char *args)
 
     DEBUG_WRAP(DebugMessage(DEBUG_LOG,"AlertCSV Got Config ARGS\n"););
     
+    /* csvargs may point into toks, split it before toks goes away */
+    data->args = mSplit(data->csvargs, ",", 128, &data->numargs, 0);
     mSplitFree(&toks, num_toks);
-    toks = mSplit(data->csvargs, ",", 128, &num_toks, 0);
+    data->csvargs = NULL;
+
+    data->fields = (AlertCSVField *)SnortAlloc(
+                        (data->numargs + 1) * sizeof(AlertCSVField));
+
+    for(num_toks = 0; num_toks < data->numargs; num_toks++)
+    {
+        data->fields[num_toks] = CSVFieldType(data->args[num_toks]);
+    }
 
-    data->args = toks;
-    data->numargs = num_toks;
+    data->tb = sftb_new(data->file, 0, -1);
+    data->cache = sftb_cache_new(0);
+
+    if(data->tb == NULL)
+        FatalError("alert_CSV: unable to allocate the output buffer\n");
 
     return data;
 }
 
+/*
+ * Function: AlertCSVIdle(int, void *)
+ *
+ * Purpose: Write out buffered records that have waited flush_secs, so the
+ *          last ones before a quiet spell still reach the file
+ *
+ * Arguments: when => IDLE_BATCH_END or IDLE_PACKET
+ *            arg => data ptr to reference this plugin's data
+ *
+ * Returns: void function
+ */
+void AlertCSVIdle(int when, void *arg)
+{
+    AlertCSVData *data = (AlertCSVData *)arg;
+
+    sftb_age(data->tb);
+}
+
 void AlertCSVCleanExit(int signal, void *arg)
 {
     AlertCSVData *data = (AlertCSVData *)arg;
@@ -210,6 +282,10 @@ void AlertCSVCleanExit(int signal, void *arg)
     {
          mSplitFree(&data->args, data->numargs);
     }
+
+    sftb_free(data->tb);
+    sftb_cache_free(data->cache);
+    free(data->fields);
     
     fclose(data->file);
     /* free memory from SpoCSVData */
@@ -227,6 +303,10 @@ void AlertCSVRestart(int signal, void *arg)
          mSplitFree(&data->args, data->numargs);
     }
 
+    sftb_free(data->tb);
+    sftb_cache_free(data->cache);
+    free(data->fields);
+
     fclose(data->file);
     /* free memory from SpoCSVData */
     free(data);
@@ -236,261 +316,351 @@ void AlertCSVRestart(int signal, void *arg)
 void AlertCSV(Packet *p, char *msg, void *arg, Event *event)
 {
     AlertCSVData *data = (AlertCSVData *)arg;
-    RealAlertCSV(p, msg, data->file, data->args, data->numargs, event); 
+    RealAlertCSV(p, msg, data, event);
     return;
 }
 
 
 
 /*
+ * Function: CSVFieldType(char *)
+ *
+ * Purpose: Map a field name from the config to the field it prints.  The
+ *          names are matched by prefix, in this order.
  *
- * Function: AlertCSV(Packet *, char *, FILE *, char *, numargs const int)
+ * Arguments: type => field name
+ *
+ * Returns: the field, CSV_UNKNOWN prints nothing
+ *
+ */
+static AlertCSVField CSVFieldType(char *type)
+{
+    if(!strncasecmp("timestamp", type, 9))
+        return CSV_TIMESTAMP;
+    else if(!strncasecmp("sig_generator",type,13))
+        return CSV_SIG_GENERATOR;
+    else if(!strncasecmp("sig_id",type,6))
+        return CSV_SIG_ID;
+    else if(!strncasecmp("sig_rev",type,7))
+        return CSV_SIG_REV;
+    else if(!strncasecmp("msg", type, 3))
+        return CSV_MSG;
+    else if(!strncasecmp("proto", type, 5))
+        return CSV_PROTO;
+    else if(!strncasecmp("ethsrc", type, 6))
+        return CSV_ETHSRC;
+    else if(!strncasecmp("ethdst", type, 6))
+        return CSV_ETHDST;
+    else if(!strncasecmp("ethtype", type, 7))
+        return CSV_ETHTYPE;
+    else if(!strncasecmp("udplength", type, 9))
+        return CSV_UDPLENGTH;
+    else if(!strncasecmp("ethlen", type, 6))
+        return CSV_ETHLEN;
+    else if(!strncasecmp("trheader", type, 8))
+        return CSV_TRHEADER;
+    else if(!strncasecmp("srcport", type, 7))
+        return CSV_SRCPORT;
+    else if(!strncasecmp("dstport", type, 7))
+        return CSV_DSTPORT;
+    else if(!strncasecmp("src", type, 3))
+        return CSV_SRC;
+    else if(!strncasecmp("dst", type, 3))
+        return CSV_DST;
+    else if(!strncasecmp("icmptype",type,8))
+        return CSV_ICMPTYPE;
+    else if(!strncasecmp("icmpcode",type,8))
+        return CSV_ICMPCODE;
+    else if(!strncasecmp("icmpid",type,6))
+        return CSV_ICMPID;
+    else if(!strncasecmp("icmpseq",type,7))
+        return CSV_ICMPSEQ;
+    else if(!strncasecmp("ttl",type,3))
+        return CSV_TTL;
+    else if(!strncasecmp("tos",type,3))
+        return CSV_TOS;
+    else if(!strncasecmp("id",type,2))
+        return CSV_ID;
+    else if(!strncasecmp("iplen",type,5))
+        return CSV_IPLEN;
+    else if(!strncasecmp("dgmlen",type,6))
+        return CSV_DGMLEN;
+    else if(!strncasecmp("tcpseq",type,6))
+        return CSV_TCPSEQ;
+    else if(!strncasecmp("tcpack",type,6))
+        return CSV_TCPACK;
+    else if(!strncasecmp("tcplen",type,6))
+        return CSV_TCPLEN;
+    else if(!strncasecmp("tcpwindow",type,9))
+        return CSV_TCPWINDOW;
+    else if(!strncasecmp("tcpflags",type,8))
+        return CSV_TCPFLAGS;
+
+    return CSV_UNKNOWN;
+}
+
+/*
+ * Function: CSVMac(SF_TEXTBUF *, u_int8_t *)
+ *
+ * Purpose: Print a MAC address the way "%X:%X:%X:%X:%X:%X" does
+ *
+ */
+static void CSVMac(SF_TEXTBUF *tb, u_int8_t *mac)
+{
+    int i;
+
+    for(i = 0; i < 6; i++)
+    {
+        if(i)
+            sftb_putc(tb, ':');
+
+        sftb_putx(tb, mac[i]);
+    }
+}
+
+/*
+ * Function: CSVHex(SF_TEXTBUF *, unsigned long)
+ *
+ * Purpose: Print a value the way "0x%lX" does
+ *
+ */
+static void CSVHex(SF_TEXTBUF *tb, unsigned long u)
+{
+    sftb_write(tb, "0x", 2);
+    sftb_putx(tb, u);
+}
+
+/*
+ *
+ * Function: RealAlertCSV(Packet *, char *, AlertCSVData *, Event *)
  *
  * Purpose: Write a user defined CSV message
  *
  * Arguments:     p => packet. (could be NULL)
  *              msg => the message to send
- *             file => file pointer to print data to
- *             args => CSV output arguements 
- *          numargs => number of arguements
+ *             data => plugin data with the output buffer and fields
+ *            event => event data
  * Returns: void function
  *
  */
-void RealAlertCSV(Packet * p, char *msg, FILE * file, char **args, 
-        int numargs, Event *event)
+void RealAlertCSV(Packet * p, char *msg, AlertCSVData *data, Event *event)
 {
-    char timestamp[TIMEBUF_SIZE];
+    SF_TEXTBUF *tb = data->tb;
     int num; 
-    char *type;
     char tcpFlags[9];
+    char *escaped_msg;
+    int len;
 
     if(p == NULL)
 	return;
 
-    bzero((char *) timestamp, TIMEBUF_SIZE);
-    ts_print(p == NULL ? NULL : (struct timeval *) & p->pkth->ts, timestamp);
-
     DEBUG_WRAP(DebugMessage(DEBUG_LOG,"Logging CSV Alert data\n");); 
 
-    for (num = 0; num < numargs; num++)
+    for (num = 0; num < data->numargs; num++)
     {
-	type = args[num];
-
-	DEBUG_WRAP(DebugMessage(DEBUG_LOG, "CSV Got type %s %d\n", type, num);); 
-
-	if(!strncasecmp("timestamp", type, 9))
-	{
-	    fwrite(timestamp, strlen(timestamp), 1, file);
-	}
-	else if(!strncasecmp("sig_generator",type,13))
-	{
-	   if(event != NULL)
-	   {
-	       fprintf(file, "%lu",  (unsigned long) event->sig_generator);
-	   }
-	}
-	else if(!strncasecmp("sig_id",type,6))
+	switch(data->fields[num])
 	{
-	   if(event != NULL)
-	   {
-	      fprintf(file, "%lu",  (unsigned long) event->sig_id);
-	   }
-	}
-	else if(!strncasecmp("sig_rev",type,7))
-	{
-	   if(event != NULL)
-	   {
-	      fprintf(file, "%lu",  (unsigned long) event->sig_rev);
- 	   }
-	}
-	else if(!strncasecmp("msg", type, 3))
-	{
-        /* Escape the msg */
-        char *escaped_msg;
-        if(!(escaped_msg = CSVEscape(msg)))
-        {
-            FatalError("Out of memory escaping msg string");
-        }
-	    fwrite(escaped_msg, strlen(escaped_msg),1,file);
-        free(escaped_msg);
-	}
-	else if(!strncasecmp("proto", type, 5))
-	{
-        if(p->iph)
-        {
-            switch (p->iph->ip_proto)
-            {
-                case IPPROTO_UDP:
-                    fwrite("UDP", 3,1,file);
-                    break;
-                case IPPROTO_TCP:
-                    fwrite("TCP", 3,1,file);
-                    break;
-                case IPPROTO_ICMP:
-                    fwrite("ICMP", 4,1,file);
-                    break;
-            }
-        }
-	}
-	else if(!strncasecmp("ethsrc", type, 6))
-	{
-	    if(p->eh)
-	    {
-            fprintf(file, "%X:%X:%X:%X:%X:%X", p->eh->ether_src[0],
-            p->eh->ether_src[1], p->eh->ether_src[2], p->eh->ether_src[3],
-            p->eh->ether_src[4], p->eh->ether_src[5]);
-	    }
-	} 
-	else if(!strncasecmp("ethdst", type, 6))
-	{
-	    if(p->eh)
-	    {
-            fprintf(file, "%X:%X:%X:%X:%X:%X", p->eh->ether_dst[0],
-            p->eh->ether_dst[1], p->eh->ether_dst[2], p->eh->ether_dst[3],
-            p->eh->ether_dst[4], p->eh->ether_dst[5]);
-	    }
-	}
-	else if(!strncasecmp("ethtype", type, 7))
-	{
-	    if(p->eh)
-	    {
-            fprintf(file,"0x%X",ntohs(p->eh->ether_type));
-	    }
-	}
-	else if(!strncasecmp("udplength", type, 9))
-	{
-	    if(p->udph)
-		fprintf(file,"%d",ntohs(p->udph->uh_len));
-	}
-	else if(!strncasecmp("ethlen", type, 6))
-	{
-	    if(p->eh)
-            fprintf(file,"0x%X",p->pkth->len);
-	}
-	else if(!strncasecmp("trheader", type, 8))
-	{
-	    if(p->trh)
-            PrintTrHeader(file, p);
-	}
-	else if(!strncasecmp("srcport", type, 7))
-	{
-        if(p->iph)
-        {
-	        switch(p->iph->ip_proto)
-	        {
-	            case IPPROTO_UDP:
-	            case IPPROTO_TCP:
-		            fprintf(file, "%d", p->sp);
-		            break;
-	        }    
-        }
-	}
-	else if(!strncasecmp("dstport", type, 7))
-	{
-        if(p->iph)
-        {
-	        switch(p->iph->ip_proto)
-	        {
-	            case IPPROTO_UDP:
-	            case IPPROTO_TCP:
-		            fprintf(file, "%d", p->dp);
-		            break;
-	        }    
-        }
-	}
-	else if(!strncasecmp("src", type, 3))
-	{
-        if(p->iph)
-            fputs(inet_ntoa(p->iph->ip_src), file);
-	}
-	else if(!strncasecmp("dst", type, 3))
-	{
-        if(p->iph)
-            fputs(inet_ntoa(p->iph->ip_dst), file); 
-	}
-	else if(!strncasecmp("icmptype",type,8))
-	{
-	    if(p->icmph)
-	    {
-		fprintf(file,"%d",p->icmph->type);
-	    }
-	}
-	else if(!strncasecmp("icmpcode",type,8))
-	{
-	    if(p->icmph)
-	    {
-		fprintf(file,"%d",p->icmph->code);
-	    }
-	}
-	else if(!strncasecmp("icmpid",type,6))
-	{
-	    if(p->icmph)
-            fprintf(file,"%d",ntohs(p->icmph->s_icmp_id));	   
-	}
-	else if(!strncasecmp("icmpseq",type,7))
-	{
-	    if(p->icmph)
-		    fprintf(file,"%d",ntohs(p->icmph->s_icmp_seq));
-	}
-	else if(!strncasecmp("ttl",type,3))
-	{
-	    if(p->iph)
-		fprintf(file,"%d",p->iph->ip_ttl);
-	}
-	else if(!strncasecmp("tos",type,3))
-	{
-	    if(p->iph)
-		fprintf(file,"%d",p->iph->ip_tos);
-	}
-	else if(!strncasecmp("id",type,2))
-	{
-	    if(p->iph)
-		fprintf(file,"%d",ntohs(p->iph->ip_id));
-	}
-	else if(!strncasecmp("iplen",type,5))
-	{
-	    if(p->iph)
-		fprintf(file,"%d",IP_HLEN(p->iph) << 2);
-	}
-	else if(!strncasecmp("dgmlen",type,6))
-	{
-	    if(p->iph)
-		fprintf(file,"%d",ntohs(p->iph->ip_len));
-	}
-	else if(!strncasecmp("tcpseq",type,6))
-	{
-	    if(p->tcph)
-		fprintf(file,"0x%lX",(u_long) ntohl(p->tcph->th_seq));
-	}
-	else if(!strncasecmp("tcpack",type,6))
-	{
-	    if(p->tcph)
-		fprintf(file,"0x%lX",(u_long) ntohl(p->tcph->th_ack));
-	}
-	else if(!strncasecmp("tcplen",type,6))
-	{
-	    if(p->tcph)
-		fprintf(file,"%d",TCP_OFFSET(p->tcph) << 2);
-	}
-	else if(!strncasecmp("tcpwindow",type,9))
-	{
-	    if(p->tcph)
-		fprintf(file,"0x%X",ntohs(p->tcph->th_win));
-	}
-	else if(!strncasecmp("tcpflags",type,8))
-	{
-	    if(p->tcph)
-	    {   
-		CreateTCPFlagString(p, tcpFlags);
-		fprintf(file,"%s", tcpFlags);
-	    }
+	    case CSV_TIMESTAMP:
+		TextBufTimestamp(tb, p);
+		break;
+
+	    case CSV_SIG_GENERATOR:
+		if(event != NULL)
+		    sftb_putu(tb, event->sig_generator);
+		break;
+
+	    case CSV_SIG_ID:
+		if(event != NULL)
+		    sftb_putu(tb, event->sig_id);
+		break;
+
+	    case CSV_SIG_REV:
+		if(event != NULL)
+		    sftb_putu(tb, event->sig_rev);
+		break;
+
+	    case CSV_MSG:
+		if(msg == NULL)
+		    break;
+
+		/* Escape the msg, once per message */
+		if((escaped_msg = sftb_cache_find(data->cache, msg, 0, 0, 0, 0, &len)))
+		{
+		    sftb_write(tb, escaped_msg, len);
+		    break;
+		}
+
+		if(!(escaped_msg = CSVEscape(msg)))
+		{
+		    FatalError("Out of memory escaping msg string");
+		}
+
+		len = strlen(escaped_msg);
+		sftb_write(tb, escaped_msg, len);
+
+		if(data->cache)
+		    sftb_cache_add(data->cache, msg, 0, 0, 0, 0, escaped_msg, len);
+
+		free(escaped_msg);
+		break;
+
+	    case CSV_PROTO:
+		if(p->iph)
+		{
+		    switch (p->iph->ip_proto)
+		    {
+			case IPPROTO_UDP:
+			    sftb_write(tb, "UDP", 3);
+			    break;
+			case IPPROTO_TCP:
+			    sftb_write(tb, "TCP", 3);
+			    break;
+			case IPPROTO_ICMP:
+			    sftb_write(tb, "ICMP", 4);
+			    break;
+		    }
+		}
+		break;
+
+	    case CSV_ETHSRC:
+		if(p->eh)
+		    CSVMac(tb, p->eh->ether_src);
+		break;
+
+	    case CSV_ETHDST:
+		if(p->eh)
+		    CSVMac(tb, p->eh->ether_dst);
+		break;
+
+	    case CSV_ETHTYPE:
+		if(p->eh)
+		    CSVHex(tb, ntohs(p->eh->ether_type));
+		break;
+
+	    case CSV_UDPLENGTH:
+		if(p->udph)
+		    sftb_putu(tb, ntohs(p->udph->uh_len));
+		break;
+
+	    case CSV_ETHLEN:
+		if(p->eh)
+		    CSVHex(tb, p->pkth->len);
+		break;
+
+	    case CSV_TRHEADER:
+		if(p->trh)
+		{
+		    /* the header printer writes straight to the file */
+		    sftb_drain(tb);
+		    PrintTrHeader(data->file, p);
+		}
+		break;
+
+	    case CSV_SRCPORT:
+		if(p->iph && (p->iph->ip_proto == IPPROTO_UDP ||
+			      p->iph->ip_proto == IPPROTO_TCP))
+		    sftb_putu(tb, p->sp);
+		break;
+
+	    case CSV_DSTPORT:
+		if(p->iph && (p->iph->ip_proto == IPPROTO_UDP ||
+			      p->iph->ip_proto == IPPROTO_TCP))
+		    sftb_putu(tb, p->dp);
+		break;
+
+	    case CSV_SRC:
+		if(p->iph)
+		    sftb_putip(tb, p->iph->ip_src.s_addr);
+		break;
+
+	    case CSV_DST:
+		if(p->iph)
+		    sftb_putip(tb, p->iph->ip_dst.s_addr);
+		break;
+
+	    case CSV_ICMPTYPE:
+		if(p->icmph)
+		    sftb_putu(tb, p->icmph->type);
+		break;
+
+	    case CSV_ICMPCODE:
+		if(p->icmph)
+		    sftb_putu(tb, p->icmph->code);
+		break;
+
+	    case CSV_ICMPID:
+		if(p->icmph)
+		    sftb_putu(tb, ntohs(p->icmph->s_icmp_id));
+		break;
+
+	    case CSV_ICMPSEQ:
+		if(p->icmph)
+		    sftb_putu(tb, ntohs(p->icmph->s_icmp_seq));
+		break;
+
+	    case CSV_TTL:
+		if(p->iph)
+		    sftb_putu(tb, p->iph->ip_ttl);
+		break;
+
+	    case CSV_TOS:
+		if(p->iph)
+		    sftb_putu(tb, p->iph->ip_tos);
+		break;
+
+	    case CSV_ID:
+		if(p->iph)
+		    sftb_putu(tb, ntohs(p->iph->ip_id));
+		break;
+
+	    case CSV_IPLEN:
+		if(p->iph)
+		    sftb_putu(tb, IP_HLEN(p->iph) << 2);
+		break;
+
+	    case CSV_DGMLEN:
+		if(p->iph)
+		    sftb_putu(tb, ntohs(p->iph->ip_len));
+		break;
+
+	    case CSV_TCPSEQ:
+		if(p->tcph)
+		    CSVHex(tb, (u_long) ntohl(p->tcph->th_seq));
+		break;
+
+	    case CSV_TCPACK:
+		if(p->tcph)
+		    CSVHex(tb, (u_long) ntohl(p->tcph->th_ack));
+		break;
+
+	    case CSV_TCPLEN:
+		if(p->tcph)
+		    sftb_putu(tb, TCP_OFFSET(p->tcph) << 2);
+		break;
+
+	    case CSV_TCPWINDOW:
+		if(p->tcph)
+		    CSVHex(tb, ntohs(p->tcph->th_win));
+		break;
+
+	    case CSV_TCPFLAGS:
+		if(p->tcph)
+		{   
+		    CreateTCPFlagString(p, tcpFlags);
+		    sftb_puts(tb, tcpFlags);
+		}
+		break;
+
+	    default:
+		break;
 	}
 
-	if (num < numargs - 1) 
-	    fwrite(",",1,1,file);
+	if (num < data->numargs - 1) 
+	    sftb_putc(tb, ',');
     }
-    fputc('\n', file);
-   
+    sftb_putc(tb, '\n');
+
+    sftb_end(tb);
 
     return;
 }
@@ -53,6 +53,12 @@
 #include <sys/types.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#ifdef ENABLE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "event.h"
 #include "decode.h"
@@ -119,6 +125,17 @@ typedef struct _SQLQuery
     struct _SQLQuery * next;
 } SQLQuery;
 
+/* an event waiting in the buffered mode queue */
+typedef struct _DatabaseEvent
+{
+    Event          event;
+    OptTreeNode  * otn;
+    char         * msg;
+    char         * timestamp;
+    unsigned int   cid;
+    SQLQuery     * queries;   /* event row first, filled in at flush time */
+    struct _DatabaseEvent * next;
+} DatabaseEvent;
 
 /* the cid is unique across the dbtype, dbname, host, and sid */
 /* therefore, we use these as a lookup key for the cid */
@@ -130,6 +147,10 @@ typedef struct _SharedDatabaseData
     int       sid;
     int       cid;
     int       reference;
+    unsigned int last_cid;  /* highest sensor.last_cid we committed */
+#ifdef ENABLE_PTHREAD
+    pthread_mutex_t lock;   /* serializes last_cid updates */
+#endif
 } SharedDatabaseData;
 
 typedef struct _DatabaseData
@@ -177,6 +198,22 @@ typedef struct _DatabaseData
     DBINT       ms_col;
 #endif
     char *args;
+
+    /* buffered mode, off when batch_size is 0 */
+    int    batch_size;
+    int    batch_time;
+    time_t last_flush;
+    DatabaseEvent *queue_head;
+    DatabaseEvent *queue_tail;
+    int    queue_len;
+    unsigned long batch_drops;
+#ifdef ENABLE_PTHREAD
+    pthread_t       flush_thread;
+    pthread_mutex_t queue_lock;
+    pthread_cond_t  queue_cond;
+    int    flush_running;
+    int    flush_stop;
+#endif
 } DatabaseData;
 
 /* list for lookup of shared data information */
@@ -214,6 +251,12 @@ typedef struct _SharedDatabaseDataNode
 #define KEYWORD_IGNOREBPF_ZERO "0"
 #define KEYWORD_IGNOREBPF_YES  "yes"
 #define KEYWORD_IGNOREBPF_ONE  "1"
+#define KEYWORD_BATCHSIZE    "batch_size"
+#define KEYWORD_BATCHTIME    "batch_time"
+
+#define DATABASE_BATCH_TIME        1           /* seconds */
+#define DATABASE_QUEUE_FACTOR      16          /* queue holds this many batches */
+#define DATABASE_BATCH_QUERY_MAX   (128*1024)  /* multi-row INSERT size */
 
 
 #define LATEST_DB_SCHEMA_VERSION 106
@@ -241,6 +284,12 @@ void          Connect(DatabaseData *);
 void          DatabasePrintUsage();
 void          FreeSharedDataList();
 
+static void   DatabaseQueueEvent(DatabaseData *, Packet *, char *, Event *);
+static void   DatabaseFlush(DatabaseData *, DatabaseEvent *);
+static void   DatabaseStartFlush(DatabaseData *);
+static void   DatabaseStopFlush(DatabaseData *);
+static int    DatabaseAdvanceLastCid(DatabaseData *, unsigned int);
+
 /******** Global Variables  ********************************************/
 
 extern PV pv;
@@ -576,6 +625,11 @@ void DatabaseInitFinalize(int unused, void *arg)
 
         data->shared->cid = event_cid;
         ++(data->shared->cid);
+
+        data->shared->last_cid = event_cid > sensor_cid ? event_cid : sensor_cid;
+#ifdef ENABLE_PTHREAD
+        pthread_mutex_init(&data->shared->lock, NULL);
+#endif
     }
     else
     {
@@ -644,6 +698,11 @@ void DatabaseInitFinalize(int unused, void *arg)
         AddFuncToOutputList(Database, NT_OUTPUT_ALERT, data);
     }
 
+    if(data->batch_size)
+    {
+        DatabaseStartFlush(data);
+    }
+
     AddFuncToCleanExitList(SpoDatabaseCleanExitFunction, data);
     AddFuncToRestartList(SpoDatabaseRestartFunction, data); 
     ++instances;
@@ -897,6 +956,26 @@ void ParseDatabaseArgs(DatabaseData *data)
 
             if( !pv.quiet_flag ) printf("database: ignore_bpf = %s\n", a1);
         }
+        if(!strncasecmp(dbarg,KEYWORD_BATCHSIZE,strlen(KEYWORD_BATCHSIZE)))
+        {
+            data->batch_size = atoi(a1);
+
+            if(data->batch_size < 0)
+            {
+                FatalError("database: invalid batch_size (%s)", a1);
+            }
+            if( !pv.quiet_flag ) printf("database: batch_size = %d\n", data->batch_size);
+        }
+        if(!strncasecmp(dbarg,KEYWORD_BATCHTIME,strlen(KEYWORD_BATCHTIME)))
+        {
+            data->batch_time = atoi(a1);
+
+            if(data->batch_time <= 0)
+            {
+                FatalError("database: invalid batch_time (%s)", a1);
+            }
+            if( !pv.quiet_flag ) printf("database: batch_time = %d\n", data->batch_time);
+        }
         dbarg = strtok(NULL, "=");
     } 
 
@@ -907,6 +986,11 @@ void ParseDatabaseArgs(DatabaseData *data)
         FatalError("");
     }
 
+    if(data->batch_time == 0)
+    {
+        data->batch_time = DATABASE_BATCH_TIME;
+    }
+
     return;
 }
 
@@ -953,61 +1037,19 @@ SQLQuery * NewQueryNode(SQLQuery * parent, int query_size)
 }  
 
 /*******************************************************************************
- * Function: Database(Packet *, char * msg, void *arg)
+ * Function: DatabaseTimestamp(DatabaseData *, Packet *)
  *
- * Purpose: Insert data into the database
+ * Purpose: Format the event timestamp the way the database expects it
  *
- * Arguments: p   => pointer to the current packet data struct 
- *            msg => pointer to the signature message
+ * Arguments: data => database information
+ *            p    => the packet, NULL to use the current time
  *
- * Returns: void function
+ * Returns: malloc'd timestamp string
  *
  ******************************************************************************/
-void Database(Packet *p, char *msg, void *arg, Event *event)
+static char *DatabaseTimestamp(DatabaseData *data, Packet *p)
 {
-    DatabaseData *data = (DatabaseData *)arg;
-    SQLQuery * query;
-    SQLQuery * root;
-    char *timestamp_string
-       , *insert_fields
-       , *insert_values
-       , *sig_name
-       , *sig_class
-       , *ref_system_name
-       , *ref_node_id_string
-       , *ref_tag
-       , *packet_data
-       , *packet_data_not_escaped;
-    int  i
-       , insert_fields_len
-       , insert_values_len
-       , ok_transaction;
-    char *select0 = NULL,
-         *select1 = NULL,
-         *insert0 = NULL;
-    unsigned int sig_id;
-    int ref_system_id;
-    unsigned int ref_id, class_id=0;
-    ClassType *class_ptr;
-    ReferenceNode *refNode;
-
-    char sig_rev[16]="";
-    char sig_sid[16]="";
-    char sig_gid[16]="";
-
-    query = NewQueryNode(NULL, 0);
-    root = query;
-
-#ifdef ENABLE_DB_TRANSACTIONS
-    BeginTransaction(data);
-#endif
-    
-    if(msg == NULL)
-    {
-        msg = "";
-    }
-
-    /*** Build the query for the Event Table ***/
+    char *timestamp_string;
 
     /* Generate a default-formatted timestamp now */
     if(p != NULL)
@@ -1118,6 +1160,50 @@ void Database(Packet *p, char *msg, void *arg, Event *event)
     }
 #endif
 
+    return timestamp_string;
+}
+
+/*******************************************************************************
+ * Function: DatabaseSignatureId(DatabaseData *, char *, Event *, OptTreeNode *)
+ *
+ * Purpose: Look up the ID # of the signature of an alert, writing the
+ *          signature, its classification and references the first time
+ *          it is seen
+ *
+ * Arguments: data  => database information
+ *            msg   => the signature message
+ *            event => the event
+ *            otn   => the rule that fired, may be NULL
+ *
+ * Returns: sig_id, 0 if it could not be written
+ *
+ ******************************************************************************/
+static unsigned int DatabaseSignatureId(DatabaseData *data, char *msg,
+                                        Event *event, OptTreeNode *otn)
+{
+    char *insert_fields
+       , *insert_values
+       , *sig_name
+       , *sig_class
+       , *ref_system_name
+       , *ref_node_id_string
+       , *ref_tag;
+    int  i
+       , insert_fields_len
+       , insert_values_len;
+    char *select0 = NULL,
+         *select1 = NULL,
+         *insert0 = NULL;
+    unsigned int sig_id;
+    int ref_system_id;
+    unsigned int ref_id, class_id=0;
+    ClassType *class_ptr;
+    ReferenceNode *refNode;
+
+    char sig_rev[16]="";
+    char sig_sid[16]="";
+    char sig_gid[16]="";
+
     /* Write the signature information 
      *  - Determine the ID # of the signature of this alert 
      */
@@ -1167,9 +1253,9 @@ void Database(Packet *p, char *msg, void *arg, Event *event)
     if(sig_id == 0)
     {
         /* get classification and priority information  */
-        if(otn_tmp)
+        if(otn)
         {
-            class_ptr = otn_tmp->sigInfo.classType;
+            class_ptr = otn->sigInfo.classType;
 
             if(class_ptr)
             {
@@ -1284,9 +1370,9 @@ void Database(Packet *p, char *msg, void *arg, Event *event)
         free(select0);    select0 = NULL;
 
         /* add the external rule references  */
-        if(otn_tmp)
+        if(otn)
         {
-            refNode = otn_tmp->sigInfo.refs;
+            refNode = otn->sigInfo.refs;
             i = 1;
 
             while(refNode)
@@ -1392,34 +1478,74 @@ void Database(Packet *p, char *msg, void *arg, Event *event)
     }
 
     free(sig_name);    sig_name = NULL;
-    
+
+    return sig_id;
+}
+
+/*******************************************************************************
+ * Function: DatabaseEventQuery(DatabaseData *, char *, unsigned int,
+ *                              unsigned int, char *)
+ *
+ * Purpose: Build the query for the Event Table
+ *
+ * Arguments: data   => database information
+ *            query  => MAX_QUERY_LENGTH buffer for the query
+ *            cid    => event ID
+ *            sig_id => signature ID
+ *            timestamp_string => from DatabaseTimestamp()
+ *
+ * Returns: void function
+ *
+ ******************************************************************************/
+static void DatabaseEventQuery(DatabaseData *data, char *query, unsigned int cid,
+                               unsigned int sig_id, char *timestamp_string)
+{
     if ( (data->shared->dbtype_id == DB_ORACLE) &&
          (data->DBschema_version >= 105) )
     {
-        snprintf(query->val, MAX_QUERY_LENGTH,
+        snprintf(query, MAX_QUERY_LENGTH,
                 "INSERT INTO "
                 "event (sid,cid,signature,timestamp) "
                 "VALUES (%u, %u, %u, TO_DATE('%s', 'YYYY-MM-DD HH24:MI:SS'))",
-                data->shared->sid, data->shared->cid, sig_id, timestamp_string);
+                data->shared->sid, cid, sig_id, timestamp_string);
     }
     else if(data->shared->dbtype_id == DB_ODBC)
     {
-        snprintf(query->val, MAX_QUERY_LENGTH,
+        snprintf(query, MAX_QUERY_LENGTH,
                 "INSERT INTO "
                 "event (sid,cid,signature,timestamp) "
                 "VALUES (%u, %u, %u, {ts '%s'})",
-                data->shared->sid, data->shared->cid, sig_id, timestamp_string);
+                data->shared->sid, cid, sig_id, timestamp_string);
     }
     else
     {
-        snprintf(query->val, MAX_QUERY_LENGTH,
+        snprintf(query, MAX_QUERY_LENGTH,
                 "INSERT INTO "
                 "event (sid,cid,signature,timestamp) "
                 "VALUES (%u, %u, %u, '%s')",
-                data->shared->sid, data->shared->cid, sig_id, timestamp_string);
+                data->shared->sid, cid, sig_id, timestamp_string);
     }
+}
 
-    free(timestamp_string);    timestamp_string = NULL;
+/*******************************************************************************
+ * Function: DatabasePacketQueries(DatabaseData *, Packet *, SQLQuery *)
+ *
+ * Purpose: Build the queries for the protocol headers, options and payload
+ *          of the current cid and append them to a query list
+ *
+ * Arguments: data  => database information
+ *            p     => the packet, may be NULL
+ *            query => the list to append to
+ *
+ * Returns: the last query of the list
+ *
+ ******************************************************************************/
+static SQLQuery *DatabasePacketQueries(DatabaseData *data, Packet *p,
+                                       SQLQuery *query)
+{
+    char *packet_data
+       , *packet_data_not_escaped;
+    int  i;
 
     /* We do not log fragments! They are assumed to be handled 
        by the fragment reassembly pre-processor */
@@ -1704,6 +1830,59 @@ void Database(Packet *p, char *msg, void *arg, Event *event)
         }
     }
 
+    return query;
+}
+
+/*******************************************************************************
+ * Function: Database(Packet *, char * msg, void *arg)
+ *
+ * Purpose: Insert data into the database
+ *
+ * Arguments: p   => pointer to the current packet data struct 
+ *            msg => pointer to the signature message
+ *
+ * Returns: void function
+ *
+ ******************************************************************************/
+void Database(Packet *p, char *msg, void *arg, Event *event)
+{
+    DatabaseData *data = (DatabaseData *)arg;
+    SQLQuery * query;
+    SQLQuery * root;
+    char *timestamp_string;
+    int  ok_transaction;
+    unsigned int sig_id;
+
+    if(msg == NULL)
+    {
+        msg = "";
+    }
+
+    if(data->batch_size)
+    {
+        DatabaseQueueEvent(data, p, msg, event);
+        return;
+    }
+
+    query = NewQueryNode(NULL, 0);
+    root = query;
+
+#ifdef ENABLE_DB_TRANSACTIONS
+    BeginTransaction(data);
+#endif
+
+    /*** Build the query for the Event Table ***/
+    timestamp_string = DatabaseTimestamp(data, p);
+
+    sig_id = DatabaseSignatureId(data, msg, event, otn_tmp);
+
+    DatabaseEventQuery(data, query->val, data->shared->cid, sig_id,
+                       timestamp_string);
+
+    free(timestamp_string);    timestamp_string = NULL;
+
+    query = DatabasePacketQueries(data, p, query);
+
     /* Execute the queries */
     query = root;
     ok_transaction = 1;
@@ -1744,6 +1923,434 @@ void Database(Packet *p, char *msg, void *arg, Event *event)
 #endif
 }
 
+/*******************************************************************************
+ * Function: DatabaseQueueEvent(DatabaseData *, Packet *, char *, Event *)
+ *
+ * Purpose: Buffered mode.  Everything that needs the packet is built now
+ *          and the event is queued with its cid; the signature lookups and
+ *          the inserts happen when the queue is flushed.  With pthread
+ *          support the flush runs on its own thread and a full queue drops
+ *          the event instead of waiting on the database.
+ *
+ * Arguments: data  => database information
+ *            p     => pointer to the current packet data struct
+ *            msg   => pointer to the signature message
+ *            event => the event
+ *
+ * Returns: void function
+ *
+ ******************************************************************************/
+static void DatabaseQueueEvent(DatabaseData *data, Packet *p, char *msg,
+                               Event *event)
+{
+    DatabaseEvent *ev;
+    DatabaseEvent *list = NULL;
+
+#ifdef ENABLE_PTHREAD
+    if(data->flush_running)
+    {
+        int full;
+
+        pthread_mutex_lock(&data->queue_lock);
+        full = data->queue_len >= data->batch_size * DATABASE_QUEUE_FACTOR;
+        pthread_mutex_unlock(&data->queue_lock);
+
+        if(full)
+        {
+            data->batch_drops++;
+            return;
+        }
+    }
+#endif
+
+    ev = (DatabaseEvent *)SnortAlloc(sizeof(DatabaseEvent));
+
+    if(event)
+        memcpy(&ev->event, event, sizeof(Event));
+
+    ev->otn = otn_tmp;
+    ev->msg = strdup(msg);
+    ev->timestamp = DatabaseTimestamp(data, p);
+
+    if(ev->msg == NULL)
+        FatalError("database: unable to allocate event message\n");
+
+    /* the event row is written at flush time when sig_id is known */
+    ev->queries = NewQueryNode(NULL, 0);
+    DatabasePacketQueries(data, p, ev->queries);
+
+    ev->cid = data->shared->cid++;
+
+    /* An ODBC bugfix */
+#ifdef ENABLE_ODBC
+    if(data->shared->cid == 600)
+    {
+        data->shared->cid = 601;
+    }
+#endif
+
+#ifdef ENABLE_PTHREAD
+    if(data->flush_running)
+    {
+        pthread_mutex_lock(&data->queue_lock);
+
+        if(data->queue_tail)
+            data->queue_tail->next = ev;
+        else
+            data->queue_head = ev;
+
+        data->queue_tail = ev;
+
+        if(++data->queue_len == data->batch_size)
+            pthread_cond_signal(&data->queue_cond);
+
+        pthread_mutex_unlock(&data->queue_lock);
+        return;
+    }
+#endif
+
+    if(data->queue_tail)
+        data->queue_tail->next = ev;
+    else
+        data->queue_head = ev;
+
+    data->queue_tail = ev;
+    data->queue_len++;
+
+    if(data->queue_len >= data->batch_size ||
+       time(NULL) - data->last_flush >= data->batch_time)
+    {
+        list = data->queue_head;
+        data->queue_head = data->queue_tail = NULL;
+        data->queue_len = 0;
+        data->last_flush = time(NULL);
+
+        DatabaseFlush(data, list);
+    }
+}
+
+/*******************************************************************************
+ * Function: DatabaseInsertBatch(DatabaseData *, char **, int)
+ *
+ * Purpose: Run a list of INSERTs.  MySQL and PostgreSQL get consecutive
+ *          rows for the same table and columns folded into one multi-row
+ *          INSERT ... VALUES (...),(...) statement; the other databases
+ *          get one statement per row.
+ *
+ * Arguments: data  => database information
+ *            rows  => the queries, all of the form "INSERT ... VALUES (...)"
+ *            nrows => number of queries
+ *
+ * Returns: 1 if successful, 0 if any insert failed
+ *
+ ******************************************************************************/
+static int DatabaseInsertBatch(DatabaseData *data, char **rows, int nrows)
+{
+    char *stmt;
+    char *values;
+    int   stmt_size = DATABASE_BATCH_QUERY_MAX;
+    int   prefix_len, stmt_len, len;
+    int   i, j;
+    int   ok = 1;
+
+    if(data->shared->dbtype_id != DB_MYSQL &&
+       data->shared->dbtype_id != DB_POSTGRESQL)
+    {
+        for(i = 0; i < nrows && ok; i++)
+            ok = Insert(rows[i], data);
+
+        return ok;
+    }
+
+    stmt = (char *)SnortAlloc(stmt_size);
+
+    for(i = 0; i < nrows && ok; i++)
+    {
+        if(rows[i] == NULL)
+            continue;
+
+        values = strstr(rows[i], " VALUES ");
+
+        if(values == NULL)
+        {
+            ok = Insert(rows[i], data);
+            continue;
+        }
+
+        prefix_len = values + 8 - rows[i];
+        stmt_len = strlen(rows[i]);
+
+        if(stmt_len >= stmt_size)
+        {
+            ok = Insert(rows[i], data);
+            continue;
+        }
+
+        memcpy(stmt, rows[i], stmt_len + 1);
+
+        /* pull in every later row with the same table and columns */
+        for(j = i + 1; j < nrows; j++)
+        {
+            if(rows[j] == NULL || strncmp(rows[j], rows[i], prefix_len))
+                continue;
+
+            len = strlen(rows[j] + prefix_len);
+
+            if(stmt_len + len + 1 >= stmt_size)
+                break;
+
+            stmt[stmt_len++] = ',';
+            memcpy(stmt + stmt_len, rows[j] + prefix_len, len + 1);
+            stmt_len += len;
+
+            rows[j] = NULL;
+        }
+
+        ok = Insert(stmt, data);
+    }
+
+    free(stmt);
+
+    return ok;
+}
+
+/*******************************************************************************
+ * Function: DatabaseFlush(DatabaseData *, DatabaseEvent *)
+ *
+ * Purpose: Write a list of queued events in one transaction.  The
+ *          sensor's last_cid is moved to the end of the batch inside the
+ *          same transaction, so the cid range a batch used is reserved
+ *          exactly when its events are committed.  Instances that share
+ *          the sensor flush their batches independently, so last_cid is
+ *          only ever moved forward, under the shared lock.
+ *
+ * Arguments: data => database information
+ *            list => events to write, freed here
+ *
+ * Returns: void function
+ *
+ ******************************************************************************/
+static void DatabaseFlush(DatabaseData *data, DatabaseEvent *list)
+{
+    DatabaseEvent *ev, *next;
+    SQLQuery *query;
+    char **rows;
+    unsigned int sig_id;
+    unsigned int last_cid = 0;
+    int nrows = 0, nevents = 0;
+    int i, ok;
+
+    if(list == NULL)
+        return;
+
+    for(ev = list; ev; ev = ev->next)
+    {
+        nevents++;
+
+        for(query = ev->queries; query; query = query->next)
+            nrows++;
+    }
+
+    rows = (char **)SnortAlloc(nrows * sizeof(char *));
+
+#ifdef ENABLE_DB_TRANSACTIONS
+    BeginTransaction(data);
+#endif
+
+    /* event rows first, then the header and payload rows in event order */
+    i = 0;
+
+    for(ev = list; ev; ev = ev->next)
+    {
+        sig_id = DatabaseSignatureId(data, ev->msg, &ev->event, ev->otn);
+
+        DatabaseEventQuery(data, ev->queries->val, ev->cid, sig_id,
+                           ev->timestamp);
+
+        rows[i++] = ev->queries->val;
+
+        if(ev->cid > last_cid)
+            last_cid = ev->cid;
+    }
+
+    for(ev = list; ev; ev = ev->next)
+    {
+        for(query = ev->queries->next; query; query = query->next)
+            rows[i++] = query->val;
+    }
+
+    ok = DatabaseInsertBatch(data, rows, nrows);
+
+    /* held to the commit, so a smaller last_cid can't land after a larger */
+#ifdef ENABLE_PTHREAD
+    pthread_mutex_lock(&data->shared->lock);
+#endif
+
+    if(ok && last_cid > data->shared->last_cid)
+        ok = UpdateLastCid(data, data->shared->sid, last_cid);
+
+    if(ok)
+    {
+#ifdef ENABLE_DB_TRANSACTIONS
+        CommitTransaction(data);
+#endif
+        if(last_cid > data->shared->last_cid)
+            data->shared->last_cid = last_cid;
+    }
+    else
+    {
+#ifdef ENABLE_DB_TRANSACTIONS
+        RollbackTransaction(data);
+#endif
+    }
+
+#ifdef ENABLE_PTHREAD
+    pthread_mutex_unlock(&data->shared->lock);
+#endif
+
+    if(!ok)
+    {
+        ErrorMessage("database: unable to write a batch of %d events\n",
+                     nevents);
+    }
+
+    free(rows);
+
+    for(ev = list; ev; ev = next)
+    {
+        next = ev->next;
+        FreeQueryNode(ev->queries);
+        free(ev->timestamp);
+        free(ev->msg);
+        free(ev);
+    }
+}
+
+#ifdef ENABLE_PTHREAD
+/*******************************************************************************
+ * Function: DatabaseFlushThread(void *)
+ *
+ * Purpose: Flush the queue whenever batch_size events are waiting or the
+ *          oldest has waited batch_time seconds, until shut down.  The
+ *          lock is only held to take the queue, never across the database.
+ *
+ * Arguments: arg => database information
+ *
+ * Returns: NULL
+ *
+ ******************************************************************************/
+static void *DatabaseFlushThread(void *arg)
+{
+    DatabaseData *data = (DatabaseData *)arg;
+    DatabaseEvent *list;
+    struct timespec ts;
+    int stop;
+
+    pthread_mutex_lock(&data->queue_lock);
+
+    do
+    {
+        if(!data->flush_stop && data->queue_len < data->batch_size)
+        {
+            ts.tv_sec = time(NULL) + data->batch_time;
+            ts.tv_nsec = 0;
+            pthread_cond_timedwait(&data->queue_cond, &data->queue_lock, &ts);
+        }
+
+        stop = data->flush_stop;
+
+        list = data->queue_head;
+        data->queue_head = data->queue_tail = NULL;
+        data->queue_len = 0;
+
+        pthread_mutex_unlock(&data->queue_lock);
+
+        DatabaseFlush(data, list);
+
+        pthread_mutex_lock(&data->queue_lock);
+
+    } while(!stop);
+
+    pthread_mutex_unlock(&data->queue_lock);
+
+    return NULL;
+}
+#endif
+
+/*******************************************************************************
+ * Function: DatabaseStartFlush(DatabaseData *)
+ *
+ * Purpose: Set up buffered mode once the database is connected
+ *
+ * Arguments: data => database information
+ *
+ * Returns: void function
+ *
+ ******************************************************************************/
+static void DatabaseStartFlush(DatabaseData *data)
+{
+    data->last_flush = time(NULL);
+
+#ifdef ENABLE_PTHREAD
+    pthread_mutex_init(&data->queue_lock, NULL);
+    pthread_cond_init(&data->queue_cond, NULL);
+
+    if(pthread_create(&data->flush_thread, NULL, DatabaseFlushThread, data))
+    {
+        FatalError("database: unable to start the flush thread: %s\n",
+                   strerror(errno));
+    }
+
+    data->flush_running = 1;
+#endif
+
+    if( !pv.quiet_flag ) printf("database: batching %d events or %d seconds\n",
+                                data->batch_size, data->batch_time);
+}
+
+/*******************************************************************************
+ * Function: DatabaseStopFlush(DatabaseData *)
+ *
+ * Purpose: Write out whatever is still queued and stop the flush thread
+ *
+ * Arguments: data => database information
+ *
+ * Returns: void function
+ *
+ ******************************************************************************/
+static void DatabaseStopFlush(DatabaseData *data)
+{
+    DatabaseEvent *list;
+
+#ifdef ENABLE_PTHREAD
+    if(data->flush_running)
+    {
+        pthread_mutex_lock(&data->queue_lock);
+        data->flush_stop = 1;
+        pthread_cond_signal(&data->queue_cond);
+        pthread_mutex_unlock(&data->queue_lock);
+
+        pthread_join(data->flush_thread, NULL);
+        data->flush_running = 0;
+
+        pthread_cond_destroy(&data->queue_cond);
+        pthread_mutex_destroy(&data->queue_lock);
+
+        if(data->batch_drops)
+        {
+            ErrorMessage("database: %lu events dropped on a full queue\n",
+                         data->batch_drops);
+        }
+    }
+#endif
+
+    list = data->queue_head;
+    data->queue_head = data->queue_tail = NULL;
+    data->queue_len = 0;
+
+    DatabaseFlush(data, list);
+}
+
 /* Some of the code in this function is from the 
    mysql_real_escape_string() function distributed with mysql.
 
@@ -1924,6 +2531,41 @@ int UpdateLastCid(DatabaseData *data, int sid, int cid)
     return ret;
 }
 
+/*******************************************************************************
+ * Function: DatabaseAdvanceLastCid(DatabaseData *, unsigned int)
+ *
+ * Purpose: Set the sensor's last_cid to cid unless an instance sharing
+ *          the sensor already stored a larger one
+ *
+ * Arguments: data  : database information
+ *            cid   : event ID
+ *
+ * Returns: status of the update
+ *
+ ******************************************************************************/
+static int DatabaseAdvanceLastCid(DatabaseData *data, unsigned int cid)
+{
+    int ret = 1;
+
+#ifdef ENABLE_PTHREAD
+    pthread_mutex_lock(&data->shared->lock);
+#endif
+
+    if(cid > data->shared->last_cid)
+    {
+        ret = UpdateLastCid(data, data->shared->sid, cid);
+
+        if(ret)
+            data->shared->last_cid = cid;
+    }
+
+#ifdef ENABLE_PTHREAD
+    pthread_mutex_unlock(&data->shared->lock);
+#endif
+
+    return ret;
+}
+
 /*******************************************************************************
  * Function: GetLastCid(DatabaseData * data, int sid)
  *
@@ -2837,6 +3479,13 @@ void DatabasePrintUsage()
     puts(" ignore_bpf - specify if you want to ignore the BPF part for a sensor\n");
     puts("              definition (yes or no, no is default)\n");
 
+    puts(" batch_size - queue events and write them this many at a time, in");
+    puts("              one transaction (0, the default, writes each event");
+    puts("              as it happens)\n");
+
+    puts(" batch_time - write a partial batch after this many seconds");
+    puts("              (1 is default)\n");
+
     puts(" FOR EXAMPLE:");
     puts(" The configuration I am currently using is MySQL with the database");
     puts(" name of \"snort\". The user \"snortusr@localhost\" has INSERT and SELECT");
@@ -2854,7 +3503,12 @@ void SpoDatabaseCleanExitFunction(int signal, void *arg)
 
     if(data != NULL) 
     {
-       UpdateLastCid(data, data->shared->sid, data->shared->cid-1);
+       if(data->batch_size)
+       {
+           DatabaseStopFlush(data);
+       }
+
+       DatabaseAdvanceLastCid(data, data->shared->cid-1);
        Disconnect(data); 
        free(data->args);
        free(data);
@@ -2875,7 +3529,12 @@ void SpoDatabaseRestartFunction(int signal, void *arg)
 
     if(data != NULL) 
     {
-       UpdateLastCid(data, data->shared->sid, data->shared->cid-1);
+       if(data->batch_size)
+       {
+           DatabaseStopFlush(data);
+       }
+
+       DatabaseAdvanceLastCid(data, data->shared->cid-1);
        Disconnect(data);
        free(data->args);
        free(data);
@@ -2895,6 +3554,9 @@ void FreeSharedDataList()
    while(sharedDataList != NULL)
    { 
        current = sharedDataList;
+#ifdef ENABLE_PTHREAD
+       pthread_mutex_destroy(&current->data->lock);
+#endif
        free(current->data);
        current->data = NULL;
        sharedDataList = current->next;
@@ -26,7 +26,9 @@
  *
  * Arguments:
  *   
- * filename of the output log (default: snort.log)
+ * filename of the output log (default: snort.log), may contain spaces
+ * async [MB] - write through a ring of this many MB (default 8) drained
+ *              by a writer thread
  *
  * Effect:
  *
@@ -65,15 +67,41 @@
 #include "util.h"
 
 #include "snort.h"
+#include "mstring.h"
 
 /* For the traversal of reassembled packets */
 #include "stream_api.h"
 
+/*
+ * Same writer as the unified async spool: without threads "async" only
+ * gets a big stdio buffer that is flushed once a second instead of
+ * after every packet.
+ */
+#include "sfwriter.h"
+
+#define TCPDUMP_RING_DEFAULT   8     /* MB */
+#define TCPDUMP_RING_MAX       256   /* MB */
+
+/* record header as it is on disk, struct pcap_pkthdr has native timevals */
+typedef struct _TcpdumpRecordHdr
+{
+    u_int32_t ts_sec;
+    u_int32_t ts_usec;
+    u_int32_t caplen;
+    u_int32_t len;
+} TcpdumpRecordHdr;
+
 typedef struct _LogTcpdumpData
 {
     char *filename;
     int log_written;
     pcap_dumper_t *dumpd;
+    unsigned int ring_size;         /* async ring in bytes, 0 for pcap_dump */
+    time_t last_flush;              /* buffered stdio output without threads */
+#ifdef SF_WRITER_THREADS
+    SF_WRITER *writer;
+    int fd;                         /* log file under the pcap dumper */
+#endif
 
 } LogTcpdumpData;
 
@@ -88,6 +116,10 @@ void SpoLogTcpdumpRestartFunc(int, void *);
 void DirectLogTcpdump(struct pcap_pkthdr *, u_int8_t *);
 void LogTcpdumpSingle(Packet *, char *, void *, Event *);
 void LogTcpdumpStream(Packet *, char *, void *, Event *);
+static void TcpdumpWrite(LogTcpdumpData *, struct pcap_pkthdr *, u_int8_t *);
+static void TcpdumpFlush(LogTcpdumpData *);
+static void TcpdumpStartWriter(LogTcpdumpData *);
+static void TcpdumpStopWriter(LogTcpdumpData *);
 
 
 
@@ -172,6 +204,10 @@ void LogTcpdumpInit(u_char *args)
 LogTcpdumpData *ParseTcpdumpArgs(char *args)
 {
     LogTcpdumpData *data;
+    char *end;
+    char *last;
+    char *prev;
+    int ring = 0;
 
     data = (LogTcpdumpData *) SnortAlloc(sizeof(LogTcpdumpData));
 
@@ -180,8 +216,49 @@ LogTcpdumpData *ParseTcpdumpArgs(char *args)
     if(args != NULL)
     {
         while(isspace((int)*args)) args++;
-        if(strcmp(args, "") != 0)
-            data->filename = strdup(args);
+        end = args + strlen(args);
+        while(end > args && isspace((int)end[-1])) end--;
+        *end = '\0';
+
+        /*
+         * The file name may have spaces in it, so only the trailing
+         * "async" or "async <MB>" is taken off as the option.
+         */
+        last = end;
+        while(last > args && !isspace((int)last[-1])) last--;
+
+        prev = last;
+        while(prev > args && isspace((int)prev[-1])) prev--;
+        end = prev;
+        while(prev > args && !isspace((int)prev[-1])) prev--;
+
+        if(prev > args && end - prev == 5 && !strncasecmp(prev, "async", 5))
+        {
+            ring = atoi(last);
+
+            if(ring <= 0)
+                FatalError("%s(%d) => invalid log_tcpdump async size: %s\n",
+                           file_name, file_line, last);
+
+            end = prev;
+        }
+        else if(last > args && !strcasecmp(last, "async"))
+        {
+            ring = TCPDUMP_RING_DEFAULT;
+            end = last;
+        }
+        else
+        {
+            end = args + strlen(args);
+        }
+
+        while(end > args && isspace((int)end[-1])) end--;
+
+        if(end > args)
+        {
+            data->filename = (char *)SnortAlloc(end - args + 1);
+            memcpy(data->filename, args, end - args);
+        }
         else
             data->filename = strdup("snort.log");
     }
@@ -190,6 +267,15 @@ LogTcpdumpData *ParseTcpdumpArgs(char *args)
         data->filename = strdup("snort.log");
     }
 
+    if(ring > TCPDUMP_RING_MAX)
+    {
+        LogMessage("log_tcpdump %s(%d)=> Lowering async ring of %iMB to %iMB\n",
+                file_name, file_line, ring, TCPDUMP_RING_MAX);
+        ring = TCPDUMP_RING_MAX;
+    }
+
+    data->ring_size = (unsigned int)ring << 20;
+
     return data;
 }
 
@@ -228,18 +314,8 @@ void LogTcpdumpSingle(Packet *p, char *msg, void *arg, Event *event)
 
     data->log_written = 1;
 
-    /* sizeof(struct pcap_pkthdr) = 16 bytes */
-    pcap_dump((u_char *)data->dumpd,p->pkth,p->pkt);
-
-    if(!pv.line_buffer_flag)
-    { 
-#ifdef WIN32
-        fflush( NULL );  /* flush all open output streams */
-#else
-        /* we happen to know that pcap_dumper_t* is really just a FILE* */
-        fflush( (FILE*) data->dumpd );
-#endif
-    }
+    TcpdumpWrite(data, p->pkth, p->pkt);
+    TcpdumpFlush(data);
 }
 
 int LogTcpdumpStreamCallback(SnortPktHeader *pkth, u_int8_t *packet_data,
@@ -247,9 +323,7 @@ int LogTcpdumpStreamCallback(SnortPktHeader *pkth, u_int8_t *packet_data,
 {
     LogTcpdumpData *data = (LogTcpdumpData *)userdata;
 
-    pcap_dump((u_char *)data->dumpd, 
-              (struct pcap_pkthdr *) pkth, 
-              (u_char *) packet_data);
+    TcpdumpWrite(data, (struct pcap_pkthdr *) pkth, packet_data);
 
     return 0;
 }
@@ -263,15 +337,201 @@ void LogTcpdumpStream(Packet *p, char *msg, void *arg, Event *event)
     if (stream_api)
         stream_api->traverse_reassembled(p, LogTcpdumpStreamCallback, data);
 
-    if(!pv.line_buffer_flag)
-    { 
-#ifdef WIN32
-        fflush( NULL );  /* flush all open output streams */
+    TcpdumpFlush(data);
+}
+
+#ifdef SF_WRITER_THREADS
+/*
+ * Function: TcpdumpWriterWrite(void *, void *, unsigned, char *, int)
+ *
+ * Purpose: Hand a run of queued pcap records to the log file, on the
+ *          writer thread
+ *
+ * Arguments: arg => pointer to the plugin's reference data struct
+ *            buf => bytes to write
+ *            len => number of bytes
+ *            errbuf => room for the error message
+ *            errlen => size of errbuf
+ *
+ * Returns: 0 on success, -1 on error
+ */
+static int TcpdumpWriterWrite(void *arg, void *buf, unsigned len,
+                              char *errbuf, int errlen)
+{
+    LogTcpdumpData *data = (LogTcpdumpData *)arg;
+    ssize_t ret;
+
+    while(len > 0)
+    {
+        ret = write(data->fd, buf, len);
+
+        if(ret < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            snprintf(errbuf, errlen, "log_tcpdump: write failed: %s\n",
+                     strerror(errno));
+            return -1;
+        }
+
+        buf = (u_int8_t *)buf + ret;
+        len -= (unsigned)ret;
+    }
+
+    return 0;
+}
+#endif
+
+/*
+ * Function: TcpdumpStartWriter(LogTcpdumpData *)
+ *
+ * Purpose: Allocate the ring and start the writer thread on the freshly
+ *          opened log.  This runs from the post config list so the thread
+ *          is created after snort has daemonized and dropped privileges.
+ *
+ * Arguments: data => pointer to the plugin's reference data struct
+ *
+ * Returns: void function
+ */
+static void TcpdumpStartWriter(LogTcpdumpData *data)
+{
+#ifdef SF_WRITER_THREADS
+    /* the file header is still in the stdio buffer, records go around it */
+    fflush((FILE *)data->dumpd);
+    data->fd = fileno((FILE *)data->dumpd);
+
+    data->writer = sfw_new(data->ring_size, TcpdumpWriterWrite, NULL, data);
+
+    if(data->writer == NULL)
+        FatalError("log_tcpdump: unable to start writer thread: %s\n",
+                   strerror(errno));
+
+    LogMessage("log_tcpdump: %s written through a %uKB ring\n",
+               data->filename, data->writer->size >> 10);
 #else
-        /* we happen to know that pcap_dumper_t* is really just a FILE* */
-        fflush( (FILE*) data->dumpd );
+    LogMessage("log_tcpdump: async output needs pthread support, "
+               "flushing %s once a second instead\n", data->filename);
+#endif
+}
+
+/*
+ * Function: TcpdumpStopWriter(LogTcpdumpData *)
+ *
+ * Purpose: Let the writer empty the ring, wait for it and report how
+ *          full the ring got and how many packets it had to drop.
+ *
+ * Arguments: data => pointer to the plugin's reference data struct
+ *
+ * Returns: void function
+ */
+static void TcpdumpStopWriter(LogTcpdumpData *data)
+{
+#ifdef SF_WRITER_THREADS
+    SF_WRITER *w = data->writer;
+
+    if(w == NULL)
+        return;
+
+    sfw_stop(w);
+
+    if(sfw_error(w) != NULL)
+        ErrorMessage("%s", sfw_error(w));
+
+    LogMessage("log_tcpdump: %s ring: %lu packets, %lu dropped, "
+               "high water %u of %u bytes\n", data->filename,
+               w->records, w->drops, w->hiwater, w->size);
+
+    sfw_free(w);
+    data->writer = NULL;
 #endif
+}
+
+/*
+ * Function: TcpdumpWrite(LogTcpdumpData *, struct pcap_pkthdr *, u_int8_t *)
+ *
+ * Purpose: Append one packet to the log.  With the writer thread running
+ *          the record is copied into the ring in the on-disk pcap layout,
+ *          or dropped and counted if the ring is full so the packet thread
+ *          never waits on the disk.  Otherwise it goes to pcap_dump().
+ *          An error the writer thread ran into is raised here.
+ *
+ * Arguments: data => pointer to the plugin's reference data struct
+ *            pkth => packet header
+ *            pkt => packet data
+ *
+ * Returns: void function
+ */
+static void TcpdumpWrite(LogTcpdumpData *data, struct pcap_pkthdr *pkth,
+                         u_int8_t *pkt)
+{
+#ifdef SF_WRITER_THREADS
+    if(data->writer != NULL)
+    {
+        TcpdumpRecordHdr hdr;
+
+        if(sfw_error(data->writer) != NULL)
+            FatalError("%s", sfw_error(data->writer));
+
+        if(sfw_reserve(data->writer, sizeof(TcpdumpRecordHdr) + pkth->caplen, 0))
+            return;
+
+        hdr.ts_sec = (u_int32_t)pkth->ts.tv_sec;
+        hdr.ts_usec = (u_int32_t)pkth->ts.tv_usec;
+        hdr.caplen = pkth->caplen;
+        hdr.len = pkth->len;
+
+        sfw_copy(data->writer, &hdr, sizeof(TcpdumpRecordHdr));
+        sfw_copy(data->writer, pkt, pkth->caplen);
+        sfw_commit(data->writer);
+        return;
     }
+#endif
+
+    /* sizeof(struct pcap_pkthdr) = 16 bytes */
+    pcap_dump((u_char *)data->dumpd, pkth, pkt);
+}
+
+/*
+ * Function: TcpdumpFlush(LogTcpdumpData *)
+ *
+ * Purpose: Push logged packets to the file after each event unless -f
+ *          was given.  The writer thread keeps the async log current by
+ *          itself, and an async log without threads is flushed at most
+ *          once a second.
+ *
+ * Arguments: data => pointer to the plugin's reference data struct
+ *
+ * Returns: void function
+ */
+static void TcpdumpFlush(LogTcpdumpData *data)
+{
+    time_t now;
+
+#ifdef SF_WRITER_THREADS
+    if(data->writer != NULL)
+        return;
+#endif
+
+    if(pv.line_buffer_flag)
+        return;
+
+    if(data->ring_size)
+    {
+        now = time(NULL);
+
+        if(now == data->last_flush)
+            return;
+
+        data->last_flush = now;
+    }
+
+#ifdef WIN32
+    fflush( NULL );  /* flush all open output streams */
+#else
+    /* we happen to know that pcap_dumper_t* is really just a FILE* */
+    fflush( (FILE*) data->dumpd );
+#endif
 }
 
 void TcpdumpInitLogFileFinalize(int unused, void *arg)
@@ -329,6 +589,9 @@ void TcpdumpInitLogFile(LogTcpdumpData *data)
             free(data->filename);
             data->filename = strdup(logdir);
         }
+
+        if(data->ring_size)
+            TcpdumpStartWriter(data);
     }
 
     return;
@@ -353,6 +616,8 @@ void SpoLogTcpdumpCleanExitFunc(int signal, void *arg)
 
     DEBUG_WRAP(DebugMessage(DEBUG_LOG,"SpoLogTcpdumpCleanExitFunc\n"););
 
+    TcpdumpStopWriter(data);
+
     /* close the output file */
     if( data->dumpd != NULL )
     {
@@ -398,6 +663,8 @@ void SpoLogTcpdumpRestartFunc(int signal, void *arg)
 
     DEBUG_WRAP(DebugMessage(DEBUG_LOG,"SpoLogTcpdumpRestartFunc\n"););
 
+    TcpdumpStopWriter(data);
+
     if( data->dumpd != NULL )
     {
         pcap_dump_close(data->dumpd); 
@@ -427,7 +694,7 @@ void SpoLogTcpdumpRestartFunc(int signal, void *arg)
 void DirectLogTcpdump(struct pcap_pkthdr *ph, u_int8_t *pkt)
 {
     pc.log_pkts++;
-    pcap_dump((u_char *)log_tcpdump_ptr->dumpd, ph, pkt);
+    TcpdumpWrite(log_tcpdump_ptr, ph, pkt);
     return;
 }
         
@@ -49,6 +49,7 @@
 #endif
 #include <errno.h>
 #include <time.h>
+#include <sys/time.h>
 
 #include "decode.h"
 #include "rules.h"
@@ -71,6 +72,10 @@
 #include "inline.h"
 #endif
 
+/* the async writer needs threads, without them "async" is accepted and
+   the spool is written inline */
+#include "sfwriter.h"
+
 #define SNORT_MAGIC     0xa1b2c3d4
 #define ALERT_MAGIC     0xDEAD4137  /* alert magic, just accept it */
 #define LOG_MAGIC       0xDEAD1080  /* log magic, what's 31337-speak for G? */
@@ -148,12 +153,20 @@ extern ipq_packet_msg_t *g_m;
 #endif
 
 /* ------------------ Data structures --------------------------*/
+#define UNIFIED_RING_DEFAULT   8     /* MB */
+#define UNIFIED_RING_MAX       256   /* MB */
+
 typedef struct _UnifiedConfig
 {
     char *filename;
     FILE *stream;
     unsigned int limit;
     unsigned int current;
+    int (*rotate)(struct _UnifiedConfig *, char *);
+    unsigned int ring_size;         /* async ring in bytes, 0 writes inline */
+#ifdef SF_WRITER_THREADS
+    SF_WRITER *writer;
+#endif
 } UnifiedConfig;
 
 typedef struct _FileHeader
@@ -183,11 +196,20 @@ static UnifiedConfig *UnifiedParseArgs(char *, char *);
 static void UnifiedCleanExit(int, void *);
 static void UnifiedRestart(int, void *);
 static void UnifiedLogInitFinalize(int, void *);
+static int UnifiedOpenFile(UnifiedConfig *, char *, char *);
+
+/* Spool record output, inline or through the async ring */
+static int UnifiedRecordStart(UnifiedConfig *, u_int32_t);
+static void UnifiedRecordWrite(UnifiedConfig *, void *, u_int32_t);
+static void UnifiedRecordEnd(UnifiedConfig *);
+static void UnifiedFlush(UnifiedConfig *);
+static void UnifiedStartWriter(int, void *);
+static void UnifiedStopWriter(UnifiedConfig *);
 
 /* Unified Output functions */
 static void UnifiedInit(u_char *);
-static void UnifiedInitFile(UnifiedConfig *);
-static void UnifiedRotateFile(UnifiedConfig *);
+static int UnifiedInitFile(UnifiedConfig *, char *);
+static int UnifiedRotateFile(UnifiedConfig *, char *);
 static void UnifiedLogAlert(Packet *, char *, void *, Event *);
 static void UnifiedLogPacketAlert(Packet *, char *, void *, Event *);
 static void RealUnifiedLogAlert(Packet *, char *, void *, Event *, 
@@ -195,20 +217,20 @@ static void RealUnifiedLogAlert(Packet *, char *, void *, Event *,
 static void RealUnifiedLogPacketAlert(Packet *, char *, void *, Event *, 
         DataHeader *);
 void RealUnifiedLogStreamAlert(Packet *,char *,void *,Event *,DataHeader *);
-static void UnifiedRotateFile(UnifiedConfig *data);
 
 /* Unified Alert functions (deprecated) */
 static void UnifiedAlertInit(u_char *);
-static void UnifiedInitAlertFile(UnifiedConfig *);
-static void UnifiedAlertRotateFile(UnifiedConfig *data);
+static int UnifiedInitAlertFile(UnifiedConfig *, char *);
+static int UnifiedAlertRotateFile(UnifiedConfig *, char *);
 static void OldUnifiedLogAlert(Packet *, char *, void *, Event *);
 
 
 /* Unified Packet Log functions (deprecated) */
 static void UnifiedLogInit(u_char *);
-static void UnifiedInitLogFile(UnifiedConfig *);
+static int UnifiedInitLogFile(UnifiedConfig *, char *);
+static int UnifiedLogWriteHeader(UnifiedConfig *, char *);
 static void OldUnifiedLogPacketAlert(Packet *, char *, void *, Event *);
-static void UnifiedLogRotateFile(UnifiedConfig *data);
+static int UnifiedLogRotateFile(UnifiedConfig *, char *);
 
 
 static UnifiedConfig *unifiedConfig;
@@ -249,6 +271,8 @@ void UnifiedSetup()
  */
 void UnifiedInit(u_char *args)
 {
+    char errbuf[STD_BUF];
+
     if(unifiedConfig)
     {
         FatalError("unified can only be instantiated once\n");
@@ -260,8 +284,13 @@ void UnifiedInit(u_char *args)
 
     /* parse the argument list from the rules file */
     unifiedConfig = UnifiedParseArgs(args, "snort-unified");
+    unifiedConfig->rotate = UnifiedRotateFile;
+
+    if(UnifiedInitFile(unifiedConfig, errbuf))
+        FatalError("%s", errbuf);
 
-    UnifiedInitFile(unifiedConfig);
+    if(unifiedConfig->ring_size)
+        AddFuncToPostConfigList(UnifiedStartWriter, unifiedConfig);
 
     //LogMessage("UnifiedFilename = %s\n", unifiedConfig->filename);
     /* Set the preprocessor function into the function list */
@@ -273,26 +302,27 @@ void UnifiedInit(u_char *args)
 }
 
 /*
- * Function: InitOutputFile()
+ * Function: UnifiedOpenFile(UnifiedConfig *, char *, char *)
  *
- * Purpose: Initialize the unified ouput file 
+ * Purpose: Open a new spool file named after the configured file and
+ *          the current time.  Errors are handed back rather than fatal
+ *          since rotations run on the async writer thread.
  *
  * Arguments: data => pointer to the plugin's reference data struct 
+ *            mode => fopen() mode
+ *            errbuf => STD_BUF bytes for the error message
  *
- * Returns: void function
+ * Returns: 0 on success, -1 on error
  */
-static void UnifiedInitFile(UnifiedConfig *data)
+static int UnifiedOpenFile(UnifiedConfig *data, char *mode, char *errbuf)
 {
     time_t curr_time;      /* place to stick the clock data */
     char logdir[STD_BUF];
-    FileHeader hdr;
     int value;
 
     bzero(logdir, STD_BUF);
     curr_time = time(NULL);
-
-    if(data == NULL)
-        FatalError("SpoUnified: Unable to get context data\n");
+    data->stream = NULL;
 
     if(*(data->filename) == '/')
         value = snprintf(logdir, STD_BUF, "%s.%lu", data->filename, 
@@ -302,12 +332,40 @@ static void UnifiedInitFile(UnifiedConfig *data)
                 data->filename, (unsigned long)curr_time);
 
     if(value == -1)
-        FatalError("SpoUnified: filepath too long\n");
+    {
+        snprintf(errbuf, STD_BUF, "unified log file logging path and file "
+                 "name are too long, aborting!\n");
+        return -1;
+    }
 
-    //printf("Opening %s\n", logdir);
+    DEBUG_WRAP(DebugMessage(DEBUG_LOG, "Opening %s\n", logdir););
 
-    if((data->stream = fopen(logdir, "wb")) == NULL)
-        FatalError("UnifiedInitLogFile(%s): %s\n", logdir, strerror(errno));
+    if((data->stream = fopen(logdir, mode)) == NULL)
+    {
+        snprintf(errbuf, STD_BUF, "SpoUnified: unable to open %s: %s\n",
+                 logdir, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Function: UnifiedInitFile(UnifiedConfig *, char *)
+ *
+ * Purpose: Initialize the unified ouput file 
+ *
+ * Arguments: data => pointer to the plugin's reference data struct 
+ *            errbuf => STD_BUF bytes for the error message
+ *
+ * Returns: 0 on success, -1 on error
+ */
+static int UnifiedInitFile(UnifiedConfig *data, char *errbuf)
+{
+    FileHeader hdr;
+
+    if(UnifiedOpenFile(data, "wb", errbuf))
+        return -1;
 
     /* write the log file header */
     hdr.magic = UNIFIED_MAGIC;
@@ -315,24 +373,256 @@ static void UnifiedInitFile(UnifiedConfig *data)
 
     if(fwrite((char *)&hdr, sizeof(hdr), 1, data->stream) != 1)
     {
-        FatalError("SpoUnified: InitOutputFile(): %s", strerror(errno));
+        snprintf(errbuf, STD_BUF, "SpoUnified: InitOutputFile(): %s\n",
+                 strerror(errno));
+        return -1;
     }
 
     fflush(data->stream);
 
-    return;
+    return 0;
 }
 
-void UnifiedRotateFile(UnifiedConfig *data)
+static int UnifiedRotateFile(UnifiedConfig *data, char *errbuf)
 {
     fclose(data->stream);
-    data->current = 0;
-    UnifiedInitFile(data);
+    return UnifiedInitFile(data, errbuf);
+}
+
+#ifdef SF_WRITER_THREADS
+/*
+ * Function: UnifiedWriterWrite(void *, void *, unsigned, char *, int)
+ *
+ * Purpose: Write a run of spooled records to the file, on the writer
+ *          thread
+ *
+ * Arguments: arg => pointer to the plugin's reference data struct
+ *            buf => bytes to write
+ *            len => number of bytes
+ *            errbuf => room for the error message
+ *            errlen => size of errbuf
+ *
+ * Returns: 0 on success, -1 on error
+ */
+static int UnifiedWriterWrite(void *arg, void *buf, unsigned len,
+                              char *errbuf, int errlen)
+{
+    UnifiedConfig *data = (UnifiedConfig *)arg;
+
+    if(fwrite(buf, len, 1, data->stream) != 1 || fflush(data->stream))
+    {
+        snprintf(errbuf, errlen, "SpoUnified: write failed: %s\n",
+                 strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Function: UnifiedWriterRotate(void *, char *, int)
+ *
+ * Purpose: Start the next spool file, on the writer thread
+ *
+ * Arguments: arg => pointer to the plugin's reference data struct
+ *            errbuf => room for the error message
+ *            errlen => size of errbuf
+ *
+ * Returns: 0 on success, -1 on error
+ */
+static int UnifiedWriterRotate(void *arg, char *errbuf, int errlen)
+{
+    UnifiedConfig *data = (UnifiedConfig *)arg;
+    char buf[STD_BUF];
+
+    if(data->rotate(data, buf))
+    {
+        snprintf(errbuf, errlen, "%s", buf);
+        return -1;
+    }
+
+    return 0;
+}
+#endif
+
+/*
+ * Function: UnifiedStartWriter(int, void *)
+ *
+ * Purpose: Allocate the ring and start the writer thread.  This runs
+ *          from the post config list so the thread is created after
+ *          snort has daemonized and dropped privileges.
+ *
+ * Arguments: unused
+ *            arg => pointer to the plugin's reference data struct
+ *
+ * Returns: void function
+ */
+static void UnifiedStartWriter(int unused, void *arg)
+{
+#ifdef SF_WRITER_THREADS
+    UnifiedConfig *data = (UnifiedConfig *)arg;
+
+    data->writer = sfw_new(data->ring_size, UnifiedWriterWrite,
+                           UnifiedWriterRotate, data);
+
+    if(data->writer == NULL)
+        FatalError("SpoUnified: unable to start writer thread: %s\n",
+                   strerror(errno));
+
+    LogMessage("SpoUnified: %s written through a %uKB ring\n",
+               data->filename, data->writer->size >> 10);
+#endif
+}
+
+/*
+ * Function: UnifiedStopWriter(UnifiedConfig *)
+ *
+ * Purpose: Let the writer flush the ring, wait for it and report how
+ *          full the ring got and how many records it had to drop.
+ *
+ * Arguments: data => pointer to the plugin's reference data struct
+ *
+ * Returns: void function
+ */
+static void UnifiedStopWriter(UnifiedConfig *data)
+{
+#ifdef SF_WRITER_THREADS
+    SF_WRITER *w = data->writer;
+
+    if(w == NULL)
+        return;
+
+    sfw_stop(w);
+
+    if(sfw_error(w) != NULL)
+        ErrorMessage("%s", sfw_error(w));
+
+    LogMessage("SpoUnified: %s ring: %lu records, %lu dropped, "
+               "high water %u of %u bytes\n", data->filename,
+               w->records, w->drops, w->hiwater, w->size);
+
+    sfw_free(w);
+    data->writer = NULL;
+#endif
+}
+
+/*
+ * Function: UnifiedRecordStart(UnifiedConfig *, u_int32_t)
+ *
+ * Purpose: Open a spool record of at most size bytes, rotating the file
+ *          first if the record would push it over the limit.  With the
+ *          async writer the space is reserved in the ring; when the ring
+ *          is full the record is dropped rather than blocking the packet
+ *          thread, and the following writes are ignored.  An error the
+ *          writer thread ran into is raised here.
+ *
+ * Arguments: data => pointer to the plugin's reference data struct
+ *            size => upper bound of the bytes about to be written
+ *
+ * Returns: 0 if the record will be written, -1 if it was dropped
+ */
+static int UnifiedRecordStart(UnifiedConfig *data, u_int32_t size)
+{
+    char errbuf[STD_BUF];
+    int rotate = (data->current + size) > data->limit;
+
+#ifdef SF_WRITER_THREADS
+    if(data->writer != NULL)
+    {
+        if(sfw_error(data->writer) != NULL)
+            FatalError("%s", sfw_error(data->writer));
+
+        if(sfw_reserve(data->writer, size, rotate))
+            return -1;
+
+        if(rotate)
+            data->current = 0;
+
+        return 0;
+    }
+#endif
+
+    if(rotate)
+    {
+        if(data->rotate(data, errbuf))
+            FatalError("%s", errbuf);
+
+        data->current = 0;
+    }
+
+    return 0;
+}
+
+/*
+ * Function: UnifiedRecordWrite(UnifiedConfig *, void *, u_int32_t)
+ *
+ * Purpose: Append part of the open record
+ *
+ * Arguments: data => pointer to the plugin's reference data struct
+ *            buf => bytes to write
+ *            len => number of bytes
+ *
+ * Returns: void function
+ */
+static void UnifiedRecordWrite(UnifiedConfig *data, void *buf, u_int32_t len)
+{
+#ifdef SF_WRITER_THREADS
+    if(data->writer != NULL)
+    {
+        sfw_copy(data->writer, buf, len);
+
+        if(data->writer->open)
+            data->current += len;
+
+        return;
+    }
+#endif
+
+    if(fwrite(buf, len, 1, data->stream) != 1)
+        FatalError("SpoUnified: write failed: %s\n", strerror(errno));
+
+    data->current += len;
+}
+
+/*
+ * Function: UnifiedRecordEnd(UnifiedConfig *)
+ *
+ * Purpose: Close the open record.  Async output is published to the
+ *          writer thread, inline output stays in the stdio buffer until
+ *          UnifiedFlush().
+ *
+ * Arguments: data => pointer to the plugin's reference data struct
+ *
+ * Returns: void function
+ */
+static void UnifiedRecordEnd(UnifiedConfig *data)
+{
+#ifdef SF_WRITER_THREADS
+    if(data->writer != NULL)
+        sfw_commit(data->writer);
+#endif
+}
+
+/*
+ * Function: UnifiedFlush(UnifiedConfig *)
+ *
+ * Purpose: Push inline output to the file, the writer thread flushes
+ *          the async spool itself after every drain.
+ *
+ * Arguments: data => pointer to the plugin's reference data struct
+ *
+ * Returns: void function
+ */
+static void UnifiedFlush(UnifiedConfig *data)
+{
+#ifdef SF_WRITER_THREADS
+    if(data->writer != NULL)
+        return;
+#endif
+
+    fflush(data->stream);
 }
 
-/* buffer */
-static char write_pkt_buffer[sizeof(DataHeader)+IP_MAXPACKET];
-/* buffer */
 int UnifiedLogData(u_int32_t type, u_int32_t length, void *data)
 {
     DataHeader dHdr;
@@ -354,29 +644,17 @@ int UnifiedLogData(u_int32_t type, u_int32_t length, void *data)
         LogMessage("Empty Alert ....LogUnified bailing \n");
         return -1;
     }
-    memset(write_pkt_buffer,'\0',sizeof(DataHeader)+IP_MAXPACKET);
 
     dHdr.type = type;
     dHdr.length = length;
-   
-    memcpy(write_pkt_buffer,&dHdr,sizeof(DataHeader));
-    memcpy(write_pkt_buffer+sizeof(DataHeader),(char *)data,length);
 
-/*
-    if(fwrite((char *)&dHdr, sizeof(DataHeader), 1, unifiedConfig->stream) 
-            != 1)
-    {
-        FatalError("SpoUnified: write failed: %s\n", strerror(errno));
-    }
+    if(UnifiedRecordStart(unifiedConfig, sizeof(DataHeader) + length))
+        return -1;
 
-    if(fwrite((char *)data, length, 1, unifiedConfig->stream) != 1)
-    {
-*/
-    if(fwrite(write_pkt_buffer,length+sizeof(DataHeader),1,unifiedConfig->stream) != 1)
-    {
-        FatalError("SpoUnified: write failed: %s\n", strerror(errno));
-    }
-    fflush(unifiedConfig->stream);
+    UnifiedRecordWrite(unifiedConfig, &dHdr, sizeof(DataHeader));
+    UnifiedRecordWrite(unifiedConfig, data, length);
+    UnifiedRecordEnd(unifiedConfig);
+    UnifiedFlush(unifiedConfig);
 
     return 0;
 }
@@ -465,30 +743,16 @@ void RealUnifiedLogAlert(Packet *p, char *msg, void *arg, Event *event,
     }
     
     /* backward compatibility stuff */
-    if(dHdr == NULL)
-    {
-        if((data->current + sizeof(UnifiedAlert)) > data->limit)
-            UnifiedAlertRotateFile(data);
-    }
-    else
-    {
-        if((data->current + sizeof(UnifiedAlert)) > data->limit)
-            UnifiedRotateFile(data);
-    }
+    if(UnifiedRecordStart(data, (dHdr ? sizeof(DataHeader) : 0) +
+                sizeof(UnifiedAlert)))
+        return;
 
     if(dHdr)
-    {
-        if(fwrite((char *)dHdr, sizeof(DataHeader), 1, data->stream) != 1)
-            FatalError("SpoUnified: write failed: %s\n", strerror(errno));
-        data->current += sizeof(DataHeader);
-    }
-    
-    if(fwrite((char *)&alertdata, sizeof(UnifiedAlert), 1, data->stream) != 1)
-            FatalError("SpoUnified: write failed: %s\n", strerror(errno));
-
+        UnifiedRecordWrite(data, dHdr, sizeof(DataHeader));
 
-    fflush(data->stream);
-    data->current += sizeof(UnifiedAlert);
+    UnifiedRecordWrite(data, &alertdata, sizeof(UnifiedAlert));
+    UnifiedRecordEnd(data);
+    UnifiedFlush(data);
 }
 
 
@@ -563,38 +827,20 @@ void RealUnifiedLogPacketAlert(Packet *p, char *msg, void *arg, Event *event,
     }
     
     /* backward compatibility stuff */
-    if(dHdr == NULL)
-    {
-        if((data->current + sizeof(UnifiedLog) + logheader.pkth.caplen) > 
-                data->limit)
-            UnifiedLogRotateFile(data);
-    }
-    else
-    {   
-        if((data->current + sizeof(UnifiedLog) + sizeof(DataHeader) 
-                    + logheader.pkth.caplen) > data->limit)
-            UnifiedRotateFile(data);
-    }
+    if(UnifiedRecordStart(data, (dHdr ? sizeof(DataHeader) : 0) +
+                sizeof(UnifiedLog) + logheader.pkth.caplen))
+        return;
+
     if(dHdr)
-    {
-        if(fwrite((char *)dHdr, sizeof(DataHeader), 1, data->stream) != 1)
-            FatalError("SpoUnified: write failed: %s\n", strerror(errno));
-        data->current += sizeof(DataHeader);
-    }
-        
-    
-    if(fwrite((char*)&logheader, sizeof(UnifiedLog), 1, data->stream) != 1)
-        FatalError("SpoUnified: write failed: %s\n", strerror(errno));
-    data->current += sizeof(UnifiedLog);
-    
+        UnifiedRecordWrite(data, dHdr, sizeof(DataHeader));
+
+    UnifiedRecordWrite(data, &logheader, sizeof(UnifiedLog));
+
     if(p)
-    {
-        if(fwrite((char*)p->pkt, p->pkth->caplen, 1, data->stream) != 1)
-            FatalError("SpoUnified: write failed: %s\n", strerror(errno));
-        data->current += p->pkth->caplen;
-    }
+        UnifiedRecordWrite(data, p->pkt, p->pkth->caplen);
 
-    fflush(data->stream);
+    UnifiedRecordEnd(data);
+    UnifiedFlush(data);
 }
 
 typedef struct _UnifiedLogStreamCallbackData
@@ -623,47 +869,22 @@ int UnifiedLogStreamCallback(SnortPktHeader *pkth, u_int8_t *packet_data,
     memcpy(&(unifiedData->logheader->pkth), pkth, sizeof(SnortPktHeader));
 
     /* backward compatibility stuff */
-    if(unifiedData->dHdr == NULL)
+    if(!UnifiedRecordStart(unifiedData->data,
+                (unifiedData->dHdr ? sizeof(DataHeader) : 0) +
+                sizeof(UnifiedLog) + unifiedData->logheader->pkth.caplen))
     {
-        if((unifiedData->data->current +
-            sizeof(UnifiedLog)+
-            unifiedData->logheader->pkth.caplen) > 
-            unifiedData->data->limit)
-        {
-            UnifiedLogRotateFile(unifiedData->data);
-        }
-    }
-    else
-    {   
-        if((unifiedData->data->current + sizeof(UnifiedLog) + sizeof(DataHeader) 
-                    + unifiedData->logheader->pkth.caplen) > unifiedData->data->limit)
-            UnifiedRotateFile(unifiedData->data);
-    }
-
-    if(unifiedData->dHdr)
-    {
-        if(fwrite((char*)unifiedData->dHdr,sizeof(DataHeader),1,unifiedData->data->stream) 
-                != 1)
-            FatalError("SpoUnified: write failed: %s\n", 
-                    strerror(errno));
-        unifiedData->data->current += sizeof(DataHeader);
-    }
+        if(unifiedData->dHdr)
+            UnifiedRecordWrite(unifiedData->data, unifiedData->dHdr,
+                    sizeof(DataHeader));
 
-    if(fwrite((char*)unifiedData->logheader,sizeof(UnifiedLog),1,unifiedData->data->stream)
-           != 1)
-        FatalError("SpoUnified: write failed: %s\n", 
-                strerror(errno));
+        UnifiedRecordWrite(unifiedData->data, unifiedData->logheader,
+                sizeof(UnifiedLog));
 
-    unifiedData->data->current += sizeof(UnifiedLog);
+        if(packet_data)
+            UnifiedRecordWrite(unifiedData->data, packet_data,
+                    unifiedData->logheader->pkth.caplen);
 
-    if(packet_data)
-    {
-        if(fwrite((char*)packet_data,unifiedData->logheader->pkth.caplen,1
-                    ,unifiedData->data->stream) != 1)
-            FatalError("SpoUnified: write failed: %s\n", 
-                    strerror(errno));
-
-        unifiedData->data->current += unifiedData->logheader->pkth.caplen;
+        UnifiedRecordEnd(unifiedData->data);
     }
 
     /* after the first logged packet modify the event headers */
@@ -734,8 +955,8 @@ void RealUnifiedLogStreamAlert(Packet *p, char *msg, void *arg, Event *event,
         unifiedData.once = once;
         stream_api->traverse_reassembled(p, UnifiedLogStreamCallback, &unifiedData);
     }
-    
-    fflush(data->stream);
+
+    UnifiedFlush(data);
 }
 
 /*
@@ -755,6 +976,7 @@ UnifiedConfig *UnifiedParseArgs(char *args, char *default_filename)
 {
     UnifiedConfig *tmp;
     int limit = 0;
+    int ring = 0;
 
     tmp = (UnifiedConfig *)calloc(sizeof(UnifiedConfig), sizeof(char));
 
@@ -801,6 +1023,20 @@ UnifiedConfig *UnifiedParseArgs(char *args, char *default_filename)
                             file_name, file_line, index);
                 }
             }
+            if(strcasecmp("async", stoks[0]) == 0)
+            {
+                if(num_stoks > 1)
+                    ring = atoi(stoks[1]);
+                else
+                    ring = UNIFIED_RING_DEFAULT;
+
+                if(ring <= 0)
+                {
+                    LogMessage("Argument Error in %s(%i): %s\n",
+                            file_name, file_line, index);
+                    ring = 0;
+                }
+            }
             mSplitFree(&stoks, num_stoks);
         }
         mSplitFree(&toks, num_toks);
@@ -824,6 +1060,24 @@ UnifiedConfig *UnifiedParseArgs(char *args, char *default_filename)
     /* convert the limit to "MB" */
     tmp->limit = limit << 20;
 
+    if(ring > UNIFIED_RING_MAX)
+    {
+        LogMessage("spo_unified %s(%d)=> Lowering async ring of %iMB to %iMB\n",
+                file_name, file_line, ring, UNIFIED_RING_MAX);
+        ring = UNIFIED_RING_MAX;
+    }
+
+#ifdef SF_WRITER_THREADS
+    if(ring > 0)
+        tmp->ring_size = (unsigned int)ring << 20;
+#else
+    if(ring > 0)
+    {
+        LogMessage("spo_unified %s(%d)=> async output needs pthread support, "
+                "writing inline\n", file_name, file_line);
+    }
+#endif
+
     return tmp;
 }
 
@@ -845,7 +1099,10 @@ static void UnifiedCleanExit(int signal, void *arg)
 
     DEBUG_WRAP(DebugMessage(DEBUG_FLOW, "SpoUnified: CleanExit\n"););
 
-    fclose(data->stream);
+    UnifiedStopWriter(data);
+
+    if(data->stream != NULL)
+        fclose(data->stream);
 
     /* free up initialized memory */
     free(data->filename);
@@ -870,7 +1127,10 @@ static void UnifiedRestart(int signal, void *arg)
 
     DEBUG_WRAP(DebugMessage(DEBUG_FLOW, "SpoUnified: Restart\n"););
 
-    fclose(data->stream);
+    UnifiedStopWriter(data);
+
+    if(data->stream != NULL)
+        fclose(data->stream);
     free(data->filename);
     free(data);
 }
@@ -881,6 +1141,7 @@ static void UnifiedRestart(int signal, void *arg)
 void UnifiedAlertInit(u_char *args)
 {
     UnifiedConfig *data;
+    char errbuf[STD_BUF];
 
     DEBUG_WRAP(DebugMessage(DEBUG_INIT, "Output: Unified Alert Initialized\n"););
 
@@ -888,8 +1149,13 @@ void UnifiedAlertInit(u_char *args)
 
     /* parse the argument list from the rules file */
     data = UnifiedParseArgs(args, "snort-unified.alert");
+    data->rotate = UnifiedAlertRotateFile;
+
+    if(UnifiedInitAlertFile(data, errbuf))
+        FatalError("%s", errbuf);
 
-    UnifiedInitAlertFile(data);
+    if(data->ring_size)
+        AddFuncToPostConfigList(UnifiedStartWriter, data);
 
 
     //LogMessage("UnifiedAlertFilename = %s\n", data->filename);
@@ -899,43 +1165,21 @@ void UnifiedAlertInit(u_char *args)
     AddFuncToRestartList(UnifiedRestart, data);
 }
 /*
- * Function: UnifiedInitAlertFile()
+ * Function: UnifiedInitAlertFile(UnifiedConfig *, char *)
  *
  * Purpose: Initialize the unified log alert file
  *
  * Arguments: data => pointer to the plugin's reference data struct 
+ *            errbuf => STD_BUF bytes for the error message
  *
- * Returns: void function
+ * Returns: 0 on success, -1 on error
  */
-void UnifiedInitAlertFile(UnifiedConfig *data)
+static int UnifiedInitAlertFile(UnifiedConfig *data, char *errbuf)
 {
-    time_t curr_time;      /* place to stick the clock data */
-    char logdir[STD_BUF];
-    int value;
     UnifiedAlertFileHeader hdr;
 
-    bzero(logdir, STD_BUF);
-    curr_time = time(NULL);
-
-    if(data->filename[0] == '/')
-        value = snprintf(logdir, STD_BUF, "%s.%lu",  data->filename, 
-                (unsigned long)curr_time);
-    else
-        value = snprintf(logdir, STD_BUF, "%s/%s.%lu", pv.log_dir, 
-                data->filename, (unsigned long)curr_time);
-
-    if(value == -1)
-    {
-        FatalError("unified log file logging path and file name are "
-                   "too long, aborting!\n");
-    }
-
-    DEBUG_WRAP(DebugMessage(DEBUG_LOG, "Opening %s\n", logdir););
-
-    if((data->stream = fopen(logdir, "wb+")) == NULL)
-    {
-        FatalError("UnifiedInitAlertFile(%s): %s\n", logdir, strerror(errno));
-    }
+    if(UnifiedOpenFile(data, "wb+", errbuf))
+        return -1;
 
     hdr.magic = ALERT_MAGIC;
     hdr.version_major = 1;
@@ -944,12 +1188,14 @@ void UnifiedInitAlertFile(UnifiedConfig *data)
 
     if(fwrite((char *)&hdr, sizeof(hdr), 1, data->stream) != 1)
     {
-        FatalError("UnifiedAlertInit(): %s\n", strerror(errno));
+        snprintf(errbuf, STD_BUF, "UnifiedAlertInit(): %s\n",
+                 strerror(errno));
+        return -1;
     }
         
     fflush(data->stream);
 
-    return;
+    return 0;
 }
 
 
@@ -958,12 +1204,11 @@ void OldUnifiedLogAlert(Packet *p, char *msg, void *arg, Event *event)
     RealUnifiedLogAlert(p, msg, arg, event, NULL);
 }
 
-void UnifiedAlertRotateFile(UnifiedConfig *data)
+static int UnifiedAlertRotateFile(UnifiedConfig *data, char *errbuf)
 {
 
     fclose(data->stream);
-    data->current = 0;
-    UnifiedInitAlertFile(data);
+    return UnifiedInitAlertFile(data, errbuf);
 }
 
 /* Unified Packet Log functions (deprecated) */
@@ -971,6 +1216,7 @@ void UnifiedAlertRotateFile(UnifiedConfig *data)
 void UnifiedLogInit(u_char *args)
 {
     UnifiedConfig *UnifiedInfo;
+    char errbuf[STD_BUF];
 
     DEBUG_WRAP(DebugMessage(DEBUG_INIT, "Output: Unified Log Initialized\n"););
 
@@ -982,9 +1228,16 @@ void UnifiedLogInit(u_char *args)
 
     //LogMessage("UnifiedLogFilename = %s\n", UnifiedInfo->filename);
 
-    UnifiedInitLogFile(UnifiedInfo);
+    UnifiedInfo->rotate = UnifiedLogRotateFile;
+
+    if(UnifiedInitLogFile(UnifiedInfo, errbuf))
+        FatalError("%s", errbuf);
+
     AddFuncToPostConfigList(UnifiedLogInitFinalize, UnifiedInfo);
 
+    if(UnifiedInfo->ring_size)
+        AddFuncToPostConfigList(UnifiedStartWriter, UnifiedInfo);
+
     pv.log_bitmap |= LOG_UNIFIED;
 
     /* Set the preprocessor function into the function list */
@@ -996,72 +1249,27 @@ void UnifiedLogInit(u_char *args)
 static void UnifiedLogInitFinalize(int unused, void *arg)
 {
     UnifiedConfig *data = (UnifiedConfig *)arg;
-    UnifiedLogFileHeader hdr;
+    char errbuf[STD_BUF];
 
-    /* write the log file header */
-    hdr.magic = LOG_MAGIC;
-    hdr.version_major = SNORT_VERSION_MAJOR;
-    hdr.version_minor = SNORT_VERSION_MINOR;
-    hdr.timezone = thiszone;
-    hdr.snaplen = snaplen;
-    hdr.sigfigs = 0;
-    hdr.linktype = datalink;
-
-#ifdef GIDS
-    hdr.linktype = DLT_EN10MB;
-#endif
-
-    if(fwrite((char *)&hdr, sizeof(hdr), 1, data->stream) != 1)
-    {
-        FatalError("UnifiedLogInitFinalize(): %s", strerror(errno));
-    }
-
-    fflush(data->stream);
+    if(UnifiedLogWriteHeader(data, errbuf))
+        FatalError("%s", errbuf);
 }
 
 /*
- * Function: UnifiedInitLogFile()
+ * Function: UnifiedLogWriteHeader(UnifiedConfig *, char *)
  *
- * Purpose: Initialize the unified log file header
+ * Purpose: Write the pcap style header of the unified log file, once
+ *          the datalink and snaplen are known
  *
  * Arguments: data => pointer to the plugin's reference data struct 
+ *            errbuf => STD_BUF bytes for the error message
  *
- * Returns: void function
+ * Returns: 0 on success, -1 on error
  */
-void UnifiedInitLogFile(UnifiedConfig *data)
+static int UnifiedLogWriteHeader(UnifiedConfig *data, char *errbuf)
 {
-    time_t curr_time;      /* place to stick the clock data */
-    char logdir[STD_BUF];
-    int value;
-    //UnifiedLogFileHeader hdr;
-
-    bzero(logdir, STD_BUF);
-    curr_time = time(NULL);
-
-    if(data == NULL)
-    {
-        FatalError("Can't get unified plugin context, that's bad\n");
-    }
-
-    if(*(data->filename) == '/')
-        value = snprintf(logdir, STD_BUF, "%s.%lu", data->filename, 
-                (unsigned long)curr_time);
-    else
-        value = snprintf(logdir, STD_BUF, "%s/%s.%lu", pv.log_dir,  
-                data->filename, (unsigned long)curr_time);
-
-    if(value == -1)
-    {
-        FatalError("unified log file logging path and file name are "
-                   "too long, aborting!\n");
-    }
-
-    if((data->stream = fopen(logdir, "wb")) == NULL)
-    {
-        FatalError("UnifiedInitLogFile(%s): %s\n", logdir, strerror(errno));
-    }
+    UnifiedLogFileHeader hdr;
 
-#if 0
     /* write the log file header */
     hdr.magic = LOG_MAGIC;
     hdr.version_major = SNORT_VERSION_MAJOR;
@@ -1077,13 +1285,30 @@ void UnifiedInitLogFile(UnifiedConfig *data)
 
     if(fwrite((char *)&hdr, sizeof(hdr), 1, data->stream) != 1)
     {
-        FatalError("UnifiedLogInit(): %s", strerror(errno));
+        snprintf(errbuf, STD_BUF, "UnifiedLogInitFinalize(): %s\n",
+                 strerror(errno));
+        return -1;
     }
-#endif
 
     fflush(data->stream);
 
-    return;
+    return 0;
+}
+
+/*
+ * Function: UnifiedInitLogFile(UnifiedConfig *, char *)
+ *
+ * Purpose: Initialize the unified log file, its header is written by
+ *          UnifiedLogWriteHeader()
+ *
+ * Arguments: data => pointer to the plugin's reference data struct 
+ *            errbuf => STD_BUF bytes for the error message
+ *
+ * Returns: 0 on success, -1 on error
+ */
+static int UnifiedInitLogFile(UnifiedConfig *data, char *errbuf)
+{
+    return UnifiedOpenFile(data, "wb", errbuf);
 }
 
 typedef struct _OldUnifiedLogStreamCallbackData
@@ -1104,6 +1329,8 @@ int OldUnifiedLogStreamCallback(SnortPktHeader *pkth, u_int8_t *packet_data,
         void *userdata)
 {
     OldUnifiedLogStreamCallbackData *unifiedData;
+    u_int32_t reclen;
+
     if (!userdata)
         return -1;
 
@@ -1140,39 +1367,46 @@ int OldUnifiedLogStreamCallback(SnortPktHeader *pkth, u_int8_t *packet_data,
 
     }
 
-    if(fwrite((char*)unifiedData->logheader,sizeof(UnifiedLog),1,unifiedData->data->stream)
-           != 1)
-        FatalError("SpoUnified: write failed: %s\n", 
-                strerror(errno));
-
-    unifiedData->data->current += sizeof(UnifiedLog);
+    /* reserve exactly what is written below */
+    reclen = sizeof(UnifiedLog);
 
     if(packet_data)
     {
+        reclen += pkth->caplen;
 #ifdef GIDS
         if(!unifiedData->eh)
+            reclen += sizeof(EtherHdr);
+#endif
+    }
+
+    if(!UnifiedRecordStart(unifiedData->data, reclen))
+    {
+        UnifiedRecordWrite(unifiedData->data, unifiedData->logheader,
+                sizeof(UnifiedLog));
+
+        if(packet_data)
         {
+#ifdef GIDS
+            if(!unifiedData->eh)
+            {
 #ifndef IPFW
-            memcpy((u_char *)g_ethernet.ether_src,g_m->hw_addr,6);
-            memset((u_char *)g_ethernet.ether_dst,0x00,6);
+                memcpy((u_char *)g_ethernet.ether_src,g_m->hw_addr,6);
+                memset((u_char *)g_ethernet.ether_dst,0x00,6);
 #else
-            memset(g_ethernet.ether_dst,0x00,6);
-            memset(g_ethernet.ether_src,0x00,6);
+                memset(g_ethernet.ether_dst,0x00,6);
+                memset(g_ethernet.ether_src,0x00,6);
 #endif
-            g_ethernet.ether_type = htons(0x0800);
+                g_ethernet.ether_type = htons(0x0800);
 
-            if(fwrite((char*)&g_ethernet,sizeof(EtherHdr),1,unifiedData->data->stream) != 1)
-                FatalError("SpoUnified: write failed: %s\n", strerror(errno));
-            unifiedData->data->current += sizeof(EtherHdr);
-        }
+                UnifiedRecordWrite(unifiedData->data, &g_ethernet,
+                        sizeof(EtherHdr));
+            }
 #endif
-        
-        if(fwrite((char*)packet_data,pkth->caplen,1,
-                    unifiedData->data->stream) != 1)
-            FatalError("SpoUnified: write failed: %s\n", 
-                    strerror(errno));
 
-        unifiedData->data->current += pkth->caplen;
+            UnifiedRecordWrite(unifiedData->data, packet_data, pkth->caplen);
+        }
+
+        UnifiedRecordEnd(unifiedData->data);
     }
 
     /* after the first logged packet modify the event headers */
@@ -1209,6 +1443,7 @@ void OldUnifiedLogPacketAlert(Packet *p, char *msg, void *arg, Event *event)
     OldUnifiedLogStreamCallbackData unifiedData;
     int first_time = 1;
     UnifiedLog logheader;
+    u_int32_t reclen;
     UnifiedConfig *data = (UnifiedConfig *)arg;
 
     if(event != NULL)
@@ -1285,11 +1520,22 @@ void OldUnifiedLogPacketAlert(Packet *p, char *msg, void *arg, Event *event)
             logheader.pkth.pktlen = 0;
         }
 
-        if((data->current + sizeof(UnifiedLog) + logheader.pkth.caplen) > 
-                data->limit)
-            UnifiedLogRotateFile(data);
+        /* reserve exactly what is written below */
+        reclen = sizeof(UnifiedLog);
+
+        if(p)
+        {
+            reclen += p->pkth->caplen;
+#ifdef GIDS
+            if(!p->eh)
+                reclen += sizeof(EtherHdr);
+#endif
+        }
 
-        fwrite((char*)&logheader, sizeof(UnifiedLog), 1, data->stream);
+        if(UnifiedRecordStart(data, reclen))
+            return;
+
+        UnifiedRecordWrite(data, &logheader, sizeof(UnifiedLog));
 
         if(p)
         {
@@ -1305,29 +1551,28 @@ void OldUnifiedLogPacketAlert(Packet *p, char *msg, void *arg, Event *event)
 #endif
                 g_ethernet.ether_type = htons(0x0800);
 
-                if(fwrite((char*)&g_ethernet,sizeof(EtherHdr),1,data->stream) != 1)
-                    FatalError("SpoUnified: write failed: %s\n", strerror(errno));
-                data->current += sizeof(EtherHdr);
+                UnifiedRecordWrite(data, &g_ethernet, sizeof(EtherHdr));
             }
 #endif
-        
-            fwrite((char*)p->pkt, p->pkth->caplen, 1, data->stream);
+
+            UnifiedRecordWrite(data, p->pkt, p->pkth->caplen);
         }
-    }
 
-    fflush(data->stream);
+        UnifiedRecordEnd(data);
+    }
 
-    data->current += sizeof(UnifiedLog) + p->pkth->caplen;
-    
+    UnifiedFlush(data);
 }
 
 
-void UnifiedLogRotateFile(UnifiedConfig *data)
+static int UnifiedLogRotateFile(UnifiedConfig *data, char *errbuf)
 {
 
     fclose(data->stream);
-    data->current = 0;
-    UnifiedInitLogFile(data);
-    UnifiedLogInitFinalize(0, (void *)data);
+
+    if(UnifiedInitLogFile(data, errbuf))
+        return -1;
+
+    return UnifiedLogWriteHeader(data, errbuf);
 }
 
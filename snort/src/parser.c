@@ -383,6 +383,7 @@ void ParseRulesFile(char *file, int inclevel)
         LogMessage("%d Option Chains linked into %d Chain Headers\n",
                 opt_count, head_count);
         LogMessage("%d Dynamic rules\n", dynamic_rules_present);
+        LogMessage("%d distinct rule address sets\n", IpAddrSetTableCount());
         LogMessage("+++++++++++++++++++++++++++++++++++++++++++++++++++\n\n");
     }
 
@@ -1399,6 +1400,8 @@ void AddrToFunc(RuleTreeNode * rtn, int mode)
             if((rtn->flags & ANY_SRC_IP) == 0)
             {
                 DEBUG_WRAP(DebugMessage(DEBUG_CONFIGRULES,"CheckSrcIP -> "););
+                rtn->sip_table = IpAddrSetCompile(rtn->sip,
+                        rtn->flags & EXCEPT_SRC_IP);
                 AddRuleFuncToList(CheckSrcIP, rtn);
             }
 
@@ -1408,6 +1411,8 @@ void AddrToFunc(RuleTreeNode * rtn, int mode)
             if((rtn->flags & ANY_DST_IP) == 0)
             {
                 DEBUG_WRAP(DebugMessage(DEBUG_CONFIGRULES,"CheckDstIP -> "););
+                rtn->dip_table = IpAddrSetCompile(rtn->dip,
+                        rtn->flags & EXCEPT_DST_IP);
                 AddRuleFuncToList(CheckDstIP, rtn);
             }
 
@@ -3726,10 +3731,48 @@ void ProcessDetectionOptions( char ** args, int nargs )
        {
            fpSetDebugMode();
        }
+       else if(!strcasecmp(args[i], "debug-print-fast-pattern"))
+       {
+           fpSetDebugPrintFastPattern();
+       }
+       else if(!strcasecmp(args[i], "pcre-dfa"))
+       {
+           fpSetPcreDfa();
+       }
+       else if(!strcasecmp(args[i], "fast-pattern-corpus"))
+       {
+           i++;
+           if(i >= nargs || fpSetFastPatternCorpus(args[i]))
+           {
+               FatalError("%s (%d)=> No argument to 'fast-pattern-corpus'. "
+                          "Must be a file of sample traffic.\n",
+                          file_name, file_line);
+           }
+       }
        else if(!strcasecmp(args[i], "no_stream_inserts"))
        {
            fpSetStreamInsert();
        }
+       else if(!strcasecmp(args[i], "adaptive-order"))
+       {
+           i++;
+           if(i < nargs)
+           {
+               if(fpSetAdaptiveOrder(atoi(args[i])))
+               {
+                   FatalError("%s (%d)=> Invalid argument to "
+                              "'adaptive-order'.  Argument must "
+                              "be greater than 0.\n",
+                              file_name, file_line);
+               }
+           }
+           else
+           {
+               FatalError("%s (%d)=> No argument to 'adaptive-order'. "
+                          "Must be the number of warm-up packets.\n",
+                          file_name, file_line);
+           }
+       }
        else if(!strcasecmp(args[i], "max_queue_events"))
        {
            i++;
@@ -456,3 +456,141 @@ int IpAddrSetContains(IpAddrSet *ias, struct in_addr test_addr)
 
     return 0;
 }
+
+
+/*
+ * Compiled address sets, shared between every rule header that ends up
+ * with the same ranges
+ */
+static IpAddrSetTable *ipset_tables = NULL;
+static int ipset_ntables = 0;
+
+/*
+ * Evaluate the set the way the rule header checks always have: the
+ * packet matches if any entry matches, an excepted entry matching
+ * anything outside its block
+ */
+static int IpAddrSetEval(IpAddrSet *ias, u_int32_t raw_addr)
+{
+    for(; ias != NULL; ias = ias->next)
+    {
+        if((ias->ip_addr == (raw_addr & ias->netmask)) ^
+                (ias->addr_flags & EXCEPT_IP))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int u32cmp(const void *a, const void *b)
+{
+    u_int32_t x = *(const u_int32_t *)a;
+    u_int32_t y = *(const u_int32_t *)b;
+
+    if(x < y) return -1;
+    if(x > y) return 1;
+    return 0;
+}
+
+/*
+ * Function: IpAddrSetCompile(IpAddrSet *, int)
+ *
+ * Purpose: Turn an address list into a range table.  Every entry covers
+ *          one block of addresses, so the result can only change at a
+ *          block start or just past a block end.  Those points are
+ *          collected and sorted, the list is evaluated once per range,
+ *          and neighbouring ranges with the same result are merged.
+ *
+ * Arguments: ias    => the address list
+ *            negate => the rule had a global "!" on this address
+ *
+ * Returns: the table, possibly one shared with an earlier rule
+ */
+IpAddrSetTable *IpAddrSetCompile(IpAddrSet *ias, int negate)
+{
+    IpAddrSetTable *t;
+    IpAddrSet *idx;
+    u_int32_t *points;
+    u_int32_t *lo;
+    u_int8_t *match;
+    u_int32_t start, end;
+    int npoints = 1;
+    int nranges = 0;
+    int i, m;
+
+    for(idx = ias; idx != NULL; idx = idx->next)
+        npoints += 2;
+
+    points = (u_int32_t *) SnortAlloc(npoints * sizeof(u_int32_t));
+
+    npoints = 0;
+    points[npoints++] = 0;
+
+    for(idx = ias; idx != NULL; idx = idx->next)
+    {
+        start = ntohl(idx->ip_addr & idx->netmask);
+        end = start | ~ntohl(idx->netmask);
+
+        points[npoints++] = start;
+
+        if(end != 0xffffffff)
+            points[npoints++] = end + 1;
+    }
+
+    qsort(points, npoints, sizeof(u_int32_t), u32cmp);
+
+    lo = (u_int32_t *) SnortAlloc(npoints * sizeof(u_int32_t));
+    match = (u_int8_t *) SnortAlloc(npoints * sizeof(u_int8_t));
+
+    for(i = 0; i < npoints; i++)
+    {
+        if(i && points[i] == points[i-1])
+            continue;
+
+        m = IpAddrSetEval(ias, htonl(points[i])) ^ (negate ? 1 : 0);
+
+        if(nranges && match[nranges-1] == m)
+            continue;
+
+        lo[nranges] = points[i];
+        match[nranges] = (u_int8_t) m;
+        nranges++;
+    }
+
+    free(points);
+
+    for(t = ipset_tables; t != NULL; t = t->next)
+    {
+        if(t->nranges == nranges &&
+           !memcmp(t->lo, lo, nranges * sizeof(u_int32_t)) &&
+           !memcmp(t->match, match, nranges * sizeof(u_int8_t)))
+        {
+            free(lo);
+            free(match);
+            return t;
+        }
+    }
+
+    t = (IpAddrSetTable *) SnortAlloc(sizeof(IpAddrSetTable));
+
+    t->lo = lo;
+    t->match = match;
+    t->nranges = nranges;
+
+    /* prime the cache so it never holds a stale answer */
+    t->cache_addr[IPSET_SLOT_SRC] = t->cache_addr[IPSET_SLOT_DST] = 0;
+    t->cache_match[IPSET_SLOT_SRC] = t->cache_match[IPSET_SLOT_DST] = match[0];
+
+    t->next = ipset_tables;
+    ipset_tables = t;
+    ipset_ntables++;
+
+    return t;
+}
+
+int IpAddrSetTableCount()
+{
+    return ipset_ntables;
+}
@@ -24,6 +24,20 @@
 #define __IP_ADDR_SET_H__
 
 #include <sys/types.h>
+#ifndef WIN32
+#include <netinet/in.h>
+#endif
+
+#ifndef DEBUG
+    #ifndef INLINE
+        #define INLINE inline
+    #endif
+#else
+    #ifdef INLINE
+        #undef INLINE
+    #endif
+    #define INLINE   
+#endif /* DEBUG */
 
 typedef struct _IpAddrSet
 {
@@ -37,6 +51,31 @@ typedef struct _IpAddrSet
 /* flags */
 #define EXCEPT_IP   0x01
 
+/*
+ * Compiled form of an IpAddrSet used by the rule header checks.  The
+ * address space is cut into sorted host order ranges, each of which
+ * either matches or doesn't, so a lookup is one binary search no matter
+ * how many entries or exceptions the set had.  A global "!" on the rule
+ * is folded into the ranges.  Identical sets share one table, and each
+ * table remembers the last source and destination address it answered
+ * for, so rules sharing a variable only search once per packet.
+ */
+typedef struct _IpAddrSetTable
+{
+    u_int32_t *lo;       /* range starts, host order, lo[0] == 0 */
+    u_int8_t  *match;    /* result for addresses in [lo[i], lo[i+1]) */
+    int        nranges;
+
+    u_int32_t  cache_addr[2];   /* last address looked up, per slot */
+    u_int8_t   cache_match[2];
+
+    struct _IpAddrSetTable *next;
+} IpAddrSetTable;
+
+/* cache slots */
+#define IPSET_SLOT_SRC  0
+#define IPSET_SLOT_DST  1
+
 void IpAddrSetPrint(char *prefix, IpAddrSet *);
 void IpAddrSetDestroy(IpAddrSet *);
 IpAddrSet *IpAddrSetCopy(IpAddrSet *);
@@ -44,6 +83,41 @@ IpAddrSet *IpAddrSetCreate();
 IpAddrSet *IpAddrSetParse(char *);
 int IpAddrSetContains(IpAddrSet *, struct in_addr);
 
+IpAddrSetTable *IpAddrSetCompile(IpAddrSet *, int negate);
+int IpAddrSetTableCount();
+
+/*
+ * Look up a network order address, slot is IPSET_SLOT_SRC or _DST
+ */
+static INLINE int IpAddrSetTableMatch(IpAddrSetTable *t, u_int32_t addr,
+                                      int slot)
+{
+    u_int32_t h;
+    int lo, hi, mid;
+
+    if(t->cache_addr[slot] == addr)
+        return t->cache_match[slot];
+
+    h = ntohl(addr);
+    lo = 0;
+    hi = t->nranges - 1;
+
+    while(lo < hi)
+    {
+        mid = (lo + hi + 1) >> 1;
+
+        if(t->lo[mid] <= h)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    t->cache_addr[slot] = addr;
+    t->cache_match[slot] = t->match[lo];
+
+    return t->match[lo];
+}
+
 
 /* XXX legacy support function */
 int ParseIP(char *paddr, IpAddrSet *);
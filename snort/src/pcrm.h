@@ -88,6 +88,9 @@ typedef struct {
   /* Setwise Pattern Matching data structures */
   void * pgPatData;
   void * pgPatDataUri;
+
+  /* Regex group for the pcre options, see sp_pcre.c */
+  void * pgPcreGroup;
   
   int avgLen;  
   int minLen;
@@ -98,6 +101,13 @@ typedef struct {
   **  Bit operation for validating matches
   */
   BITOP boRuleNodeID;
+
+  /*
+  **  Rule nodes set in boRuleNodeID since the last reset, so the
+  **  reset only has to clear those and not the whole bitmap
+  */
+  int *pgHits;
+  int  pgHitCount;
   
   /*
   *   Not rule list for this group
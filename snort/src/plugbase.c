@@ -107,6 +107,7 @@
 #include "output-plugins/spo_alert_fast.h"
 #include "output-plugins/spo_alert_full.h"
 #include "output-plugins/spo_alert_unixsock.h"
+#include "output-plugins/spo_alert_shm.h"
 #include "output-plugins/spo_csv.h"
 #include "output-plugins/spo_unified.h"
 #include "output-plugins/spo_log_null.h"
@@ -124,6 +125,7 @@ PluginSignalFuncNode *PluginShutdownList;
 PluginSignalFuncNode *PluginCleanExitList;
 PluginSignalFuncNode *PluginRestartList;
 PluginSignalFuncNode *PluginPostConfigList;
+PluginSignalFuncNode *PluginIdleList;
 
 PreprocSignalFuncNode *PreprocShutdownList;
 PreprocSignalFuncNode *PreprocCleanExitList;
@@ -345,6 +347,66 @@ OptFpList *AddOptFuncToList(int (*func) (Packet *, struct _OptTreeNode *,
     return idx;
 }
 
+/****************************************************************************
+ *
+ * Function: OptFpListSetKey(OptFpList *, void *, int)
+ *
+ * Purpose: Marks an option test as pure: it neither looks at nor changes
+ *          anything but the packet and the key bytes, so rules with the
+ *          same test and key can share a single evaluation per packet.
+ *          The key is compared when the detection engine is built, it
+ *          must stay valid until then.
+ *
+ * Arguments: fpl => the node AddOptFuncToList() returned
+ *            key => the test's data, NULL if it has none
+ *            key_size => bytes at key
+ *
+ * Returns: void function
+ *
+ ***************************************************************************/
+void OptFpListSetKey(OptFpList *fpl, void *key, int key_size)
+{
+    fpl->key = key;
+    fpl->key_size = key ? key_size : 0;
+    fpl->pure = 1;
+    fpl->movable = 1;
+}
+
+/****************************************************************************
+ *
+ * Function: OptFpListSetMovable(OptFpList *)
+ *
+ * Purpose: Marks an option test that doesn't use the cursor (doe_ptr) and
+ *          changes nothing, the detection engine may run it earlier than
+ *          the rule lists it.
+ *
+ * Arguments: fpl => the node AddOptFuncToList() returned
+ *
+ * Returns: void function
+ *
+ ***************************************************************************/
+void OptFpListSetMovable(OptFpList *fpl)
+{
+    fpl->movable = 1;
+}
+
+/****************************************************************************
+ *
+ * Function: OptFpListSetLocal(OptFpList *)
+ *
+ * Purpose: Marks an option test whose only side effect is on the cursor,
+ *          movable tests may be hoisted in front of it.
+ *
+ * Arguments: fpl => the node AddOptFuncToList() returned
+ *
+ * Returns: void function
+ *
+ ***************************************************************************/
+void OptFpListSetLocal(OptFpList *fpl)
+{
+    fpl->local = 1;
+}
+
 /****************************************************************************
  *
  * Function: AddRspFuncToList(int (*func)(), OptTreeNode *)
@@ -462,6 +524,21 @@ void PostConfigInitPlugins()
     }
 }
 
+/* called between packet batches and after every packet, for outputs that
+   hold on to events, with IDLE_BATCH_END or IDLE_PACKET */
+void IdlePlugins(int when)
+{
+    PluginSignalFuncNode *idx;
+
+    idx = PluginIdleList;
+
+    while (idx != NULL)
+    {
+        idx->func(when, idx->arg);
+        idx = idx->next;
+    }
+}
+
 /****************************************************************************
  *
  * Function: RegisterPreprocessor(char *, void (*func)(u_char *))
@@ -801,6 +878,7 @@ void InitOutputPlugins()
 #ifndef WIN32
     /* Win32 doesn't support AF_UNIX sockets */
     AlertUnixSockSetup();
+    AlertShmSetup();
 #endif /* !WIN32 */
     AlertCSVSetup();
     LogNullSetup();
@@ -1173,6 +1251,11 @@ void AddFuncToPostConfigList(void (*func)(int, void *), void *arg)
     PluginPostConfigList = AddFuncToSignalList(func, arg, PluginPostConfigList);
 }
 
+void AddFuncToIdleList(void (*func)(int, void *), void *arg)
+{
+    PluginIdleList = AddFuncToSignalList(func, arg, PluginIdleList);
+}
+
 PluginSignalFuncNode *AddFuncToSignalList(void (*func) (int, void *), void *arg,
                                           PluginSignalFuncNode * list)
 {
@@ -89,6 +89,9 @@ void RegisterPlugin(char *, void (*func)(char *, OptTreeNode *, int));
 void DumpPlugIns();
 OptFpList *AddOptFuncToList(int (*func)(Packet *, struct _OptTreeNode*, 
             struct _OptFpList*), OptTreeNode *);
+void OptFpListSetKey(OptFpList *, void *, int);
+void OptFpListSetMovable(OptFpList *);
+void OptFpListSetLocal(OptFpList *);
 void AddRspFuncToList(int (*func) (Packet *, struct _RspFpList *), 
                       OptTreeNode *, void *);
 
@@ -173,9 +176,15 @@ void AddFuncToRestartList(void (*func)(int, void*), void*);
 void AddFuncToCleanExitList(void (*func)(int, void*), void*);
 void AddFuncToShutdownList(void (*func)(int, void*), void*);
 void AddFuncToPostConfigList(void (*func)(int, void *), void *);
+void AddFuncToIdleList(void (*func)(int, void *), void *);
 PluginSignalFuncNode *AddFuncToSignalList(void (*func)(int, void*), void*, PluginSignalFuncNode *);
 
 void PostConfigInitPlugins();
+void IdlePlugins(int);
+
+/* what IdlePlugins() passes the idle list */
+#define IDLE_BATCH_END  0   /* between packet batches, send what is queued */
+#define IDLE_PACKET     1   /* after every packet, send what has waited */
 
 #define ENCODING_HEX 0
 #define ENCODING_BASE64 1
@@ -561,6 +561,10 @@ void flowcache_stats(FILE *stream, FLOWCACHE *flowcachep)
                 flowcachep->ipv4_table->mc.nblocks,
                 flowcache_overhead_blocks(flowcachep),
                 could_hold);
+
+    if(flowcachep->ipv4_table->mc.slab != NULL)
+        sfslab_showstats(flowcachep->ipv4_table->mc.slab, "flowcache arena",
+                         flow_printf);
     
     flow_printf("IPV4 count: %u frees: %u\nlow_time: %u, high_time: %u,"
                 " diff: %dh:%02d:%02ds\n",
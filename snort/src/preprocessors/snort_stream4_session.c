@@ -36,12 +36,12 @@
 
 #define _STREAM4_INTERNAL_USAGE_ONLY_
 
-#include "sfxhash.h"
 #include "ubi_SplayTree.h"
 #include "decode.h"
 #include "debug.h"
 #include "stream.h"
 #include "log.h"
+#include "util.h"
 
 /* splay tree root data */
 static ubi_trRoot s_cache;
@@ -52,7 +52,40 @@ extern void DeleteSession(Session *, u_int32_t);
 extern Stream4Data s4data;
 extern u_int32_t stream4_memory_usage;
 
-static SFXHASH *sessionHashTable = NULL;
+#ifdef USE_HASH_TABLE
+#define SESSION_BUCKET_SIZE   64    /* one cache line */
+#define SESSION_BUCKET_SLOTS  (int)((SESSION_BUCKET_SIZE - sizeof(void *)) / \
+                                    (sizeof(u_int32_t) + sizeof(Session *)))
+
+typedef union _SessionBucket
+{
+    struct
+    {
+        u_int32_t hash[SESSION_BUCKET_SLOTS];  /* tuple hash of each slot */
+        Session *ssn[SESSION_BUCKET_SLOTS];    /* NULL if the slot is free */
+        union _SessionBucket *next;            /* overflow chain */
+    } s;
+    char align[SESSION_BUCKET_SIZE];
+} SessionBucket;
+
+typedef struct _SessionTable
+{
+    SessionBucket *buckets;
+    void *bucket_mem;           /* malloc'd block buckets are aligned in */
+    u_int32_t nbuckets;         /* always a power of two */
+    u_int32_t noverflow;        /* overflow buckets allocated */
+
+    u_int32_t count;            /* sessions in the table */
+    u_int32_t max;              /* max_sessions */
+    u_int32_t nalloc;           /* sessions allocated so far */
+
+    Session *lru_head;          /* most recently used */
+    Session *lru_tail;          /* least recently used */
+    Session *free_list;         /* recycled sessions, linked by lru_next */
+} SessionTable;
+
+static SessionTable sessionTable;
+#endif
 
 #include "snort.h"
 #include "profiler.h"
@@ -60,6 +93,9 @@ static SFXHASH *sessionHashTable = NULL;
 extern PreprocStats stream4LUSessPerfStats;
 #endif
 
+#include <stdlib.h>
+#include <string.h>
+
 #ifndef WIN32
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -67,12 +103,134 @@ extern PreprocStats stream4LUSessPerfStats;
 #endif
 
 #ifdef USE_HASH_TABLE
-int GetSessionCount()
+/*
+ * Session table helpers.
+ *
+ * Each bucket is one cache line holding the tuple hash of every slot
+ * next to the session pointer, so a lookup reads a single line and only
+ * touches a Session when its hash already matches.  A bucket that fills
+ * up chains to an overflow bucket.  Sessions are also kept on an LRU
+ * list, which is what the timeout and memcap pruning walks.
+ */
+static void SessionLruUnlink(Session *ssn)
 {
-    if (sessionHashTable)
-        return sessionHashTable->count;
+    if (ssn->lru_prev)
+        ssn->lru_prev->lru_next = ssn->lru_next;
     else
-        return 0;
+        sessionTable.lru_head = ssn->lru_next;
+
+    if (ssn->lru_next)
+        ssn->lru_next->lru_prev = ssn->lru_prev;
+    else
+        sessionTable.lru_tail = ssn->lru_prev;
+
+    ssn->lru_prev = ssn->lru_next = NULL;
+}
+
+static void SessionLruPush(Session *ssn)
+{
+    ssn->lru_prev = NULL;
+    ssn->lru_next = sessionTable.lru_head;
+
+    if (sessionTable.lru_head)
+        sessionTable.lru_head->lru_prev = ssn;
+    else
+        sessionTable.lru_tail = ssn;
+
+    sessionTable.lru_head = ssn;
+}
+
+static void SessionMoveToFront(Session *ssn)
+{
+    if (sessionTable.lru_head != ssn)
+    {
+        SessionLruUnlink(ssn);
+        SessionLruPush(ssn);
+    }
+}
+
+static SessionBucket *SessionHashBucket(u_int32_t hash)
+{
+    return &sessionTable.buckets[hash & (sessionTable.nbuckets - 1)];
+}
+
+static Session *SessionTableFind(SessionHashKey *key, u_int32_t hash)
+{
+    SessionBucket *b;
+    int i;
+
+    for (b = SessionHashBucket(hash); b; b = b->s.next)
+    {
+        for (i = 0; i < SESSION_BUCKET_SLOTS; i++)
+        {
+            if ((b->s.hash[i] == hash) && b->s.ssn[i] &&
+                !memcmp(&b->s.ssn[i]->hashKey, key, sizeof(SessionHashKey)))
+            {
+                return b->s.ssn[i];
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static int SessionTableInsert(Session *ssn)
+{
+    SessionBucket *b, *last = NULL;
+    int i;
+
+    for (b = SessionHashBucket(ssn->hashValue); b; b = b->s.next)
+    {
+        for (i = 0; i < SESSION_BUCKET_SLOTS; i++)
+        {
+            if (b->s.ssn[i] == NULL)
+            {
+                b->s.hash[i] = ssn->hashValue;
+                b->s.ssn[i] = ssn;
+                return 0;
+            }
+        }
+        last = b;
+    }
+
+    /* Overflow buckets stay on the chain once allocated, the number of
+     * sessions is capped so they can't grow without bound. */
+    b = (SessionBucket *) calloc(1, sizeof(SessionBucket));
+    if (b == NULL)
+        return -1;
+
+    sessionTable.noverflow++;
+    last->s.next = b;
+    b->s.hash[0] = ssn->hashValue;
+    b->s.ssn[0] = ssn;
+
+    return 0;
+}
+
+static int SessionTableRemove(Session *ssn)
+{
+    SessionBucket *b;
+    int i;
+
+    for (b = SessionHashBucket(ssn->hashValue); b; b = b->s.next)
+    {
+        for (i = 0; i < SESSION_BUCKET_SLOTS; i++)
+        {
+            if (b->s.ssn[i] == ssn)
+            {
+                b->s.hash[i] = 0;
+                b->s.ssn[i] = NULL;
+                return 0;
+            }
+        }
+    }
+
+    return -1;
+}
+
+int GetSessionCount()
+{
+    return sessionTable.count;
 }
 
 int GetSessionKey(Packet *p, SessionHashKey *key)
@@ -119,28 +277,34 @@ int GetSessionKey(Packet *p, SessionHashKey *key)
 
 Session *GetSessionFromHashTable(Packet *p)
 {
-    Session *returned = NULL;
-    SFXHASH_NODE *hnode;
+    Session *returned;
     SessionHashKey sessionKey;
 
     if (!GetSessionKey(p, &sessionKey))
         return NULL;
 
-    hnode = sfxhash_find_node(sessionHashTable, &sessionKey);
+    returned = SessionTableFind(&sessionKey, GetPacketTupleHash(p));
+
+    if (returned)
+        SessionMoveToFront(returned);
 
-    if (hnode && hnode->data)
-    {
-        /* This is a unique hnode, since the sfxhash finds the
-         * same key before returning this node.
-         */
-        returned = (Session *)hnode->data;
-    }
     return returned;
 }
 
 int RemoveSessionFromHashTable(Session *ssn)
 {
-    return sfxhash_remove(sessionHashTable, &(ssn->hashKey));
+    if (SessionTableRemove(ssn))
+        return -1;
+
+    SessionLruUnlink(ssn);
+    sessionTable.count--;
+
+    /* DropSession() still looks at the session after this, only the
+     * LRU link is reused to keep it on the free list. */
+    ssn->lru_next = sessionTable.free_list;
+    sessionTable.free_list = ssn;
+
+    return 0;
 }
 
 int CleanHashTable(u_int32_t thetime, Session *save_me, int memCheck)
@@ -151,7 +315,7 @@ int CleanHashTable(u_int32_t thetime, Session *save_me, int memCheck)
     if (thetime != 0)
     {
         char got_one;
-        idx = (Session *) sfxhash_lru(sessionHashTable);
+        idx = sessionTable.lru_tail;
 
         if(idx == NULL)
         {
@@ -163,12 +327,10 @@ int CleanHashTable(u_int32_t thetime, Session *save_me, int memCheck)
             got_one = 0;            
             if(idx == save_me)
             {
-                SFXHASH_NODE *lastNode = sfxhash_lru_node(sessionHashTable);
-                sfxhash_gmovetofront(sessionHashTable, lastNode);
-                lastNode = sfxhash_lru_node(sessionHashTable);
-                if ((lastNode) && (lastNode->data != idx))
+                SessionMoveToFront(idx);
+                if (sessionTable.lru_tail != idx)
                 {
-                    idx = (Session *)lastNode->data;
+                    idx = sessionTable.lru_tail;
                     continue;
                 }
                 else
@@ -181,11 +343,11 @@ int CleanHashTable(u_int32_t thetime, Session *save_me, int memCheck)
             {
                 Session *savidx = idx;
 
-                if(sfxhash_count(sessionHashTable) > 1)
+                if(sessionTable.count > 1)
                 {
                     DEBUG_WRAP(DebugMessage(DEBUG_STREAM, "pruning stale session\n"););
                     DeleteSession(savidx, thetime);
-                    idx = (Session *) sfxhash_lru(sessionHashTable);
+                    idx = sessionTable.lru_tail;
                     pruned++;
                     got_one = 1;
                 }
@@ -211,32 +373,30 @@ int CleanHashTable(u_int32_t thetime, Session *save_me, int memCheck)
          * new ones.
          */
         while ( ((memCheck && (stream4_memory_usage > s4data.memcap)) ||
-                 (sessionHashTable->count >
+                 (sessionTable.count >
                    (s4data.max_sessions - s4data.cache_clean_sessions))) &&
-                (sfxhash_count(sessionHashTable) > 1))
+                (sessionTable.count > 1))
         {
             int i;
-            idx = (Session *) sfxhash_lru(sessionHashTable);
+            idx = sessionTable.lru_tail;
             for (i=0;i<s4data.cache_clean_sessions && 
-                     (sfxhash_count(sessionHashTable) > 1); i++)
+                     (sessionTable.count > 1); i++)
             {
                 if(idx != save_me)
                 {
                     DeleteSession(idx, thetime);
                     pruned++;
-                    idx = (Session *) sfxhash_lru(sessionHashTable);
+                    idx = sessionTable.lru_tail;
                 }
                 else
                 {
-                    SFXHASH_NODE *lastNode = sfxhash_lru_node(sessionHashTable);
-                    sfxhash_gmovetofront(sessionHashTable, lastNode);
-                    lastNode = sfxhash_lru_node(sessionHashTable);
-                    if ((lastNode) && (lastNode->data == idx))
+                    SessionMoveToFront(idx);
+                    if (sessionTable.lru_tail == idx)
                     {
                         /* Okay, this session is the only one left */
                         break;
                     }
-                    idx = (Session *) sfxhash_lru(sessionHashTable);
+                    idx = sessionTable.lru_tail;
                     i--; /* Didn't clean this one */
                 }
             }
@@ -247,45 +407,133 @@ int CleanHashTable(u_int32_t thetime, Session *save_me, int memCheck)
         /* Free up a percentage of the cache */
         u_int32_t smallPercent = (u_int32_t)(s4data.max_sessions *
                         s4data.cache_clean_percent);
-        idx = (Session *) sfxhash_lru(sessionHashTable);
+        idx = sessionTable.lru_tail;
         while ((stream4_memory_usage > (s4data.memcap - smallPercent)) &&
-                (sfxhash_count(sessionHashTable) > 1))
+                (sessionTable.count > 1))
         {
-            idx = (Session *) sfxhash_lru(sessionHashTable);
+            idx = sessionTable.lru_tail;
             if(idx != save_me)
             {
                 DeleteSession(idx, thetime);
                 pruned++;
-                idx = (Session *) sfxhash_lru(sessionHashTable);
+                idx = sessionTable.lru_tail;
             }
             else
             {
-                SFXHASH_NODE *lastNode = sfxhash_lru_node(sessionHashTable);
-                sfxhash_gmovetofront(sessionHashTable, lastNode);
-                lastNode = sfxhash_lru_node(sessionHashTable);
-                if ((lastNode) && (lastNode->data == idx))
+                SessionMoveToFront(idx);
+                if (sessionTable.lru_tail == idx)
                 {
                     /* Okay, this session is the only one left */
                     break;
                 }
-                idx = (Session *) sfxhash_lru(sessionHashTable);
+                idx = sessionTable.lru_tail;
             }
         }
     }
     return pruned;
 }
 
+/*
+ * Time out at most limit idle sessions from the LRU end of the table.
+ *
+ * Every lookup moves a session to the front of the LRU list, and all
+ * sessions share the same idle timeout, so the list is also in
+ * expiration order: the walk stops at the first session that is still
+ * live and never looks at anything else.
+ */
+int TimeoutSessionCache(u_int32_t thetime, u_int32_t limit, Session *save_me)
+{
+    Session *idx;
+    u_int32_t pruned = 0;
+
+    while (pruned < limit)
+    {
+        idx = sessionTable.lru_tail;
+
+        if (idx == NULL)
+            break;
+
+        if (idx == save_me)
+        {
+            if (sessionTable.count < 2)
+                break;
+
+            SessionMoveToFront(idx);
+            continue;
+        }
+
+        if ((idx->last_session_time + s4data.timeout) >= thetime)
+            break;
+
+        DEBUG_WRAP(DebugMessage(DEBUG_STREAM, "timing out stale session\n"););
+        DeleteSession(idx, thetime);
+        pruned++;
+    }
+
+    return pruned;
+}
+
+/*
+ * Hand out a session for this key, the existing one if the key is
+ * already in the table.  Returns NULL once max_sessions are in use.
+ */
+static Session *SessionTableGet(SessionHashKey *key, u_int32_t hash)
+{
+    Session *ssn;
+
+    ssn = SessionTableFind(key, hash);
+    if (ssn)
+    {
+        SessionMoveToFront(ssn);
+        return ssn;
+    }
+
+    if (sessionTable.free_list)
+    {
+        ssn = sessionTable.free_list;
+        sessionTable.free_list = ssn->lru_next;
+    }
+    else if (sessionTable.nalloc < sessionTable.max)
+    {
+        ssn = (Session *) calloc(1, sizeof(Session));
+        if (ssn == NULL)
+            return NULL;
+        sessionTable.nalloc++;
+    }
+    else
+    {
+        return NULL;
+    }
+
+    memcpy(&ssn->hashKey, key, sizeof(SessionHashKey));
+    ssn->hashValue = hash;
+
+    if (SessionTableInsert(ssn))
+    {
+        ssn->lru_next = sessionTable.free_list;
+        sessionTable.free_list = ssn;
+        return NULL;
+    }
+
+    SessionLruPush(ssn);
+    sessionTable.count++;
+
+    return ssn;
+}
+
 Session *GetNewSession(Packet *p)
 {
     Session *retSsn = NULL;
     SessionHashKey sessionKey;
-    SFXHASH_NODE *hnode;
+    u_int32_t hash;
 
     if (!GetSessionKey(p, &sessionKey))
         return retSsn;
 
-    hnode = sfxhash_get_node(sessionHashTable, &sessionKey);
-    if (!hnode)
+    hash = GetPacketTupleHash(p);
+
+    retSsn = SessionTableGet(&sessionKey, hash);
+    if (!retSsn)
     {
         DEBUG_WRAP(DebugMessage(DEBUG_STREAM, "HashTable full, clean it\n"););
         if (!CleanHashTable(p->pkth->ts.tv_sec, NULL, 0))
@@ -295,21 +543,26 @@ Session *GetNewSession(Packet *p)
         }
 
         /* Should have some freed nodes now */
-        hnode = sfxhash_get_node(sessionHashTable, &sessionKey);
+        retSsn = SessionTableGet(&sessionKey, hash);
 #ifdef DEBUG
-        if (!hnode)
+        if (!retSsn)
         {
             DEBUG_WRAP(DebugMessage(DEBUG_STREAM, "Problem, no freed nodes\n"););
         }
 #endif
     }
-    if (hnode && hnode->data)
+    if (retSsn)
     {
-        retSsn = hnode->data;
+        Session *prev = retSsn->lru_prev;
+        Session *next = retSsn->lru_next;
 
-        /* Zero everything out */
+        /* Zero everything out but the table links */
         memset(retSsn, 0, sizeof(Session));
 
+        retSsn->lru_prev = prev;
+        retSsn->lru_next = next;
+        retSsn->hashValue = hash;
+
         /* Save the session key for future use */
         memcpy(&(retSsn->hashKey), &sessionKey,
                         sizeof(SessionHashKey));
@@ -443,34 +696,33 @@ static int CompareFunc(ubi_trItemPtr ItemPtr, ubi_trNodePtr NodePtr)
 void InitSessionCache()
 {
 #ifdef USE_HASH_TABLE
-    if (!sessionHashTable)
+    if (!sessionTable.buckets)
     {
-        /* Create the hash table --
-         * SESSION_HASH_TABLE_SIZE hash buckets
-         * keysize = 12 bytes (2x 32bit IP, 2x16bit port)
-         * data size = sizeof(Session) object
-         * no max mem
-         * no automatic node recovery
-         * NULL node recovery free function
-         * NULL user data free function
-         * recycle nodes
-         */
         /* Rule of thumb, size should be 1.4 times max to avoid
-         * collisions.
+         * collisions.  A bucket holds SESSION_BUCKET_SLOTS sessions,
+         * round the bucket count up to a power of two so the hash can
+         * just be masked.
          */
-        int hashTableSize = (int) (s4data.max_sessions * 1.4);
-        int maxSessionMem = s4data.max_sessions * (
-                             sizeof(Session) +
-                             sizeof(SFXHASH_NODE) +
-                             sizeof(SessionHashKey) +
-                             sizeof (SFXHASH_NODE *));
-        int tableMem = (hashTableSize +1) * sizeof(SFXHASH_NODE*);
-        int maxMem = maxSessionMem + tableMem;
-        sessionHashTable = sfxhash_new(hashTableSize,
-                        sizeof(SessionHashKey),
-                        sizeof(Session), maxMem, 0, NULL, NULL, 1);
+        u_int32_t want = (u_int32_t)(s4data.max_sessions * 1.4) /
+                         SESSION_BUCKET_SLOTS + 1;
+        u_int32_t nbuckets = 1;
+
+        while (nbuckets < want)
+            nbuckets <<= 1;
 
+        sessionTable.bucket_mem = calloc(nbuckets + 1, sizeof(SessionBucket));
+        if (sessionTable.bucket_mem == NULL)
+        {
+            FatalError("Unable to allocate %u stream4 session buckets\n",
+                       nbuckets);
+        }
 
+        /* line the buckets up with the cache */
+        sessionTable.buckets = (SessionBucket *)
+            (((unsigned long)sessionTable.bucket_mem + SESSION_BUCKET_SIZE - 1)
+             & ~((unsigned long)SESSION_BUCKET_SIZE - 1));
+        sessionTable.nbuckets = nbuckets;
+        sessionTable.max = s4data.max_sessions;
     }
 #else /* USE_SPLAY_TREE */
     (void)ubi_trInitTree(RootPtr,       /* ptr to the tree head */
@@ -484,7 +736,7 @@ void PurgeSessionCache()
 {
     Session *ssn = NULL;
 #ifdef USE_HASH_TABLE
-    ssn = (Session *)sfxhash_mru(sessionHashTable);
+    ssn = sessionTable.lru_head;
 #else /* USE_SPLAY_TREE */
     ssn = (Session *)ubi_trFirst(RootPtr);
 #endif
@@ -492,7 +744,7 @@ void PurgeSessionCache()
     {
         DeleteSession(ssn, 0);
 #ifdef USE_HASH_TABLE
-        ssn = (Session *)sfxhash_mru(sessionHashTable);
+        ssn = sessionTable.lru_head;
 #else /* USE_SPLAY_TREE */
         ssn = (Session *)ubi_trFirst(RootPtr);
 #endif
@@ -503,7 +755,8 @@ void PrintSessionCache()
 {
 #ifdef USE_HASH_TABLE
     DEBUG_WRAP(DebugMessage(DEBUG_STREAM, "%lu streams active, %u bytes in use\n", 
-                            sfxhash_count(sessionHashTable), stream4_memory_usage););
+                            (unsigned long) sessionTable.count,
+                            stream4_memory_usage););
 #else /* USE_SPLAY_TREE */
     DEBUG_WRAP(DebugMessage(DEBUG_STREAM, "%lu streams active, %u bytes in use\n", 
                             ubi_trCount(RootPtr), stream4_memory_usage););
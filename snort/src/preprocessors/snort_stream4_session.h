@@ -10,6 +10,7 @@ Session *GetNewSession(Packet *);
 Session *RemoveSession(Session *);
 void PrintSessionCache();
 int PruneSessionCache(u_int32_t thetime, int mustdie, Session *save_me);
+int TimeoutSessionCache(u_int32_t thetime, u_int32_t limit, Session *save_me);
 int GetSessionCount();
 #endif
 
@@ -102,6 +102,7 @@
 
 #include "sfutil/sflsq.h"
 #include "sfutil/sfxhash.h"
+#include "sfutil/sfslab.h"
 
 #include "snort.h"
 #include "snort_packet_header.h"
@@ -157,6 +158,14 @@ extern OptTreeNode *otn_tmp;
 /* max frags in a single frag tracker */
 #define DEFAULT_MAX_FRAGS   8192
 
+/* per tracker rebuild buffers: room for the ethernet header and the
+ * largest IP header in front of the payload, +2 keeps the payload word
+ * aligned.  Buffer sizes are powers of two between min and max.
+ */
+#define FRAG_REBUILD_HEADROOM   (ETHERNET_HEADER_LEN + 60 + 2)
+#define FRAG_REBUILD_MIN        2048
+#define FRAG_REBUILD_MAX        65536
+
 /* return values for CheckTimeout() */
 #define FRAG_TIME_OK            0
 #define FRAG_TIMEOUT            1
@@ -219,6 +228,8 @@ typedef struct _Frag3Frag
     u_int8_t *fptr;     /* free pointer */
     u_int16_t flen;     /* free len, unneeded? */
 
+    char inbuf;         /* data lives in the tracker's rebuild buffer */
+
     struct _Frag3Frag *prev;
     struct _Frag3Frag *next;
 
@@ -281,6 +292,11 @@ typedef struct _FragTracker
 
     int ordinal;
 
+    u_int8_t *rebuild_buf;     /* fragments are copied to their final spot */
+    u_int32_t rebuild_size;    /* size of rebuild_buf */
+    u_int32_t rebuild_used;    /* highest payload byte written */
+    char rebuild_dirty;        /* overlap or no memory, rebuild by copying */
+
 } FragTracker;
 
 /* statistics tracking struct */
@@ -299,6 +315,7 @@ typedef struct _Frag3Stats
     u_int32_t  discards;
     u_int32_t  anomalies;
     u_int32_t  alerts;
+    u_int32_t  rebuilds_inplace;
 
 } Frag3Stats;
 
@@ -324,6 +341,9 @@ static Frag3Context **frag3ContextList = NULL; /* List of Frag3 Contexts configu
 static u_int8_t numFrag3Contexts = 0;
 
 static Packet *defrag_pkt;               /* holder for prealloc'd defrag pkt */
+static SFSLAB rebuild_slab;              /* per tracker rebuild buffers */
+static u_int32_t rebuild_mem;            /* bytes in rebuild buffers */
+static u_int32_t rebuild_hint;           /* size of the last rebuilt datagram */
 
 /* enum for policy names */
 static char *policy_names[] = { "no policy!",
@@ -367,6 +387,7 @@ static struct timeval *pkttime;    /* packet timestamp */
 static void Frag3DeleteFrag(Frag3Frag *);
 static void Frag3RemoveTracker(void *, void *);
 static void Frag3DeleteTracker(FragTracker *);
+static void Frag3RebuildFree(FragTracker *);
 static int Frag3AutoFree(void *, void *);
 static int Frag3UserFree(void *, void *);
 
@@ -779,6 +800,12 @@ void Frag3GlobalInit(u_char *args)
      */
     Frag3InitPkt();
 
+    if(sfslab_init(&rebuild_slab, FRAG_REBUILD_MIN, FRAG_REBUILD_MAX,
+                FRAG_REBUILD_MAX))
+    {
+        FatalError("Unable to set up frag3 rebuild buffers\n");
+    }
+
     /* 
      * indicate that we've got a global config active 
      */
@@ -1871,6 +1898,146 @@ static int Frag3HandleIPOptions(FragTracker *ft,
     return 1;
 }
 
+/**
+ * Release the rebuild buffer of a FragTracker
+ *
+ * @param ft FragTracker to release the buffer from
+ *
+ * @return none
+ */
+static void Frag3RebuildFree(FragTracker *ft)
+{
+    if(ft->rebuild_buf)
+    {
+        sfslab_free(&rebuild_slab, ft->rebuild_buf, ft->rebuild_size);
+
+        rebuild_mem -= ft->rebuild_size;
+        if(!global_config.use_prealloc)
+            mem_in_use -= ft->rebuild_size;
+    }
+
+    ft->rebuild_buf = NULL;
+    ft->rebuild_size = 0;
+    ft->rebuild_used = 0;
+}
+
+/**
+ * Get a rebuild buffer big enough to hold the payload up to end.  The
+ * data already in the old buffer moves over and the fragments that
+ * point at it are adjusted.  Rebuild buffers may use up to a quarter
+ * of the memcap and are never pruned for, if memory is tight the
+ * tracker just rebuilds the old way.
+ *
+ * @param ft FragTracker to grow the buffer for
+ * @param end end of the payload that has to fit
+ *
+ * @return status
+ * @retval 0 buffer is big enough
+ * @retval -1 no buffer, the tracker has to copy its fragments on rebuild
+ */
+static int Frag3RebuildGrow(FragTracker *ft, u_int32_t end)
+{
+    u_int8_t *buf;
+    u_int32_t want;
+    u_int32_t size = FRAG_REBUILD_MIN;
+    Frag3Frag *frag;
+
+    if(end + FRAG_REBUILD_HEADROOM > FRAG_REBUILD_MAX)
+        return -1;
+
+    /*
+     * datagrams usually come in runs of the same size (NFS, etc.), so
+     * start out at the size of the last one we put together
+     */
+    want = end > rebuild_hint ? end : rebuild_hint;
+    want += FRAG_REBUILD_HEADROOM;
+    if(want > FRAG_REBUILD_MAX)
+        want = FRAG_REBUILD_MAX;
+
+    while(size < want)
+        size <<= 1;
+
+    if(rebuild_mem - ft->rebuild_size + size > global_config.memcap / 4)
+        return -1;
+
+    if(!global_config.use_prealloc &&
+            (mem_in_use + size > global_config.memcap))
+    {
+        return -1;
+    }
+
+    buf = (u_int8_t *) sfslab_alloc(&rebuild_slab, size);
+    if(buf == NULL)
+        return -1;
+
+    if(ft->rebuild_buf)
+    {
+        u_int32_t used = ft->rebuild_used;
+
+        memcpy(buf + FRAG_REBUILD_HEADROOM,
+               ft->rebuild_buf + FRAG_REBUILD_HEADROOM, used);
+
+        for(frag = ft->fraglist; frag; frag = frag->next)
+        {
+            if(frag->inbuf)
+                frag->data = buf + (frag->data - ft->rebuild_buf);
+        }
+
+        Frag3RebuildFree(ft);
+        ft->rebuild_used = used;
+    }
+
+    rebuild_mem += size;
+    if(!global_config.use_prealloc)
+        mem_in_use += size;
+
+    ft->rebuild_buf = buf;
+    ft->rebuild_size = size;
+
+    return 0;
+}
+
+/**
+ * Copy fragment data to its final position in the tracker's rebuild
+ * buffer.  Only done while none of the tracker's fragments overlap, so
+ * the buffer always holds exactly what the fraglist describes and the
+ * rebuild doesn't have to copy anything.
+ *
+ * @param ft FragTracker the fragment belongs to
+ * @param data fragment data
+ * @param offset offset of the data in the reassembled payload
+ * @param size number of bytes to store
+ *
+ * @return pointer to the data in the rebuild buffer, NULL if the
+ *         fragment has to keep its own copy
+ */
+static u_int8_t *Frag3RebuildStore(FragTracker *ft, u_int8_t *data,
+        u_int16_t offset, u_int16_t size)
+{
+    u_int32_t end = offset + size;
+    u_int8_t *dst;
+
+    if(ft->rebuild_dirty)
+        return NULL;
+
+    if(end + FRAG_REBUILD_HEADROOM > ft->rebuild_size)
+    {
+        if(Frag3RebuildGrow(ft, end))
+        {
+            ft->rebuild_dirty = 1;
+            return NULL;
+        }
+    }
+
+    dst = ft->rebuild_buf + FRAG_REBUILD_HEADROOM + offset;
+    memcpy(dst, data, size);
+
+    if(end > ft->rebuild_used)
+        ft->rebuild_used = end;
+
+    return dst;
+}
+
 /**
  * Didn't find a FragTracker in the hash table, create a new one and put it
  * into the f_cache
@@ -1890,6 +2057,7 @@ static int Frag3NewTracker(Packet *p, FRAGKEY *fkey, Frag3Context *f3context)
     char *fragStart;
     u_int16_t fragLength;
     u_int16_t frag_end;
+    u_int8_t *inbuf_data;
     SFXHASH_NODE *hnode;
 
     fragStart = (u_int8_t *)p->iph + IP_HLEN(p->iph) * 4;
@@ -1967,6 +2135,16 @@ static int Frag3NewTracker(Packet *p, FRAGKEY *fkey, Frag3Context *f3context)
     tmp->context = f3context;
     tmp->ordinal = 0;
 
+    /*
+     * put the data where it goes in the reassembled packet.  Only
+     * trackers that start with the offset 0 fragment get a rebuild
+     * buffer, a stray tail fragment would need one the size of the
+     * whole datagram.
+     */
+    tmp->rebuild_dirty = (p->frag_offset != 0);
+    inbuf_data = Frag3RebuildStore(tmp, (u_int8_t *)fragStart,
+            (u_int16_t)(p->frag_offset << 3), fragLength);
+
     /* 
      * get our first fragment storage struct 
      */
@@ -1986,9 +2164,11 @@ static int Frag3NewTracker(Packet *p, FRAGKEY *fkey, Frag3Context *f3context)
         f = (Frag3Frag *) SnortAlloc(sizeof(Frag3Frag));
         mem_in_use += sizeof(Frag3Frag);
 
-        f->fptr = (u_int8_t *) SnortAlloc(fragLength);
-        mem_in_use += fragLength;
-    
+        if(inbuf_data == NULL)
+        {
+            f->fptr = (u_int8_t *) SnortAlloc(fragLength);
+            mem_in_use += fragLength;
+        }
 
     }
     else
@@ -2017,13 +2197,24 @@ static int Frag3NewTracker(Packet *p, FRAGKEY *fkey, Frag3Context *f3context)
     /*
      * setup the Frag3Frag struct with the current packet's data
      */
-    memcpy(f->fptr, fragStart, fragLength);
+    if(inbuf_data)
+    {
+        f->inbuf = 1;
+        f->flen = 0;
+        f->data = inbuf_data;
+    }
+    else
+    {
+        memcpy(f->fptr, fragStart, fragLength);
+        f->inbuf = 0;
+        f->flen = fragLength;
+        f->data = f->fptr;     /* ptr to adjusted start position */
+    }
 
-    f->size = f->flen = fragLength;
+    f->size = fragLength;
     f->offset = p->frag_offset << 3;
     frag_end = f->offset + fragLength;
     f->ord = tmp->ordinal++;
-    f->data = f->fptr;     /* ptr to adjusted start position */
     if (!p->mf)
     {
         f->last = 1;
@@ -2143,6 +2334,7 @@ static int AddFragNode(FragTracker *ft,
 {
     Frag3Frag *newfrag = NULL;  /* new frag container */
     int16_t newSize = len - slide - trunc;
+    u_int8_t *inbuf_data;
 
     if (newSize <= 0)
     {
@@ -2174,6 +2366,12 @@ static int AddFragNode(FragTracker *ft,
         return FRAG_INSERT_ANOMALY;
     }
 
+    /*
+     * put the data where it goes in the reassembled packet
+     */
+    inbuf_data = Frag3RebuildStore(ft, fragStart + slide, frag_offset,
+            (u_int16_t)newSize);
+
     /*
      * grab/generate a new frag node
      */
@@ -2199,8 +2397,11 @@ static int AddFragNode(FragTracker *ft,
         /* 
          * allocate some space to hold the actual data 
          */
-        newfrag->fptr = (u_int8_t*)SnortAlloc(fragLength);
-        mem_in_use += fragLength;
+        if(inbuf_data == NULL)
+        {
+            newfrag->fptr = (u_int8_t*)SnortAlloc(fragLength);
+            mem_in_use += fragLength;
+        }
     }
     else
     {
@@ -2224,14 +2425,25 @@ static int AddFragNode(FragTracker *ft,
 
     f3stats.fragnodes_created++;
 
-    newfrag->flen = fragLength;  
-    memcpy(newfrag->fptr, fragStart, fragLength);
-    newfrag->ord = ft->ordinal++;
+    if(inbuf_data)
+    {
+        newfrag->inbuf = 1;
+        newfrag->flen = 0;
+        newfrag->data = inbuf_data;
+    }
+    else
+    {
+        newfrag->inbuf = 0;
+        newfrag->flen = fragLength;  
+        memcpy(newfrag->fptr, fragStart, fragLength);
 
-    /* 
-     * twiddle the frag values for overlaps
-     */
-    newfrag->data = newfrag->fptr + slide;
+        /* 
+         * twiddle the frag values for overlaps
+         */
+        newfrag->data = newfrag->fptr + slide;
+    }
+
+    newfrag->ord = ft->ordinal++;
     newfrag->size = newSize;
     newfrag->offset = frag_offset;
     newfrag->last = lastfrag;
@@ -2308,8 +2520,11 @@ static int DupFragNode(FragTracker *ft,
         /* 
          * allocate some space to hold the actual data 
          */
-        newfrag->fptr = (u_int8_t*)SnortAlloc(left->flen);
-        mem_in_use += left->flen;
+        if(!left->inbuf)
+        {
+            newfrag->fptr = (u_int8_t*)SnortAlloc(left->flen);
+            mem_in_use += left->flen;
+        }
     }
     else
     {
@@ -2337,9 +2552,20 @@ static int DupFragNode(FragTracker *ft,
     /* 
      * twiddle the frag values for overlaps
      */
-    newfrag->flen = left->flen;
-    memcpy(newfrag->fptr, left->fptr, newfrag->flen);
-    newfrag->data = newfrag->fptr + (left->data - left->fptr);
+    if(left->inbuf)
+    {
+        /* both halves keep pointing into the rebuild buffer */
+        newfrag->inbuf = 1;
+        newfrag->flen = 0;
+        newfrag->data = left->data;
+    }
+    else
+    {
+        newfrag->inbuf = 0;
+        newfrag->flen = left->flen;
+        memcpy(newfrag->fptr, left->fptr, newfrag->flen);
+        newfrag->data = newfrag->fptr + (left->data - left->fptr);
+    }
     newfrag->size = left->size;
     newfrag->offset = left->offset;
     newfrag->last = left->last;
@@ -2445,6 +2671,7 @@ static int Frag3Insert(Packet *p, FragTracker *ft, FRAGKEY *fkey,
         ft->copied_ip_option_count = 0;
         ft->context = f3context;
         ft->ordinal = 0;
+        ft->rebuild_dirty = (p->frag_offset != 0);
 
         //DEBUG_WRAP(DebugMessage(DEBUG_FRAG, 
         //            "[..] Deleting fragtracker due to timeout!\n"););
@@ -2647,6 +2874,9 @@ static int Frag3Insert(Packet *p, FragTracker *ft, FRAGKEY *fkey,
 
         if(overlap > 0)
         {
+            /* the rebuild buffer can't follow overlaps */
+            ft->rebuild_dirty = 1;
+
             if(frag_end < ft->calculated_size ||
                     ((ft->frag_flags & FRAG_GOT_LAST) && 
                      frag_end != ft->calculated_size))
@@ -2827,6 +3057,8 @@ left_overlap_last:
                     "Next (right)fragment %d@%d\n", 
                     right->size, right->offset););
 
+        ft->rebuild_dirty = 1;
+
 #ifdef DEBUG_FRAG3
         PrintFrag3Frag(right);
 #endif
@@ -3208,6 +3440,45 @@ static int INLINE Frag3IsComplete(FragTracker *ft)
     return 0;
 }
 
+/**
+ * Check whether the FragTracker's rebuild buffer already holds the whole
+ * reassembled payload: every fragment sits at its final spot and they
+ * cover the datagram end to end without gaps or overlaps.
+ *
+ * @param ft FragTracker to check
+ *
+ * @return status
+ * @retval 1 the payload can be used in place
+ * @retval 0 the fragments have to be copied into defrag_pkt
+ */
+static int Frag3RebuildInPlace(FragTracker *ft)
+{
+    Frag3Frag *frag;
+    u_int8_t *payload;
+    u_int32_t expect = 0;
+
+    if(ft->rebuild_dirty || ft->rebuild_buf == NULL)
+        return 0;
+
+    if(ft->calculated_size + FRAG_REBUILD_HEADROOM > ft->rebuild_size)
+        return 0;
+
+    payload = ft->rebuild_buf + FRAG_REBUILD_HEADROOM;
+
+    for(frag = ft->fraglist; frag; frag = frag->next)
+    {
+        if(!frag->inbuf || frag->offset != expect ||
+                frag->data != payload + frag->offset)
+        {
+            return 0;
+        }
+
+        expect += frag->size;
+    }
+
+    return expect == ft->calculated_size;
+}
+
 /**
  * Reassemble the packet from the data in the FragTracker and reinject into
  * Snort's packet analysis system
@@ -3219,11 +3490,14 @@ static int INLINE Frag3IsComplete(FragTracker *ft)
  */
 static void Frag3Rebuild(FragTracker *ft, Packet *p)
 {
+    u_int8_t *rebuild_pkt;  /* ptr to the start of the rebuilt packet */
     u_int8_t *rebuild_ptr;  /* ptr to the start of the reassembly buffer */
     u_int8_t *rebuild_end;  /* ptr to the end of the reassembly buffer */
     Frag3Frag *frag;    /* frag pointer for managing fragments */
     u_int8_t new_ip_hlen = 0;
     u_int8_t save_ip_hlen = 0;
+    u_int32_t opt_len = 0;
+    int inplace;
     PROFILE_VARS;
 
     DEBUG_WRAP(DebugMessage(DEBUG_FRAG, "Rebuilding pkt [0x%X:%d  0x%X:%d]\n", 
@@ -3242,10 +3516,26 @@ static void Frag3Rebuild(FragTracker *ft, Packet *p)
     defrag_pkt->pkth->ts.tv_sec = p->pkth->ts.tv_sec;
     defrag_pkt->pkth->ts.tv_usec = p->pkth->ts.tv_usec;
 
-    /* 
-     * set the pointer to the end of the rebuild packet
-     */
-    rebuild_end = defrag_pkt->pkt + DATASIZE;
+    if (ft->ip_options_data && ft->ip_options_len)
+        opt_len = ft->ip_options_len;
+
+    inplace = Frag3RebuildInPlace(ft);
+
+    if (inplace)
+    {
+        /*
+         * the payload is already in the tracker's rebuild buffer, just
+         * put the headers in front of it
+         */
+        rebuild_pkt = ft->rebuild_buf + FRAG_REBUILD_HEADROOM - opt_len -
+                      sizeof(IPHdr) - ETHERNET_HEADER_LEN;
+        rebuild_end = ft->rebuild_buf + ft->rebuild_size;
+    }
+    else
+    {
+        rebuild_pkt = defrag_pkt->pkt;
+        rebuild_end = defrag_pkt->pkt + DATASIZE;
+    }
 
     /*
      * If there are IP options for this reassembled frag, adjust
@@ -3269,14 +3559,14 @@ static void Frag3Rebuild(FragTracker *ft, Packet *p)
     }
 
     /* copy the packet data from the last packet of the frag */
-    SafeMemcpy(defrag_pkt->pkt, p->pkt, ETHERNET_HEADER_LEN + sizeof(IPHdr),
-            defrag_pkt->pkt, rebuild_end);
+    SafeMemcpy(rebuild_pkt, p->pkt, ETHERNET_HEADER_LEN + sizeof(IPHdr),
+            rebuild_pkt, rebuild_end);
 
     /*
      * set the pointer to the beginning of the transport layer of the
      * rebuilt packet
      */
-    rebuild_ptr = defrag_pkt->pkt + ETHERNET_HEADER_LEN + sizeof(IPHdr);
+    rebuild_ptr = rebuild_pkt + ETHERNET_HEADER_LEN + sizeof(IPHdr);
 
     /*
      * if there are IP options, copy those in as well
@@ -3307,7 +3597,7 @@ static void Frag3Rebuild(FragTracker *ft, Packet *p)
     /* 
      * reset the ip header pointer 
      */
-    defrag_pkt->iph = (IPHdr *) (defrag_pkt->pkt + ETHERNET_HEADER_LEN);
+    defrag_pkt->iph = (IPHdr *) (rebuild_pkt + ETHERNET_HEADER_LEN);
 
     /* 
      * clear the packet fragment fields 
@@ -3321,7 +3611,7 @@ static void Frag3Rebuild(FragTracker *ft, Packet *p)
     /* 
      * walk the fragment list and rebuild the packet 
      */
-    for(frag = ft->fraglist; frag; frag = frag->next)
+    for(frag = inplace ? NULL : ft->fraglist; frag; frag = frag->next)
     {
         DEBUG_WRAP(DebugMessage(DEBUG_FRAG, 
                     "   frag: %p\n"
@@ -3397,6 +3687,11 @@ static void Frag3Rebuild(FragTracker *ft, Packet *p)
     pc.rebuilt_frags++;
     sfPerf.sfBase.iFragFlushes++;
 
+    if (inplace)
+        f3stats.rebuilds_inplace++;
+
+    rebuild_hint = ft->calculated_size;
+
     /* Rebuild is complete */
     PREPROC_PROFILE_END(frag3RebuildPerfStats);
 
@@ -3424,7 +3719,7 @@ static void Frag3Rebuild(FragTracker *ft, Packet *p)
         ClearDumpBuf();
     }
 #endif
-    ProcessPacket(NULL, defrag_pkt->pkth, defrag_pkt->pkt, ft);
+    ProcessPacket(NULL, defrag_pkt->pkth, rebuild_pkt, ft);
 
     DEBUG_WRAP(DebugMessage(DEBUG_FRAG, 
                 "Done with rebuilt packet, marking rebuilt...\n"););
@@ -3521,6 +3816,9 @@ static void Frag3DeleteTracker(FragTracker *ft)
         ft->ip_options_data = NULL;
     }
 
+    Frag3RebuildFree(ft);
+    ft->rebuild_dirty = 0;
+
     return;
 }
 
@@ -3743,6 +4041,7 @@ void Frag3PrintStats()
     LogMessage("FragTrackers Auto Freed: %lu\n", f3stats.fragtrackers_autoreleased);
     LogMessage("    Frag Nodes Inserted: %lu\n", f3stats.fragnodes_created);
     LogMessage("     Frag Nodes Deleted: %lu\n", f3stats.fragnodes_released);
+    LogMessage("   Rebuilds w/o Copying: %lu\n", f3stats.rebuilds_inplace);
 
     LogMessage("===================================================="
             "===========================\n");
@@ -47,6 +47,7 @@
 
 #include <sys/types.h>
 #include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
 
 #ifdef HAVE_STRINGS_H	 
@@ -94,6 +95,7 @@ typedef struct _RpcDecodeData
 
 static RpcDecodeData rpcpreprocdata; /* Configuration Set */
 static char RpcDecodePorts[65536/8];
+static u_int8_t rpc_buf[65536];   /* decode buffer for payloads outside p->pkt */
 
 #ifdef PERF_PROFILING
 PreprocStats rpcdecodePerfStats;
@@ -453,6 +455,17 @@ int ConvertRPC(Packet *p)
         return RPC_FRAG_TRAFFIC;
     }
 
+    /*
+     * A rebuilt stream packet may point its payload straight at a
+     * queued segment, which the loggers still write out later.  Decode
+     * a copy so the segment keeps the bytes that were on the wire.
+     */
+    if(data < p->pkt || data + psize > p->pkt + p->pkth->caplen)
+    {
+        memcpy(rpc_buf, data, psize);
+        data = p->data = rpc_buf;
+    }
+
     rpc =   (u_int8_t *) data;
     index = (u_int8_t *) data;
     end =   (u_int8_t *) data + psize;
@@ -139,6 +139,10 @@
 
 #include "profiler.h"
 
+#ifndef PKT_STORE_SPLAY_TREE
+#include "sfslab.h"
+#endif
+
 /*  D E F I N E S  **************************************************/
 
 /* normal TCP states */
@@ -180,6 +184,7 @@
 #define STREAM4_MAX_SESSIONS   8192     /* 8k */
 #define STREAM4_CLEANUP   5             /* Cleanup 5 sessions at a time */
 #define STREAM4_CACHE_PERCENT 0.1       /* Or cleanup 0.1 % sessions at a time */
+#define STREAM4_TIMEOUT_PRUNE_LIMIT 5   /* time out 5 sessions per packet, max */
 #define STREAM4_TTL_LIMIT 5             /* default for TTL Limit */
 #define DEFAULT_STREAM_TRACKERS 256000  /* 256k sessions by default */
 
@@ -202,6 +207,11 @@
 /* # of packets that we accept on an unestab conn */
 #define UNESTABLISHED_MAX_PCOUNT 300
 
+/* size classes for the segment store -- a StreamPacketData and its
+ * packet copy share one block, anything past the top class is malloc'd */
+#define SEG_SLAB_MIN_SIZE   256
+#define SEG_SLAB_MAX_SIZE   2048
+
 /* what pcap can hold is how this limit comes about -- cmg */
 #define MAX_STREAM_SIZE (IP_MAXPACKET - IP_HEADER_LEN - TCP_HEADER_LEN - ETHERNET_HEADER_LEN) 
 
@@ -298,11 +308,25 @@ typedef struct _OverlapData
 
 } OverlapData;
 
+/* payload ranges picked up by TraverseFunc, copied out in one pass
+ * (or not at all) once we know what the rebuilt packet looks like */
+#define BUILD_MAX_SEGS 64
+
+typedef struct _BuildSeg
+{
+    u_int8_t *data;
+    u_int32_t offset;   /* offset into the rebuilt payload */
+    u_int32_t len;
+} BuildSeg;
+
 typedef struct _BuildData
 {
     Stream *stream;
     u_int8_t *buf;
     u_int32_t total_size;
+    BuildSeg segs[BUILD_MAX_SEGS];
+    u_int32_t nsegs;
+    u_int8_t gathered;  /* some ranges already copied into buf */
     /* u_int32_t build_flags; -- reserved for the day when we generate 1 stream event and log the stream */
 } BuildData;
 
@@ -368,6 +392,11 @@ int GetSessionCount();
 
 u_int32_t safe_alloc_faults;
 
+#ifndef PKT_STORE_SPLAY_TREE
+/* pooled storage for queued segments */
+static SFSLAB seg_slab;
+#endif
+
 /* we keep a stream packet queued up and ready to go for reassembly */
 Packet *stream_pkt;
 
@@ -405,6 +434,7 @@ PreprocStats stream4ProcessRebuiltPerfStats;
 
 /*  P R O T O T Y P E S  ********************************************/
 void *SafeAlloc(unsigned long, int, Session *);
+static void SafeAllocAccount(unsigned long, int, Session *);
 void ParseStream4Args(char *);
 void Stream4InitReassembler(u_char *);
 void Stream4InitExternalOptions(u_char *);
@@ -464,6 +494,8 @@ static StreamPacketData *RemoveSpd(Stream *s, StreamPacketData *spd);
 static void AddSpd(Stream *s, StreamPacketData *prev, StreamPacketData *new);
 static int DupSpd(Packet *p, Stream *s, StreamPacketData *left, StreamPacketData **retSpd);
 static StreamPacketData *SpdSeqExists(Stream *s, u_int32_t pkt_seq);
+static StreamPacketData *SpdAlloc(Packet *p, u_int32_t pkt_size);
+static void SpdFree(StreamPacketData *spd);
 #endif
 
 /*
@@ -673,6 +705,48 @@ static void KillSpd(ubi_trNodePtr NodePtr)
 }
 #endif
 
+/**
+ * Copy the queued payload ranges into the rebuild buffer.
+ *
+ * @param bd build state holding the ranges
+ */
+static void BuildGather(BuildData *bd)
+{
+    u_int32_t i;
+
+    for(i = 0; i < bd->nsegs; i++)
+    {
+        SafeMemcpy(bd->buf + bd->segs[i].offset, bd->segs[i].data,
+                bd->segs[i].len, bd->buf, bd->buf + MAX_STREAM_SIZE);
+    }
+
+    if(bd->nsegs)
+        bd->gathered = 1;
+
+    bd->nsegs = 0;
+}
+
+/**
+ * Remember a payload range for the rebuilt packet.  Nothing is copied
+ * here; BuildPacket() decides whether the range can be used in place.
+ *
+ * @param bd build state
+ * @param offset where the range goes in the rebuilt payload
+ * @param data start of the range in the queued segment
+ * @param len length of the range
+ */
+static INLINE void BuildAddSeg(BuildData *bd, u_int32_t offset,
+        u_int8_t *data, u_int32_t len)
+{
+    if(bd->nsegs == BUILD_MAX_SEGS)
+        BuildGather(bd);
+
+    bd->segs[bd->nsegs].data = data;
+    bd->segs[bd->nsegs].offset = offset;
+    bd->segs[bd->nsegs].len = len;
+    bd->nsegs++;
+}
+
 #ifdef PKT_STORE_SPLAY_TREE
 static void TraverseFunc(ubi_trNodePtr NodePtr, void *build_data)
 #else
@@ -682,7 +756,6 @@ static void TraverseFunc(StreamPacketData *NodePtr, void *build_data)
     Stream *s;
     StreamPacketData *spd;
     BuildData *bd;
-    u_int8_t *buf;
     int trunc_size;
     int offset = 0;
 
@@ -692,7 +765,6 @@ static void TraverseFunc(StreamPacketData *NodePtr, void *build_data)
     spd = (StreamPacketData *) NodePtr;
     bd = (BuildData *) build_data;
     s = bd->stream;
-    buf = bd->buf;
 
     /* Don't reassemble if there's nothing to reassemble.
      * The first two cases can probably never happen. I personally
@@ -749,9 +821,8 @@ static void TraverseFunc(StreamPacketData *NodePtr, void *build_data)
         {
             DEBUG_WRAP(DebugMessage(DEBUG_STREAM, "Copying %d bytes into buffer, "
                         "offset %d, buf %p\n", trunc_size, offset, 
-                        buf););
-            SafeMemcpy(buf, spd->payload+offset, trunc_size,
-                    stream_pkt->data, stream_pkt->data + MAX_STREAM_SIZE);            
+                        bd->buf););
+            BuildAddSeg(bd, 0, spd->payload+offset, trunc_size);
             pc.rebuilt_segs++;
             bd->total_size += trunc_size;
         }
@@ -783,7 +854,7 @@ static void TraverseFunc(StreamPacketData *NodePtr, void *build_data)
 
         DEBUG_WRAP(DebugMessage(DEBUG_STREAM, "Copying %d bytes into buffer, "
                     "offset %d, buf %p\n", spd->payload_size, offset, 
-                    buf););
+                    bd->buf););
 
         DEBUG_WRAP(DebugMessage(DEBUG_STREAM,
                     "spd->seq_num (%u)  s->last_ack (%u) "
@@ -793,8 +864,7 @@ static void TraverseFunc(StreamPacketData *NodePtr, void *build_data)
                     spd->payload_size, s->next_seq, offset, 
                     MAX_STREAM_SIZE));
 
-        SafeMemcpy(buf+offset, spd->payload, spd->payload_size,
-                stream_pkt->data, stream_pkt->data + MAX_STREAM_SIZE);
+        BuildAddSeg(bd, offset, spd->payload, spd->payload_size);
 
         pc.rebuilt_segs++;
 
@@ -833,9 +903,8 @@ static void TraverseFunc(StreamPacketData *NodePtr, void *build_data)
         {
             DEBUG_WRAP(DebugMessage(DEBUG_STREAM, "Copying %d bytes into buffer, "
                         "offset %d, buf %p\n", trunc_size, offset, 
-                        buf););
-            SafeMemcpy(buf+offset, spd->payload, trunc_size,
-                    stream_pkt->data, stream_pkt->data + MAX_STREAM_SIZE);            
+                        bd->buf););
+            BuildAddSeg(bd, offset, spd->payload, trunc_size);
             pc.rebuilt_segs++;
             bd->total_size += trunc_size;
             spd->chuck = SEG_PARTIAL;
@@ -914,15 +983,17 @@ void SegmentCleanTraverse(Stream *s)
 #ifdef PKT_STORE_SPLAY_TREE
             foo = (StreamPacketData *) ubi_sptRemove(&s->data, 
                     (ubi_btNodePtr) savspd);
-#else
-            foo = RemoveSpd(s, savspd);
-#endif
             StreamSegmentSub(s, foo->payload_size);
 
             stream4_memory_usage -= foo->pkt_size;
             free(foo->pktOrig);
             stream4_memory_usage -= sizeof(StreamPacketData);
             free(foo);
+#else
+            foo = RemoveSpd(s, savspd);
+            StreamSegmentSub(s, foo->payload_size);
+            SpdFree(foo);
+#endif
         }
         else
         {
@@ -953,10 +1024,13 @@ static void LogTraverse(StreamPacketData *NodePtr, void *foo)
     DirectLogTcpdump((struct pcap_pkthdr *)&spd->pkth, spd->pkt); 
 }
 
-void *SafeAlloc(unsigned long size, int tv_sec, Session *ssn)
+/*
+ * Charge size bytes against the stream4 memcap, pruning sessions if
+ * that puts us over.  SafeAlloc() and the segment store both go
+ * through here so they share the same accounting.
+ */
+static void SafeAllocAccount(unsigned long size, int tv_sec, Session *ssn)
 {
-    void *tmp;
-
     stream4_memory_usage += size;
 
     /* if we use up all of our RAM, try to free up some stale sessions */
@@ -970,6 +1044,13 @@ void *SafeAlloc(unsigned long size, int tv_sec, Session *ssn)
             PruneSessionCache(0, 5, ssn);            
         }
     }
+}
+
+void *SafeAlloc(unsigned long size, int tv_sec, Session *ssn)
+{
+    void *tmp;
+
+    SafeAllocAccount(size, tv_sec, ssn);
 
     tmp = (void *) calloc(size, sizeof(char));
 
@@ -1069,6 +1150,13 @@ void Stream4Init(u_char *args)
     /* tell the rest of the program that we're stateful */
     snort_runtime.capabilities.stateful_inspection = 1;
    
+#ifndef PKT_STORE_SPLAY_TREE
+    if(sfslab_init(&seg_slab, SEG_SLAB_MIN_SIZE, SEG_SLAB_MAX_SIZE, 0))
+    {
+        FatalError("Unable to initialize stream4 segment store\n");
+    }
+#endif
+
 #ifdef USE_HASH_TABLE
     InitSessionCache();
 #else /* USE_SPLAY_TREE */
@@ -1115,6 +1203,11 @@ void DisplayStream4Config(void)
     LogMessage("    Session statistics: %s\n", 
                s4data.track_stats_flag ? "ACTIVE":"INACTIVE");
     LogMessage("    Session timeout: %d seconds\n", s4data.timeout);
+    if (s4data.timeout_prune_limit)
+        LogMessage("    Session timeouts per packet: %d\n",
+                   s4data.timeout_prune_limit);
+    else
+        LogMessage("    Session timeouts per packet: unlimited\n");
     LogMessage("    Session memory cap: %lu bytes\n", (unsigned long)s4data.memcap);
     LogMessage("    Session count max: %d sessions\n", (unsigned long)s4data.max_sessions);
 
@@ -1176,6 +1269,7 @@ void ParseStream4Args(char *args)
     s4data.max_sessions = STREAM4_MAX_SESSIONS;
     s4data.cache_clean_percent = 0;
     s4data.cache_clean_sessions = STREAM4_CLEANUP;
+    s4data.timeout_prune_limit = STREAM4_TIMEOUT_PRUNE_LIMIT;
     s4data.stateful_inspection_flag = 1;
     s4data.state_alerts = 0;
     s4data.evasion_alerts = 1;
@@ -1359,6 +1453,18 @@ void ParseStream4Args(char *args)
 
             }
         }
+        else if(!strcasecmp(stoks[0], "timeout_prune_limit"))
+        {
+            if(s_toks > 1 && isdigit((int)stoks[1][0]))
+            {
+                s4data.timeout_prune_limit = atoi(stoks[1]);
+            }
+            else
+            {
+                FatalError("%s(%d) => Bad timeout_prune_limit value in "
+                           "config file\n", file_name, file_line);
+            }
+        }
         else if(!strcasecmp(stoks[0], "ttl_limit"))
         {
             if(s_toks > 1)
@@ -2365,6 +2471,29 @@ static INLINE void PruneCheck(Packet *p)
 {
     PROFILE_VARS;
 
+#ifdef USE_HASH_TABLE
+    /*
+     * Time out a few sessions on every packet instead of walking all
+     * of the expired ones once per timeout period.  That walk is where
+     * the latency spikes came from with large session tables.
+     */
+    if (s4data.timeout_prune_limit)
+    {
+        PREPROC_PROFILE_START(stream4PrunePerfStats);
+
+        /* never time out the session of the packet in hand */
+        if (TimeoutSessionCache(p->pkth->ts.tv_sec,
+                                s4data.timeout_prune_limit,
+                                (Session *) p->ssnptr))
+        {
+            sfPerf.sfBase.iStreamTimeouts++;
+        }
+
+        PREPROC_PROFILE_END(stream4PrunePerfStats);
+        return;
+    }
+#endif
+
     if (!s4data.last_prune_time)
     {
         s4data.last_prune_time = p->pkth->ts.tv_sec;
@@ -4339,10 +4468,7 @@ void DeleteSpd(StreamPacketData **seglist)
         dump = spd;
         spd = spd->next;
 
-        stream4_memory_usage -= dump->pkt_size;
-        free(dump->pktOrig);
-        stream4_memory_usage -= sizeof(StreamPacketData);
-        free(dump);
+        SpdFree(dump);
     }
 
     *seglist = NULL;
@@ -4437,6 +4563,11 @@ void Stream4CleanExitFunction(int signal, void *foo)
             if(stats_log != NULL)
                 fclose(stats_log->fp);
     }
+
+#ifndef PKT_STORE_SPLAY_TREE
+    /* the shutdown list already purged the sessions */
+    sfslab_destroy(&seg_slab);
+#endif
 }
 
 
@@ -4450,6 +4581,12 @@ void Stream4RestartFunction(int signal, void *foo)
             if(stats_log != NULL)
                 fclose(stats_log->fp);
     }
+
+#ifndef PKT_STORE_SPLAY_TREE
+    /* queued segments still point into the slab, but nothing looks at
+     * them again before the restart */
+    sfslab_destroy(&seg_slab);
+#endif
 }
 
 
@@ -4532,6 +4669,50 @@ static StreamPacketData *SpdSeqExists(Stream *s, u_int32_t pkt_seq)
     return NULL;
 }
 
+/**
+ * Get a segment descriptor with room for a pkt_size byte packet copy.
+ *
+ * The descriptor and the packet copy come out of the same slab block,
+ * so queueing a segment is one free list pop rather than two callocs
+ * and the flush walk touches the payload right next to its descriptor.
+ * The packet copy itself is not cleared, callers copy over it.
+ *
+ * @param p packet being queued (for memcap pruning)
+ * @param pkt_size bytes needed for the packet copy
+ *
+ * @return the new descriptor, spd->pkt pointing at the packet copy
+ */
+static StreamPacketData *SpdAlloc(Packet *p, u_int32_t pkt_size)
+{
+    StreamPacketData *spd;
+    u_int32_t size = sizeof(StreamPacketData) + pkt_size;
+
+    SafeAllocAccount(size, p->pkth->ts.tv_sec, (Session *)p->ssnptr);
+
+    spd = (StreamPacketData *) sfslab_alloc(&seg_slab, size);
+
+    if(spd == NULL)
+    {
+        FatalError("Unable to allocate memory! (%lu bytes in use)\n", 
+                   (unsigned long)stream4_memory_usage);
+    }
+
+    memset(spd, 0, sizeof(StreamPacketData));
+
+    spd->pktOrig = spd->pkt = (u_int8_t *)(spd + 1);
+    spd->pkt_size = pkt_size;
+
+    return spd;
+}
+
+static void SpdFree(StreamPacketData *spd)
+{
+    u_int32_t size = sizeof(StreamPacketData) + spd->pkt_size;
+
+    stream4_memory_usage -= size;
+    sfslab_free(&seg_slab, spd, size);
+}
+
 static StreamPacketData *RemoveSpd(Stream *s, StreamPacketData *spd)
 {
     if(s == NULL || spd == NULL)
@@ -4609,16 +4790,11 @@ static int DupSpd(Packet *p, Stream *s, StreamPacketData *left, StreamPacketData
     /*
      * get a new node
      */
-    spd = (StreamPacketData *) SafeAlloc(sizeof(StreamPacketData),
-                                p->pkth->ts.tv_sec, (Session *)p->ssnptr);
-
-    spd->pktOrig = spd->pkt = (u_int8_t *) SafeAlloc(left->pkt_size,
-                                p->pkth->ts.tv_sec, (Session *)p->ssnptr);
+    spd = SpdAlloc(p, left->pkt_size);
 
     memcpy(spd->pktOrig, left->pktOrig, left->pkth.caplen);
     memcpy(&spd->pkth, &left->pkth, sizeof(SnortPktHeader));
 
-    spd->pkt_size = left->pkt_size;
     spd->pkt += SPARC_TWIDDLE;
     spd->data = spd->pkt + (left->data - left->pkt);
 
@@ -4681,14 +4857,9 @@ static int InsertPkt(Stream *s, Packet *p, int16_t len, u_int32_t slide,
         return -1;
     }
 
-    spd = (StreamPacketData *) SafeAlloc(sizeof(StreamPacketData),
-                                    p->pkth->ts.tv_sec, (Session *)p->ssnptr);
-
-    spd->pktOrig = spd->pkt = (u_int8_t *) SafeAlloc(p->pkth->caplen + SPARC_TWIDDLE,
-                                    p->pkth->ts.tv_sec, (Session *)p->ssnptr);
+    spd = SpdAlloc(p, p->pkth->caplen + SPARC_TWIDDLE);
 
     spd->pkt += SPARC_TWIDDLE;
-    spd->pkt_size = p->pkth->caplen + SPARC_TWIDDLE;
 
     memcpy(spd->pkt, p->pkt, p->pkth->caplen);
     memcpy(&spd->pkth, p->pkth, sizeof(SnortPktHeader));
@@ -5030,10 +5201,7 @@ void StoreStreamPkt2(Session *ssn, Packet *p, u_int32_t pkt_seq)
 
                         left = left->prev;
                         dump = RemoveSpd(s, dump);
-                        stream4_memory_usage -= dump->pkt_size;
-                        free(dump->pktOrig);
-                        stream4_memory_usage -= sizeof(StreamPacketData);
-                        free(dump);
+                        SpdFree(dump);
                     }
                     break;
             }
@@ -5074,10 +5242,7 @@ void StoreStreamPkt2(Session *ssn, Packet *p, u_int32_t pkt_seq)
 
                         right = right->next;
                         dump = RemoveSpd(s, dump);
-                        stream4_memory_usage -= dump->pkt_size;
-                        free(dump->pktOrig);
-                        stream4_memory_usage -= sizeof(StreamPacketData);
-                        free(dump);
+                        SpdFree(dump);
                     }
                     break;
                 case METHOD_FAVOR_OLD:
@@ -5224,10 +5389,7 @@ void StoreStreamPkt2(Session *ssn, Packet *p, u_int32_t pkt_seq)
                     right = right->next;
                     StreamSegmentSub(s, dump->payload_size);
                     dump = RemoveSpd(s, dump);
-                    stream4_memory_usage -= dump->pkt_size;
-                    free(dump->pktOrig);
-                    stream4_memory_usage -= sizeof(StreamPacketData);
-                    free(dump);
+                    SpdFree(dump);
                     break;
             }
         }
@@ -5913,6 +6075,7 @@ void FlushStream(Stream *s, Packet *p, int direction)
             do_detect_content = tmp_do_detect_content;
             PREPROC_PROFILE_END(stream4ProcessRebuiltPerfStats);
 
+            /* never set when the payload was used in place */
             if(s4data.zero_flushed_packets)
                 bzero(stream_pkt->data, stream_pkt->dsize);
 
@@ -6318,9 +6481,14 @@ int BuildPacket(Stream *s, u_int32_t stream_size, Packet *p, int direction)
 
     s4data.stop_traverse = 0;
 
+    /* the last flush may have pointed data into a queued segment */
+    stream_pkt->data = (u_int8_t *)stream_pkt->tcph + TCP_HEADER_LEN;
+
     bd.stream = s;
     bd.buf = stream_pkt->data;
     bd.total_size = 0;
+    bd.nsegs = 0;
+    bd.gathered = 0;
 
     /* walk the packet tree (in order) and rebuild the app layer data */
 #ifdef PKT_STORE_SPLAY_TREE
@@ -6427,6 +6595,30 @@ int BuildPacket(Stream *s, u_int32_t stream_size, Packet *p, int direction)
 
     s4data.stop_traverse = 0;
 
+    /*
+     * If a single queued segment supplies the whole payload (the usual
+     * case for one-segment requests) point the rebuilt packet straight
+     * at it instead of copying.  Otherwise put the pieces together.
+     *
+     * In place, the payload is not in stream_pkt->pkt, so caplen is cut
+     * back to the headers and anything that dumps pkt..caplen gets a
+     * truncated capture rather than the last flush's payload.  pkth->len
+     * keeps the real size.  Preprocessors that rewrite the payload
+     * (rpc_decode) must work on their own copy of it.
+     */
+    if(!bd.gathered && bd.nsegs == 1 && bd.segs[0].offset == 0 &&
+       bd.segs[0].len >= stream_pkt->dsize && !s4data.zero_flushed_packets)
+    {
+        stream_pkt->data = bd.segs[0].data;
+        stream_pkt->pkth->caplen = ETHERNET_HEADER_LEN + IP_HEADER_LEN +
+                                   TCP_HEADER_LEN;
+        pc.rebuilt_inplace++;
+    }
+    else
+    {
+        BuildGather(&bd);
+    }
+
     stream_pkt->tcp_option_count = 0;
     stream_pkt->tcp_lastopt_bad = 0;
     stream_pkt->packet_flags = (PKT_REBUILT_STREAM|PKT_STREAM_EST);
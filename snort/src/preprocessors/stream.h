@@ -30,7 +30,7 @@ typedef struct _StreamPacketData
     u_int8_t *pktOrig;
     u_int8_t *pkt;
     SnortPktHeader pkth;
-    u_int16_t pkt_size;
+    u_int32_t pkt_size;
     /* Pointer to trimmed payload */
     u_int8_t *payload;
     u_int16_t payload_size;
@@ -128,6 +128,9 @@ typedef struct _Session
     void (*preproc_free)(void *); /* function to free preproc_data */
 #ifdef USE_HASH_TABLE
     SessionHashKey hashKey;
+    u_int32_t hashValue;          /* tuple hash, picks the table bucket */
+    struct _Session *lru_prev;    /* toward most recently used */
+    struct _Session *lru_next;    /* toward least recently used */
 #else /* USE_SPLAY_TREE */
 #endif
 } Session;
@@ -158,6 +161,8 @@ typedef struct _Stream4Data
     char *stats_file;
     
     u_int32_t last_prune_time;
+    u_int32_t timeout_prune_limit; /* max sessions to time out per packet,
+                                      0 prunes once per timeout period */
 
     char reassemble_client;
     char reassemble_server;
@@ -148,8 +148,48 @@ typedef struct _OptFpList
 
     struct _OptFpList *next;
 
+    /* 
+     * set through OptFpListSetKey() by tests whose result depends only
+     * on the packet and key_size bytes at key, those tests can be shared
+     * between rules in the option trie
+     */
+    void *key;
+    int   key_size;
+    int   pure;
+
+    /*
+     * movable tests don't use the cursor and have no side effects, so
+     * they may run anywhere in the list; local tests use the cursor but
+     * change nothing outside the rule, movable tests may be run before
+     * them.  Anything else stays where the rule writer put it.
+     */
+    int   movable;
+    int   local;
+
 } OptFpList;
 
+/*
+ * One node of the option prefix trie built by fpcreate.  Rules whose
+ * option lists start with the same pure tests share the path down to
+ * their last one, and each node's result is kept for the rest of the
+ * packet once it has been evaluated.
+ */
+typedef struct _OptTrieNode
+{
+    OptFpList test;               /* copy of the test, next is OptListEnd */
+    struct _OptTreeNode *otn;     /* an OTN carrying the test, for ds_list */
+
+    struct _OptTrieNode *parent;
+    struct _OptTrieNode *child;
+    struct _OptTrieNode *sibling;
+
+    u_int32_t eval_seq;           /* packet the result belongs to */
+    int       result;
+
+    struct _OptTestStats *stats;  /* warm-up numbers for this test type */
+
+} OptTrieNode;
+
 typedef struct _RspFpList
 {
     int (* ResponseFunc)(Packet *, struct _RspFpList *);
@@ -174,6 +214,10 @@ typedef struct _OptTreeNode
 {
     /* plugin/detection functions go here */
     OptFpList *opt_func;
+
+    /* shared leading tests and what is left of opt_func after them */
+    OptTrieNode *opt_prefix;
+    OptFpList *opt_func_rest;
     RspFpList *rsp_func;  /* response functions */
     OutputFuncNode *outputFuncs; /* per sid enabled output functions */
 
@@ -274,6 +318,9 @@ typedef struct _RuleTreeNode
     IpAddrSet *sip;
     IpAddrSet *dip;
 
+    IpAddrSetTable *sip_table;   /* compiled sip/dip for CheckSrcIP/DstIP */
+    IpAddrSetTable *dip_table;
+
     int not_sp_flag;     /* not source port flag */
 
     u_short hsp;         /* hi src port */
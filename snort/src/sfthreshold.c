@@ -61,6 +61,8 @@
      Data
 */
 static int          s_memcap  = 1024 * 1024;
+static int          s_sketch  = 0;
+static int          s_sketch_seconds = THD_SKETCH_SECONDS;
 static THD_STRUCT * s_thd     = 0;
 static int          s_enabled = 1;
 static int          s_checked = 0; /**< have we evaluated this yet? */
@@ -215,6 +217,9 @@ void ParseThreshold2( THDX_STRUCT * thdx, char * s )
    Process the 'config threshold: memcap #bytes, option2-name option2-value, ...'
 
    config threshold: memcap #bytes
+   config threshold: sketch #bytes          - count IP's in a sketch before tracking them
+   config threshold: sketch_seconds #secs   - sketch counts last one to two of these,
+                                              raised to the longest threshold seconds
 */
 void ProcessThresholdOptions(char *options)
 {
@@ -231,12 +236,34 @@ void ProcessThresholdOptions(char *options)
 
       for(i=0;i<nargs;i++)
       {
-          oargs = mSplit(options," ",2,&noargs,0);  /* get rule option pairs */
+          oargs = mSplit(args[i]," ",2,&noargs,0);  /* get rule option pairs */
+
+          if( noargs != 2 )
+          {
+             FatalError("%s(%d) => Threshold-RuleOptionParse: argument pairing error\n",file_name, file_line);
+          }
 
           if( strcmp(oargs[0],"memcap") == 0  )
           {
              s_memcap = xatou(oargs[1],"config threshold: memcap");
           }
+          else if( s_thd && (strcmp(oargs[0],"sketch") == 0 ||
+                             strcmp(oargs[0],"sketch_seconds") == 0) )
+          {
+             /* sfthreshold_init() made the table without it */
+             FatalError("%s(%d) => Threshold-RuleOptionParse: config threshold: %s must come before the first threshold or suppress\n",file_name, file_line, oargs[0]);
+          }
+          else if( strcmp(oargs[0],"sketch") == 0  )
+          {
+             s_sketch = xatou(oargs[1],"config threshold: sketch");
+          }
+          else if( strcmp(oargs[0],"sketch_seconds") == 0  )
+          {
+             s_sketch_seconds = xatou(oargs[1],"config threshold: sketch_seconds");
+
+             if( !s_sketch_seconds )
+                FatalError("%s(%d) => Threshold-RuleOptionParse: sketch_seconds must be at least 1\n",file_name, file_line);
+          }
           else
           {
              FatalError("%s(%d) => Threshold-RuleOptionParse: unknown argument\n",file_name, file_line);
@@ -570,6 +597,11 @@ int sfthreshold_init()
        return -1;
    }
 
+   if( s_sketch && sfthd_sketch( s_thd, s_sketch, s_sketch_seconds ) )
+   {
+       FatalError("Threshold: could not allocate a %d byte sketch\n", s_sketch);
+   }
+
    return 0;
 }
 
@@ -775,6 +807,8 @@ void print_thresholding()
 	LogMessage("\n");
 	LogMessage("+-----------------------[thresholding-config]----------------------------------\n");
 	LogMessage("| memory-cap : %d bytes\n",s_memcap);
+	if( s_thd && s_thd->sketch )
+	    LogMessage("| sketch     : %d bytes, %u second periods\n",s_sketch,s_thd->sketch->seconds);
 
 	
 	LogMessage("+-----------------------[thresholding-global]----------------------------------\n");
@@ -0,0 +1,204 @@
+/*
+  sfcmsketch.c
+
+  Count-min sketch of recent events, see sfcmsketch.h.
+
+  The row cells for a key come from one mix of the key and double
+  hashing, cell(r) = h1 + r * h2, rather than one hash per row.  Updates
+  are conservative, which keeps estimates a lot closer under a flood of
+  distinct keys than incrementing every row.
+*/
+#include <stdlib.h>
+#include <string.h>
+
+#include "sfcmsketch.h"
+
+#define SFCMS_ROT(x,k)  (((x) << (k)) | ((x) >> (32 - (k))))
+
+/*
+*   nbytes is the memory for both banks, rounded down to a power of two
+*   row width
+*/
+SFCMS * sfcms_new( unsigned nbytes, unsigned seconds )
+{
+    SFCMS  * cms;
+    unsigned width = SFCMS_MIN_WIDTH;
+
+    if( !seconds )
+        return 0;
+
+    while( (size_t)width * 2 * 2 * SFCMS_ROWS * sizeof(unsigned) <= nbytes )
+        width *= 2;
+
+    cms = (SFCMS*)calloc(1, sizeof(SFCMS));
+
+    if( !cms )
+        return 0;
+
+    cms->width   = width;
+    cms->seconds = seconds;
+    cms->bank[0] = (unsigned*)calloc((size_t)SFCMS_ROWS * width, sizeof(unsigned));
+    cms->bank[1] = (unsigned*)calloc((size_t)SFCMS_ROWS * width, sizeof(unsigned));
+
+    if( !cms->bank[0] || !cms->bank[1] )
+    {
+        sfcms_free(cms);
+        return 0;
+    }
+
+    return cms;
+}
+
+void sfcms_free( SFCMS * cms )
+{
+    if( !cms )
+        return;
+
+    free(cms->bank[0]);
+    free(cms->bank[1]);
+    free(cms);
+}
+
+/*
+*   Start a new period: the older bank is cleared and counted into from
+*   now on.  After a gap of two periods or more both banks are stale.
+*/
+static void sfcms_roll( SFCMS * cms, time_t now )
+{
+    size_t size = (size_t)SFCMS_ROWS * cms->width * sizeof(unsigned);
+
+    if( now - cms->period >= 2 * (time_t)cms->seconds )
+    {
+        memset(cms->bank[0], 0, size);
+        memset(cms->bank[1], 0, size);
+        cms->period = now;
+        return;
+    }
+
+    cms->cur ^= 1;
+    memset(cms->bank[cms->cur], 0, size);
+    cms->period += cms->seconds;
+}
+
+/*
+*   Count one event for key (a,b,c) and return the estimated number of
+*   events for it over the last one to two periods, this one included
+*/
+unsigned sfcms_add( SFCMS * cms, unsigned a, unsigned b, unsigned c,
+                    time_t now )
+{
+    unsigned * cur;
+    unsigned * prev;
+    unsigned   mask = cms->width - 1;
+    unsigned   est  = ~0U;
+    unsigned   idx[SFCMS_ROWS];
+    unsigned   n, r;
+
+    if( now >= cms->period + (time_t)cms->seconds )
+        sfcms_roll(cms, now);
+
+    cur  = cms->bank[cms->cur];
+    prev = cms->bank[cms->cur ^ 1];
+
+    /* lookup3 final mix */
+    a += 0xdeadbeef;
+    b += 0xdeadbeef;
+    c += 0xdeadbeef;
+
+    c ^= b; c -= SFCMS_ROT(b,14);
+    a ^= c; a -= SFCMS_ROT(c,11);
+    b ^= a; b -= SFCMS_ROT(a,25);
+    c ^= b; c -= SFCMS_ROT(b,16);
+    a ^= c; a -= SFCMS_ROT(c,4);
+    b ^= a; b -= SFCMS_ROT(a,14);
+    c ^= b; c -= SFCMS_ROT(b,24);
+
+    b |= 1;
+
+    for( r = 0; r < SFCMS_ROWS; r++ )
+    {
+        idx[r] = r * cms->width + ((c + r * b) & mask);
+        n = cur[idx[r]] + prev[idx[r]];
+
+        if( n < est )
+            est = n;
+    }
+
+    /* conservative update: only raise the cells that are below the new
+       estimate, the others already count at least this key's events */
+    est++;
+
+    for( r = 0; r < SFCMS_ROWS; r++ )
+    {
+        if( cur[idx[r]] + prev[idx[r]] < est )
+            cur[idx[r]] = est - prev[idx[r]];
+    }
+
+    cms->adds++;
+
+    return est;
+}
+
+#ifdef SFCMS_MAIN
+/*
+*   Count a flood of one-off keys with a few heavy keys mixed in, check
+*   the heavy keys are never under-counted, report how many one-off keys
+*   look repeated, and check counts decay away after two periods.
+*/
+#include <stdio.h>
+
+int main( int argc, char ** argv )
+{
+    SFCMS  * cms;
+    unsigned nbytes = argc > 1 ? (unsigned)atoi(argv[1]) : 4 * 1024 * 1024;
+    unsigned nkeys  = argc > 2 ? (unsigned)atoi(argv[2]) : 1000000;
+    unsigned i, j, est, over = 0, bad = 0;
+
+    cms = sfcms_new(nbytes, 60);
+
+    if( !cms )
+    {
+        printf("sfcms_new failed\n");
+        return 1;
+    }
+
+    for( i = 0; i < nkeys; i++ )
+    {
+        if( sfcms_add(cms, 1, i, 0x0a000000 + i, 1000) > 1 )
+            over++;
+
+        if( i % 10000 == 0 )
+        {
+            for( j = 0; j < 100; j++ )
+                sfcms_add(cms, 2, j, 0xc0a80000 + j, 1000);
+        }
+    }
+
+    for( j = 0; j < 100; j++ )
+    {
+        est = sfcms_add(cms, 2, j, 0xc0a80000 + j, 1030);
+
+        if( est < nkeys / 10000 + 1 )
+            bad++;
+    }
+
+    /* next period still sees the last one */
+    est = sfcms_add(cms, 2, 0, 0xc0a80000, 1075);
+
+    if( est < nkeys / 10000 + 2 )
+        bad++;
+
+    /* two periods on it has all gone */
+    est = sfcms_add(cms, 2, 0, 0xc0a80000, 1200);
+
+    if( est != 1 )
+        bad++;
+
+    printf("%u bytes, width %u: %u keys, %u over-counted (%.3f%%), %d bad\n",
+           nbytes, cms->width, nkeys, over, 100.0 * over / nkeys, bad);
+
+    sfcms_free(cms);
+
+    return bad != 0;
+}
+#endif
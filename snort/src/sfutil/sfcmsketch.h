@@ -0,0 +1,47 @@
+/*
+**  sfcmsketch.h
+**
+**  Count-min sketch of recent events.
+**
+**  Counts events per key in a fixed block of memory, however many
+**  distinct keys show up.  Each key is counted in one cell of each of
+**  SFCMS_ROWS rows and its estimate is the smallest of those cells, so an
+**  estimate is never low and is too high by at most about e/width of the
+**  events counted in the same period, in all but a small fraction of
+**  cases.
+**
+**  Counts decay in two banks of 'seconds' each.  Events go into the
+**  current bank and estimates add in the previous one.  When a period
+**  ends the older bank is cleared and becomes the current one, so an
+**  estimate covers the last 'seconds' to 2*'seconds' of events.
+**
+**  Adding to the sketch is a handful of counter increments with no
+**  allocation and no locking.
+*/
+#ifndef __SF_CMSKETCH_H__
+#define __SF_CMSKETCH_H__
+
+#include <time.h>
+
+#define SFCMS_ROWS          4
+#define SFCMS_MIN_WIDTH     256
+
+typedef struct _SFCMS
+{
+    unsigned * bank[2];     /* SFCMS_ROWS * width counters each */
+    int        cur;         /* bank being added to */
+    unsigned   width;       /* cells per row, a power of two */
+    unsigned   seconds;     /* length of a bank period */
+    time_t     period;      /* start of the current period */
+
+    unsigned long adds;
+
+} SFCMS;
+
+SFCMS  * sfcms_new( unsigned nbytes, unsigned seconds );
+void     sfcms_free( SFCMS * cms );
+
+unsigned sfcms_add( SFCMS * cms, unsigned a, unsigned b, unsigned c,
+                    time_t now );
+
+#endif
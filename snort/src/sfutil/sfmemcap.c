@@ -5,6 +5,15 @@
   the MEMCAP structure.  The MEMCAP structure tracks memory usage.  Each allocation
   has 4 bytes added to it so we can store the allocation size.  This allows us to 
   free a block and accurately track how much memory was recovered.
+
+  Blocks come from a slab arena owned by the MEMCAP, so the hash tables
+  built on it recycle their nodes through size class free lists instead
+  of going to malloc and free for each one.  The memcap still counts the
+  bytes asked for plus the size header, exactly as before.  Build with
+  SFMEMCAP_MALLOC to get plain malloc/free back, e.g. for valgrind.
+
+  Freed blocks stay on their class free list until sfmemcap_term(), see
+  sfmemcap.h for what that means for the memcap.
   
   Marc Norton  
 */
@@ -22,6 +31,7 @@ void sfmemcap_init( MEMCAP * mc, unsigned nbytes )
 	mc->memcap = nbytes;
 	mc->memused= 0;
 	mc->nblocks= 0;
+	mc->slab   = 0;
 }
 
 /*
@@ -38,12 +48,56 @@ MEMCAP * sfmemcap_new( unsigned nbytes )
 	 return mc;
 }
 
+/*
+*  Release the arena - every block still allocated from it goes too
+*/
+void sfmemcap_term( MEMCAP * mc )
+{
+     if( mc->slab )
+     {
+         sfslab_destroy( mc->slab );
+         free( mc->slab );
+         mc->slab = 0;
+     }
+}
+
 /*
 *  Release the memcap structure
 */
 void sfmemcap_delete( MEMCAP * p )
 {
-     if(p)free( p );
+     if(p)
+     {
+         sfmemcap_term( p );
+         free( p );
+     }
+}
+
+/*
+*  Get the block from the arena, or malloc if it is disabled
+*/
+static long * sfmemcap_get( MEMCAP * mc, unsigned nbytes )
+{
+#ifdef SFMEMCAP_MALLOC
+   return (long *) malloc( nbytes );
+#else
+   if( !mc->slab )
+   {
+       mc->slab = (SFSLAB*)malloc( sizeof(SFSLAB) );
+       if( !mc->slab )
+           return 0;
+
+       if( sfslab_init_steps( mc->slab, SFMEMCAP_SLAB_MIN, SFMEMCAP_SLAB_MAX,
+                              SFMEMCAP_CHUNK_SIZE, SFMEMCAP_SLAB_STEPS ) )
+       {
+           free( mc->slab );
+           mc->slab = 0;
+           return 0;
+       }
+   }
+
+   return (long *) sfslab_alloc( mc->slab, nbytes );
+#endif
 }
 
 /*
@@ -68,7 +122,7 @@ void * sfmemcap_alloc( MEMCAP * mc, unsigned nbytes )
       }
    }
 
-   data = (long *) malloc( nbytes );
+   data = sfmemcap_get( mc, nbytes );
    if( data == NULL )
    {
         return 0;
@@ -94,7 +148,11 @@ void sfmemcap_free( MEMCAP * mc, void * p )
    mc->memused -= (unsigned)(*q);
    mc->nblocks--;
 
+#ifdef SFMEMCAP_MALLOC
    free(q);
+#else
+   sfslab_free(mc->slab, q, (unsigned)(*q));
+#endif
 }
 
 /*
@@ -105,6 +163,9 @@ void sfmemcap_showmem( MEMCAP * mc )
      fprintf(stderr, "memcap: memcap = %u bytes,",mc->memcap);
      fprintf(stderr, " memused= %u bytes,",mc->memused);
      fprintf(stderr, " nblocks= %d blocks\n",mc->nblocks);
+
+     if( mc->slab )
+         sfslab_showstats( mc->slab, "memcap arena", 0 );
 }
 
 /*
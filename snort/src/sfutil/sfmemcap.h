@@ -4,17 +4,37 @@
 #ifndef __SF_MEMCAP_H__
 #define __SF_MEMCAP_H__
 
+#include "sfslab.h"
+
+/*
+*   Arena options.  The arena never hands chunks back before
+*   sfmemcap_term(), a freed block only goes back on its size class free
+*   list.  memused bounds what is in use, not what the arena holds: that
+*   is the high water of each size class, so a MEMCAP whose mix of block
+*   sizes shifts over time can hold more than memcap bytes.  sfxhash, the
+*   only user, allocates one node size per table, which keeps it within
+*   memcap plus a chunk per class.  Other users should do the same or
+*   build with SFMEMCAP_MALLOC.
+*/
+#define SFMEMCAP_SLAB_MIN    16
+#define SFMEMCAP_SLAB_MAX    2048
+#define SFMEMCAP_SLAB_STEPS  4
+#define SFMEMCAP_CHUNK_SIZE  (16*1024)
+
 typedef struct
 {
    unsigned memused;
    unsigned memcap;
    int      nblocks;
 
+   SFSLAB * slab;    /* this memcap's arena, made on the first alloc */
+
 }MEMCAP;
 
 void     sfmemcap_init(MEMCAP * mc, unsigned nbytes);
 MEMCAP * sfmemcap_new( unsigned nbytes );
 void     sfmemcap_delete( MEMCAP * mc );
+void     sfmemcap_term( MEMCAP * mc );
 void   * sfmemcap_alloc(MEMCAP * mc, unsigned nbytes);
 void     sfmemcap_showmem(MEMCAP * mc );
 void     sfmemcap_free( MEMCAP * mc, void * memory);
@@ -0,0 +1,273 @@
+/*
+  sfmsgbatch.c
+
+  Batch of datagrams for one socket, sent with a single sendmmsg() where
+  the system has it.
+
+  The iovecs and message headers are set up once when the batch is made,
+  each slot keeps its own buffer and destination, so adding a message
+  only stores its length.
+*/
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#if defined(HAVE_SENDMMSG) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE     /* sendmmsg() and struct mmsghdr */
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "sfmsgbatch.h"
+
+#ifdef HAVE_SENDMMSG
+typedef struct mmsghdr SFMB_MSG;
+#define SFMB_HDR(m)   (&(m)->msg_hdr)
+#else
+typedef struct msghdr SFMB_MSG;
+#define SFMB_HDR(m)   (m)
+#endif
+
+/*
+*   addr may be NULL if fd is connected, nslots 0 and flush_secs < 0 pick
+*   the defaults
+*/
+SF_MSGBATCH * sfmb_new( int fd, struct sockaddr * addr, socklen_t addrlen,
+                        int slot_size, int nslots, int flush_secs )
+{
+    SF_MSGBATCH * mb;
+    SFMB_MSG    * msgs;
+    int i;
+
+    if( slot_size <= 0 )
+        return 0;
+
+    mb = (SF_MSGBATCH*)calloc(1, sizeof(SF_MSGBATCH));
+
+    if( !mb )
+        return 0;
+
+    mb->fd         = fd;
+    mb->slot_size  = slot_size;
+    mb->nslots     = nslots > 0 ? nslots : SFMB_MAX_MSGS;
+    mb->flush_secs = flush_secs >= 0 ? flush_secs : SFMB_FLUSH_SECS;
+
+    if( addr )
+    {
+        mb->addr = (struct sockaddr*)malloc(addrlen);
+
+        if( !mb->addr )
+        {
+            sfmb_free(mb);
+            return 0;
+        }
+
+        memcpy(mb->addr, addr, addrlen);
+        mb->addrlen = addrlen;
+    }
+
+    mb->buf  = (unsigned char*)malloc((size_t)mb->nslots * slot_size);
+    mb->iov  = (struct iovec*)calloc(mb->nslots, sizeof(struct iovec));
+    mb->msgs = calloc(mb->nslots, sizeof(SFMB_MSG));
+
+    if( !mb->buf || !mb->iov || !mb->msgs )
+    {
+        sfmb_free(mb);
+        return 0;
+    }
+
+    msgs = (SFMB_MSG*)mb->msgs;
+
+    for( i = 0; i < mb->nslots; i++ )
+    {
+        mb->iov[i].iov_base = mb->buf + (size_t)i * slot_size;
+
+        SFMB_HDR(&msgs[i])->msg_name    = mb->addr;
+        SFMB_HDR(&msgs[i])->msg_namelen = mb->addrlen;
+        SFMB_HDR(&msgs[i])->msg_iov     = &mb->iov[i];
+        SFMB_HDR(&msgs[i])->msg_iovlen  = 1;
+    }
+
+    return mb;
+}
+
+/*
+*   The caller flushes first if it wants the waiting messages sent
+*/
+void sfmb_free( SF_MSGBATCH * mb )
+{
+    if( !mb )
+        return;
+
+    free(mb->msgs);
+    free(mb->iov);
+    free(mb->buf);
+    free(mb->addr);
+    free(mb);
+}
+
+/*
+*   Room for the next message, slot_size bytes.  A full batch is sent
+*   first.
+*/
+void * sfmb_slot( SF_MSGBATCH * mb )
+{
+    if( mb->count == mb->nslots )
+        sfmb_flush(mb);
+
+    return mb->iov[mb->count].iov_base;
+}
+
+/*
+*   The message in the slot from sfmb_slot() is len bytes long.  Send the
+*   batch if that filled it or the oldest message has waited flush_secs,
+*   otherwise leave it for the next message or sfmb_flush().
+*/
+void sfmb_commit( SF_MSGBATCH * mb, int len )
+{
+    time_t now;
+
+    if( len > mb->slot_size )
+        len = mb->slot_size;
+
+    mb->iov[mb->count++].iov_len = len;
+
+    if( mb->count == mb->nslots || mb->flush_secs == 0 )
+    {
+        sfmb_flush(mb);
+        return;
+    }
+
+    now = time(0);
+
+    if( !mb->oldest )
+        mb->oldest = now;
+    else if( now - mb->oldest >= mb->flush_secs )
+        sfmb_flush(mb);
+}
+
+/*
+*   Send the batch if the oldest message has waited flush_secs, for
+*   callers that check between messages.  Nothing waiting costs a test.
+*/
+void sfmb_age( SF_MSGBATCH * mb )
+{
+    if( mb->count && time(0) - mb->oldest >= mb->flush_secs )
+        sfmb_flush(mb);
+}
+
+/*
+*   Send everything waiting.  A message the socket refuses is counted and
+*   skipped, like the single sendto() callers never retried either.
+*/
+void sfmb_flush( SF_MSGBATCH * mb )
+{
+    SFMB_MSG * msgs = (SFMB_MSG*)mb->msgs;
+    int i = 0;
+    int n;
+
+    while( i < mb->count )
+    {
+#ifdef HAVE_SENDMMSG
+        n = sendmmsg(mb->fd, msgs + i, mb->count - i, 0);
+#else
+        n = sendmsg(mb->fd, SFMB_HDR(msgs + i), 0) < 0 ? -1 : 1;
+#endif
+        mb->calls++;
+
+        if( n < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+
+            mb->drops++;
+            i++;
+            continue;
+        }
+
+        mb->sent += n;
+        i += n;
+    }
+
+    mb->count  = 0;
+    mb->oldest = 0;
+}
+
+#ifdef SFMSGBATCH_MAIN
+/*
+*   Send a few batches over a socketpair and check every datagram comes
+*   out whole and in order
+*/
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+int main( int argc, char ** argv )
+{
+    SF_MSGBATCH * mb;
+    int   sv[2];
+    char  buf[256];
+    char * slot;
+    int   i, j, n, len, got = 0, bad = 0;
+    int   nmsgs = argc > 1 ? atoi(argv[1]) : 150;
+
+    if( socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) )
+    {
+        perror("socketpair");
+        return 1;
+    }
+
+    fcntl(sv[1], F_SETFL, O_NONBLOCK);
+
+    mb = sfmb_new(sv[0], 0, 0, 100, 16, 60);
+
+    for( i = 0; i < nmsgs; i++ )
+    {
+        slot = (char*)sfmb_slot(mb);
+        len  = 1 + i % 100;
+
+        for( j = 0; j < len; j++ )
+            slot[j] = (char)(i + j);
+
+        sfmb_commit(mb, len);
+
+        /* keep the receive buffer from filling up */
+        while( (n = recv(sv[1], buf, sizeof(buf), 0)) > 0 )
+        {
+            if( n != 1 + got % 100 )
+                bad++;
+
+            for( j = 0; j < n; j++ )
+                if( buf[j] != (char)(got + j) )
+                    bad++;
+
+            got++;
+        }
+    }
+
+    sfmb_flush(mb);
+
+    while( (n = recv(sv[1], buf, sizeof(buf), 0)) > 0 )
+    {
+        if( n != 1 + got % 100 )
+            bad++;
+
+        for( j = 0; j < n; j++ )
+            if( buf[j] != (char)(got + j) )
+                bad++;
+
+        got++;
+    }
+
+    printf("%d messages, %d received, %lu sent in %lu calls, %lu dropped, "
+           "%d bad\n", nmsgs, got, mb->sent, mb->calls, mb->drops, bad);
+
+    sfmb_free(mb);
+    close(sv[0]);
+    close(sv[1]);
+
+    return bad || got != nmsgs;
+}
+#endif
@@ -0,0 +1,58 @@
+/*
+**  sfmsgbatch.h
+**
+**  Batch of datagrams for one socket.
+**
+**  Alert outputs that send one datagram per alert build each message in
+**  a fixed size slot of the batch and the whole batch goes out with one
+**  sendmmsg() once it is full, once the oldest message is old enough, or
+**  when the caller flushes it at the end of a packet batch.  Every slot
+**  is still sent as its own datagram, so receivers see exactly the
+**  messages they saw before.
+**
+**  Without sendmmsg() the batch is sent with one sendmsg() per message,
+**  which only saves the per alert flush decision.
+*/
+#ifndef __SF_MSGBATCH_H__
+#define __SF_MSGBATCH_H__
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#define SFMB_MAX_MSGS       64      /* default messages per batch */
+#define SFMB_FLUSH_SECS     1       /* default age before a send */
+
+typedef struct _SF_MSGBATCH
+{
+    int              fd;
+    struct sockaddr *addr;         /* NULL for a connected socket */
+    socklen_t        addrlen;
+
+    unsigned char  * buf;          /* nslots slots of slot_size bytes */
+    int              slot_size;
+    int              nslots;
+    int              count;        /* messages waiting */
+    struct iovec   * iov;
+    void           * msgs;         /* struct mmsghdr or struct msghdr array */
+
+    int              flush_secs;   /* send once the oldest message is this old */
+    time_t           oldest;
+
+    unsigned long    sent;
+    unsigned long    drops;        /* messages the socket refused */
+    unsigned long    calls;        /* send system calls */
+
+} SF_MSGBATCH;
+
+SF_MSGBATCH * sfmb_new( int fd, struct sockaddr * addr, socklen_t addrlen,
+                        int slot_size, int nslots, int flush_secs );
+void   sfmb_free( SF_MSGBATCH * mb );
+
+void * sfmb_slot( SF_MSGBATCH * mb );
+void   sfmb_commit( SF_MSGBATCH * mb, int len );
+void   sfmb_flush( SF_MSGBATCH * mb );
+void   sfmb_age( SF_MSGBATCH * mb );
+
+#endif
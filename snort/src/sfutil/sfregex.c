@@ -0,0 +1,1198 @@
+/*
+  sfregex.c
+
+  Multi-regex matcher - Thompson NFAs for a set of simple regular
+  expressions, run together through a lazily built DFA.
+
+  Each expression is parsed into a small syntax tree, and the tree is
+  compiled back to front into NFA nodes: a node is either a byte class
+  with one successor, a split with two, or an accept node for one
+  expression.  DFA states are sets of class and accept nodes and are
+  only built when the data walks into them.  Expressions that are not
+  anchored have their start nodes in every state, which is what makes
+  the search find matches starting anywhere.
+
+  See sfregex.h for the syntax.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "sfregex.h"
+
+#define RX_CLS_BYTES    32
+#define RX_MAX_NODES    4096     /* NFA nodes per expression */
+#define RX_MAX_REPEAT   256      /* largest {n,m} we expand */
+#define RX_HASH_SIZE    1024
+
+#define RX_BIT_SET(cls,c)   ((cls)[(c) >> 3] |= (1 << ((c) & 7)))
+#define RX_BIT_TEST(cls,c)  ((cls)[(c) >> 3] &  (1 << ((c) & 7)))
+
+/*
+*  Syntax tree
+*/
+enum { AST_EMPTY, AST_CLS, AST_CAT, AST_ALT, AST_REP };
+
+typedef struct
+{
+    int           type;
+    int           a, b;       /* children */
+    int           min, max;   /* AST_REP, max < 0 is unbounded */
+    unsigned char cls[RX_CLS_BYTES];
+
+} RX_AST;
+
+typedef struct
+{
+    const char  * re;
+    int           pos;
+    int           flags;
+    int           error;
+
+    RX_AST      * ast;
+    int           nast;
+    int           maxast;
+
+} RX_PARSER;
+
+/*
+*  NFA
+*/
+enum { NFA_CLS, NFA_SPLIT, NFA_MATCH, NFA_EOL };
+
+typedef struct
+{
+    int           type;
+    int           out, out1;
+    int           member;     /* NFA_MATCH, NFA_EOL */
+    unsigned char cls[RX_CLS_BYTES];
+
+} RX_NODE;
+
+/*
+*  DFA state - the NFA class and accept nodes it stands for, and the
+*  transitions built so far
+*/
+typedef struct _RX_STATE
+{
+    int               * nodes;
+    int                 nnodes;
+    unsigned            hash;
+    int                 index;  /* in RX_PART.states */
+
+    unsigned            match;  /* members matched on entering the state */
+    unsigned            eol;    /* members matched if the data ends here */
+
+    int                 next[256];  /* state index, -1 not built yet */
+
+    struct _RX_STATE  * hnext;
+
+} RX_STATE;
+
+typedef struct _RX_PART
+{
+    RX_NODE     * nodes;
+    int           nnodes;
+    int           maxnodes;
+
+    int           start[SFREGEX_PART_SIZE];
+    int           anchored[SFREGEX_PART_SIZE];
+    int           nmembers;
+    unsigned      endonly;    /* members with a strict '$' */
+
+    RX_STATE   ** states;
+    int           nstates;
+    int           init;       /* initial state, -1 not built yet */
+    RX_STATE    * hash[RX_HASH_SIZE];
+
+    /* scratch for building states */
+    int         * mark;
+    int           gen;
+    int         * stack;
+    int         * set;
+
+    unsigned long nflush;
+
+} RX_PART;
+
+struct _SFREGEX_SET
+{
+    RX_PART    ** parts;
+    int           nparts;
+    int           nmembers;
+    int           max_states;
+    int           compiled;
+};
+
+/*
+*  Syntax tree construction
+*/
+static int ast_new( RX_PARSER * px, int type )
+{
+    if( px->nast == px->maxast )
+    {
+        RX_AST * ast;
+        int      n = px->maxast ? px->maxast * 2 : 64;
+
+        ast = (RX_AST *) realloc( px->ast, n * sizeof(RX_AST) );
+        if( !ast )
+        {
+            px->error = 1;
+            return -1;
+        }
+
+        px->ast    = ast;
+        px->maxast = n;
+    }
+
+    memset( &px->ast[px->nast], 0, sizeof(RX_AST) );
+    px->ast[px->nast].type = type;
+
+    return px->nast++;
+}
+
+static int ast_pair( RX_PARSER * px, int type, int a, int b )
+{
+    int n = ast_new( px, type );
+
+    if( n < 0 )
+        return -1;
+
+    px->ast[n].a = a;
+    px->ast[n].b = b;
+
+    return n;
+}
+
+static void cls_range( unsigned char * cls, int lo, int hi )
+{
+    for( ; lo <= hi; lo++ )
+        RX_BIT_SET( cls, lo );
+}
+
+static void cls_fold( unsigned char * cls )
+{
+    int c;
+
+    for( c = 'a'; c <= 'z'; c++ )
+    {
+        if( RX_BIT_TEST(cls, c) || RX_BIT_TEST(cls, toupper(c)) )
+        {
+            RX_BIT_SET( cls, c );
+            RX_BIT_SET( cls, toupper(c) );
+        }
+    }
+}
+
+static void cls_negate( unsigned char * cls )
+{
+    int i;
+
+    for( i = 0; i < RX_CLS_BYTES; i++ )
+        cls[i] = ~cls[i];
+}
+
+/*
+*  \d \w \s and friends into cls, returns 0 if c isn't one of them
+*/
+static int cls_escape( unsigned char * cls, int c )
+{
+    unsigned char tmp[RX_CLS_BYTES];
+
+    memset( tmp, 0, sizeof(tmp) );
+
+    switch( tolower(c) )
+    {
+    case 'd':
+        cls_range( tmp, '0', '9' );
+        break;
+
+    case 'w':
+        cls_range( tmp, '0', '9' );
+        cls_range( tmp, 'a', 'z' );
+        cls_range( tmp, 'A', 'Z' );
+        RX_BIT_SET( tmp, '_' );
+        break;
+
+    case 's':
+        RX_BIT_SET( tmp, ' ' );
+        RX_BIT_SET( tmp, '\t' );
+        RX_BIT_SET( tmp, '\n' );
+        RX_BIT_SET( tmp, '\f' );
+        RX_BIT_SET( tmp, '\r' );
+        break;
+
+    default:
+        return 0;
+    }
+
+    if( isupper(c) )
+        cls_negate( tmp );
+
+    for( c = 0; c < RX_CLS_BYTES; c++ )
+        cls[c] |= tmp[c];
+
+    return 1;
+}
+
+static int hex_value( int c )
+{
+    if( c >= '0' && c <= '9' ) return c - '0';
+    if( c >= 'a' && c <= 'f' ) return c - 'a' + 10;
+    if( c >= 'A' && c <= 'F' ) return c - 'A' + 10;
+    return -1;
+}
+
+/*
+*  Single byte escapes, px->pos is just past the backslash.  Returns
+*  the byte or -1 if the escape isn't a plain byte.
+*/
+static int parse_byte_escape( RX_PARSER * px, int in_class )
+{
+    int c = (unsigned char) px->re[px->pos];
+    int h;
+
+    switch( c )
+    {
+    case 'n': px->pos++; return '\n';
+    case 'r': px->pos++; return '\r';
+    case 't': px->pos++; return '\t';
+    case 'f': px->pos++; return '\f';
+    case 'a': px->pos++; return 0x07;
+    case 'e': px->pos++; return 0x1b;
+
+    case 'b':
+        if( !in_class )
+            return -1;
+        px->pos++;
+        return 0x08;
+
+    case 'x':
+        px->pos++;
+
+        if( (h = hex_value(px->re[px->pos])) < 0 )
+            return -1;
+
+        c = h;
+        px->pos++;
+
+        if( (h = hex_value(px->re[px->pos])) >= 0 )
+        {
+            c = c * 16 + h;
+            px->pos++;
+        }
+
+        return c;
+
+    case '\0':
+        return -1;
+
+    default:
+        if( isalnum(c) )
+            return -1;
+
+        px->pos++;
+        return c;
+    }
+}
+
+static int parse_alt( RX_PARSER * px );
+
+static int parse_class( RX_PARSER * px, unsigned char * cls )
+{
+    int negate = 0, first = 1, lo, hi;
+
+    if( px->re[px->pos] == '^' )
+    {
+        negate = 1;
+        px->pos++;
+    }
+
+    for( ;; first = 0 )
+    {
+        lo = (unsigned char) px->re[px->pos];
+
+        if( lo == '\0' )
+            return -1;
+
+        if( lo == ']' && !first )
+        {
+            px->pos++;
+            break;
+        }
+
+        /* [:alpha:] and friends */
+        if( lo == '[' && (px->re[px->pos+1] == ':' ||
+                          px->re[px->pos+1] == '=' ||
+                          px->re[px->pos+1] == '.') )
+            return -1;
+
+        px->pos++;
+
+        if( lo == '\\' )
+        {
+            if( cls_escape( cls, px->re[px->pos] ) )
+            {
+                px->pos++;
+                continue;
+            }
+
+            if( (lo = parse_byte_escape( px, 1 )) < 0 )
+                return -1;
+        }
+
+        if( px->re[px->pos] == '-' && px->re[px->pos+1] != ']' &&
+            px->re[px->pos+1] != '\0' )
+        {
+            px->pos++;
+            hi = (unsigned char) px->re[px->pos++];
+
+            if( hi == '\\' )
+            {
+                if( (hi = parse_byte_escape( px, 1 )) < 0 )
+                    return -1;
+            }
+            else if( hi == '[' )
+            {
+                return -1;
+            }
+
+            if( hi < lo )
+                return -1;
+
+            cls_range( cls, lo, hi );
+        }
+        else
+        {
+            RX_BIT_SET( cls, lo );
+        }
+    }
+
+    /* case folding goes first, [^a] doesn't match 'A' under /i either */
+    if( px->flags & SFREGEX_NOCASE )
+        cls_fold( cls );
+
+    if( negate )
+        cls_negate( cls );
+
+    return 0;
+}
+
+static int parse_atom( RX_PARSER * px )
+{
+    int n, c;
+
+    c = (unsigned char) px->re[px->pos];
+
+    switch( c )
+    {
+    case '(':
+        px->pos++;
+
+        if( px->re[px->pos] == '?' )
+        {
+            /* only (?:...), no look-around, options or named groups */
+            if( px->re[px->pos+1] != ':' )
+                return -1;
+
+            px->pos += 2;
+        }
+
+        n = parse_alt( px );
+
+        if( n < 0 || px->re[px->pos] != ')' )
+            return -1;
+
+        px->pos++;
+        return n;
+
+    case '[':
+        px->pos++;
+
+        if( (n = ast_new( px, AST_CLS )) < 0 )
+            return -1;
+
+        if( parse_class( px, px->ast[n].cls ) )
+            return -1;
+
+        return n;
+
+    case '.':
+        px->pos++;
+
+        if( (n = ast_new( px, AST_CLS )) < 0 )
+            return -1;
+
+        cls_range( px->ast[n].cls, 0, 255 );
+
+        if( !(px->flags & SFREGEX_DOTALL) )
+            px->ast[n].cls['\n' >> 3] &= ~(1 << ('\n' & 7));
+
+        return n;
+
+    case '\\':
+        px->pos++;
+
+        if( (n = ast_new( px, AST_CLS )) < 0 )
+            return -1;
+
+        if( cls_escape( px->ast[n].cls, px->re[px->pos] ) )
+        {
+            px->pos++;
+            return n;
+        }
+
+        if( (c = parse_byte_escape( px, 0 )) < 0 )
+            return -1;
+
+        break;
+
+    case '\0': case '|': case ')':
+    case '*': case '+': case '?': case '{':
+    case '^': case '$':
+        return -1;
+
+    default:
+        px->pos++;
+
+        if( (n = ast_new( px, AST_CLS )) < 0 )
+            return -1;
+
+        break;
+    }
+
+    /* a single byte */
+    RX_BIT_SET( px->ast[n].cls, c );
+
+    if( px->flags & SFREGEX_NOCASE )
+        cls_fold( px->ast[n].cls );
+
+    return n;
+}
+
+static int parse_number( RX_PARSER * px )
+{
+    int n = 0;
+
+    if( !isdigit((int)px->re[px->pos]) )
+        return -1;
+
+    while( isdigit((int)px->re[px->pos]) )
+    {
+        n = n * 10 + px->re[px->pos++] - '0';
+
+        if( n > RX_MAX_REPEAT )
+            return -1;
+    }
+
+    return n;
+}
+
+static int parse_repeat( RX_PARSER * px )
+{
+    int a, n, min, max;
+
+    if( (a = parse_atom( px )) < 0 )
+        return -1;
+
+    for( ;; )
+    {
+        switch( px->re[px->pos] )
+        {
+        case '*': min = 0; max = -1; px->pos++; break;
+        case '+': min = 1; max = -1; px->pos++; break;
+        case '?': min = 0; max = 1;  px->pos++; break;
+
+        case '{':
+            px->pos++;
+
+            if( (min = parse_number( px )) < 0 )
+                return -1;
+
+            max = min;
+
+            if( px->re[px->pos] == ',' )
+            {
+                px->pos++;
+                max = -1;
+
+                if( px->re[px->pos] != '}' &&
+                    (max = parse_number( px )) < min )
+                    return -1;
+            }
+
+            if( px->re[px->pos] != '}' )
+                return -1;
+
+            px->pos++;
+            break;
+
+        default:
+            return a;
+        }
+
+        /* lazy doesn't change whether there is a match, possessive does */
+        if( px->re[px->pos] == '?' )
+            px->pos++;
+        else if( px->re[px->pos] == '+' )
+            return -1;
+
+        if( (n = ast_new( px, AST_REP )) < 0 )
+            return -1;
+
+        px->ast[n].a   = a;
+        px->ast[n].min = min;
+        px->ast[n].max = max;
+
+        a = n;
+    }
+}
+
+static int parse_cat( RX_PARSER * px )
+{
+    int t = -1, a;
+
+    while( px->re[px->pos] && px->re[px->pos] != '|' &&
+           px->re[px->pos] != ')' )
+    {
+        if( (a = parse_repeat( px )) < 0 )
+            return -1;
+
+        t = (t < 0) ? a : ast_pair( px, AST_CAT, t, a );
+
+        if( t < 0 )
+            return -1;
+    }
+
+    if( t < 0 )
+        t = ast_new( px, AST_EMPTY );
+
+    return t;
+}
+
+static int parse_alt( RX_PARSER * px )
+{
+    int t, u;
+
+    if( (t = parse_cat( px )) < 0 )
+        return -1;
+
+    while( px->re[px->pos] == '|' )
+    {
+        px->pos++;
+
+        if( (u = parse_cat( px )) < 0 )
+            return -1;
+
+        if( (t = ast_pair( px, AST_ALT, t, u )) < 0 )
+            return -1;
+    }
+
+    return t;
+}
+
+/*
+*  NFA construction
+*/
+static int nfa_new( RX_PART * p, int type, int out, int out1 )
+{
+    RX_NODE * node;
+
+    if( p->nnodes == p->maxnodes )
+    {
+        int n = p->maxnodes ? p->maxnodes * 2 : 256;
+
+        node = (RX_NODE *) realloc( p->nodes, n * sizeof(RX_NODE) );
+        if( !node )
+            return -1;
+
+        p->nodes    = node;
+        p->maxnodes = n;
+    }
+
+    node = &p->nodes[p->nnodes];
+    memset( node, 0, sizeof(RX_NODE) );
+
+    node->type = type;
+    node->out  = out;
+    node->out1 = out1;
+
+    return p->nnodes++;
+}
+
+/*
+*  Compile tree n so that it continues at node next, back to front so
+*  no dangling pointers have to be patched.  Returns the entry node.
+*/
+static int nfa_compile( RX_PART * p, RX_AST * ast, int n, int next, int limit )
+{
+    RX_AST * t = &ast[n];
+    int      s, a, b, i;
+
+    if( next < 0 || p->nnodes > limit )
+        return -1;
+
+    switch( t->type )
+    {
+    case AST_EMPTY:
+        return next;
+
+    case AST_CLS:
+        if( (s = nfa_new( p, NFA_CLS, next, -1 )) < 0 )
+            return -1;
+
+        memcpy( p->nodes[s].cls, t->cls, RX_CLS_BYTES );
+        return s;
+
+    case AST_CAT:
+        return nfa_compile( p, ast, t->a,
+                            nfa_compile( p, ast, t->b, next, limit ), limit );
+
+    case AST_ALT:
+        a = nfa_compile( p, ast, t->a, next, limit );
+        b = nfa_compile( p, ast, t->b, next, limit );
+
+        if( a < 0 || b < 0 )
+            return -1;
+
+        return nfa_new( p, NFA_SPLIT, a, b );
+
+    case AST_REP:
+        if( t->max < 0 )
+        {
+            /* loop: split back into the body or on to next */
+            if( (s = nfa_new( p, NFA_SPLIT, -1, next )) < 0 )
+                return -1;
+
+            if( (a = nfa_compile( p, ast, t->a, s, limit )) < 0 )
+                return -1;
+
+            p->nodes[s].out = a;
+        }
+        else
+        {
+            /* the optional copies nest: (a(a)?)? */
+            for( s = next, i = t->min; i < t->max; i++ )
+            {
+                if( (a = nfa_compile( p, ast, t->a, s, limit )) < 0 )
+                    return -1;
+
+                if( (s = nfa_new( p, NFA_SPLIT, a, next )) < 0 )
+                    return -1;
+            }
+        }
+
+        for( i = 0; i < t->min; i++ )
+        {
+            if( (s = nfa_compile( p, ast, t->a, s, limit )) < 0 )
+                return -1;
+        }
+
+        return s;
+    }
+
+    return -1;
+}
+
+/*
+*  Public API
+*/
+SFREGEX_SET * sfregex_new( int max_states )
+{
+    SFREGEX_SET * set;
+
+    set = (SFREGEX_SET *) calloc( 1, sizeof(SFREGEX_SET) );
+    if( !set )
+        return 0;
+
+    set->max_states = max_states > 0 ? max_states : SFREGEX_MAX_STATES;
+
+    return set;
+}
+
+/*
+*  Add an expression, returns its index in the set or -1 if it uses
+*  something we don't support.
+*/
+int sfregex_add( SFREGEX_SET * set, const char * re, int flags )
+{
+    RX_PARSER px;
+    RX_PART * p;
+    char    * buf;
+    int       len, root, accept, start, save, eol = 0, member;
+
+    if( !set || !re || set->compiled )
+        return -1;
+
+    len = strlen( re );
+
+    buf = (char *) malloc( len + 1 );
+    if( !buf )
+        return -1;
+
+    memcpy( buf, re, len + 1 );
+
+    /* '^' at the front and '$' at the end, nowhere else */
+    if( buf[0] == '^' )
+    {
+        flags |= SFREGEX_ANCHORED;
+        memmove( buf, buf + 1, len-- );
+    }
+
+    if( len > 0 && buf[len-1] == '$' )
+    {
+        int i, nbs = 0;
+
+        for( i = len - 2; i >= 0 && buf[i] == '\\'; i-- )
+            nbs++;
+
+        if( !(nbs & 1) )
+        {
+            eol = 1;
+            buf[--len] = '\0';
+        }
+    }
+
+    memset( &px, 0, sizeof(px) );
+    px.re    = buf;
+    px.flags = flags;
+
+    root = parse_alt( &px );
+
+    /* a leftover ')' or a stripped anchor that only binds one branch */
+    if( root < 0 || px.error || px.re[px.pos] != '\0' ||
+        ((flags & SFREGEX_ANCHORED || eol) && px.ast[root].type == AST_ALT) )
+    {
+        free( px.ast );
+        free( buf );
+        return -1;
+    }
+
+    /* find a partition with room */
+    if( !set->nparts ||
+        set->parts[set->nparts-1]->nmembers == SFREGEX_PART_SIZE )
+    {
+        RX_PART ** parts;
+
+        parts = (RX_PART **) realloc( set->parts,
+                                      (set->nparts + 1) * sizeof(RX_PART *) );
+        if( !parts )
+            goto fail;
+
+        set->parts = parts;
+
+        p = (RX_PART *) calloc( 1, sizeof(RX_PART) );
+        if( !p )
+            goto fail;
+
+        p->init = -1;
+        set->parts[set->nparts++] = p;
+    }
+
+    p      = set->parts[set->nparts-1];
+    save   = p->nnodes;
+    member = p->nmembers;
+
+    if( (accept = nfa_new( p, eol ? NFA_EOL : NFA_MATCH, -1, -1 )) < 0 )
+        goto fail;
+
+    p->nodes[accept].member = member;
+
+    start = nfa_compile( p, px.ast, root, accept, save + RX_MAX_NODES );
+
+    if( start < 0 || p->nnodes > save + RX_MAX_NODES )
+    {
+        p->nnodes = save;
+        goto fail;
+    }
+
+    p->start[member]    = start;
+    p->anchored[member] = (flags & SFREGEX_ANCHORED) ? 1 : 0;
+
+    if( eol && (flags & SFREGEX_ENDONLY) )
+        p->endonly |= 1U << member;
+
+    p->nmembers++;
+
+    free( px.ast );
+    free( buf );
+
+    return set->nmembers++;
+
+fail:
+    free( px.ast );
+    free( buf );
+    return -1;
+}
+
+/*
+*  Done adding, set up the scratch space for building states
+*/
+int sfregex_compile( SFREGEX_SET * set )
+{
+    RX_PART * p;
+    int       i;
+
+    if( !set )
+        return -1;
+
+    for( i = 0; i < set->nparts; i++ )
+    {
+        p = set->parts[i];
+
+        p->mark   = (int *) calloc( p->nnodes, sizeof(int) );
+        p->stack  = (int *) calloc( 3 * p->nnodes + SFREGEX_PART_SIZE + 1,
+                                    sizeof(int) );
+        p->set    = (int *) calloc( p->nnodes + 1, sizeof(int) );
+        p->states = (RX_STATE **) calloc( set->max_states, sizeof(RX_STATE *) );
+
+        if( !p->mark || !p->stack || !p->set || !p->states )
+            return -1;
+    }
+
+    set->compiled = 1;
+
+    return 0;
+}
+
+int sfregex_count( SFREGEX_SET * set )
+{
+    return set ? set->nmembers : 0;
+}
+
+static int int_cmp( const void * a, const void * b )
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+/*
+*  Follow the splits from the nodes on the stack, collecting the class
+*  and accept nodes in p->set.  Returns how many there are.
+*/
+static int rx_closure( RX_PART * p, int sp )
+{
+    RX_NODE * node;
+    int       n, count = 0;
+
+    if( ++p->gen == 0 )
+    {
+        memset( p->mark, 0, p->nnodes * sizeof(int) );
+        p->gen = 1;
+    }
+
+    while( sp > 0 )
+    {
+        n = p->stack[--sp];
+
+        if( p->mark[n] == p->gen )
+            continue;
+
+        p->mark[n] = p->gen;
+        node = &p->nodes[n];
+
+        if( node->type == NFA_SPLIT )
+        {
+            p->stack[sp++] = node->out1;
+            p->stack[sp++] = node->out;
+        }
+        else
+        {
+            p->set[count++] = n;
+        }
+    }
+
+    qsort( p->set, count, sizeof(int), int_cmp );
+
+    return count;
+}
+
+static void rx_flush( RX_PART * p )
+{
+    int i;
+
+    for( i = 0; i < p->nstates; i++ )
+    {
+        free( p->states[i]->nodes );
+        free( p->states[i] );
+    }
+
+    memset( p->hash, 0, sizeof(p->hash) );
+    p->nstates = 0;
+    p->init    = -1;
+    p->nflush++;
+}
+
+/*
+*  Find or make the state for the node set in p->set
+*/
+static int rx_state( RX_PART * p, int count, int max_states )
+{
+    RX_STATE * s;
+    unsigned   hash = count;
+    int        i, idx;
+
+    for( i = 0; i < count; i++ )
+        hash = hash * 31 + p->set[i];
+
+    for( s = p->hash[hash % RX_HASH_SIZE]; s; s = s->hnext )
+    {
+        if( s->hash == hash && s->nnodes == count &&
+            !memcmp( s->nodes, p->set, count * sizeof(int) ) )
+        {
+            return s->index;
+        }
+    }
+
+    /* full, start over - p->set is scratch and survives this */
+    if( p->nstates == max_states )
+        rx_flush( p );
+
+    s = (RX_STATE *) calloc( 1, sizeof(RX_STATE) );
+    if( !s )
+        return -1;
+
+    s->nodes = (int *) malloc( (count ? count : 1) * sizeof(int) );
+    if( !s->nodes )
+    {
+        free( s );
+        return -1;
+    }
+
+    memcpy( s->nodes, p->set, count * sizeof(int) );
+    s->nnodes = count;
+    s->hash   = hash;
+
+    for( i = 0; i < count; i++ )
+    {
+        RX_NODE * node = &p->nodes[p->set[i]];
+
+        if( node->type == NFA_MATCH )
+            s->match |= 1U << node->member;
+        else if( node->type == NFA_EOL )
+            s->eol |= 1U << node->member;
+    }
+
+    for( i = 0; i < 256; i++ )
+        s->next[i] = -1;
+
+    s->hnext = p->hash[hash % RX_HASH_SIZE];
+    p->hash[hash % RX_HASH_SIZE] = s;
+
+    idx = p->nstates++;
+    p->states[idx] = s;
+    s->index = idx;
+
+    return idx;
+}
+
+static int rx_init_state( RX_PART * p, int max_states )
+{
+    int i, sp = 0;
+
+    if( p->init >= 0 )
+        return p->init;
+
+    for( i = 0; i < p->nmembers; i++ )
+        p->stack[sp++] = p->start[i];
+
+    p->init = rx_state( p, rx_closure( p, sp ), max_states );
+
+    return p->init;
+}
+
+/*
+*  Build the transition from state idx on byte c
+*/
+static int rx_step( RX_PART * p, int idx, int c, int max_states )
+{
+    RX_STATE    * s = p->states[idx];
+    RX_NODE     * node;
+    unsigned long nflush = p->nflush;
+    int           i, sp = 0, next;
+
+    for( i = 0; i < s->nnodes; i++ )
+    {
+        node = &p->nodes[s->nodes[i]];
+
+        if( node->type == NFA_CLS && RX_BIT_TEST(node->cls, c) )
+            p->stack[sp++] = node->out;
+    }
+
+    /* unanchored expressions may start at any byte */
+    for( i = 0; i < p->nmembers; i++ )
+    {
+        if( !p->anchored[i] )
+            p->stack[sp++] = p->start[i];
+    }
+
+    next = rx_state( p, rx_closure( p, sp ), max_states );
+
+    /* a flush takes the source state with it */
+    if( next >= 0 && p->nflush == nflush )
+        s->next[c] = next;
+
+    return next;
+}
+
+/*
+*  Search buf, matched[i] is set to 1 for each expression i that
+*  matches somewhere.  Returns the number of expressions that matched,
+*  -1 on error.
+*/
+int sfregex_search( SFREGEX_SET * set, const unsigned char * buf, int len,
+                    unsigned char * matched )
+{
+    RX_PART  * p;
+    RX_STATE * s;
+    unsigned   found, all;
+    int        i, k, idx, base, nfound = 0;
+
+    if( !set || !set->compiled || len < 0 )
+        return -1;
+
+    memset( matched, 0, set->nmembers );
+
+    for( k = 0, base = 0; k < set->nparts; base += p->nmembers, k++ )
+    {
+        p   = set->parts[k];
+        all = (p->nmembers == 32) ? ~0U : ((1U << p->nmembers) - 1);
+
+        if( (idx = rx_init_state( p, set->max_states )) < 0 )
+            return -1;
+
+        s     = p->states[idx];
+        found = s->match;
+
+        for( i = 0; i < len && found != all; i++ )
+        {
+            /* '$' also matches in front of a final newline */
+            if( i == len - 1 && buf[i] == '\n' )
+                found |= s->eol & ~p->endonly;
+
+            if( s->next[buf[i]] >= 0 )
+                idx = s->next[buf[i]];
+            else if( (idx = rx_step( p, idx, buf[i], set->max_states )) < 0 )
+                return -1;
+
+            s = p->states[idx];
+            found |= s->match;
+
+            /* nothing left alive, only anchored expressions get here */
+            if( !s->nnodes )
+                break;
+        }
+
+        if( i == len )
+            found |= s->eol;
+
+        for( i = 0; i < p->nmembers; i++ )
+        {
+            if( found & (1U << i) )
+            {
+                matched[base + i] = 1;
+                nfound++;
+            }
+        }
+    }
+
+    return nfound;
+}
+
+void sfregex_free( SFREGEX_SET * set )
+{
+    RX_PART * p;
+    int       i;
+
+    if( !set )
+        return;
+
+    for( i = 0; i < set->nparts; i++ )
+    {
+        p = set->parts[i];
+
+        if( p->states )
+            rx_flush( p );
+
+        free( p->states );
+        free( p->nodes );
+        free( p->mark );
+        free( p->stack );
+        free( p->set );
+        free( p );
+    }
+
+    free( set->parts );
+    free( set );
+}
+
+void sfregex_showstats( SFREGEX_SET * set, const char * name )
+{
+    int i;
+
+    if( !set )
+        return;
+
+    fprintf(stderr, "%s: %d expressions in %d partitions\n",
+            name ? name : "sfregex", set->nmembers, set->nparts);
+
+    for( i = 0; i < set->nparts; i++ )
+    {
+        RX_PART * p = set->parts[i];
+
+        fprintf(stderr, "   %2d: %d expressions, %d nfa nodes, "
+                "%d dfa states, %lu flushes\n",
+                i, p->nmembers, p->nnodes, p->nstates, p->nflush);
+    }
+}
+
+#ifdef SFREGEX_MAIN
+int main( int argc, char ** argv )
+{
+    static const char * re[] = {
+        "abc", "^GET /", "a(b|c)+d", "x[0-9]{2,3}y", "end$", "(?:foo|bar)baz",
+        "[^a-z]q", "u.*v", "\\x41\\x42", "colou?r", "a\\d+b", 0
+    };
+    static const char * text[] = {
+        "xxabcxx", "GET /index", "POST /", "abcbd", "x12y x1y", "the end",
+        "the end\n", "barbaz", "Aq", "u....v", "AB", "color", "a123b", 0
+    };
+    SFREGEX_SET   * set;
+    unsigned char   matched[32];
+    int             i, j;
+
+    set = sfregex_new( 8 );
+
+    for( i = 0; re[i]; i++ )
+    {
+        if( sfregex_add( set, re[i], 0 ) < 0 )
+            printf("unsupported: %s\n", re[i]);
+    }
+
+    if( sfregex_add( set, "a(?=b)", 0 ) >= 0 || sfregex_add( set, "(a)\\1", 0 ) >= 0 )
+        printf("look-around or back reference accepted\n");
+
+    sfregex_compile( set );
+
+    for( j = 0; text[j]; j++ )
+    {
+        sfregex_search( set, (const unsigned char *)text[j], strlen(text[j]),
+                        matched );
+
+        printf("%-12s:", text[j]);
+
+        for( i = 0; re[i]; i++ )
+        {
+            if( matched[i] )
+                printf(" %s", re[i]);
+        }
+
+        printf("\n");
+    }
+
+    sfregex_showstats( set, "test" );
+    sfregex_free( set );
+
+    return 0;
+}
+#endif
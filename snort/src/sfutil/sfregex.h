@@ -0,0 +1,49 @@
+/*
+**  sfregex.h
+**
+**  Multi-regex matcher.
+**
+**  A set of simple regular expressions is compiled into Thompson NFAs
+**  and matched together by a lazily built DFA, one pass over the data
+**  no matter how many expressions are in the set and no backtracking.
+**  The set is split into partitions of up to SFREGEX_PART_SIZE
+**  expressions, each with its own DFA, and each DFA keeps at most
+**  max_states states.  When it fills up, the states are thrown away
+**  and built again as needed, so memory is bounded even for
+**  expressions whose DFA would blow up.
+**
+**  Only the question "does this expression match anywhere in the
+**  buffer" is answered, not where.
+**
+**  Supported: literals, escapes (\d \w \s and their negations, \n \r \t
+**  \f \e \a \xHH, escaped punctuation), classes, '.', groups and (?:),
+**  alternation, * + ? {n} {n,} {n,m} (lazy forms too), '^' at the start
+**  and '$' at the end.  Anything else - back references, look-around,
+**  \b, inline options, possessive quantifiers - makes sfregex_add()
+**  refuse the expression so the caller can fall back to pcre.
+*/
+#ifndef __SF_REGEX_H__
+#define __SF_REGEX_H__
+
+#include <sys/types.h>
+
+#define SFREGEX_NOCASE      0x01   /* /i */
+#define SFREGEX_DOTALL      0x02   /* /s, '.' matches newline */
+#define SFREGEX_ANCHORED    0x04   /* /A, match at the start only */
+#define SFREGEX_ENDONLY     0x08   /* /E, '$' ignores a final newline */
+
+#define SFREGEX_PART_SIZE   32
+#define SFREGEX_MAX_STATES  256    /* default DFA states per partition */
+
+typedef struct _SFREGEX_SET SFREGEX_SET;
+
+SFREGEX_SET * sfregex_new( int max_states );
+int    sfregex_add( SFREGEX_SET * set, const char * re, int flags );
+int    sfregex_compile( SFREGEX_SET * set );
+int    sfregex_count( SFREGEX_SET * set );
+int    sfregex_search( SFREGEX_SET * set, const unsigned char * buf, int len,
+                       unsigned char * matched );
+void   sfregex_free( SFREGEX_SET * set );
+void   sfregex_showstats( SFREGEX_SET * set, const char * name );
+
+#endif
@@ -0,0 +1,312 @@
+/*
+  sfslab.c
+
+  Size class slab allocator.  Objects are grouped into power of two size
+  classes between min_size and max_size, optionally with steps classes
+  per doubling, rounded to 8 bytes.  Each class keeps a free list
+  threaded through the free objects themselves; when a class runs dry a
+  new chunk is malloc'd and carved into objects of that class.  Chunks
+  are only given back to the system by sfslab_destroy().
+
+  Anything bigger than the top class is passed straight to malloc/free.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "sfslab.h"
+
+/*
+*  Chunk header - keeps the chunk list and the alignment of the first object
+*/
+typedef union _SFSLAB_CHUNK
+{
+    union _SFSLAB_CHUNK * next;
+    double                align;
+} SFSLAB_CHUNK;
+
+#define SFSLAB_ALIGN(n)   (((n) + 7) & ~7U)
+
+/*
+*   Set up the size classes, min_size is rounded up so a free object can
+*   always hold the free list pointer.
+*/
+int sfslab_init( SFSLAB * s, unsigned min_size, unsigned max_size,
+                 unsigned chunk_size )
+{
+    return sfslab_init_steps( s, min_size, max_size, chunk_size, 1 );
+}
+
+/*
+*   Same with each doubling from one power of two to the next split into
+*   steps classes, 4 steps keep the rounding loss under 20%.
+*/
+int sfslab_init_steps( SFSLAB * s, unsigned min_size, unsigned max_size,
+                       unsigned chunk_size, unsigned steps )
+{
+    unsigned base, size, top, i;
+    int      c;
+
+    if( !s || !max_size )
+        return -1;
+
+    memset(s, 0, sizeof(SFSLAB));
+
+    if( min_size < sizeof(void*) )
+        min_size = sizeof(void*);
+
+    if( steps < 1 )
+        steps = 1;
+
+    for( base = sizeof(void*); base < min_size; base <<= 1 )
+        ;
+
+    s->chunk_size = chunk_size ? chunk_size : SFSLAB_CHUNK_SIZE;
+
+    for( ; s->nclasses < SFSLAB_MAX_CLASSES; base <<= 1 )
+    {
+        for( i = 0; i < steps && s->nclasses < SFSLAB_MAX_CLASSES; i++ )
+        {
+            size = SFSLAB_ALIGN(base + base / steps * i);
+
+            if( s->nclasses && size <= s->classes[s->nclasses-1].size )
+                continue;
+
+            s->classes[s->nclasses++].size = size;
+
+            if( size >= max_size )
+                break;
+        }
+
+        if( s->classes[s->nclasses-1].size >= max_size )
+            break;
+    }
+
+    /*
+    *   Map every multiple of 8 up to the top class to its class, all
+    *   class sizes are multiples of 8 so that is the answer for any size
+    *   rounded up to one.
+    */
+    top = s->classes[s->nclasses-1].size;
+
+    s->index = (unsigned char *) malloc( top / 8 + 1 );
+    if( !s->index )
+        return -1;
+
+    for( i = 0, c = 0; i <= top / 8; i++ )
+    {
+        while( i * 8 > s->classes[c].size )
+            c++;
+
+        s->index[i] = (unsigned char)c;
+    }
+
+    return 0;
+}
+
+/*
+*   Find the smallest class that holds nbytes, NULL if it's too big
+*/
+static SFSLAB_CLASS * sfslab_class( SFSLAB * s, unsigned nbytes )
+{
+    if( nbytes > s->classes[s->nclasses-1].size )
+        return 0;
+
+    return &s->classes[ s->index[ (nbytes + 7) >> 3 ] ];
+}
+
+/*
+*   Grab a new chunk and put all of its objects on the class free list
+*/
+static int sfslab_refill( SFSLAB * s, SFSLAB_CLASS * c )
+{
+    SFSLAB_CHUNK * chunk;
+    unsigned       nobjs, i;
+    char         * obj;
+
+    nobjs = s->chunk_size / c->size;
+    if( nobjs < 1 )
+        nobjs = 1;
+
+    chunk = (SFSLAB_CHUNK *) malloc( sizeof(SFSLAB_CHUNK) + nobjs * c->size );
+    if( !chunk )
+        return -1;
+
+    chunk->next = (SFSLAB_CHUNK *) s->chunks;
+    s->chunks   = chunk;
+    s->nchunks++;
+
+    obj = (char *)(chunk + 1);
+
+    for( i = 0; i < nobjs; i++, obj += c->size )
+    {
+        *(void **)obj = c->free_list;
+        c->free_list  = obj;
+    }
+
+    c->nfree += nobjs;
+
+    return 0;
+}
+
+/*
+*   Allocate some memory, the contents are not cleared
+*/
+void * sfslab_alloc( SFSLAB * s, unsigned nbytes )
+{
+    SFSLAB_CLASS * c;
+    void         * p;
+
+    c = sfslab_class( s, nbytes );
+
+    if( !c )
+    {
+        p = malloc( nbytes );
+        if( p )
+        {
+            s->nbig++;
+            s->bigbytes += nbytes;
+        }
+        return p;
+    }
+
+    if( !c->free_list && sfslab_refill( s, c ) )
+        return 0;
+
+    p = c->free_list;
+    c->free_list = *(void **)p;
+
+    c->nfree--;
+    c->nused++;
+
+    if( c->nused > c->hiwater )
+        c->hiwater = c->nused;
+
+    return p;
+}
+
+/*
+*   Release memory back to its class
+*/
+void sfslab_free( SFSLAB * s, void * p, unsigned nbytes )
+{
+    SFSLAB_CLASS * c;
+
+    if( !p )
+        return;
+
+    c = sfslab_class( s, nbytes );
+
+    if( !c )
+    {
+        s->nbig--;
+        s->bigbytes -= nbytes;
+        free( p );
+        return;
+    }
+
+    *(void **)p  = c->free_list;
+    c->free_list = p;
+
+    c->nused--;
+    c->nfree++;
+}
+
+/*
+*   Release all chunks, any objects still in use become invalid
+*/
+void sfslab_destroy( SFSLAB * s )
+{
+    SFSLAB_CHUNK * chunk, * next;
+
+    for( chunk = (SFSLAB_CHUNK *) s->chunks; chunk; chunk = next )
+    {
+        next = chunk->next;
+        free( chunk );
+    }
+
+    free( s->index );
+
+    memset(s, 0, sizeof(SFSLAB));
+}
+
+/*
+*   Default printer for sfslab_showstats
+*/
+static int sfslab_print( const char * format, ... )
+{
+    va_list ap;
+    int     n;
+
+    va_start(ap, format);
+    n = vfprintf(stderr, format, ap);
+    va_end(ap);
+
+    return n;
+}
+
+/*
+*   Dump per class usage through print, or to stderr if it is NULL
+*/
+void sfslab_showstats( SFSLAB * s, const char * name,
+                       int (*print)( const char *, ... ) )
+{
+    int i;
+
+    if( !print )
+        print = sfslab_print;
+
+    print("%s: %lu chunks of %u bytes, %lu large blocks (%lu bytes)\n",
+            name ? name : "sfslab", s->nchunks, s->chunk_size,
+            s->nbig, s->bigbytes);
+
+    for( i = 0; i < s->nclasses; i++ )
+    {
+        SFSLAB_CLASS * c = &s->classes[i];
+
+        if( !c->nused && !c->nfree )
+            continue;
+
+        print("   %6u bytes: used=%lu free=%lu hiwater=%lu\n",
+                c->size, c->nused, c->nfree, c->hiwater);
+    }
+}
+
+#ifdef SFSLAB_MAIN
+int main( int argc, char ** argv )
+{
+    SFSLAB  slab;
+    void  * p[1000];
+    int     i;
+
+    if( sfslab_init( &slab, 32, 2048, 0 ) )
+    {
+        printf("sfslab_init failed\n");
+        return 1;
+    }
+
+    for( i = 0; i < 1000; i++ )
+    {
+        p[i] = sfslab_alloc( &slab, (i * 7) % 4000 + 1 );
+        memset( p[i], i & 0xff, (i * 7) % 4000 + 1 );
+    }
+
+    for( i = 0; i < 1000; i += 2 )
+        sfslab_free( &slab, p[i], (i * 7) % 4000 + 1 );
+
+    for( i = 0; i < 1000; i += 2 )
+        p[i] = sfslab_alloc( &slab, (i * 7) % 4000 + 1 );
+
+    sfslab_showstats( &slab, "test", 0 );
+
+    for( i = 0; i < 1000; i++ )
+        sfslab_free( &slab, p[i], (i * 7) % 4000 + 1 );
+
+    sfslab_showstats( &slab, "test", 0 );
+
+    sfslab_destroy( &slab );
+
+    return 0;
+}
+#endif
@@ -0,0 +1,59 @@
+/*
+**  sfslab.h
+**
+**  Size class slab allocator.
+**
+**  Small objects are carved out of large chunks and recycled through
+**  per size class free lists, so a busy allocator does not go back to
+**  malloc/free for every object.  Requests larger than the biggest
+**  size class fall through to malloc.
+**
+**  Size classes are powers of two, or with sfslab_init_steps() each
+**  doubling is split into a few steps to waste less on rounding.
+**
+**  Callers must pass the same size to sfslab_free() that they passed
+**  to sfslab_alloc(), the allocator keeps no per-object header.
+*/
+#ifndef __SF_SLAB_H__
+#define __SF_SLAB_H__
+
+#define SFSLAB_MAX_CLASSES   64
+#define SFSLAB_CHUNK_SIZE    (64*1024)
+
+typedef struct _SFSLAB_CLASS
+{
+    unsigned        size;     /* object size for this class */
+    void          * free_list;/* singly linked list of free objects */
+    unsigned long   nused;    /* objects handed out */
+    unsigned long   nfree;    /* objects sitting on the free list */
+    unsigned long   hiwater;  /* most objects ever in use at once */
+
+} SFSLAB_CLASS;
+
+typedef struct _SFSLAB
+{
+    SFSLAB_CLASS    classes[SFSLAB_MAX_CLASSES];
+    int             nclasses;
+    unsigned        chunk_size;
+
+    unsigned char * index;    /* class of each 8 byte size up to the top class */
+
+    void          * chunks;   /* chunks we carved objects from */
+    unsigned long   nchunks;
+
+    unsigned long   nbig;     /* malloc'd objects larger than the top class */
+    unsigned long   bigbytes;
+
+} SFSLAB;
+
+int    sfslab_init( SFSLAB * s, unsigned min_size, unsigned max_size,
+                    unsigned chunk_size );
+int    sfslab_init_steps( SFSLAB * s, unsigned min_size, unsigned max_size,
+                          unsigned chunk_size, unsigned steps );
+void * sfslab_alloc( SFSLAB * s, unsigned nbytes );
+void   sfslab_free( SFSLAB * s, void * p, unsigned nbytes );
+void   sfslab_destroy( SFSLAB * s );
+void   sfslab_showstats( SFSLAB * s, const char * name,
+                         int (*print)( const char *, ... ) );
+
+#endif
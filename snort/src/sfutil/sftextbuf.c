@@ -0,0 +1,552 @@
+/*
+  sftextbuf.c
+
+  Append buffer for text output, with stdio free formatters for the
+  things alert lines are made of: decimal and hex integers, IPv4
+  addresses and tcpdump style timestamps.
+
+  The timestamp formatter keeps the "MM/DD[/YY]-" prefix of the current
+  day, so the only gmtime() call is the first one each day.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sftextbuf.h"
+
+/*
+*   Make room for len more bytes, the buffer is grown rather than written
+*   out so that a record is never split.
+*/
+static int sftb_reserve( SF_TEXTBUF * tb, int len )
+{
+    char * buf;
+    int    size;
+
+    if( tb->len + len <= tb->size )
+        return 0;
+
+    for( size = tb->size; size < tb->len + len; size <<= 1 )
+        ;
+
+    buf = (char*)realloc(tb->buf, size);
+
+    if( !buf )
+        return -1;
+
+    tb->buf  = buf;
+    tb->size = size;
+
+    return 0;
+}
+
+/*
+*   flush_size 0 and flush_secs < 0 pick the defaults
+*/
+SF_TEXTBUF * sftb_new( FILE * fp, int flush_size, int flush_secs )
+{
+    SF_TEXTBUF * tb;
+
+    tb = (SF_TEXTBUF*)calloc(1, sizeof(SF_TEXTBUF));
+
+    if( !tb )
+        return 0;
+
+    tb->fp         = fp;
+    tb->flush_size = flush_size > 0 ? flush_size : SFTB_FLUSH_SIZE;
+    tb->flush_secs = flush_secs >= 0 ? flush_secs : SFTB_FLUSH_SECS;
+    tb->ts_day     = -1;
+
+    /* a record or two of headroom so the common case never grows */
+    tb->size = tb->flush_size + 4096;
+    tb->buf  = (char*)malloc(tb->size);
+
+    if( !tb->buf )
+    {
+        free(tb);
+        return 0;
+    }
+
+    return tb;
+}
+
+/*
+*   Write out what is left, the FILE is the caller's to close
+*/
+void sftb_free( SF_TEXTBUF * tb )
+{
+    if( !tb )
+        return;
+
+    sftb_flush(tb);
+
+    free(tb->buf);
+    free(tb);
+}
+
+void sftb_write( SF_TEXTBUF * tb, const char * s, int len )
+{
+    if( len <= 0 || sftb_reserve(tb, len) )
+        return;
+
+    memcpy(tb->buf + tb->len, s, len);
+    tb->len += len;
+}
+
+void sftb_puts( SF_TEXTBUF * tb, const char * s )
+{
+    sftb_write(tb, s, strlen(s));
+}
+
+void sftb_putc( SF_TEXTBUF * tb, int c )
+{
+    if( tb->len < tb->size || !sftb_reserve(tb, 1) )
+        tb->buf[tb->len++] = (char)c;
+}
+
+/*
+*   Unsigned decimal, like "%lu"
+*/
+void sftb_putu( SF_TEXTBUF * tb, unsigned long u )
+{
+    char   tmp[24];
+    char * p = tmp + sizeof(tmp);
+
+    do
+    {
+        *--p = (char)('0' + u % 10);
+        u /= 10;
+
+    } while( u );
+
+    sftb_write(tb, p, tmp + sizeof(tmp) - p);
+}
+
+/*
+*   Unsigned upper case hex, like "%lX"
+*/
+void sftb_putx( SF_TEXTBUF * tb, unsigned long u )
+{
+    static const char digits[] = "0123456789ABCDEF";
+    char   tmp[24];
+    char * p = tmp + sizeof(tmp);
+
+    do
+    {
+        *--p = digits[u & 0xf];
+        u >>= 4;
+
+    } while( u );
+
+    sftb_write(tb, p, tmp + sizeof(tmp) - p);
+}
+
+/*
+*   Dotted quad, the address is in network order like inet_ntoa() takes it
+*/
+void sftb_putip( SF_TEXTBUF * tb, u_int32_t ip )
+{
+    const unsigned char * b = (const unsigned char *)&ip;
+    char * p;
+    int    i;
+    unsigned v;
+
+    if( sftb_reserve(tb, 15) )
+        return;
+
+    p = tb->buf + tb->len;
+
+    for( i = 0; i < 4; i++ )
+    {
+        v = b[i];
+
+        if( v >= 100 )
+        {
+            *p++ = (char)('0' + v / 100);
+            v %= 100;
+            *p++ = (char)('0' + v / 10);
+        }
+        else if( v >= 10 )
+        {
+            *p++ = (char)('0' + v / 10);
+        }
+
+        *p++ = (char)('0' + v % 10);
+
+        if( i < 3 )
+            *p++ = '.';
+    }
+
+    tb->len = p - tb->buf;
+}
+
+static char * sftb_2digits( char * p, unsigned v )
+{
+    *p++ = (char)('0' + (v / 10) % 10);
+    *p++ = (char)('0' + v % 10);
+    return p;
+}
+
+/*
+*   Same output as ts_print(): "MM/DD[/YY]-HH:MM:SS.UUUUUU " with the
+*   trailing space.  localzone is the offset from GMT in seconds, a NULL
+*   tv means now.
+*/
+void sftb_puttime( SF_TEXTBUF * tb, const struct timeval * tv,
+                   int localzone, int include_year )
+{
+    struct timeval now;
+    struct tm * lt;
+    time_t day, t;
+    unsigned s, usec;
+    char * p;
+    int    i;
+
+    if( !tv )
+    {
+        gettimeofday(&now, 0);
+        tv = &now;
+    }
+
+    t   = tv->tv_sec + localzone;
+    s   = (unsigned)(t % 86400);
+    day = t - s;
+
+    if( day != tb->ts_day || include_year != tb->ts_year )
+    {
+        lt = gmtime(&day);
+
+        if( !lt )
+            return;
+
+        p = sftb_2digits(tb->ts_date, lt->tm_mon + 1);
+        *p++ = '/';
+        p = sftb_2digits(p, lt->tm_mday);
+
+        if( include_year )
+        {
+            *p++ = '/';
+            p = sftb_2digits(p, lt->tm_year - 100);
+        }
+
+        *p++ = '-';
+
+        tb->ts_date_len = p - tb->ts_date;
+        tb->ts_day      = day;
+        tb->ts_year     = include_year;
+    }
+
+    if( sftb_reserve(tb, tb->ts_date_len + 17) )
+        return;
+
+    p = tb->buf + tb->len;
+
+    memcpy(p, tb->ts_date, tb->ts_date_len);
+    p += tb->ts_date_len;
+
+    p = sftb_2digits(p, s / 3600);
+    *p++ = ':';
+    p = sftb_2digits(p, (s % 3600) / 60);
+    *p++ = ':';
+    p = sftb_2digits(p, s % 60);
+    *p++ = '.';
+
+    usec = (unsigned)tv->tv_usec;
+
+    for( i = 5; i >= 0; i-- )
+    {
+        p[i] = (char)('0' + usec % 10);
+        usec /= 10;
+    }
+
+    p += 6;
+    *p++ = ' ';
+
+    tb->len = p - tb->buf;
+}
+
+/*
+*   Hand the buffered text to stdio without flushing the FILE
+*/
+void sftb_drain( SF_TEXTBUF * tb )
+{
+    if( tb->len )
+    {
+        fwrite(tb->buf, tb->len, 1, tb->fp);
+        tb->len = 0;
+    }
+}
+
+void sftb_flush( SF_TEXTBUF * tb )
+{
+    sftb_drain(tb);
+    fflush(tb->fp);
+
+    tb->oldest = 0;
+    tb->writes++;
+}
+
+/*
+*   A record is complete, write the buffer out if it is full or the
+*   oldest record in it has waited flush_secs.  The age is only looked
+*   at when a record comes in, a quiet output calls sftb_age() between
+*   records so its last ones still go out.
+*/
+void sftb_end( SF_TEXTBUF * tb )
+{
+    time_t now;
+
+    tb->records++;
+
+    if( tb->flush_secs == 0 || tb->len >= tb->flush_size )
+    {
+        sftb_flush(tb);
+        return;
+    }
+
+    now = time(0);
+
+    if( !tb->oldest )
+        tb->oldest = now;
+    else if( now - tb->oldest >= tb->flush_secs )
+        sftb_flush(tb);
+}
+
+/*
+*   Write out records that have waited flush_secs, for callers that check
+*   between records.  Nothing waiting costs a test.
+*/
+void sftb_age( SF_TEXTBUF * tb )
+{
+    if( tb->oldest && time(0) - tb->oldest >= tb->flush_secs )
+        sftb_flush(tb);
+}
+
+/*
+*   String cache
+*/
+SFTB_CACHE * sftb_cache_new( int nnodes )
+{
+    SFTB_CACHE * c;
+    int n;
+
+    if( nnodes <= 0 )
+        nnodes = SFTB_CACHE_SIZE;
+
+    for( n = 1; n < nnodes; n <<= 1 )
+        ;
+
+    c = (SFTB_CACHE*)calloc(1, sizeof(SFTB_CACHE));
+
+    if( !c )
+        return 0;
+
+    c->nodes = (SFTB_CACHE_NODE*)calloc(n, sizeof(SFTB_CACHE_NODE));
+
+    if( !c->nodes )
+    {
+        free(c);
+        return 0;
+    }
+
+    c->nnodes = n;
+
+    return c;
+}
+
+static SFTB_CACHE_NODE * sftb_cache_node( SFTB_CACHE * c, const char * msg,
+                                          u_int32_t gid, u_int32_t sid )
+{
+    unsigned long h = (unsigned long)msg;
+
+    h = (h >> 4) ^ (h >> 12) ^ (sid * 31) ^ gid;
+
+    return &c->nodes[h & (c->nnodes - 1)];
+}
+
+/*
+*   Returns the text stored for this message and signature, NULL if it
+*   has to be rendered.  The message is compared by value as well, some
+*   callers build their message in a reused buffer.
+*/
+char * sftb_cache_find( SFTB_CACHE * c, const char * msg, u_int32_t gid,
+                        u_int32_t sid, u_int32_t rev, int flags, int * len )
+{
+    SFTB_CACHE_NODE * n = sftb_cache_node(c, msg, gid, sid);
+
+    if( n->text && n->msg == msg && n->sid == sid && n->gid == gid &&
+        n->rev == rev && n->flags == flags && !strcmp(n->msgcopy, msg) )
+    {
+        c->hits++;
+        *len = n->len;
+        return n->text;
+    }
+
+    c->misses++;
+
+    return 0;
+}
+
+/*
+*   Store text for a message and signature, replacing whatever shared
+*   its slot
+*/
+void sftb_cache_add( SFTB_CACHE * c, const char * msg, u_int32_t gid,
+                     u_int32_t sid, u_int32_t rev, int flags,
+                     const char * text, int len )
+{
+    SFTB_CACHE_NODE * n = sftb_cache_node(c, msg, gid, sid);
+    char * t, * m;
+
+    t = (char*)malloc(len);
+    m = strdup(msg);
+
+    if( !t || !m )
+    {
+        free(t);
+        free(m);
+        return;
+    }
+
+    free(n->text);
+    free(n->msgcopy);
+
+    memcpy(t, text, len);
+
+    n->msg     = msg;
+    n->msgcopy = m;
+    n->gid     = gid;
+    n->sid     = sid;
+    n->rev     = rev;
+    n->flags   = flags;
+    n->text    = t;
+    n->len     = len;
+}
+
+void sftb_cache_free( SFTB_CACHE * c )
+{
+    int i;
+
+    if( !c )
+        return;
+
+    for( i = 0; i < c->nnodes; i++ )
+    {
+        free(c->nodes[i].text);
+        free(c->nodes[i].msgcopy);
+    }
+
+    free(c->nodes);
+    free(c);
+}
+
+#ifdef SFTEXTBUF_MAIN
+/*
+*   Check the formatters against printf and ts_print style output
+*/
+#include <arpa/inet.h>
+
+static int check( SF_TEXTBUF * tb, const char * want )
+{
+    int ok = (int)strlen(want) == tb->len && !memcmp(tb->buf, want, tb->len);
+
+    if( !ok )
+        printf("got '%.*s' want '%s'\n", tb->len, tb->buf, want);
+
+    tb->len = 0;
+
+    return ok;
+}
+
+int main( int argc, char ** argv )
+{
+    SF_TEXTBUF * tb;
+    SFTB_CACHE * c;
+    struct timeval tv;
+    struct tm * lt;
+    char want[64];
+    unsigned long u;
+    char msg[32];
+    int  i, len, bad = 0;
+    char * text;
+
+    tb = sftb_new(stdout, 0, -1);
+
+    for( u = 1; u < 4000000000UL; u = u * 3 + 1 )
+    {
+        sftb_putu(tb, u);  sprintf(want, "%lu", u);  bad += !check(tb, want);
+        sftb_putx(tb, u);  sprintf(want, "%lX", u);  bad += !check(tb, want);
+    }
+
+    sftb_putu(tb, 0);  bad += !check(tb, "0");
+
+    for( i = 0; i < 100000; i++ )
+    {
+        u_int32_t ip = (u_int32_t)(i * 2654435761UL);
+        struct in_addr in;
+
+        in.s_addr = ip;
+        sftb_putip(tb, ip);
+        bad += !check(tb, inet_ntoa(in));
+    }
+
+    for( i = 0; i < 100000; i++ )
+    {
+        time_t t, day;
+        int s, year = i & 1;
+
+        tv.tv_sec  = 1000000000 + i * 7919;
+        tv.tv_usec = (long)((i * 104729UL) % 1000000);
+
+        t   = tv.tv_sec - 18000;
+        s   = t % 86400;
+        day = t - s;
+        lt  = gmtime(&day);
+
+        if( year )
+            sprintf(want, "%02d/%02d/%02d-%02d:%02d:%02d.%06u ",
+                    lt->tm_mon + 1, lt->tm_mday, lt->tm_year - 100,
+                    s / 3600, (s % 3600) / 60, s % 60, (unsigned)tv.tv_usec);
+        else
+            sprintf(want, "%02d/%02d-%02d:%02d:%02d.%06u ",
+                    lt->tm_mon + 1, lt->tm_mday,
+                    s / 3600, (s % 3600) / 60, s % 60, (unsigned)tv.tv_usec);
+
+        sftb_puttime(tb, &tv, -18000, year);
+        bad += !check(tb, want);
+    }
+
+    /* a record waits in the buffer until it is flush_secs old */
+    tb->fp = tmpfile();
+    sftb_puts(tb, "aged\n");
+    sftb_end(tb);
+    sftb_age(tb);
+    bad += !(tb->len == 5 && tb->oldest);
+
+    tb->oldest -= tb->flush_secs;
+    sftb_age(tb);
+    bad += !(tb->len == 0 && !tb->oldest && ftell(tb->fp) == 5);
+
+    fclose(tb->fp);
+    tb->fp = stdout;
+
+    c = sftb_cache_new(4);
+
+    strcpy(msg, "first");
+    sftb_cache_add(c, msg, 1, 2, 3, 0, "AAA", 3);
+    text = sftb_cache_find(c, msg, 1, 2, 3, 0, &len);
+    bad += !(text && len == 3 && !memcmp(text, "AAA", 3));
+
+    /* same pointer, new contents */
+    strcpy(msg, "second");
+    bad += sftb_cache_find(c, msg, 1, 2, 3, 0, &len) != 0;
+    bad += sftb_cache_find(c, "first", 1, 2, 3, 0, &len) != 0;
+
+    sftb_cache_free(c);
+    sftb_free(tb);
+
+    printf("%s: %d bad\n", argv[0], bad);
+
+    return bad != 0;
+}
+#endif
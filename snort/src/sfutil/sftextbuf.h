@@ -0,0 +1,101 @@
+/*
+**  sftextbuf.h
+**
+**  Append buffer for text output.
+**
+**  Text alert outputs format a record into the buffer with the
+**  hand-rolled integer, address and timestamp formatters below instead
+**  of stdio, and the buffer is handed to stdio in one piece once it is
+**  big enough or old enough.  A record is never split: the buffer grows
+**  while a record is being built and is only written out between
+**  records, at sftb_end() or sftb_age().
+**
+**  Callers that need to mix in output from FILE based printers call
+**  sftb_drain() first so the file sees everything in order.
+**
+**  The string cache keeps text that only depends on the rule - the
+**  message and its gid:sid:rev decoration - so it is rendered once per
+**  rule rather than once per alert.
+*/
+#ifndef __SF_TEXTBUF_H__
+#define __SF_TEXTBUF_H__
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <stdio.h>
+#include <time.h>
+
+#define SFTB_FLUSH_SIZE     (64*1024)  /* default bytes before a write */
+#define SFTB_FLUSH_SECS     1          /* default age before a write */
+#define SFTB_CACHE_SIZE     1024       /* default string cache entries */
+
+typedef struct _SF_TEXTBUF
+{
+    FILE   * fp;
+    char   * buf;
+    int      len;
+    int      size;
+    int      flush_size;   /* write once this much is buffered */
+    int      flush_secs;   /* or once the oldest record is this old, 0 = always */
+    time_t   oldest;       /* when the first buffered record was added */
+
+    /* the date part of the last timestamp, redone when the day changes */
+    time_t   ts_day;
+    int      ts_year;
+    char     ts_date[12];
+    int      ts_date_len;
+
+    unsigned long records;
+    unsigned long writes;
+
+} SF_TEXTBUF;
+
+typedef struct _SFTB_CACHE_NODE
+{
+    const char * msg;      /* message pointer the text was made from */
+    char       * msgcopy;  /* and its contents, in case the pointer is reused */
+    u_int32_t    gid;
+    u_int32_t    sid;
+    u_int32_t    rev;
+    int          flags;
+    char       * text;
+    int          len;
+
+} SFTB_CACHE_NODE;
+
+typedef struct _SFTB_CACHE
+{
+    SFTB_CACHE_NODE * nodes;
+    int               nnodes;  /* power of two */
+
+    unsigned long     hits;
+    unsigned long     misses;
+
+} SFTB_CACHE;
+
+SF_TEXTBUF * sftb_new( FILE * fp, int flush_size, int flush_secs );
+void   sftb_free( SF_TEXTBUF * tb );
+
+void   sftb_write( SF_TEXTBUF * tb, const char * s, int len );
+void   sftb_puts( SF_TEXTBUF * tb, const char * s );
+void   sftb_putc( SF_TEXTBUF * tb, int c );
+void   sftb_putu( SF_TEXTBUF * tb, unsigned long u );
+void   sftb_putx( SF_TEXTBUF * tb, unsigned long u );
+void   sftb_putip( SF_TEXTBUF * tb, u_int32_t ip );
+void   sftb_puttime( SF_TEXTBUF * tb, const struct timeval * tv,
+                     int localzone, int include_year );
+
+void   sftb_end( SF_TEXTBUF * tb );
+void   sftb_age( SF_TEXTBUF * tb );
+void   sftb_drain( SF_TEXTBUF * tb );
+void   sftb_flush( SF_TEXTBUF * tb );
+
+SFTB_CACHE * sftb_cache_new( int nnodes );
+char * sftb_cache_find( SFTB_CACHE * c, const char * msg, u_int32_t gid,
+                        u_int32_t sid, u_int32_t rev, int flags, int * len );
+void   sftb_cache_add( SFTB_CACHE * c, const char * msg, u_int32_t gid,
+                       u_int32_t sid, u_int32_t rev, int flags,
+                       const char * text, int len );
+void   sftb_cache_free( SFTB_CACHE * c );
+
+#endif
@@ -16,6 +16,7 @@
 #include "sflsq.h"
 #include "sfghash.h"
 #include "sfxhash.h"
+#include "sfcmsketch.h"
 
 #include "sfthd.h"
     
@@ -107,6 +108,55 @@ THD_STRUCT * sfthd_new( unsigned nbytes )
     return thd;
 }
 
+/*!
+  Count IP's in a count-min sketch until they need an exact node.
+
+  Without a sketch every IP that triggers a thresholded event gets a node
+  in ip_nodes or ip_gnodes, so a flood of distinct IP's recycles the nodes
+  of the IP's that matter.  With one, an IP's first event is only counted
+  in the sketch and the nodes are left to the IP's that come back.  The
+  sketch takes the same memory whatever the flood.
+
+  The sketch period is raised to the longest threshold window, so an IP
+  seen twice within a window is always given a node.  The price is some
+  error: the sketch can over count an IP that shares its cells with
+  others, and it counts events from up to two periods back, so an IP's
+  first events can be held back by a limit, or can reach a threshold
+  early.  A 'both' threshold is never promoted past its count and is
+  given a node when it alerts, so it still alerts once.  An IP's window
+  starts at its second event rather than its first.  The sketch needs
+  about 32 bytes per IP seen in two periods to keep over counting rare.
+   
+  @param thd     Threshold table from sfthd_new()
+  @param nbytes  memory for the sketch, in bytes
+  @param seconds counts are kept for one to two periods of this length
+
+  @return integer
+  @retval  0 success
+  @retval !0 could not allocate the sketch
+*/
+int sfthd_sketch( THD_STRUCT * thd, unsigned nbytes, unsigned seconds )
+{
+    if( !thd )
+        return -1;
+
+    sfcms_free( thd->sketch );
+
+    if( !seconds )
+        seconds = THD_SKETCH_SECONDS;
+
+    if( seconds < thd->max_seconds )
+        seconds = thd->max_seconds;
+
+    thd->sketch = sfcms_new( nbytes, seconds );
+    if( !thd->sketch )
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
 /*!
 
 Add a permanent threshold object to the threshold table. Multiple
@@ -453,6 +503,16 @@ int sfthd_create_threshold(	THD_STRUCT * thd,
                 unsigned     not_flag)
 {
 
+  /* the sketch has to remember an IP for at least a whole window */
+  if( thd && type != THD_TYPE_SUPPRESS && seconds > 0 &&
+      (unsigned)seconds > thd->max_seconds )
+  {
+      thd->max_seconds = seconds;
+
+      if( thd->sketch && thd->sketch->seconds < thd->max_seconds )
+          thd->sketch->seconds = thd->max_seconds;
+  }
+
   if( sig_id == 0 )
   {
     	  return  sfthd_create_threshold_global( thd,
@@ -523,6 +583,8 @@ int sfthd_test_object(	THD_STRUCT * thd,
     THD_IP_NODE_KEY key;
     THD_IP_NODE     data,*sfthd_ip_node;
     int             status=0;
+    int             promote=0;
+    SFXHASH_NODE  * hnode;
     unsigned        ip,dt;
 
 #ifdef THD_DEBUG
@@ -577,28 +639,68 @@ int sfthd_test_object(	THD_STRUCT * thd,
     data.count  = 1;
     data.tstart = curtime; /* Event time */
 
-    /* 
-     * Check for any Permanent sig_id objects for this gen_id  or add this one ...
-     */
-    status = sfxhash_add( thd->ip_nodes, (void*)&key, &data );
-    
-    if( status == SFXHASH_INTABLE )
+    if( thd->sketch )
     {
-        /* Already in the table */
-        sfthd_ip_node = thd->ip_nodes->cnode->data;
+        sfthd_ip_node = (THD_IP_NODE*)sfxhash_find( thd->ip_nodes, (void*)&key );
 
-        /* Increment the event count */
-        sfthd_ip_node->count++;
-    }
-    else if (status )
-    {
-        /* hash error */
-        return 1; /*  check the next threshold object */
+        if( sfthd_ip_node )
+        {
+            /* Increment the event count */
+            sfthd_ip_node->count++;
+        }
+        else
+        {
+            /*
+             * Not tracked - count it in the sketch, and only give it a node
+             * once it has been seen before.  Its window then starts now.
+             */
+            data.count = sfcms_add( thd->sketch, key.thd_id, ip, 0, curtime );
+            sfthd_ip_node = &data;
+
+            /*
+             * An over count must not carry 'both' past its one alert, and
+             * once it alerts it needs a node to remember that it has.
+             */
+            if( sfthd_node->type == THD_TYPE_BOTH &&
+                data.count >= sfthd_node->count )
+            {
+                data.count = sfthd_node->count;
+                promote = 1;
+            }
+
+            if( (data.count > 1 || promote) &&
+                (hnode = sfxhash_get_node( thd->ip_nodes, (void*)&key )) )
+            {
+                sfthd_ip_node  = (THD_IP_NODE*)hnode->data;
+                *sfthd_ip_node = data;
+            }
+        }
     }
     else
     {
-        /* Was not in the table - it was added - work with our copy of the data */
-        sfthd_ip_node = &data;
+        /* 
+         * Check for any Permanent sig_id objects for this gen_id  or add this one ...
+         */
+        status = sfxhash_add( thd->ip_nodes, (void*)&key, &data );
+    
+        if( status == SFXHASH_INTABLE )
+        {
+            /* Already in the table */
+            sfthd_ip_node = thd->ip_nodes->cnode->data;
+
+            /* Increment the event count */
+            sfthd_ip_node->count++;
+        }
+        else if (status )
+        {
+            /* hash error */
+            return 1; /*  check the next threshold object */
+        }
+        else
+        {
+            /* Was not in the table - it was added - work with our copy of the data */
+            sfthd_ip_node = &data;
+        }
     }
 
 
@@ -722,6 +824,8 @@ int sfthd_test_gobject(	THD_STRUCT * thd,
     THD_IP_GNODE_KEY key;
     THD_IP_GNODE     data, *sfthd_ip_node;
     int              status=0;
+    int              promote=0;
+    SFXHASH_NODE   * hnode;
     unsigned         ip, dt;
 
 #ifdef THD_DEBUG
@@ -776,28 +880,70 @@ int sfthd_test_gobject(	THD_STRUCT * thd,
     data.count  = 1;
     data.tstart = curtime; /* Event time */
 
-    /* 
-     * Check for any Permanent sig_id objects for this gen_id  or add this one ...
-     */
-    status = sfxhash_add( thd->ip_gnodes, (void*)&key, &data );
-    
-    if( status == SFXHASH_INTABLE )
+    if( thd->sketch )
     {
-        /* Already in the table */
-        sfthd_ip_node = thd->ip_gnodes->cnode->data;
+        sfthd_ip_node = (THD_IP_GNODE*)sfxhash_find( thd->ip_gnodes, (void*)&key );
 
-        /* Increment the event count */
-        sfthd_ip_node->count++;
-    }
-    else if (status )
-    {
-        /* hash error */
-        return 1; /*  check the next threshold object */
+        if( sfthd_ip_node )
+        {
+            /* Increment the event count */
+            sfthd_ip_node->count++;
+        }
+        else
+        {
+            /*
+             * Not tracked - count it in the sketch, and only give it a node
+             * once it has been seen before.  Its window then starts now.
+             */
+            /* the top bit keeps these apart from the local thd_id keys */
+            data.count = sfcms_add( thd->sketch, key.gen_id | 0x80000000,
+                                    key.sig_id, ip, curtime );
+            sfthd_ip_node = &data;
+
+            /*
+             * An over count must not carry 'both' past its one alert, and
+             * once it alerts it needs a node to remember that it has.
+             */
+            if( sfthd_node->type == THD_TYPE_BOTH &&
+                data.count >= sfthd_node->count )
+            {
+                data.count = sfthd_node->count;
+                promote = 1;
+            }
+
+            if( (data.count > 1 || promote) &&
+                (hnode = sfxhash_get_node( thd->ip_gnodes, (void*)&key )) )
+            {
+                sfthd_ip_node  = (THD_IP_GNODE*)hnode->data;
+                *sfthd_ip_node = data;
+            }
+        }
     }
     else
     {
-        /* Was not in the table - it was added - work with our copy of the data */
-        sfthd_ip_node = &data;
+        /* 
+         * Check for any Permanent sig_id objects for this gen_id  or add this one ...
+         */
+        status = sfxhash_add( thd->ip_gnodes, (void*)&key, &data );
+    
+        if( status == SFXHASH_INTABLE )
+        {
+            /* Already in the table */
+            sfthd_ip_node = thd->ip_gnodes->cnode->data;
+
+            /* Increment the event count */
+            sfthd_ip_node->count++;
+        }
+        else if (status )
+        {
+            /* hash error */
+            return 1; /*  check the next threshold object */
+        }
+        else
+        {
+            /* Was not in the table - it was added - work with our copy of the data */
+            sfthd_ip_node = &data;
+        }
     }
 
 
@@ -8,6 +8,7 @@
 
 #include "sfghash.h"
 #include "sfxhash.h"
+#include "sfcmsketch.h"
 /*!
     Max GEN_ID value - Set this to the Max Used by Snort, this is used for the
     dimensions of the gen_id lookup array.  
@@ -20,6 +21,11 @@
 
 #define THD_TOO_MANY_THDOBJ -15 
 
+/*!
+   Default sketch period, in seconds
+*/
+#define THD_SKETCH_SECONDS 60
+
 /*!
    Type of Thresholding
 */
@@ -179,6 +185,10 @@ typedef struct {
 
  SFXHASH  * supress;    /* Global hash of supressed nodes */
 
+ SFCMS    * sketch;     /* Optional counts of IP's without an ip_nodes/ip_gnodes node yet */
+
+ unsigned   max_seconds; /* Longest threshold window, the sketch period is at least this */
+
 					 
 }THD_STRUCT;
 
@@ -200,6 +210,8 @@ int sfthd_create_threshold( THD_STRUCT * thd,
                        unsigned     ip_mask, 
                        unsigned     not_flag ); 
 
+int sfthd_sketch( THD_STRUCT * thd, unsigned nbytes, unsigned seconds );
+
 int sfthd_test_threshold( THD_STRUCT * thd,
                         unsigned     gen_id,  
                         unsigned     sig_id,
@@ -0,0 +1,472 @@
+/*
+  sfwriter.c
+
+  Asynchronous file writer, see sfwriter.h.
+
+  head and tail run freely and are only masked when the buffer is
+  indexed, so head - tail is always the number of bytes queued.  The
+  packet thread only writes head, pos and rot_head, the writer thread
+  only writes tail and rot_tail; a barrier orders each record's bytes
+  before the head that publishes them.
+*/
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "sfwriter.h"
+
+#ifdef SF_WRITER_THREADS
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#define SFW_BARRIER()   __sync_synchronize()
+
+/*
+*   Write everything published, calling the rotate callback wherever the
+*   packet thread queued a rotation.  Returns the bytes written, 0 when
+*   there was nothing to do or a callback failed.
+*/
+static unsigned sfw_drain( SF_WRITER * w )
+{
+    unsigned head, tail, end, off, n, at;
+    unsigned written = 0;
+
+    head = w->head;
+    SFW_BARRIER();
+    tail = w->tail;
+
+    while( tail != head )
+    {
+        end = head;
+
+        if( w->rot_tail != w->rot_head )
+        {
+            SFW_BARRIER();
+            at = w->rotate[w->rot_tail % SFW_ROTATE_MAX];
+
+            if( at == tail )
+            {
+                if( w->rotate_file(w->ctx, w->errbuf, SFW_ERRBUF) )
+                    goto fail;
+
+                SFW_BARRIER();
+                w->rot_tail++;
+                continue;
+            }
+
+            if( at - tail < head - tail )
+                end = at;
+        }
+
+        off = tail & w->mask;
+        n   = end - tail;
+
+        if( off + n > w->size )
+            n = w->size - off;
+
+        if( w->write(w->ctx, w->buf + off, n, w->errbuf, SFW_ERRBUF) )
+            goto fail;
+
+        tail    += n;
+        written += n;
+
+        SFW_BARRIER();
+        w->tail = tail;
+    }
+
+    return written;
+
+fail:
+    SFW_BARRIER();
+    w->failed = 1;
+    return 0;
+}
+
+/*
+*   Drain until stopped.  The thread sleeps while the ring is empty and
+*   is woken by the packet thread once enough is queued, or by the
+*   timeout so the file never lags far behind a quiet sensor.
+*/
+static void * sfw_thread( void * arg )
+{
+    SF_WRITER     * w = (SF_WRITER*)arg;
+    struct timeval  now;
+    struct timespec ts;
+    int             stop;
+
+    for(;;)
+    {
+        /* read the stop flag first so the last drain sees every record */
+        stop = w->stop;
+        SFW_BARRIER();
+
+        if( sfw_drain(w) )
+            continue;
+
+        if( stop || w->failed )
+            break;
+
+        gettimeofday(&now, NULL);
+        now.tv_usec += SFW_WAIT_USEC;
+        ts.tv_sec  = now.tv_sec + now.tv_usec / 1000000;
+        ts.tv_nsec = (now.tv_usec % 1000000) * 1000;
+
+        pthread_mutex_lock(&w->lock);
+        w->sleeping = 1;
+        SFW_BARRIER();
+        if( !w->stop && w->head == w->tail )
+            pthread_cond_timedwait(&w->cond, &w->lock, &ts);
+        w->sleeping = 0;
+        pthread_mutex_unlock(&w->lock);
+    }
+
+    return NULL;
+}
+
+static void sfw_wake( SF_WRITER * w )
+{
+    pthread_mutex_lock(&w->lock);
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+/*
+*   size is rounded up to a power of two.  rotate may be NULL if the
+*   caller never rotates.  Returns NULL with errno set if the ring or
+*   the thread could not be had.
+*/
+SF_WRITER * sfw_new( unsigned size, SFW_WRITE write, SFW_ROTATE rotate,
+                     void * ctx )
+{
+    SF_WRITER * w;
+    unsigned    n = 4096;
+    int         err;
+
+    while( n < size )
+        n <<= 1;
+
+    w = (SF_WRITER*)calloc(1, sizeof(SF_WRITER));
+
+    if( !w )
+        return 0;
+
+    w->buf = (unsigned char*)malloc(n);
+
+    if( !w->buf )
+    {
+        free(w);
+        return 0;
+    }
+
+    w->size        = n;
+    w->mask        = n - 1;
+    w->write       = write;
+    w->rotate_file = rotate;
+    w->ctx         = ctx;
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+
+    /* pthread_create() returns its error rather than setting errno */
+    if( (err = pthread_create(&w->thread, NULL, sfw_thread, w)) != 0 )
+    {
+        sfw_free(w);
+        errno = err;
+        return 0;
+    }
+
+    w->running = 1;
+
+    return w;
+}
+
+/*
+*   Let the writer empty the ring and wait for it.  The counters and any
+*   error are final once this returns.
+*/
+void sfw_stop( SF_WRITER * w )
+{
+    if( !w || !w->running )
+        return;
+
+    SFW_BARRIER();
+    w->stop = 1;
+    sfw_wake(w);
+    pthread_join(w->thread, NULL);
+
+    w->running = 0;
+}
+
+void sfw_free( SF_WRITER * w )
+{
+    if( !w )
+        return;
+
+    sfw_stop(w);
+
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+    free(w->buf);
+    free(w);
+}
+
+/*
+*   Open a record of at most size bytes, with a file rotation in front of
+*   it if rotate is set.  Returns -1 and drops the record, ignoring the
+*   copies that follow, if the ring or the rotation queue is full.
+*/
+int sfw_reserve( SF_WRITER * w, unsigned size, int rotate )
+{
+    unsigned head = w->head;
+
+    if( size > w->size - (head - w->tail) ||
+        (rotate && w->rot_head - w->rot_tail >= SFW_ROTATE_MAX) )
+    {
+        w->drops++;
+        w->open = 0;
+        return -1;
+    }
+
+    if( rotate )
+    {
+        w->rotate[w->rot_head % SFW_ROTATE_MAX] = head;
+        SFW_BARRIER();
+        w->rot_head++;
+    }
+
+    w->pos  = head;
+    w->end  = head + size;
+    w->open = 1;
+
+    return 0;
+}
+
+/*
+*   Append to the open record.  A copy past the reservation would run
+*   into data the writer has not consumed, the record is dropped instead.
+*/
+void sfw_copy( SF_WRITER * w, void * buf, unsigned len )
+{
+    unsigned off, n;
+
+    if( !w->open )
+        return;
+
+    if( len > w->end - w->pos )
+    {
+        w->drops++;
+        w->open = 0;
+        return;
+    }
+
+    off = w->pos & w->mask;
+    n   = len;
+
+    if( off + n > w->size )
+        n = w->size - off;
+
+    memcpy(w->buf + off, buf, n);
+
+    if( n < len )
+        memcpy(w->buf, (unsigned char*)buf + n, len - n);
+
+    w->pos += len;
+}
+
+/*
+*   Publish the open record to the writer
+*/
+void sfw_commit( SF_WRITER * w )
+{
+    unsigned used;
+
+    if( !w->open )
+        return;
+
+    w->open = 0;
+
+    SFW_BARRIER();
+    w->head = w->pos;
+    w->records++;
+
+    /* head must be visible before sleeping is read, or the writer can
+       miss this record and sleep out its timeout with the ring filling */
+    SFW_BARRIER();
+
+    used = w->pos - w->tail;
+
+    if( used > w->hiwater )
+        w->hiwater = used;
+
+    /* let the writer batch up an eighth of the ring before waking it */
+    if( w->sleeping && used >= (w->size >> 3) )
+        sfw_wake(w);
+}
+
+/*
+*   The message of the callback that stopped the writer, NULL while it
+*   is fine
+*/
+const char * sfw_error( SF_WRITER * w )
+{
+    if( !w->failed )
+        return NULL;
+
+    SFW_BARRIER();
+
+    return w->errbuf;
+}
+
+#ifdef SFWRITER_MAIN
+/*
+*   Push numbered records through a small ring into a file, rotating to
+*   a new file every so often, and check each file holds an unbroken run
+*   of records.  Then make the writer fail and check the error comes
+*   back to this thread.
+*/
+#include <unistd.h>
+
+typedef struct
+{
+    FILE * fp;
+    int    files;
+    int    fail;
+
+} TEST_CTX;
+
+static int test_write( void * ctx, void * buf, unsigned len,
+                       char * errbuf, int errlen )
+{
+    TEST_CTX * t = (TEST_CTX*)ctx;
+
+    if( t->fail || fwrite(buf, len, 1, t->fp) != 1 )
+    {
+        snprintf(errbuf, errlen, "write failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int test_rotate( void * ctx, char * errbuf, int errlen )
+{
+    TEST_CTX * t = (TEST_CTX*)ctx;
+    char       name[64];
+
+    fclose(t->fp);
+    snprintf(name, sizeof(name), "/tmp/sfwriter.%d", ++t->files);
+
+    if( !(t->fp = fopen(name, "w+")) )
+    {
+        snprintf(errbuf, errlen, "unable to open %s\n", name);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int test_check( int file, unsigned * next )
+{
+    char     name[64];
+    FILE   * fp;
+    unsigned rec[8];
+    int      n = 0, bad = 0;
+
+    snprintf(name, sizeof(name), "/tmp/sfwriter.%d", file);
+    fp = fopen(name, "r");
+
+    while( fp && fread(rec, sizeof(rec), 1, fp) == 1 )
+    {
+        if( rec[0] < *next || rec[7] != rec[0] )
+            bad++;
+
+        *next = rec[0] + 1;
+        n++;
+    }
+
+    if( fp )
+        fclose(fp);
+
+    unlink(name);
+
+    return bad ? -1 : n;
+}
+
+int main( int argc, char ** argv )
+{
+    SF_WRITER * w;
+    TEST_CTX    t;
+    unsigned    rec[8];
+    unsigned    i, next = 0;
+    int         f, n, total = 0, bad = 0;
+
+    t.files = 0;
+    t.fail  = 0;
+    t.fp    = fopen("/tmp/sfwriter.0", "w+");
+
+    w = sfw_new(8192, test_write, test_rotate, &t);
+
+    for( i = 0; i < 100000; i++ )
+    {
+        rec[0] = rec[7] = i;
+
+        /* a full ring drops the record, give the writer time and retry */
+        while( sfw_reserve(w, sizeof(rec), i && i % 20000 == 0) )
+            usleep(100);
+
+        sfw_copy(w, rec, 4);
+        sfw_copy(w, rec + 1, sizeof(rec) - 4);
+        sfw_commit(w);
+    }
+
+    sfw_stop(w);
+    fclose(t.fp);
+
+    for( f = 0; f <= t.files; f++ )
+    {
+        if( (n = test_check(f, &next)) < 0 )
+            bad++;
+        else
+            total += n;
+    }
+
+    printf("%lu records, %lu dropped, %d in %d files, high water %u of %u\n",
+           w->records, w->drops, total, t.files + 1, w->hiwater, w->size);
+
+    if( total != 100000 || t.files != 4 )
+        bad++;
+
+    sfw_free(w);
+
+    /* a failing writer stops and reports back */
+    t.fp   = fopen("/tmp/sfwriter.0", "w+");
+    t.fail = 1;
+    w = sfw_new(8192, test_write, NULL, &t);
+
+    sfw_reserve(w, sizeof(rec), 0);
+    sfw_copy(w, rec, sizeof(rec));
+    sfw_commit(w);
+
+    for( i = 0; i < 100 && !sfw_error(w); i++ )
+        usleep(10000);
+
+    printf("error: %s", sfw_error(w) ? sfw_error(w) : "none\n");
+
+    if( !sfw_error(w) )
+        bad++;
+
+    sfw_free(w);
+    fclose(t.fp);
+    unlink("/tmp/sfwriter.0");
+
+    printf("%s\n", bad ? "FAILED" : "passed");
+
+    return bad != 0;
+}
+#endif
+
+#endif /* SF_WRITER_THREADS */
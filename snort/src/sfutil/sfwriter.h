@@ -0,0 +1,96 @@
+/*
+**  sfwriter.h
+**
+**  Asynchronous file writer.
+**
+**  A single producer, single consumer byte ring drained by a writer
+**  thread.  The packet thread reserves room for a record, copies it in
+**  and publishes it, and never waits on the disk: when the ring is full
+**  the record is dropped and counted.  The writer thread hands whatever
+**  is published to the write callback in as few calls as the wrap
+**  allows, so the disk sees large sequential writes however small the
+**  records are.
+**
+**  File rotations are queued as ring offsets so the writer calls the
+**  rotate callback exactly between the right two records.  A callback
+**  that fails leaves its message in the writer and stops it, and the
+**  packet thread picks the error up with sfw_error() - the writer never
+**  exits the process under the packet thread.
+**
+**  Needs pthreads and the gcc 4.1 memory barrier, SF_WRITER_THREADS is
+**  only defined where both are available.  Include config.h first.
+*/
+#ifndef __SF_WRITER_H__
+#define __SF_WRITER_H__
+
+#if defined(ENABLE_PTHREAD) && defined(__GNUC__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1))
+#define SF_WRITER_THREADS
+#endif
+
+#ifdef SF_WRITER_THREADS
+
+#include <sys/types.h>
+#include <pthread.h>
+
+#define SFW_ROTATE_MAX      64      /* rotations queued ahead of the writer */
+#define SFW_WAIT_USEC       100000  /* writer sleeps at most this long */
+#define SFW_ERRBUF          1024
+
+/*
+*   Both callbacks run on the writer thread, return 0 on success or -1
+*   with a message in errbuf
+*/
+typedef int (*SFW_WRITE)( void * ctx, void * buf, unsigned len,
+                          char * errbuf, int errlen );
+typedef int (*SFW_ROTATE)( void * ctx, char * errbuf, int errlen );
+
+typedef struct _SF_WRITER
+{
+    unsigned char * buf;
+    unsigned  size;                 /* power of two */
+    unsigned  mask;
+
+    volatile unsigned head;         /* end of published records */
+    volatile unsigned tail;         /* end of written data */
+    unsigned  pos;                  /* fill point of the open record */
+    unsigned  end;                  /* end of the room reserved for it */
+    int       open;                 /* 0 if the open record was dropped */
+
+    volatile unsigned rotate[SFW_ROTATE_MAX];
+    volatile unsigned rot_head;
+    volatile unsigned rot_tail;
+
+    SFW_WRITE  write;
+    SFW_ROTATE rotate_file;
+    void     * ctx;
+
+    volatile int sleeping;
+    volatile int stop;
+    volatile int failed;            /* writer gave up, see errbuf */
+    char      errbuf[SFW_ERRBUF];
+    int       running;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+
+    unsigned      hiwater;          /* most bytes ever queued */
+    unsigned long records;
+    unsigned long drops;
+
+} SF_WRITER;
+
+SF_WRITER  * sfw_new( unsigned size, SFW_WRITE write, SFW_ROTATE rotate,
+                      void * ctx );
+void         sfw_stop( SF_WRITER * w );
+void         sfw_free( SF_WRITER * w );
+
+int          sfw_reserve( SF_WRITER * w, unsigned size, int rotate );
+void         sfw_copy( SF_WRITER * w, void * buf, unsigned len );
+void         sfw_commit( SF_WRITER * w );
+
+const char * sfw_error( SF_WRITER * w );
+
+#endif /* SF_WRITER_THREADS */
+
+#endif
@@ -298,6 +298,9 @@ void sfxhash_delete( SFXHASH * h )
         h->table = 0;
     }
 
+    /* recycled nodes and anything the user got from sfxhash_alloc go too */
+    sfmemcap_term( &h->mc );
+
     free( h ); /* free the table from general memory */
 }
 
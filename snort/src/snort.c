@@ -1212,6 +1212,10 @@ void ProcessPacket(char *user, struct pcap_pkthdr * pkthdr, u_char * pkt, void *
         s_packetBitOpInit = 1;
     }
 
+    /* pcap_loop() and long reads never get to snort_idle(), so queued
+       alerts are also sent once they are old enough */
+    IdlePlugins(IDLE_PACKET);
+
     /* reset the packet flags for each packet */
     p.packet_flags = 0;
 #ifndef GIDS
@@ -2566,6 +2570,9 @@ int snort_idle()
         sfRotatePerformanceStatisticsFile(&sfPerf);
         pv.rotate_perf_file=0; 
     }
+
+    /* end of a packet batch, let outputs send what they queued */
+    IdlePlugins(IDLE_BATCH_END);
     
     return 0;
 }
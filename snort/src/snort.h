@@ -356,6 +356,7 @@ typedef struct _PacketCount
     u_long rebuilt_tcp;     /* number of phoney tcp packets generated */
     u_long tcp_streams;     /* number of tcp streams created */
     u_long rebuilt_segs;    /* number of tcp segments used in rebuilt pkts */
+    u_long rebuilt_inplace; /* rebuilt pkts that used segment data in place */
     u_long str_mem_faults;  /* number of times the stream memory cap was hit */
 
   /* wireless statistics */
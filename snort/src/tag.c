@@ -39,7 +39,7 @@
 #include "log.h"
 #include "snort.h"
 
-#include "ubi_SplayTree.h"
+#include "sfutil/sfxhash.h"
 
 /* @todo Move all inlines to one central place */
 #ifndef DEBUG
@@ -73,19 +73,36 @@
 #define TAG_PRUNE_QUANTUM   300
 #define TAG_MEMCAP          4194304  /* 4MB */
 
+#define TAG_HASH_ROWS       1024
+
+/* one second per slot, and enough slots that a tag is never scheduled
+ * more than one turn of the wheel ahead (must be a power of 2)
+ */
+#define TAG_WHEEL_SLOTS     512
+#define TAG_WHEEL_MASK      (TAG_WHEEL_SLOTS - 1)
+
 
 /*  D A T A   S T R U C T U R E S  **********************************/
-typedef struct _PruneData
+
+/* session tags are keyed on both endpoints, lower address/port first so
+ * either direction of the session finds the same node; host tags only
+ * use ip1
+ */
+typedef struct _TagKey
 {
-    u_int32_t pruned;
-    u_int32_t time;
-    ubi_trRootPtr tree;
-} PruneData;
+    u_int32_t ip1;
+    u_int32_t ip2;
+    u_int16_t port1;
+    u_int16_t port2;
+    u_int32_t type;     /* TAG_SESSION or TAG_HOST */
+} TagKey;
 
 typedef struct _TagNode
 {
-    ubi_trNode Node;
-    
+    /* expiry wheel slot list */
+    struct _TagNode *wnext;
+    struct _TagNode **wprev;
+
     /* ip addrs */
     u_int32_t sip;
     u_int32_t dip;
@@ -125,65 +142,38 @@ typedef struct _TagNode
 } TagNode;
 
 /*  G L O B A L S  **************************************************/
-static ubi_trRoot host_tag_cache;
-static ubi_trRootPtr host_tag_cache_ptr = &host_tag_cache;
+static SFXHASH *tag_cache;
 
-static ubi_trRoot ssn_tag_cache;
-static ubi_trRootPtr ssn_tag_cache_ptr = &ssn_tag_cache;
+static u_int32_t ssn_tag_count;
+static u_int32_t host_tag_count;
+
+/* idle expiry: each tag sits in the slot for the second it would go
+ * idle, as of when it was last scheduled.  Matches only update
+ * last_access, a tag found in its slot still active is moved on instead.
+ */
+static TagNode *tag_wheel[TAG_WHEEL_SLOTS];
+static u_int32_t tag_wheel_time;
 
-static u_int32_t last_prune_time;
 static u_int32_t tag_alloc_faults;
-static u_int32_t tag_memory_usage;
 
 extern char check_tags_flag;
 extern char *file_name;
 extern int file_line;
 
 /*  P R O T O T Y P E S  ********************************************/
-static void *TagAlloc(unsigned long);
-static int PruneTagCache(u_int32_t, int);
-static int PruneTime(ubi_trRootPtr, u_int32_t);
+static int TagRecycle(void *, void *);
+static void TagWheelAdd(TagNode *);
+static void TagWheelAdvance(u_int32_t);
+static void TagRemove(TagNode *, TagKey *);
 static void TagSession(Packet *, TagData *, u_int32_t, u_int16_t);
 static void TagHost(Packet *, TagData *, u_int32_t, u_int16_t);
 static void AddTagNode(Packet *, TagData *, int, u_int32_t, u_int16_t);
 static INLINE void SwapTag(TagNode *);
+static INLINE void SetSessionKey(TagKey *, u_int32_t, u_int32_t, 
+                                 u_int16_t, u_int16_t);
+static INLINE void SetHostKey(TagKey *, u_int32_t);
 
 
-/* I should really make a generic function to do this... */
-static void *TagAlloc(unsigned long size)
-{
-    void *tmp;
-
-    tag_memory_usage += size;
-
-    if(tag_memory_usage > TAG_MEMCAP)
-    {
-        /* aggressively prune */
-        struct timeval tv;
-        struct timezone tz;
-
-        tag_alloc_faults++;
-
-        gettimeofday(&tv, &tz);
-
-        if(!PruneTagCache((u_int32_t)tv.tv_sec, 0))
-        {
-            /* if we can't prune due to time, just nuke 5 random sessions */
-            PruneTagCache(0, 5);
-        }
-    }
-
-    tmp = (void *) calloc(size, sizeof(char));
-
-    if(tmp == NULL)
-    {
-        FatalError("TagAlloc(): Unable to allocate memory! (%d bytes in use)\n",
-                    tag_memory_usage);
-    }
-
-    return tmp;
-}
-
 #ifdef DEBUG
 
 /** 
@@ -200,8 +190,8 @@ static void PrintTagNode(TagNode *np)
     
     printf("+--------------------------------------------------------------\n");
     printf("| Ssn Counts: %u, Host Counts: %u\n",
-           ssn_tag_cache.count,
-           host_tag_cache.count);
+           ssn_tag_count,
+           host_tag_count);
     
     printf("| (%u) %x:%d -> %x:%d Metric: %u "
            "LastAccess: %u, event_id: %u mode: %u event_time.tv_sec: %u\n"
@@ -241,85 +231,173 @@ static INLINE void SwapTag(TagNode *np)
     np->dp = tport;
 }
 
-
-static int TagCompareSession(ubi_trItemPtr ItemPtr, ubi_trNodePtr NodePtr)
+/** 
+ * Build the session key, the same for both directions of a session
+ */
+static INLINE void SetSessionKey(TagKey *key, u_int32_t sip, u_int32_t dip,
+                                 u_int16_t sp, u_int16_t dp)
 {
-    TagNode *nTag;
-    TagNode *iTag; 
-
-    nTag = ((TagNode *)NodePtr);
-    iTag = ((TagNode *)ItemPtr);
-
-    if(nTag->sip < iTag->sip)
-    {
-        return 1;
-    }
-    else if(nTag->sip > iTag->sip)
-    {
-        return -1;
-    }
-        
-    if(nTag->dip < iTag->dip)
+    if(sip < dip || (sip == dip && sp <= dp))
     {
-        return 1;
+        key->ip1 = sip;
+        key->ip2 = dip;
+        key->port1 = sp;
+        key->port2 = dp;
     }
-    else if(nTag->dip > iTag->dip)
+    else
     {
-        return -1;
+        key->ip1 = dip;
+        key->ip2 = sip;
+        key->port1 = dp;
+        key->port2 = sp;
     }
 
-    if(nTag->sp < iTag->sp)
-    {
-        return 1;
-    }
-    else if(nTag->sp > iTag->sp)
-    {
-        return -1;
-    }
+    key->type = TAG_SESSION;
+}
 
-    if(nTag->dp < iTag->dp)
-    {
-        return 1;
-    }
-    else if(nTag->dp > iTag->dp)
-    {
-        return -1;
-    }
+static INLINE void SetHostKey(TagKey *key, u_int32_t ip)
+{
+    key->ip1 = ip;
+    key->ip2 = 0;
+    key->port1 = 0;
+    key->port2 = 0;
+    key->type = TAG_HOST;
+}
+
+/** 
+ * The tag table is at its memcap and is about to reuse its least
+ * recently used node; take it off the wheel first.
+ * 
+ * @return 0 to let the node go
+ */
+static int TagRecycle(void *key, void *data)
+{
+    TagNode *np = (TagNode *) data;
+
+    tag_alloc_faults++;
+
+    if((np->wprev[0] = np->wnext) != NULL)
+        np->wnext->wprev = np->wprev;
+
+    if(((TagKey *) key)->type == TAG_SESSION)
+        ssn_tag_count--;
+    else
+        host_tag_count--;
 
     return 0;
 }
 
+/** 
+ * Put a node in the wheel slot for the second it goes idle, pulled in
+ * to the last slot of the current turn if that is further out.
+ */
+static void TagWheelAdd(TagNode *np)
+{
+    u_int32_t expires = np->last_access + TAG_PRUNE_QUANTUM + 1;
+    TagNode **slot;
+
+    if(expires <= tag_wheel_time)
+        expires = tag_wheel_time + 1;
+    else if(expires - tag_wheel_time >= TAG_WHEEL_SLOTS)
+        expires = tag_wheel_time + TAG_WHEEL_SLOTS - 1;
+
+    slot = &tag_wheel[expires & TAG_WHEEL_MASK];
 
-static int TagCompareHost(ubi_trItemPtr ItemPtr, ubi_trNodePtr NodePtr)
+    if((np->wnext = *slot) != NULL)
+        np->wnext->wprev = &np->wnext;
+
+    np->wprev = slot;
+    *slot = np;
+}
+
+/** 
+ * Expire the tags that have been idle for TAG_PRUNE_QUANTUM seconds by
+ * visiting the wheel slots between the last call and now.  Tags that
+ * were matched since they were scheduled go back on the wheel.
+ *
+ * @param now current packet time
+ */
+static void TagWheelAdvance(u_int32_t now)
 {
-    TagNode *nTag;
-    TagNode *iTag; 
+    TagNode *np;
+    TagNode *next;
+    TagKey key;
+    u_int32_t steps;
 
-    nTag = ((TagNode *)NodePtr);
-    iTag = ((TagNode *)ItemPtr);
+    if(now <= tag_wheel_time)
+        return;
 
-    if(nTag->sip < iTag->sip)
-    {
-        return 1;
-    }
-    else if(nTag->sip > iTag->sip)
+    /* after a gap longer than a turn, one turn visits everything */
+    if(now - tag_wheel_time > TAG_WHEEL_SLOTS)
+        tag_wheel_time = now - TAG_WHEEL_SLOTS;
+
+    for(steps = now - tag_wheel_time; steps > 0; steps--)
     {
-        return -1;
+        tag_wheel_time++;
+
+        np = tag_wheel[tag_wheel_time & TAG_WHEEL_MASK];
+        tag_wheel[tag_wheel_time & TAG_WHEEL_MASK] = NULL;
+
+        for(; np != NULL; np = next)
+        {
+            next = np->wnext;
+
+            if(next != NULL)
+                next->wprev = &tag_wheel[tag_wheel_time & TAG_WHEEL_MASK];
+
+            if((np->last_access + TAG_PRUNE_QUANTUM) < now)
+            {
+                DEBUG_WRAP(DebugMessage(DEBUG_FLOW, "Pruning idle tag\n"););
+
+                np->wprev = &np->wnext;
+                np->wnext = NULL;
+
+                if(np->mode == TAG_SESSION)
+                    SetSessionKey(&key, np->sip, np->dip, np->sp, np->dp);
+                else
+                    SetHostKey(&key, np->sip);
+
+                TagRemove(np, &key);
+            }
+            else
+            {
+                TagWheelAdd(np);
+            }
+        }
     }
+}
 
-    return 0;
+/** 
+ * Take a node off the wheel and out of the table
+ */
+static void TagRemove(TagNode *np, TagKey *key)
+{
+    if((np->wprev[0] = np->wnext) != NULL)
+        np->wnext->wprev = np->wprev;
+
+    if(key->type == TAG_SESSION)
+        ssn_tag_count--;
+    else
+        host_tag_count--;
+
+    sfxhash_remove(tag_cache, key);
 }
 
 void InitTag()
 {
-    (void)ubi_trInitTree(ssn_tag_cache_ptr,  /* ptr to the tree head */
-                         TagCompareSession,  /* comparison function */
-                         0);            /* don't allow overwrites/duplicates */
-
-    (void)ubi_trInitTree(host_tag_cache_ptr, /* ptr to the tree head */
-                         TagCompareHost,     /* comparison function */
-                         0);            /* don't allow overwrites/duplicates */
+    tag_cache = sfxhash_new(TAG_HASH_ROWS,      /* number of hash rows */
+                            sizeof(TagKey),     /* size of the key */
+                            sizeof(TagNode),    /* size of the data */
+                            TAG_MEMCAP,         /* memcap */
+                            1,                  /* reuse the LRU node at the cap */
+                            TagRecycle,         /* unlink it from the wheel */
+                            NULL,               /* no user data to free */
+                            1);                 /* recycle nodes */
 
+    if(tag_cache == NULL)
+    {
+        FatalError("InitTag(): Unable to allocate the tag table!\n");
+    }
 }
 
 
@@ -356,106 +434,127 @@ static void TagHost(Packet *p, TagData *tag, u_int32_t time, u_int16_t event_id)
 static void AddTagNode(Packet *p, TagData *tag, int mode, u_int32_t now, 
                 u_int16_t event_id)
 {
-    TagNode *idx;  /* index pointer */
     TagNode *returned;
-    ubi_trRootPtr tag_cache_ptr = NULL;
+    TagNode *np;
+    TagKey key;
+    SFXHASH_NODE *hnode;
+    int seconds = 0;
 
     DEBUG_WRAP(DebugMessage(DEBUG_FLOW, "Adding new Tag Head\n"););
 
-    idx = (TagNode *) TagAlloc(sizeof(TagNode));
-
-    idx->sip = p->iph->ip_src.s_addr;
-    idx->dip = p->iph->ip_dst.s_addr;
-    idx->sp = p->sp;
-    idx->dp = p->dp;
-    idx->proto = p->iph->ip_proto;
-    idx->metric = tag->tag_metric;
-    idx->last_access = now;
-    idx->event_id = event_id;
-    idx->event_time.tv_sec = p->pkth->ts.tv_sec;
-    idx->event_time.tv_usec = p->pkth->ts.tv_usec;
-    idx->mode = mode;
-    idx->pkt_count = 0;
-    
-    if(idx->metric & TAG_METRIC_SECONDS)
-    {
-        /* set the expiration time for this tag */
-        idx->seconds = now + tag->tag_seconds;
-    }
-
-    if(idx->metric & TAG_METRIC_BYTES)
-    {
-        /* set the expiration time for this tag */
-        idx->bytes = tag->tag_bytes;
-    }
-
-    if(idx->metric & TAG_METRIC_PACKETS)
+    if(tag->tag_metric & TAG_METRIC_SECONDS)
     {
         /* set the expiration time for this tag */
-        idx->packets = tag->tag_packets;
+        seconds = now + tag->tag_seconds;
     }
 
-    DEBUG_WRAP(PrintTagNode(idx););
-    
+    /* check for duplicates */
     if(mode == TAG_SESSION)
     {
         DEBUG_WRAP(DebugMessage(DEBUG_FLOW,"Session Tag!\n"););
-        tag_cache_ptr = ssn_tag_cache_ptr;
+        SetSessionKey(&key, p->iph->ip_src.s_addr, p->iph->ip_dst.s_addr,
+                      p->sp, p->dp);
+        returned = (TagNode *) sfxhash_find(tag_cache, &key);
     }
     else
     {
         DEBUG_WRAP(DebugMessage(DEBUG_FLOW,"Host Tag!\n"););
-        tag_cache_ptr = host_tag_cache_ptr;
+        SetHostKey(&key, p->iph->ip_src.s_addr);
+        returned = (TagNode *) sfxhash_find(tag_cache, &key);
+
+        if(returned == NULL)
+        {
+            DEBUG_WRAP(DebugMessage(DEBUG_FLOW,"Looking the other way!!\n"););
+            SetHostKey(&key, p->iph->ip_dst.s_addr);
+            returned = (TagNode *) sfxhash_find(tag_cache, &key);
+        }
     }
-    
-    /* check for duplicates */
-    returned = (TagNode *) ubi_sptFind(tag_cache_ptr, 
-                                       (ubi_btItemPtr)idx);
-        
-    if(returned == NULL)
+
+    if(returned != NULL)
     {
-        DEBUG_WRAP(DebugMessage(DEBUG_FLOW,"Looking the other way!!\n"););
-        SwapTag(idx);            
-        returned = (TagNode *) ubi_sptFind(tag_cache_ptr, 
-                                           (ubi_btItemPtr)idx);
-        SwapTag(idx);
+        DEBUG_WRAP(DebugMessage(DEBUG_FLOW,"Existing Tag found!\n"););
+
+        if(tag->tag_metric & TAG_METRIC_SECONDS)
+            returned->seconds = seconds;
+        else
+            returned->seconds += seconds;
+
+        DEBUG_WRAP(PrintTagNode(returned););
+
+        return;
     }
 
-    if(returned == NULL)
+    DEBUG_WRAP(DebugMessage(DEBUG_FLOW,"Inserting a New Tag!\n"););
+
+    /* if we're supposed to be tagging the other side, swap it
+       around -- Lawrence Reed */
+    if(mode == TAG_SESSION)
+        SetSessionKey(&key, p->iph->ip_src.s_addr, p->iph->ip_dst.s_addr,
+                      p->sp, p->dp);
+    else if(mode == TAG_HOST_DST)
+        SetHostKey(&key, p->iph->ip_dst.s_addr);
+    else
+        SetHostKey(&key, p->iph->ip_src.s_addr);
+
+    hnode = sfxhash_get_node(tag_cache, &key);
+
+    if(hnode == NULL)
     {
-        DEBUG_WRAP(DebugMessage(DEBUG_FLOW,"Inserting a New Tag!\n"););
+        DEBUG_WRAP(DebugMessage(DEBUG_FLOW,
+                                "sfxhash_get_node failed, that's going to "
+                                "make life difficult\n"););
+        tag_alloc_faults++;
+        return;
+    }
 
-        /* if we're supposed to be tagging the other side, swap it
-           around -- Lawrence Reed */
-        if(mode == TAG_HOST_DST)
-        {
-            SwapTag(idx);
-        }
+    np = (TagNode *) hnode->data;
+    memset(np, 0, sizeof(TagNode));
 
-        if(ubi_sptInsert(tag_cache_ptr,
-                         (ubi_btNodePtr)idx, (ubi_btNodePtr)idx, NULL) == FALSE)
-        {
-            DEBUG_WRAP(DebugMessage(DEBUG_FLOW,
-                                    "sptInsert failed, that's going to "
-                                    "make life difficult\n"););
-            return;
-        }
+    np->sip = p->iph->ip_src.s_addr;
+    np->dip = p->iph->ip_dst.s_addr;
+    np->sp = p->sp;
+    np->dp = p->dp;
+    np->proto = p->iph->ip_proto;
+    np->metric = tag->tag_metric;
+    np->last_access = now;
+    np->event_id = event_id;
+    np->event_time.tv_sec = p->pkth->ts.tv_sec;
+    np->event_time.tv_usec = p->pkth->ts.tv_usec;
+    np->mode = mode;
+    np->pkt_count = 0;
+    np->seconds = seconds;
+
+    if(np->metric & TAG_METRIC_BYTES)
+    {
+        /* set the expiration time for this tag */
+        np->bytes = tag->tag_bytes;
     }
-    else
+
+    if(np->metric & TAG_METRIC_PACKETS)
     {
-        DEBUG_WRAP(DebugMessage(DEBUG_FLOW,"Existing Tag found!\n"););
+        /* set the expiration time for this tag */
+        np->packets = tag->tag_packets;
+    }
 
-        if(idx->metric & TAG_METRIC_SECONDS)
-            returned->seconds = idx->seconds;
-        else
-            returned->seconds += idx->seconds;
+    if(mode == TAG_HOST_DST)
+    {
+        SwapTag(np);
+    }
 
-        /* get rid of the new tag since we are using an existing one */
-        free(idx); 
-        tag_memory_usage -= sizeof(TagNode);
+    /* nothing on the wheel, so its clock may be far behind */
+    if(!ssn_tag_count && !host_tag_count)
+    {
+        tag_wheel_time = now;
     }
 
-    DEBUG_WRAP(PrintTagNode(idx););
+    if(mode == TAG_SESSION)
+        ssn_tag_count++;
+    else
+        host_tag_count++;
+
+    TagWheelAdd(np);
+
+    DEBUG_WRAP(PrintTagNode(np););
     
     return;
 }
@@ -463,13 +562,13 @@ static void AddTagNode(Packet *p, TagData *tag, int mode, u_int32_t now,
 
 int CheckTagList(Packet *p, Event *event)
 {
-    TagNode idx;
+    TagKey key;
     TagNode *returned = NULL;
-    ubi_trRootPtr taglist = NULL;
     char create_event = 1;
+    int tagged = 0;
 
     /* check for active tags */
-    if(!ubi_trCount(host_tag_cache_ptr) && !ubi_trCount(ssn_tag_cache_ptr))
+    if(!ssn_tag_count && !host_tag_count)
     {
         return 0;
     }
@@ -481,66 +580,31 @@ int CheckTagList(Packet *p, Event *event)
     }
 
     DEBUG_WRAP(DebugMessage(DEBUG_FLOW,"Host Tags Active: %d   Session Tags Active: %d\n", 
-			    ubi_trCount(host_tag_cache_ptr), ubi_trCount(ssn_tag_cache_ptr)););
-
-    DEBUG_WRAP(DebugMessage(DEBUG_FLOW, "[*] Checking session tag list (forward)...\n"););
-
-    idx.sip = p->iph->ip_src.s_addr;
-    idx.dip = p->iph->ip_dst.s_addr;
-    idx.sp = p->sp;
-    idx.dp = p->dp;
+			    host_tag_count, ssn_tag_count););
 
     /* check for session tags... */
-    returned = (TagNode *) ubi_sptFind(ssn_tag_cache_ptr, (ubi_btItemPtr)&idx);
-
-    if(returned == NULL)
+    if(ssn_tag_count)
     {
-        idx.dip = p->iph->ip_src.s_addr;
-        idx.sip = p->iph->ip_dst.s_addr;
-        idx.dp = p->sp;
-        idx.sp = p->dp;
-
-        DEBUG_WRAP(DebugMessage(DEBUG_FLOW, "   Checking session tag list (reverse)...\n"););
-        returned = (TagNode *) ubi_sptFind(ssn_tag_cache_ptr, 
-                (ubi_btItemPtr)&idx);
+        DEBUG_WRAP(DebugMessage(DEBUG_FLOW, "[*] Checking session tag list...\n"););
 
-        if(returned == NULL)
-        {
-            DEBUG_WRAP(DebugMessage(DEBUG_FLOW, "   Checking host tag list "
-				    "(forward)...\n"););
+        SetSessionKey(&key, p->iph->ip_src.s_addr, p->iph->ip_dst.s_addr,
+                      p->sp, p->dp);
+        returned = (TagNode *) sfxhash_find(tag_cache, &key);
+    }
 
-            returned = (TagNode *) ubi_sptFind(host_tag_cache_ptr, 
-                    (ubi_btItemPtr)&idx);
+    if(returned == NULL && host_tag_count)
+    {
+        DEBUG_WRAP(DebugMessage(DEBUG_FLOW, "   Checking host tag list...\n"););
 
-            if(returned == NULL)
-            {
-                /*
-                **  Only switch sip, because that's all we check for
-                **  the host tags.
-                */
-                idx.sip = p->iph->ip_src.s_addr;
-
-                returned = (TagNode *) ubi_sptFind(host_tag_cache_ptr, 
-                        (ubi_btItemPtr)&idx);
-            }
+        SetHostKey(&key, p->iph->ip_dst.s_addr);
+        returned = (TagNode *) sfxhash_find(tag_cache, &key);
 
-            if(returned != NULL)
-            {
-                DEBUG_WRAP(DebugMessage(DEBUG_FLOW,"   [*!*] Found host node\n"););
-                taglist = host_tag_cache_ptr;
-            }
-        }
-        else
+        if(returned == NULL)
         {
-            DEBUG_WRAP(DebugMessage(DEBUG_FLOW,"   [*!*] Found session node\n"););
-            taglist = ssn_tag_cache_ptr;
+            SetHostKey(&key, p->iph->ip_src.s_addr);
+            returned = (TagNode *) sfxhash_find(tag_cache, &key);
         }
     }
-    else
-    {
-        DEBUG_WRAP(DebugMessage(DEBUG_FLOW,"   [*!*] Found session node\n"););
-        taglist = ssn_tag_cache_ptr;
-    }
 
     if(returned != NULL)
     {
@@ -610,120 +674,15 @@ int CheckTagList(Packet *p, Event *event)
         {
             DEBUG_WRAP(DebugMessage(DEBUG_FLOW,"    Prune condition met for tag, removing"
 				    " from list\n"););
-            returned = (TagNode *) ubi_sptRemove(taglist, 
-                    (ubi_btNodePtr)returned);
-
-            free(returned);
-            tag_memory_usage -= sizeof(TagNode);
+            TagRemove(returned, &key);
         }
-    }
-
-    if( (u_int)(p->pkth->ts.tv_sec) > last_prune_time + TAG_PRUNE_QUANTUM)
-    {
-        DEBUG_WRAP(DebugMessage(DEBUG_FLOW,
-                                "Exceeded Prune Quantum, pruning tag trees\n"););
-        PruneTagCache(p->pkth->ts.tv_sec, 0);
-        last_prune_time = p->pkth->ts.tv_sec;
-    }
 
-    if((returned != NULL) && (create_event))
-    {
-        return 1;
+        tagged = create_event;
     }
 
-    return 0;
-}
-
-
-static int PruneTagCache(u_int32_t thetime, int mustdie)
-{
-    TagNode *idx;
-    int pruned = 0;
-
-    if(!mustdie)
-    {
-        if(ubi_trCount(ssn_tag_cache_ptr))
-        {
-            pruned = PruneTime(ssn_tag_cache_ptr, thetime);
-        }
-
-        if(ubi_trCount(host_tag_cache_ptr))
-        {
-            pruned += PruneTime(host_tag_cache_ptr, thetime);
-        }
-
-        return pruned;
-    }
-    else
-    {
-        while(mustdie > 0)
-        {
-            if(ubi_trCount(ssn_tag_cache_ptr))
-            {
-                idx = (TagNode *) 
-                    ubi_btLeafNode((ubi_btNodePtr)ssn_tag_cache_ptr);
-                mustdie--;
-                free(idx);
-                tag_memory_usage -= sizeof(TagNode);
-            }
-
-            if(ubi_trCount(host_tag_cache_ptr))
-            {
-                idx = (TagNode *) 
-                    ubi_btLeafNode((ubi_btNodePtr)host_tag_cache_ptr);
-                mustdie--;
-                free(idx);
-                tag_memory_usage -= sizeof(TagNode);
-            }
-        }
-
-        return 0;
-
-    }
-}
-
-
-static int PruneTime(ubi_trRootPtr tree, u_int32_t thetime)
-{
-    int pruned = 0;
-    TagNode *idx;
-    TagNode *savidx;
-    TagNode *killme;
-
-    idx = (TagNode *) ubi_btFirst((ubi_btNodePtr)tree);
-
-    if(idx == NULL)
-    {
-        return 0;
-    }
-
-    do
-    {
-        if((idx->last_access+TAG_PRUNE_QUANTUM) < thetime)
-        {
-            savidx = idx;
-            idx = (TagNode *) ubi_btNext((ubi_btNodePtr)idx);
-
-            killme = (TagNode *) ubi_sptRemove(tree, (ubi_btNodePtr) savidx);
-
-            free(killme);
-            tag_memory_usage -= sizeof(TagNode);
-            pruned++;
-        }
-        else
-        {
-            if(idx != NULL && ubi_trCount(tree))
-            {
-                idx = (TagNode *) ubi_btNext((ubi_btNodePtr)idx);
-            }
-            else
-            {
-                return pruned;
-            }
-        }
-    } while(idx != NULL);
+    TagWheelAdvance(p->pkth->ts.tv_sec);
 
-    return pruned;
+    return tagged;
 }
 
 void SetTags(Packet *p, OptTreeNode *otn, u_int16_t event_id)
@@ -1291,6 +1291,7 @@ void DropStats(int iParamIgnored)
         LogMessage("    Stream Trackers: %-10lu\n", pc.tcp_streams);
         LogMessage("    Stream flushes: %-10lu\n", pc.rebuilt_tcp);
         LogMessage("    Segments used: %-10lu\n", pc.rebuilt_segs);
+        LogMessage("    Flushes w/o copy: %-10lu\n", pc.rebuilt_inplace);
         LogMessage("    Stream4 Memory Faults: %-10lu\n", 
                 pc.str_mem_faults);
     }